@@ -33,6 +33,7 @@
 #include "alarm.h"
 #include "duration.h"
 #include "incidence.h"
+#include "incidence_p.h"
 
 #include <QTime>
 
@@ -543,7 +544,8 @@ KDateTime Alarm::nextTime( const KDateTime &preTime, bool ignoreRepetitions ) co
     if ( d->mAlarmRepeatCount && !ignoreRepetitions ) {
       // The alarm has repetitions, so check whether repetitions of previous
       // recurrences happen after given time.
-      KDateTime prevRecurrence = d->mParent->recurrence()->getPreviousDateTime( preTime );
+      KDateTime prevRecurrence =
+        IncidenceInternals::recurrence( *d->mParent )->getPreviousDateTime( preTime );
       if ( prevRecurrence.isValid() ) {
         KDateTime prevLastRepeat = alarmOffset.end( duration().end( prevRecurrence ) );
         // kDebug() << "prevRecurrence" << prevRecurrence;
@@ -557,7 +559,8 @@ KDateTime Alarm::nextTime( const KDateTime &preTime, bool ignoreRepetitions ) co
       }
     }
     // Check the next recurrence now.
-    KDateTime nextRecurrence = d->mParent->recurrence()->getNextDateTime( preTime );
+    KDateTime nextRecurrence =
+      IncidenceInternals::recurrence( *d->mParent )->getNextDateTime( preTime );
     if ( nextRecurrence.isValid() ) {
       KDateTime nextAlarm = alarmOffset.end( nextRecurrence );
       /*
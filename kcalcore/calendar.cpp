@@ -36,7 +36,9 @@
 */
 #include "calendar.h"
 #include "calfilter.h"
+#include "compactdatetime_p.h"
 #include "icaltimezones.h"
+#include "incidence_p.h"
 #include "sorting.h"
 #include "visitor.h"
 
@@ -46,10 +48,161 @@ extern "C" {
   #include <icaltimezone.h>
 }
 
-#include <algorithm>  // for std::remove()
+#include <QtCore/QRunnable>
+#include <QtCore/QSet>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVector>
+
+#include <algorithm>  // for std::remove() and std::merge()
+#include <limits>
 
 using namespace KCalCore;
 
+//@cond PRIVATE
+/**
+  Secondary index mapping string keys, like scheduling identifiers or
+  categories, to the incidences carrying them.
+
+  Every incidence remembers the keys it was indexed under, so it can be
+  removed again after its properties have already changed.
+*/
+class IncidenceKeyIndex
+{
+  public:
+    void insert( const Incidence::Ptr &incidence, const QStringList &keys )
+    {
+      mKeys.insert( incidence, keys );
+      foreach ( const QString &key, keys ) {
+        mIncidences[key].insert( incidence );
+      }
+    }
+
+    void remove( const Incidence::Ptr &incidence )
+    {
+      QHash<Incidence::Ptr, QStringList>::iterator it = mKeys.find( incidence );
+      if ( it == mKeys.end() ) {
+        return;
+      }
+      foreach ( const QString &key, it.value() ) {
+        QHash<QString, QSet<Incidence::Ptr> >::iterator set = mIncidences.find( key );
+        if ( set != mIncidences.end() ) {
+          set.value().remove( incidence );
+          if ( set.value().isEmpty() ) {
+            mIncidences.erase( set );
+          }
+        }
+      }
+      mKeys.erase( it );
+    }
+
+    bool contains( const Incidence::Ptr &incidence ) const
+    {
+      return mKeys.contains( incidence );
+    }
+
+    Incidence::List values( const QString &key ) const
+    {
+      Incidence::List list;
+      QHash<QString, QSet<Incidence::Ptr> >::const_iterator it = mIncidences.constFind( key );
+      if ( it != mIncidences.constEnd() ) {
+        list.reserve( it.value().count() );
+        foreach ( const Incidence::Ptr &incidence, it.value() ) {
+          list.append( incidence );
+        }
+      }
+      return list;
+    }
+
+    Incidence::Ptr value( const QString &key ) const
+    {
+      QHash<QString, QSet<Incidence::Ptr> >::const_iterator it = mIncidences.constFind( key );
+      if ( it == mIncidences.constEnd() ) {
+        return Incidence::Ptr();
+      }
+      return *it.value().constBegin();
+    }
+
+    QStringList keys() const
+    {
+      return mIncidences.keys();
+    }
+
+    void clear()
+    {
+      mIncidences.clear();
+      mKeys.clear();
+    }
+
+  private:
+    QHash<QString, QSet<Incidence::Ptr> > mIncidences;
+    QHash<Incidence::Ptr, QStringList> mKeys;
+};
+//@endcond
+
+//@cond PRIVATE
+class KCalCore::Calendar::ChangeSet::Private
+{
+  public:
+    enum Kind {
+      None,     // added and deleted again
+      Added,
+      Changed,
+      Deleted
+    };
+
+    void record( const Incidence::Ptr &incidence, Kind kind )
+    {
+      QHash<Incidence::Ptr, Kind>::iterator it = mKinds.find( incidence );
+      if ( it == mKinds.end() ) {
+        mOrder.append( incidence );
+        mKinds.insert( incidence, kind );
+        return;
+      }
+      // Merge with the earlier change; a change never overrides it
+      if ( kind == Added ) {
+        if ( it.value() == None ) {
+          it.value() = Added;
+        } else if ( it.value() == Deleted ) {
+          it.value() = Changed;
+        }
+      } else if ( kind == Deleted ) {
+        if ( it.value() == Added ) {
+          it.value() = None;
+        } else if ( it.value() == Changed ) {
+          it.value() = Deleted;
+        }
+      }
+    }
+
+    // Drops a pending addition of @p incidence, if there is one
+    bool cancelAddition( const Incidence::Ptr &incidence )
+    {
+      QHash<Incidence::Ptr, Kind>::iterator it = mKinds.find( incidence );
+      if ( it == mKinds.end() || it.value() != Added ) {
+        return false;
+      }
+      it.value() = None;
+      return true;
+    }
+
+    Incidence::List list( Kind kind ) const
+    {
+      Incidence::List result;
+      Incidence::List::const_iterator it;
+      for ( it = mOrder.constBegin(); it != mOrder.constEnd(); ++it ) {
+        if ( mKinds.value( *it ) == kind ) {
+          result.append( *it );
+        }
+      }
+      return result;
+    }
+
+    Incidence::List mOrder;                   // in order of the first change
+    QHash<Incidence::Ptr, Kind> mKinds;
+};
+//@endcond
+
 /**
   Private class that helps to provide binary compatibility between releases.
   @internal
@@ -64,7 +217,8 @@ class KCalCore::Calendar::Private
         mNewObserver( false ),
         mObserversEnabled( true ),
         mDefaultFilter( new CalFilter ),
-        batchAddingInProgress( false )
+        batchAddingInProgress( false ),
+        mTransactionLevel( 0 )
     {
       // Setup default filter, which does nothing
       mFilter = mDefaultFilter;
@@ -85,6 +239,8 @@ class KCalCore::Calendar::Private
       delete mDefaultFilter;
     }
     KDateTime::Spec timeZoneIdSpec( const QString &timeZoneId, bool view );
+    void indexIncidence( const Incidence::Ptr &incidence );
+    void unindexIncidence( const Incidence::Ptr &incidence );
 
     QString mProductId;
     Person::Ptr mOwner;
@@ -113,9 +269,82 @@ class KCalCore::Calendar::Private
     QString mDefaultNotebook; // uid of default notebook
     QMap<QString, Incidence::List > mIncidenceRelations;
     bool batchAddingInProgress;
-
+    int mTransactionLevel;
+    ChangeSet mChanges; // of the running transaction
+
+    // Secondary indexes, kept up to date by the notifyIncidence*() calls
+    IncidenceKeyIndex mSchedulingIdIndex;
+    IncidenceKeyIndex mCategoryIndex;
+    IncidenceKeyIndex mRelatedToIndex;
+    IncidenceKeyIndex mEmailIndex;
+    IncidenceKeyIndex mDuplicateIndex; // incidences of mNotebookIncidences
+    QSet<Incidence::Ptr> mRecurringJournals;
 };
 
+/**
+  Returns the key under which an incidence is filed in the duplicate
+  index: its start time in UTC seconds, followed by its summary.
+  Incidences accepted by isDuplicate() always share the same key.
+*/
+static QString duplicateKey( const Incidence::Ptr &incidence )
+{
+  const KDateTime start = incidence->dtStart();
+  QString key;
+  if ( start.isValid() ) {
+    // A date-only start is equal to another one only if the whole day is,
+    // so it is keyed by the start of the day in its time spec
+    key = QString::number( utcSecs( start ) );
+  }
+  key += QLatin1Char( '|' );
+  key += incidence->summary();
+  return key;
+}
+
+static bool isDuplicate( const Incidence::Ptr &a, const Incidence::Ptr &b )
+{
+  return ( ( a->dtStart() == b->dtStart() ) ||
+           ( !a->dtStart().isValid() && !b->dtStart().isValid() ) ) &&
+         ( a->summary() == b->summary() );
+}
+
+void KCalCore::Calendar::Private::indexIncidence( const Incidence::Ptr &incidence )
+{
+  mSchedulingIdIndex.insert( incidence, QStringList( incidence->schedulingID() ) );
+  mCategoryIndex.insert( incidence, incidence->categories() );
+
+  QStringList relatedTo;
+  if ( !incidence->relatedTo().isEmpty() ) {
+    relatedTo.append( incidence->relatedTo() );
+  }
+  mRelatedToIndex.insert( incidence, relatedTo );
+
+  QStringList emails;
+  if ( incidence->organizer() && !incidence->organizer()->email().isEmpty() ) {
+    emails.append( incidence->organizer()->email() );
+  }
+  foreach ( const QString &email, incidence->attendeeEmails() ) {
+    if ( !email.isEmpty() && !emails.contains( email ) ) {
+      emails.append( email );
+    }
+  }
+  mEmailIndex.insert( incidence, emails );
+
+  if ( incidence->type() == IncidenceBase::TypeJournal && incidence->recurs() ) {
+    mRecurringJournals.insert( incidence );
+  } else {
+    mRecurringJournals.remove( incidence );
+  }
+}
+
+void KCalCore::Calendar::Private::unindexIncidence( const Incidence::Ptr &incidence )
+{
+  mSchedulingIdIndex.remove( incidence );
+  mCategoryIndex.remove( incidence );
+  mRelatedToIndex.remove( incidence );
+  mEmailIndex.remove( incidence );
+  mRecurringJournals.remove( incidence );
+}
+
 /**
   Make a QHash::value that returns a QVector.
 */
@@ -376,21 +605,24 @@ CalFilter *Calendar::filter() const
 
 QStringList Calendar::categories() const
 {
-  Incidence::List rawInc( rawIncidences() );
-  QStringList cats, thisCats;
-  // @TODO: For now just iterate over all incidences. In the future,
-  // the list of categories should be built when reading the file.
-  for ( Incidence::List::ConstIterator i = rawInc.constBegin();
-        i != rawInc.constEnd(); ++i ) {
-    thisCats = ( *i )->categories();
-    for ( QStringList::ConstIterator si = thisCats.constBegin();
-          si != thisCats.constEnd(); ++si ) {
-      if ( !cats.contains( *si ) ) {
-        cats.append( *si );
-      }
-    }
-  }
-  return cats;
+  QStringList categories = d->mCategoryIndex.keys();
+  categories.sort();
+  return categories;
+}
+
+Incidence::List Calendar::incidencesWithCategory( const QString &category ) const
+{
+  return d->mCategoryIndex.values( category );
+}
+
+Incidence::List Calendar::incidencesRelatedTo( const QString &uid ) const
+{
+  return d->mRelatedToIndex.values( uid );
+}
+
+Incidence::List Calendar::incidencesWithEmail( const QString &email ) const
+{
+  return d->mEmailIndex.values( email );
 }
 
 Incidence::List Calendar::incidences( const QDate &date ) const
@@ -428,16 +660,178 @@ Incidence::List Calendar::instances( const Incidence::Ptr &incidence ) const
   }
 }
 
+//@cond PRIVATE
+/*
+  An occurrence with the time it starts at in the time spec of the query,
+  which is what occurrencesInRange() sorts by.
+*/
+struct SortableOccurrence
+{
+  KDateTime key;
+  Calendar::Occurrence occurrence;
+
+  bool operator<( const SortableOccurrence &other ) const
+  {
+    return key < other.key;
+  }
+};
+
+/*
+  Appends the occurrence from @p start to @p end of @p incidence to @p list
+  if it overlaps the range from @p from to @p to. All-day occurrences cover
+  whole days in @p spec, other occurrences end just before their end time,
+  like in rawEventsForDate().
+*/
+static void appendOccurrence( QList<SortableOccurrence> &list, const Incidence::Ptr &incidence,
+                              const KDateTime &start, const KDateTime &end,
+                              const KDateTime &from, const KDateTime &to,
+                              const KDateTime::Spec &spec )
+{
+  KDateTime first, last;
+  if ( incidence->allDay() ) {
+    first = KDateTime( start.date(), QTime( 0, 0, 0 ), spec );
+    last = KDateTime( end.date(), QTime( 23, 59, 59 ), spec );
+  } else {
+    first = start;
+    last = end > start ? end.addSecs( -1 ) : start;
+  }
+  if ( first <= to && last >= from ) {
+    SortableOccurrence occurrence;
+    occurrence.key = first;
+    occurrence.occurrence.incidence = incidence;
+    occurrence.occurrence.start = start;
+    occurrence.occurrence.end = end;
+    list.append( occurrence );
+  }
+}
+//@endcond
+
+Calendar::OccurrenceList Calendar::occurrencesInRange( const KDateTime &start,
+                                                      const KDateTime &end,
+                                                      const KDateTime::Spec &timeSpec ) const
+{
+  const KDateTime::Spec ts = timeSpec.isValid() ? timeSpec : this->timeSpec();
+  const QDate startDate = start.toTimeSpec( ts ).date();
+  const QDate endDate = end.toTimeSpec( ts ).date();
+
+  // One query per type finds all incidences which may occur in the range
+  Event::List events = rawEvents( startDate, endDate, ts );
+  d->mFilter->apply( &events );
+  Todo::List todos = rawTodos( startDate, endDate, ts );
+  d->mFilter->apply( &todos );
+  // Other journals are found by the date they are indexed on, which is
+  // taken in their own time spec, so the dates are widened to cover any
+  // UTC offset. Only the recurring ones have to be checked in full.
+  Journal::List journals;
+  for ( QDate date = startDate.addDays( -2 ); date <= endDate.addDays( 2 ); date = date.addDays( 1 ) ) {
+    const Journal::List dated = rawJournalsForDate( date );
+    Journal::List::ConstIterator j;
+    for ( j = dated.constBegin(); j != dated.constEnd(); ++j ) {
+      if ( !( *j )->recurs() ) {
+        journals.append( *j );
+      }
+    }
+  }
+  QSet<Incidence::Ptr>::ConstIterator r;
+  for ( r = d->mRecurringJournals.constBegin(); r != d->mRecurringJournals.constEnd(); ++r ) {
+    journals.append( ( *r ).staticCast<Journal>() );
+  }
+  d->mFilter->apply( &journals );
+  const Incidence::List incidences = mergeIncidenceList( events, todos, journals );
+
+  QList<SortableOccurrence> occurrences;
+  Incidence::List::ConstIterator it;
+  for ( it = incidences.constBegin(); it != incidences.constEnd(); ++it ) {
+    const Incidence::Ptr incidence = *it;
+    const KDateTime dtStart = incidence->dateTime( IncidenceBase::RoleDisplayStart );
+    KDateTime dtEnd = incidence->dateTime( IncidenceBase::RoleDisplayEnd );
+    if ( !dtStart.isValid() ) {
+      continue;
+    }
+    if ( !dtEnd.isValid() || dtEnd < dtStart ) {
+      dtEnd = dtStart;
+    }
+
+    if ( !incidence->recurs() ) {
+      appendOccurrence( occurrences, incidence, dtStart, dtEnd, start, end, ts );
+      continue;
+    }
+
+    // Occurrences replaced by exceptions are left to the exceptions
+    QList<KDateTime> exceptions;
+    const Incidence::List instances = this->instances( incidence );
+    Incidence::List::ConstIterator i;
+    for ( i = instances.constBegin(); i != instances.constEnd(); ++i ) {
+      exceptions.append( ( *i )->recurrenceId() );
+    }
+
+    // Expand the recurrence once over the whole range, widened by the
+    // length of an occurrence so that occurrences which started earlier
+    // are found as well
+    const Recurrence *recurrence = IncidenceInternals::recurrence( *incidence );
+    const KDateTime base = recurrence->startDateTime();
+    DateTimeList times;
+    int startDays = 0, endDays = 0;
+    qint64 startSecs = 0, endSecs = 0;
+    if ( incidence->allDay() ) {
+      startDays = base.date().daysTo( dtStart.date() );
+      endDays = base.date().daysTo( dtEnd.date() );
+      times = recurrence->timesInInterval( start.addDays( -endDays - 1 ),
+                                           end.addDays( 1 - startDays ) );
+    } else {
+      startSecs = base.secsTo_long( dtStart );
+      endSecs = base.secsTo_long( dtEnd );
+      times = recurrence->timesInInterval( start.addSecs( -endSecs ),
+                                           end.addSecs( -startSecs ) );
+    }
+
+    DateTimeList::ConstIterator t;
+    for ( t = times.constBegin(); t != times.constEnd(); ++t ) {
+      if ( !( *t ).isValid() ) {
+        continue;
+      }
+      bool replaced = false;
+      QList<KDateTime>::ConstIterator e;
+      for ( e = exceptions.constBegin(); e != exceptions.constEnd() && !replaced; ++e ) {
+        replaced = ( *e ).isDateOnly() ? ( *e ).date() == ( *t ).date() : *e == *t;
+      }
+      if ( replaced ) {
+        continue;
+      }
+
+      KDateTime occurrenceStart, occurrenceEnd;
+      if ( incidence->allDay() ) {
+        occurrenceStart = dtStart;
+        occurrenceStart.setDate( ( *t ).date().addDays( startDays ) );
+        occurrenceEnd = dtEnd;
+        occurrenceEnd.setDate( ( *t ).date().addDays( endDays ) );
+      } else {
+        occurrenceStart = ( *t ).addSecs( startSecs );
+        occurrenceEnd = ( *t ).addSecs( endSecs );
+      }
+      appendOccurrence( occurrences, incidence, occurrenceStart, occurrenceEnd, start, end, ts );
+    }
+  }
+
+  qStableSort( occurrences.begin(), occurrences.end() );
+
+  OccurrenceList result;
+  result.reserve( occurrences.count() );
+  QList<SortableOccurrence>::ConstIterator o;
+  for ( o = occurrences.constBegin(); o != occurrences.constEnd(); ++o ) {
+    result.append( ( *o ).occurrence );
+  }
+  return result;
+}
+
 Incidence::List Calendar::duplicates( const Incidence::Ptr &incidence )
 {
   if ( incidence ) {
     Incidence::List list;
-    Incidence::List vals = values( d->mNotebookIncidences );
+    const Incidence::List candidates = d->mDuplicateIndex.values( duplicateKey( incidence ) );
     Incidence::List::const_iterator it;
-    for ( it = vals.constBegin(); it != vals.constEnd(); ++it ) {
-      if ( ( ( incidence->dtStart() == ( *it )->dtStart() ) ||
-             ( !incidence->dtStart().isValid() && !( *it )->dtStart().isValid() ) ) &&
-           ( incidence->summary() == ( *it )->summary() ) ) {
+    for ( it = candidates.constBegin(); it != candidates.constEnd(); ++it ) {
+      if ( isDuplicate( incidence, *it ) ) {
         list.append( *it );
       }
     }
@@ -447,6 +841,32 @@ Incidence::List Calendar::duplicates( const Incidence::Ptr &incidence )
   }
 }
 
+Incidence::List Calendar::findDuplicates( const Incidence::List &incidences ) const
+{
+  Incidence::List list;
+  QMultiHash<QString, Incidence::Ptr> seen;
+  Incidence::List::const_iterator it;
+  for ( it = incidences.constBegin(); it != incidences.constEnd(); ++it ) {
+    if ( !*it ) {
+      continue;
+    }
+    const QString key = duplicateKey( *it );
+    bool duplicate = false;
+    const Incidence::List candidates = d->mDuplicateIndex.values( key ) +
+                                       values( seen, key );
+    Incidence::List::const_iterator c;
+    for ( c = candidates.constBegin(); c != candidates.constEnd() && !duplicate; ++c ) {
+      duplicate = isDuplicate( *it, *c );
+    }
+    if ( duplicate ) {
+      list.append( *it );
+    } else {
+      seen.insert( key, *it );
+    }
+  }
+  return list;
+}
+
 bool Calendar::addNotebook( const QString &notebook, bool isVisible )
 {
   if ( d->mNotebooks.contains( notebook ) ) {
@@ -516,6 +936,7 @@ bool Calendar::isVisible( const Incidence::Ptr &incidence ) const
 void Calendar::clearNotebookAssociations()
 {
   d->mNotebookIncidences.clear();
+  d->mDuplicateIndex.clear();
   d->mUidToNotebook.clear();
   d->mIncidenceVisibility.clear();
 }
@@ -549,11 +970,14 @@ bool Calendar::setNotebook( const Incidence::Ptr &inc, const QString &notebook )
       notifyIncidenceChanged( inc ); // for removing from old notebook
       // don not remove from mUidToNotebook to keep deleted incidences
       d->mNotebookIncidences.remove( old, inc );
+      d->mDuplicateIndex.remove( inc );
     }
   }
   if ( !notebook.isEmpty() ) {
     d->mUidToNotebook.insert( inc->uid(), notebook );
     d->mNotebookIncidences.insert( notebook, inc );
+    d->mDuplicateIndex.remove( inc );
+    d->mDuplicateIndex.insert( inc, QStringList( duplicateKey( inc ) ) );
     kDebug() << "setting notebook" << notebook << "for" << inc->uid();
     notifyIncidenceChanged( inc ); // for inserting into new notebook
   }
@@ -589,52 +1013,281 @@ Incidence::List Calendar::incidences( const QString &notebook ) const
   }
 }
 
-/** static */
-Event::List Calendar::sortEvents( const Event::List &eventList,
-                                  EventSortField sortField,
-                                  SortDirection sortDirection )
+//@cond PRIVATE
+/*
+  Sorting of incidence lists on precomputed keys.
+
+  The comparators in sorting.h convert date/times to UTC and fold the case
+  of summaries on every call. Here each incidence is converted once into a
+  flat key, and the keys are sorted with comparisons which give the same
+  results as those comparators.
+*/
+static int sSortThreadCount = 1;
+static const int MinKeysPerThread = 8192;
+
+struct SortKey
 {
+  qint64 start;     // UTC milliseconds; the start of the day if date-only
+  qint64 end;       // UTC milliseconds of the end of the day if date-only, else start
+  int number;       // priority or percent complete
+  int index;        // position in the list being sorted, and in the summaries
+  bool dateOnly;
+};
 
-  if ( eventList.isEmpty() ) {
-    return Event::List();
-  }
+class SortKeys
+{
+  public:
+    enum Kind {
+      DateKey,
+      NumberKey,
+      SummaryKey
+    };
+
+    SortKeys( Kind kind, SortDirection direction, int count )
+      : mKind( kind ), mAscending( direction == SortDirectionAscending )
+    {
+      mKeys.reserve( count );
+      mSummaries.reserve( count );
+    }
 
-  Event::List eventListSorted;
+    void append( const KDateTime &dt, int number, const QString &summary )
+    {
+      SortKey key;
+      // invalid values come first
+      key.start = dt.isValid() ? utcMSecs( dt ) : std::numeric_limits<qint64>::min();
+      key.end = key.start;
+      key.number = number;
+      key.index = mKeys.count();
+      key.dateOnly = dt.isDateOnly();
+      if ( key.dateOnly ) {
+        // the day ends at its last millisecond in the value's own spec
+        key.end = utcMSecs( KDateTime( dt.date(), QTime( 23, 59, 59, 999 ), dt.timeSpec() ) );
+      }
+      mKeys.append( key );
+      mSummaries.append( summary.toCaseFolded() );
+    }
 
-  // Notice we alphabetically presort Summaries first.
-  // We do this so comparison "ties" stay in a nice order.
-  eventListSorted = eventList;
-  switch ( sortField ) {
-  case EventSortUnsorted:
-    break;
+    // Returns the positions of the items in sorted order
+    QVector<int> sorted();
 
-  case EventSortStartDate:
-    if ( sortDirection == SortDirectionAscending ) {
-      qSort( eventListSorted.begin(), eventListSorted.end(), Events::startDateLessThan );
-    } else {
-      qSort( eventListSorted.begin(), eventListSorted.end(), Events::startDateMoreThan );
+    bool lessThan( const SortKey &a, const SortKey &b ) const;
+
+  private:
+    int compareSummaries( const SortKey &a, const SortKey &b ) const
+    {
+      return mSummaries[a.index].compare( mSummaries[b.index] );
     }
-    break;
 
-  case EventSortEndDate:
-    if ( sortDirection == SortDirectionAscending ) {
-      qSort( eventListSorted.begin(), eventListSorted.end(), Events::endDateLessThan );
-    } else {
-      qSort( eventListSorted.begin(), eventListSorted.end(), Events::endDateMoreThan );
+    QVector<SortKey> mKeys;
+    QVector<QString> mSummaries;   // case folded
+    Kind mKind;
+    bool mAscending;
+};
+
+/*
+  Returns the KDateTime::Comparison of the values described by two keys,
+  following KDateTime::compare().
+*/
+static int compareKeys( const SortKey &a, const SortKey &b )
+{
+  if ( !a.dateOnly && !b.dateOnly ) {
+    return a.start == b.start ? KDateTime::Equal :
+           a.start < b.start ? KDateTime::Before : KDateTime::After;
+  }
+  if ( a.start == b.start ) {
+    return !a.dateOnly ? KDateTime::AtStart :
+           a.end == b.end ? KDateTime::Equal :
+           a.end < b.end ? KDateTime::AtStart | KDateTime::Inside :
+           KDateTime::AtStart | KDateTime::Inside | KDateTime::AtEnd | KDateTime::After;
+  }
+  if ( a.start < b.start ) {
+    return a.end < b.start ? KDateTime::Before :
+           a.end == b.end ? KDateTime::Before | KDateTime::AtStart | KDateTime::Inside | KDateTime::AtEnd :
+           a.end == b.start ? KDateTime::Before | KDateTime::AtStart :
+           a.end < b.end ? KDateTime::Before | KDateTime::AtStart | KDateTime::Inside :
+           KDateTime::Outside;
+  }
+  return a.start > b.end ? KDateTime::After :
+         a.start == b.end ? ( a.end == b.end ? KDateTime::AtEnd : KDateTime::AtEnd | KDateTime::After ) :
+         a.end == b.end ? KDateTime::Inside | KDateTime::AtEnd :
+         a.end < b.end ? KDateTime::Inside :
+         KDateTime::Inside | KDateTime::AtEnd | KDateTime::After;
+}
+
+bool SortKeys::lessThan( const SortKey &a, const SortKey &b ) const
+{
+  switch ( mKind ) {
+  case DateKey:
+  {
+    const int res = compareKeys( a, b );
+    if ( res == KDateTime::Equal ) {
+      break;
     }
+    return mAscending ? ( res & ( KDateTime::Before | KDateTime::AtStart ) ) :
+                        ( res & ( KDateTime::After | KDateTime::AtEnd ) );
+  }
+  case NumberKey:
+    if ( a.number != b.number ) {
+      return mAscending ? a.number < b.number : a.number > b.number;
+    }
+    break;
+  case SummaryKey:
     break;
+  }
+  return mAscending ? compareSummaries( a, b ) < 0 : compareSummaries( a, b ) > 0;
+}
 
-  case EventSortSummary:
-    if ( sortDirection == SortDirectionAscending ) {
-      qSort( eventListSorted.begin(), eventListSorted.end(), Events::summaryLessThan );
-    } else {
-      qSort( eventListSorted.begin(), eventListSorted.end(), Events::summaryMoreThan );
+class SortKeyLessThan
+{
+  public:
+    explicit SortKeyLessThan( const SortKeys *keys ) : mKeys( keys ) {}
+    bool operator()( const SortKey &a, const SortKey &b ) const
+    {
+      return mKeys->lessThan( a, b );
+    }
+
+  private:
+    const SortKeys *mKeys;
+};
+
+/*
+  Sorts one slice of the keys, or merges two adjacent sorted slices into
+  the same positions of another array, on a worker thread.
+*/
+class SortKeysJob : public QRunnable
+{
+  public:
+    SortKeysJob( SortKey *begin, SortKey *middle, SortKey *end, SortKey *out,
+                 const SortKeyLessThan &lessThan )
+      : mBegin( begin ), mMiddle( middle ), mEnd( end ), mOut( out ), mLessThan( lessThan )
+    {}
+
+    void run()
+    {
+      if ( !mOut ) {
+        qSort( mBegin, mEnd, mLessThan );
+      } else {
+        std::merge( mBegin, mMiddle, mMiddle, mEnd, mOut, mLessThan );
+      }
+    }
+
+  private:
+    SortKey *mBegin;
+    SortKey *mMiddle;
+    SortKey *mEnd;
+    SortKey *mOut;    // null to sort the slice in place
+    SortKeyLessThan mLessThan;
+};
+
+QVector<int> SortKeys::sorted()
+{
+  const int count = mKeys.count();
+  const SortKeyLessThan lessThan( this );
+  int threads = sSortThreadCount > 0 ? sSortThreadCount : QThread::idealThreadCount();
+  threads = qMin( threads, count / MinKeysPerThread );
+  if ( threads < 2 ) {
+    qSort( mKeys.begin(), mKeys.end(), lessThan );
+  } else {
+    // Sort equal slices on worker threads, then merge pairs of slices
+    // until one is left. Merging never reorders equal keys within a slice.
+    QVector<int> bounds;
+    for ( int i = 0; i <= threads; ++i ) {
+      bounds.append( int( qint64( count ) * i / threads ) );
+    }
+    QVector<SortKey> buffer( count );
+    SortKey *keys = mKeys.data();
+    SortKey *out = buffer.data();
+    QThreadPool pool;
+    pool.setMaxThreadCount( threads );
+    for ( int i = 0; i < threads; ++i ) {
+      pool.start( new SortKeysJob( keys + bounds[i], 0, keys + bounds[i + 1], 0, lessThan ) );
+    }
+    pool.waitForDone();
+    while ( bounds.count() > 2 ) {
+      QVector<int> merged;
+      merged.append( 0 );
+      for ( int i = 0; i + 1 < bounds.count(); i += 2 ) {
+        if ( i + 2 < bounds.count() ) {
+          pool.start( new SortKeysJob( keys + bounds[i], keys + bounds[i + 1],
+                                       keys + bounds[i + 2], out + bounds[i], lessThan ) );
+          merged.append( bounds[i + 2] );
+        } else {
+          std::copy( keys + bounds[i], keys + bounds[i + 1], out + bounds[i] );
+          merged.append( bounds[i + 1] );
+        }
+      }
+      pool.waitForDone();
+      qSwap( keys, out );
+      bounds = merged;
+    }
+    if ( keys != mKeys.data() ) {
+      mKeys = buffer;
     }
-    break;
   }
 
-  return eventListSorted;
+  QVector<int> result;
+  result.reserve( count );
+  for ( int i = 0; i < count; ++i ) {
+    result.append( mKeys[i].index );
+  }
+  return result;
+}
+
+template <class T>
+static QList<QSharedPointer<T> > sortedList( const QList<QSharedPointer<T> > &list,
+                                             SortKeys &keys )
+{
+  const QVector<int> order = keys.sorted();
+  QList<QSharedPointer<T> > result;
+  result.reserve( order.count() );
+  for ( int i = 0, end = order.count(); i < end; ++i ) {
+    result.append( list[order[i]] );
+  }
+  return result;
+}
+//@endcond
+
+/** static */
+void Calendar::setSortThreadCount( int count )
+{
+  sSortThreadCount = qMax( 0, count );
+}
+
+/** static */
+int Calendar::sortThreadCount()
+{
+  return sSortThreadCount;
+}
 
+/** static */
+Event::List Calendar::sortEvents( const Event::List &eventList,
+                                  EventSortField sortField,
+                                  SortDirection sortDirection )
+{
+  if ( eventList.isEmpty() ) {
+    return Event::List();
+  }
+  if ( sortField == EventSortUnsorted ) {
+    return eventList;
+  }
+
+  // Ties on dates are broken by the summaries, as in sorting.h
+  SortKeys keys( sortField == EventSortSummary ? SortKeys::SummaryKey : SortKeys::DateKey,
+                 sortDirection, eventList.count() );
+  foreach ( const Event::Ptr &event, eventList ) {
+    switch ( sortField ) {
+    case EventSortStartDate:
+      keys.append( event->dtStart(), 0, event->summary() );
+      break;
+    case EventSortEndDate:
+      keys.append( event->dtEnd(), 0, event->summary() );
+      break;
+    default:
+      keys.append( KDateTime(), 0, event->summary() );
+      break;
+    }
+  }
+  return sortedList( eventList, keys );
 }
 
 Event::List Calendar::events( const QDate &date,
@@ -809,29 +1462,12 @@ Incidence::Ptr Calendar::deleted( const QString &uid, const KDateTime &recurrenc
 
 Incidence::List Calendar::incidencesFromSchedulingID( const QString &sid ) const
 {
-  Incidence::List result;
-  const Incidence::List incidences = rawIncidences();
-  Incidence::List::const_iterator it = incidences.begin();
-  for ( ; it != incidences.end(); ++it ) {
-    if ( (*it)->schedulingID() == sid ) {
-      result.append( *it );
-    }
-  }
-  return result;
+  return d->mSchedulingIdIndex.values( sid );
 }
 
 Incidence::Ptr Calendar::incidenceFromSchedulingID( const QString &uid ) const
 {
-  const Incidence::List incidences = rawIncidences();
-  Incidence::List::const_iterator it = incidences.begin();
-  for ( ; it != incidences.end(); ++it ) {
-    if ( (*it)->schedulingID() == uid ) {
-      // Touchdown, and the crowd goes wild
-      return *it;
-    }
-  }
-  // Not found
-  return Incidence::Ptr();
+  return d->mSchedulingIdIndex.value( uid );
 }
 
 /** static */
@@ -842,69 +1478,49 @@ Todo::List Calendar::sortTodos( const Todo::List &todoList,
   if ( todoList.isEmpty() ) {
     return Todo::List();
   }
+  if ( sortField == TodoSortUnsorted ) {
+    return todoList;
+  }
 
-  Todo::List todoListSorted;
-
-  // Notice we alphabetically presort Summaries first.
-  // We do this so comparison "ties" stay in a nice order.
-
-  // Note that To-dos may not have Start DateTimes nor due DateTimes.
-
-  todoListSorted = todoList;
+  // Note that To-dos may not have Start DateTimes nor due DateTimes;
+  // those sort first.
+  SortKeys::Kind kind;
   switch ( sortField ) {
-  case TodoSortUnsorted:
-    break;
-
-  case TodoSortStartDate:
-    if ( sortDirection == SortDirectionAscending ) {
-      qSort( todoListSorted.begin(), todoListSorted.end(), Todos::startDateLessThan );
-    } else {
-      qSort( todoListSorted.begin(), todoListSorted.end(), Todos::startDateMoreThan );
-    }
-    break;
-
-  case TodoSortDueDate:
-    if ( sortDirection == SortDirectionAscending ) {
-      qSort( todoListSorted.begin(), todoListSorted.end(), Todos::dueDateLessThan );
-    } else {
-      qSort( todoListSorted.begin(), todoListSorted.end(), Todos::dueDateMoreThan );
-    }
-    break;
-
   case TodoSortPriority:
-    if ( sortDirection == SortDirectionAscending ) {
-      qSort( todoListSorted.begin(), todoListSorted.end(), Todos::priorityLessThan );
-    } else {
-      qSort( todoListSorted.begin(), todoListSorted.end(), Todos::priorityMoreThan );
-    }
-    break;
-
   case TodoSortPercentComplete:
-    if ( sortDirection == SortDirectionAscending ) {
-      qSort( todoListSorted.begin(), todoListSorted.end(), Todos::percentLessThan );
-    } else {
-      qSort( todoListSorted.begin(), todoListSorted.end(), Todos::percentMoreThan );
-    }
+    kind = SortKeys::NumberKey;
     break;
-
   case TodoSortSummary:
-    if ( sortDirection == SortDirectionAscending ) {
-      qSort( todoListSorted.begin(), todoListSorted.end(), Todos::summaryLessThan );
-    } else {
-      qSort( todoListSorted.begin(), todoListSorted.end(), Todos::summaryMoreThan );
-    }
+    kind = SortKeys::SummaryKey;
     break;
-
-  case TodoSortCreated:
-    if ( sortDirection == SortDirectionAscending ) {
-      qSort( todoListSorted.begin(), todoListSorted.end(), Todos::createdLessThan );
-    } else {
-      qSort( todoListSorted.begin(), todoListSorted.end(), Todos::createdMoreThan );
-    }
+  default:
+    kind = SortKeys::DateKey;
     break;
   }
-
-  return todoListSorted;
+  SortKeys keys( kind, sortDirection, todoList.count() );
+  foreach ( const Todo::Ptr &todo, todoList ) {
+    switch ( sortField ) {
+    case TodoSortStartDate:
+      keys.append( todo->dtStart(), 0, todo->summary() );
+      break;
+    case TodoSortDueDate:
+      keys.append( todo->dtDue(), 0, todo->summary() );
+      break;
+    case TodoSortCreated:
+      keys.append( todo->created(), 0, todo->summary() );
+      break;
+    case TodoSortPriority:
+      keys.append( KDateTime(), todo->priority(), todo->summary() );
+      break;
+    case TodoSortPercentComplete:
+      keys.append( KDateTime(), todo->percentComplete(), todo->summary() );
+      break;
+    default:
+      keys.append( KDateTime(), 0, todo->summary() );
+      break;
+    }
+  }
+  return sortedList( todoList, keys );
 }
 
 Todo::List Calendar::todos( TodoSortField sortField,
@@ -938,31 +1554,17 @@ Journal::List Calendar::sortJournals( const Journal::List &journalList,
   if ( journalList.isEmpty() ) {
     return Journal::List();
   }
-
-  Journal::List journalListSorted = journalList;
-
-  switch ( sortField ) {
-  case JournalSortUnsorted:
-    break;
-
-  case JournalSortDate:
-    if ( sortDirection == SortDirectionAscending ) {
-      qSort( journalListSorted.begin(), journalListSorted.end(), Journals::dateLessThan );
-    } else {
-      qSort( journalListSorted.begin(), journalListSorted.end(), Journals::dateMoreThan );
-    }
-    break;
-
-  case JournalSortSummary:
-    if ( sortDirection == SortDirectionAscending ) {
-      qSort( journalListSorted.begin(), journalListSorted.end(), Journals::summaryLessThan );
-    } else {
-      qSort( journalListSorted.begin(), journalListSorted.end(), Journals::summaryMoreThan );
-    }
-    break;
+  if ( sortField == JournalSortUnsorted ) {
+    return journalList;
   }
 
-  return journalListSorted;
+  SortKeys keys( sortField == JournalSortSummary ? SortKeys::SummaryKey : SortKeys::DateKey,
+                 sortDirection, journalList.count() );
+  foreach ( const Journal::Ptr &journal, journalList ) {
+    keys.append( sortField == JournalSortDate ? journal->dtStart() : KDateTime(),
+                 0, journal->summary() );
+  }
+  return sortedList( journalList, keys );
 }
 
 Journal::List Calendar::journals( JournalSortField sortField,
@@ -1156,6 +1758,60 @@ Calendar::CalendarObserver::calendarIncidenceAdditionCanceled( const Incidence::
   Q_UNUSED( incidence );
 }
 
+Calendar::TransactionObserver::~TransactionObserver()
+{
+}
+
+Calendar::ChangeSet::ChangeSet()
+  : d( new KCalCore::Calendar::ChangeSet::Private )
+{
+}
+
+Calendar::ChangeSet::ChangeSet( const ChangeSet &other )
+  : d( new KCalCore::Calendar::ChangeSet::Private( *other.d ) )
+{
+}
+
+Calendar::ChangeSet::~ChangeSet()
+{
+  delete d;
+}
+
+Calendar::ChangeSet &Calendar::ChangeSet::operator=( const ChangeSet &other )
+{
+  // check for self assignment
+  if ( &other == this ) {
+    return *this;
+  }
+  *d = *other.d;
+  return *this;
+}
+
+bool Calendar::ChangeSet::isEmpty() const
+{
+  foreach ( Private::Kind kind, d->mKinds ) {
+    if ( kind != Private::None ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+Incidence::List Calendar::ChangeSet::added() const
+{
+  return d->list( Private::Added );
+}
+
+Incidence::List Calendar::ChangeSet::changed() const
+{
+  return d->list( Private::Changed );
+}
+
+Incidence::List Calendar::ChangeSet::deleted() const
+{
+  return d->list( Private::Deleted );
+}
+
 void Calendar::registerObserver( CalendarObserver *observer )
 {
   if ( !observer ) {
@@ -1239,10 +1895,17 @@ void Calendar::notifyIncidenceAdded( const Incidence::Ptr &incidence )
     return;
   }
 
+  d->indexIncidence( incidence );
+
   if ( !d->mObserversEnabled ) {
     return;
   }
 
+  if ( d->mTransactionLevel > 0 ) {
+    d->mChanges.d->record( incidence, ChangeSet::Private::Added );
+    return;
+  }
+
   foreach ( CalendarObserver *observer, d->mObservers ) {
     observer->calendarIncidenceAdded( incidence );
   }
@@ -1254,10 +1917,24 @@ void Calendar::notifyIncidenceChanged( const Incidence::Ptr &incidence )
     return;
   }
 
+  if ( d->mSchedulingIdIndex.contains( incidence ) ) {
+    d->unindexIncidence( incidence );
+    d->indexIncidence( incidence );
+  }
+  if ( d->mDuplicateIndex.contains( incidence ) ) {
+    d->mDuplicateIndex.remove( incidence );
+    d->mDuplicateIndex.insert( incidence, QStringList( duplicateKey( incidence ) ) );
+  }
+
   if ( !d->mObserversEnabled ) {
     return;
   }
 
+  if ( d->mTransactionLevel > 0 ) {
+    d->mChanges.d->record( incidence, ChangeSet::Private::Changed );
+    return;
+  }
+
   foreach ( CalendarObserver *observer, d->mObservers ) {
     observer->calendarIncidenceChanged( incidence );
   }
@@ -1269,10 +1946,17 @@ void Calendar::notifyIncidenceDeleted( const Incidence::Ptr &incidence )
     return;
   }
 
+  d->unindexIncidence( incidence );
+
   if ( !d->mObserversEnabled ) {
     return;
   }
 
+  if ( d->mTransactionLevel > 0 ) {
+    d->mChanges.d->record( incidence, ChangeSet::Private::Deleted );
+    return;
+  }
+
   foreach ( CalendarObserver *observer, d->mObservers ) {
     observer->calendarIncidenceDeleted( incidence );
   }
@@ -1284,10 +1968,18 @@ void Calendar::notifyIncidenceAdditionCanceled( const Incidence::Ptr &incidence
     return;
   }
 
+  d->unindexIncidence( incidence );
+
   if ( !d->mObserversEnabled ) {
     return;
   }
 
+  // An addition which is still pending in the transaction is just
+  // dropped; otherwise the observers already know about it
+  if ( d->mTransactionLevel > 0 && d->mChanges.d->cancelAddition( incidence ) ) {
+    return;
+  }
+
   foreach ( CalendarObserver *observer, d->mObservers ) {
     observer->calendarIncidenceAdditionCanceled( incidence );
   }
@@ -1353,13 +2045,14 @@ void Calendar::appendAlarms( Alarm::List &alarms, const Incidence::Ptr &incidenc
 {
   KDateTime preTime = from.addSecs( -1 );
 
-  Alarm::List alarmlist = incidence->alarms();
+  const Alarm::List alarmlist = IncidenceInternals::alarms( *incidence );
   for ( int i = 0, iend = alarmlist.count();  i < iend;  ++i ) {
     if ( alarmlist[i]->enabled() ) {
       KDateTime dt = alarmlist[i]->nextRepetition( preTime );
       if ( dt.isValid() && dt <= to ) {
         kDebug() << incidence->summary() << "':" << dt.toString();
-        alarms.append( alarmlist[i] );
+        // the caller may change the alarm
+        alarms.append( IncidenceInternals::handOutAlarm( *incidence, i ) );
       }
     }
   }
@@ -1374,8 +2067,14 @@ void Calendar::appendRecurringAlarms( Alarm::List &alarms,
   bool endOffsetValid = false;
   Duration endOffset( 0 );
   Duration period( from, to );
+  const Recurrence *recurrence = IncidenceInternals::recurrence( *incidence );
+  if ( !recurrence ) {
+    // without a recurrence, the alarms go off once
+    appendAlarms( alarms, incidence, from, to );
+    return;
+  }
 
-  Alarm::List alarmlist = incidence->alarms();
+  const Alarm::List alarmlist = IncidenceInternals::alarms( *incidence );
   for ( int i = 0, iend = alarmlist.count();  i < iend;  ++i ) {
     Alarm::Ptr a = alarmlist[i];
     if ( a->enabled() ) {
@@ -1417,7 +2116,7 @@ void Calendar::appendRecurringAlarms( Alarm::List &alarms,
 
         // Adjust the 'alarmStart' date/time and find the next recurrence at or after it.
         // Treate the two offsets separately in case one is daily and the other not.
-        dt = incidence->recurrence()->getNextDateTime( baseStart.addSecs( -1 ) );
+        dt = recurrence->getNextDateTime( baseStart.addSecs( -1 ) );
         if ( !dt.isValid() ||
              ( dt = endOffset.end( offset.end( dt ) ) ) > to ) // adjust 'dt' to get the alarm time
         {
@@ -1431,7 +2130,7 @@ void Calendar::appendRecurringAlarms( Alarm::List &alarms,
           bool found = false;
           Duration alarmDuration = a->duration();
           for ( KDateTime base = baseStart;
-                ( dt = incidence->recurrence()->getPreviousDateTime( base ) ).isValid();
+                ( dt = recurrence->getPreviousDateTime( base ) ).isValid();
                 base = dt ) {
             if ( a->duration().end( dt ) < base ) {
               break;  // this recurrence's last repetition is too early, so give up
@@ -1474,7 +2173,8 @@ void Calendar::appendRecurringAlarms( Alarm::List &alarms,
         }
       }
       kDebug() << incidence->summary() << "':" << dt.toString();
-      alarms.append( a );
+      // the caller may change the alarm
+      alarms.append( IncidenceInternals::handOutAlarm( *incidence, i ) );
     }
   }
 }
@@ -1494,6 +2194,49 @@ bool Calendar::batchAdding() const
   return d->batchAddingInProgress;
 }
 
+void Calendar::startTransaction()
+{
+  ++d->mTransactionLevel;
+}
+
+void Calendar::commitTransaction()
+{
+  if ( d->mTransactionLevel == 0 || --d->mTransactionLevel > 0 ) {
+    return;
+  }
+
+  const ChangeSet changes = d->mChanges;
+  d->mChanges = ChangeSet();
+  if ( changes.isEmpty() || !d->mObserversEnabled ) {
+    return;
+  }
+
+  const Incidence::List added = changes.added();
+  const Incidence::List changed = changes.changed();
+  const Incidence::List deleted = changes.deleted();
+  foreach ( CalendarObserver *observer, d->mObservers ) {
+    TransactionObserver *transactionObserver = dynamic_cast<TransactionObserver*>( observer );
+    if ( transactionObserver ) {
+      transactionObserver->calendarIncidencesChanged( changes, this );
+      continue;
+    }
+    foreach ( const Incidence::Ptr &incidence, added ) {
+      observer->calendarIncidenceAdded( incidence );
+    }
+    foreach ( const Incidence::Ptr &incidence, changed ) {
+      observer->calendarIncidenceChanged( incidence );
+    }
+    foreach ( const Incidence::Ptr &incidence, deleted ) {
+      observer->calendarIncidenceDeleted( incidence );
+    }
+  }
+}
+
+bool Calendar::inTransaction() const
+{
+  return d->mTransactionLevel > 0;
+}
+
 void Calendar::virtual_hook( int id, void *data )
 {
   Q_UNUSED( id );
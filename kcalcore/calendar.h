@@ -381,12 +381,38 @@ class KCALCORE_EXPORT Calendar : public QObject, public CustomProperties,
     virtual bool isSaving() const;
 
     /**
-      Returns a list of all categories used by Incidences in this Calendar.
+      Returns a sorted list of all categories used by Incidences in this Calendar.
 
       @return a QStringList containing all the categories.
     */
     QStringList categories() const;
 
+    /**
+      Returns all incidences in this Calendar which have the category
+      @p category, in no particular order.
+
+      @param category is the category name.
+    */
+    Incidence::List incidencesWithCategory( const QString &category ) const;
+
+    /**
+      Returns all incidences in this Calendar whose RELATED-TO property
+      (of RELTYPE parent) is @p uid, in no particular order. Unlike
+      relations(), the parent does not need to be in the Calendar.
+
+      @param uid is the parent identifier.
+    */
+    Incidence::List incidencesRelatedTo( const QString &uid ) const;
+
+    /**
+      Returns all incidences in this Calendar which have @p email as
+      the organizer's or an attendee's email address, in no particular
+      order. The comparison is case sensitive.
+
+      @param email is the email address.
+    */
+    Incidence::List incidencesWithEmail( const QString &email ) const;
+
   // Incidence Specific Methods //
 
     /**
@@ -409,6 +435,34 @@ class KCALCORE_EXPORT Calendar : public QObject, public CustomProperties,
     */
     bool batchAdding() const;
 
+    /**
+      Starts a transaction. Until the matching commitTransaction(), the
+      additions, changes and deletions of incidences are collected instead
+      of being announced to the observers one by one. Transactions may be
+      nested; only the outermost commitTransaction() delivers the changes.
+
+      @see commitTransaction(), TransactionObserver::calendarIncidencesChanged()
+    */
+    void startTransaction();
+
+    /**
+      Ends a transaction started with startTransaction(). When the
+      outermost transaction ends, all its changes are passed to the
+      observers, unless there were none: in a single
+      TransactionObserver::calendarIncidencesChanged() call to observers
+      which implement it, and one by one to the others.
+
+      @see startTransaction()
+    */
+    void commitTransaction();
+
+    /**
+      Returns true if a transaction is in progress.
+
+      @see startTransaction()
+    */
+    bool inTransaction() const;
+
     /**
       Inserts an Incidence into the calendar.
 
@@ -463,6 +517,48 @@ class KCALCORE_EXPORT Calendar : public QObject, public CustomProperties,
     */
     virtual Incidence::List instances( const Incidence::Ptr &incidence ) const;
 
+    /**
+      @brief
+      One occurrence of an Incidence, as returned by occurrencesInRange().
+
+      For all-day incidences, @p start and @p end are dates and @p end is
+      the last day of the occurrence, like Event::dtEnd().
+    */
+    struct Occurrence
+    {
+      Incidence::Ptr incidence;  /**< the incidence which occurs */
+      KDateTime start;           /**< the start of the occurrence */
+      KDateTime end;             /**< the end of the occurrence */
+    };
+
+    /**
+      List of occurrences.
+    */
+    typedef QList<Occurrence> OccurrenceList;
+
+    /**
+      Returns a filtered list of all the occurrences of all Incidences
+      which overlap a time range, sorted by their start.
+
+      This expands the recurrences of all incidences in one pass, which is
+      much cheaper than asking for the incidences of each day of the range
+      in turn. Occurrences are determined the same way as by
+      rawEventsForDate(): an occurrence is returned if any part of it lies in
+      the range, all-day occurrences cover whole days in @p timeSpec, and
+      an occurrence which was replaced by an exception (an incidence with a
+      matching RECURRENCE-ID) is returned as that exception instead.
+      To-dos occur at their due date.
+
+      @param start is the inclusive start of the range.
+      @param end is the inclusive end of the range.
+      @param timeSpec time zone etc. to interpret all-day occurrences in,
+                      or the calendar's default time spec if none is specified
+
+      @return the list of filtered occurrences, sorted by start.
+    */
+    OccurrenceList occurrencesInRange( const KDateTime &start, const KDateTime &end,
+                                       const KDateTime::Spec &timeSpec = KDateTime::Spec() ) const;
+
     // Notebook Specific Methods //
 
     /**
@@ -585,6 +681,17 @@ class KCALCORE_EXPORT Calendar : public QObject, public CustomProperties,
     */
     virtual Incidence::List duplicates( const Incidence::Ptr &incidence );
 
+    /**
+      Checks a whole list of incidences, e.g. the contents of an import,
+      for duplicates in one pass. An incidence is a duplicate if it has
+      the same start time and summary as an incidence in one of the
+      notebooks, or as an earlier entry of @p incidences.
+
+      @param incidences is the list of incidences to check.
+      @return the entries of @p incidences which are duplicates, in order.
+    */
+    Incidence::List findDuplicates( const Incidence::List &incidences ) const;
+
     /**
       Returns the Incidence associated with the given unique identifier.
 
@@ -718,6 +825,24 @@ class KCALCORE_EXPORT Calendar : public QObject, public CustomProperties,
     */
     virtual void deleteAllEvents() = 0;
 
+    /**
+      Sets the number of threads used by sortEvents(), sortTodos() and
+      sortJournals() to sort large lists. The sort keys of the incidences
+      are always read on the calling thread; only their ordering is spread
+      over a pool of worker threads.
+
+      @param count the number of threads; 1, the default, sorts on the
+      calling thread and 0 uses one thread per processor core.
+      @see sortThreadCount().
+    */
+    static void setSortThreadCount( int count );
+
+    /**
+      Returns the number of threads used to sort incidence lists.
+      @see setSortThreadCount().
+    */
+    static int sortThreadCount();
+
     /**
       Sort a list of Events.
 
@@ -1280,6 +1405,71 @@ class KCALCORE_EXPORT Calendar : public QObject, public CustomProperties,
 
   // Observer Specific Methods //
 
+    /**
+      @class ChangeSet
+
+      The incidences added, changed and deleted during a transaction,
+      with repeated changes to the same incidence merged: an incidence
+      is reported at most once, and one that was added and deleted again
+      is not reported at all.
+
+      @see startTransaction(), commitTransaction()
+    */
+    class KCALCORE_EXPORT ChangeSet
+    {
+      public:
+        /**
+          Constructs an empty change set.
+        */
+        ChangeSet();
+
+        /**
+          Copy constructor.
+          @param other is the change set to copy.
+        */
+        ChangeSet( const ChangeSet &other );
+
+        /**
+          Destructor.
+        */
+        ~ChangeSet();
+
+        /**
+          Assignment operator.
+          @param other is the change set to assign.
+        */
+        ChangeSet &operator=( const ChangeSet &other );
+
+        /**
+          Returns true if the change set does not contain any changes.
+        */
+        bool isEmpty() const;
+
+        /**
+          Returns the incidences added to the calendar, in order.
+        */
+        Incidence::List added() const;
+
+        /**
+          Returns the incidences which were already in the calendar and
+          have been modified, in order.
+        */
+        Incidence::List changed() const;
+
+        /**
+          Returns the incidences which were already in the calendar and
+          have been removed from it, in order.
+        */
+        Incidence::List deleted() const;
+
+      private:
+        //@cond PRIVATE
+        friend class Calendar;
+        class Private;
+        Private *const d;
+        //@endcond
+    };
+
     /**
       @class CalendarObserver
 
@@ -1327,6 +1517,39 @@ class KCALCORE_EXPORT Calendar : public QObject, public CustomProperties,
         virtual void calendarIncidenceAdditionCanceled( const Incidence::Ptr &incidence );
     };
 
+    /**
+      @class TransactionObserver
+
+      An observer which handles all changes of a transaction at once.
+
+      A CalendarObserver which also inherits TransactionObserver is passed
+      the changes of a transaction in one calendarIncidencesChanged() call.
+      Other observers get calendarIncidenceAdded(), calendarIncidenceChanged()
+      and calendarIncidenceDeleted() for each incidence of the transaction.
+
+      @see Calendar::startTransaction()
+      @since 4.11
+    */
+    class KCALCORE_EXPORT TransactionObserver //krazy:exclude=dpointer
+    {
+      public:
+        /**
+          Destructor.
+        */
+        virtual ~TransactionObserver();
+
+        /**
+          Notify the Observer about all changes of a transaction at once.
+
+          @param changes are the merged changes of the transaction.
+          @param calendar is a pointer to the Calendar object that
+          is being observed.
+          @see Calendar::commitTransaction()
+        */
+        virtual void calendarIncidencesChanged( const ChangeSet &changes,
+                                                Calendar *calendar ) = 0;
+    };
+
     /**
       Registers an Observer for this Calendar.
 
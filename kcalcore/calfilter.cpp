@@ -35,6 +35,8 @@
 
 #include "calfilter.h"
 
+#include <QtCore/QSet>
+
 using namespace KCalCore;
 
 /**
@@ -50,14 +52,97 @@ class KCalCore::CalFilter::Private
         mCompletedTimeSpan( 0 ),
         mEnabled( true )
     {}
+    bool accepts( const Incidence::Ptr &incidence, KDateTime &now ) const;
+
+    // Removes the rejected incidences in a single pass, keeping the order
+    // and the list's storage
+    template <class List>
+    void apply( List *list ) const
+    {
+      if ( !mEnabled ) {
+        return;
+      }
+
+      KDateTime now;    // shared by the whole pass, read on first use
+      typename List::Iterator out = list->begin();
+      for ( typename List::Iterator it = out; it != list->end(); ++it ) {
+        if ( accepts( *it, now ) ) {
+          if ( out != it ) {
+            *out = *it;
+          }
+          ++out;
+        }
+      }
+      list->erase( out, list->end() );
+    }
+
     QString mName;   // filter name
     QStringList mCategoryList;
     QStringList mEmailList;
+    QSet<QString> mCategories;  // mCategoryList, for lookups
+    QSet<QString> mEmails;      // mEmailList, for lookups
     int mCriteria;
     int mCompletedTimeSpan;
     bool mEnabled;
 
 };
+
+bool CalFilter::Private::accepts( const Incidence::Ptr &incidence, KDateTime &now ) const
+{
+  if ( incidence->type() == IncidenceBase::TypeTodo ) {
+    const Todo::Ptr todo = incidence.staticCast<Todo>();
+    if ( ( mCriteria & ( HideCompletedTodos | HideInactiveTodos ) ) && !now.isValid() ) {
+      now = KDateTime::currentUtcDateTime();
+    }
+
+    if ( ( mCriteria & HideCompletedTodos ) && todo->isCompleted() ) {
+      // Check if completion date is suffently long ago:
+      if ( todo->completed().addDays( mCompletedTimeSpan ) < now ) {
+        return false;
+      }
+    }
+
+    if ( ( mCriteria & HideInactiveTodos ) &&
+         ( ( todo->hasStartDate() && now < todo->dtStart() ) ||
+           todo->isCompleted() ) ) {
+      return false;
+    }
+
+    if ( mCriteria & HideNoMatchingAttendeeTodos ) {
+      const QStringList emails = todo->attendeeEmails();
+      // no attendees, must be me only
+      bool iAmOneOfTheAttendees = emails.isEmpty();
+      QStringList::ConstIterator it;
+      for ( it = emails.constBegin(); !iAmOneOfTheAttendees && it != emails.constEnd(); ++it ) {
+        iAmOneOfTheAttendees = mEmails.contains( *it );
+      }
+      if ( !iAmOneOfTheAttendees ) {
+        return false;
+      }
+    }
+  }
+
+  if ( mCriteria & HideRecurring ) {
+    if ( incidence->recurs() ) {
+      return false;
+    }
+  }
+
+  // ShowCategories passes incidences with one of the categories,
+  // otherwise those with one of them are hidden
+  const bool show = mCriteria & ShowCategories;
+  if ( mCategories.isEmpty() ) {
+    return !show;
+  }
+  const QStringList incidenceCategories = incidence->categories();
+  for ( QStringList::ConstIterator it = incidenceCategories.constBegin();
+        it != incidenceCategories.constEnd(); ++it ) {
+    if ( mCategories.contains( *it ) ) {
+      return show;
+    }
+  }
+  return !show;
+}
 //@endcond
 
 CalFilter::CalFilter() : d( new KCalCore::CalFilter::Private )
@@ -86,51 +171,22 @@ bool KCalCore::CalFilter::operator==( const CalFilter &filter ) const
 
 void CalFilter::apply( Event::List *eventList ) const
 {
-  if ( !d->mEnabled ) {
-    return;
-  }
-
-  Event::List::Iterator it = eventList->begin();
-  while ( it != eventList->end() ) {
-    if ( !filterIncidence( *it ) ) {
-      it = eventList->erase( it );
-    } else {
-      ++it;
-    }
-  }
+  d->apply( eventList );
 }
 
-// TODO: avoid duplicating apply() code
 void CalFilter::apply( Todo::List *todoList ) const
 {
-  if ( !d->mEnabled ) {
-    return;
-  }
-
-  Todo::List::Iterator it = todoList->begin();
-  while ( it != todoList->end() ) {
-    if ( !filterIncidence( *it ) ) {
-      it = todoList->erase( it );
-    } else {
-      ++it;
-    }
-  }
+  d->apply( todoList );
 }
 
 void CalFilter::apply( Journal::List *journalList ) const
 {
-  if ( !d->mEnabled ) {
-    return;
-  }
+  d->apply( journalList );
+}
 
-  Journal::List::Iterator it = journalList->begin();
-  while ( it != journalList->end() ) {
-    if ( !filterIncidence( *it ) ) {
-      it = journalList->erase( it );
-    } else {
-      ++it;
-    }
-  }
+void CalFilter::apply( Incidence::List *incidenceList ) const
+{
+  d->apply( incidenceList );
 }
 
 bool CalFilter::filterIncidence( Incidence::Ptr incidence ) const
@@ -139,77 +195,8 @@ bool CalFilter::filterIncidence( Incidence::Ptr incidence ) const
     return true;
   }
 
-  Todo::Ptr todo = incidence.dynamicCast<Todo>();
-  if ( todo ) {
-    if ( ( d->mCriteria & HideCompletedTodos ) && todo->isCompleted() ) {
-      // Check if completion date is suffently long ago:
-      if ( todo->completed().addDays( d->mCompletedTimeSpan ) <
-           KDateTime::currentUtcDateTime() ) {
-        return false;
-      }
-    }
-
-    if ( ( d->mCriteria & HideInactiveTodos ) &&
-         ( ( todo->hasStartDate() &&
-             KDateTime::currentUtcDateTime() < todo->dtStart() ) ||
-           todo->isCompleted() ) ) {
-      return false;
-    }
-
-    if ( d->mCriteria & HideNoMatchingAttendeeTodos ) {
-      bool iAmOneOfTheAttendees = false;
-      const Attendee::List &attendees = todo->attendees();
-      if ( !todo->attendees().isEmpty() ) {
-        Attendee::List::ConstIterator it;
-        for ( it = attendees.begin(); it != attendees.end(); ++it ) {
-          if ( d->mEmailList.contains( ( *it )->email() ) ) {
-            iAmOneOfTheAttendees = true;
-            break;
-          }
-        }
-      } else {
-        // no attendees, must be me only
-        iAmOneOfTheAttendees = true;
-      }
-      if ( !iAmOneOfTheAttendees ) {
-        return false;
-      }
-    }
-  }
-
-  if ( d->mCriteria & HideRecurring ) {
-    if ( incidence->recurs() ) {
-      return false;
-    }
-  }
-
-  if ( d->mCriteria & ShowCategories ) {
-    for ( QStringList::ConstIterator it = d->mCategoryList.constBegin();
-          it != d->mCategoryList.constEnd(); ++it ) {
-      QStringList incidenceCategories = incidence->categories();
-      for ( QStringList::ConstIterator it2 = incidenceCategories.constBegin();
-            it2 != incidenceCategories.constEnd(); ++it2 ) {
-        if ( ( *it ) == ( *it2 ) ) {
-          return true;
-        }
-      }
-    }
-    return false;
-  } else {
-    for ( QStringList::ConstIterator it = d->mCategoryList.constBegin();
-          it != d->mCategoryList.constEnd(); ++it ) {
-      QStringList incidenceCategories = incidence->categories();
-      for ( QStringList::ConstIterator it2 = incidenceCategories.constBegin();
-            it2 != incidenceCategories.constEnd(); ++it2 ) {
-        if ( ( *it ) == ( *it2 ) ) {
-          return false;
-        }
-      }
-    }
-    return true;
-  }
-
-  return true;
+  KDateTime now;
+  return d->accepts( incidence, now );
 }
 
 void CalFilter::setName( const QString &name )
@@ -245,6 +232,7 @@ int CalFilter::criteria() const
 void CalFilter::setCategoryList( const QStringList &categoryList )
 {
   d->mCategoryList = categoryList;
+  d->mCategories = categoryList.toSet();
 }
 
 QStringList CalFilter::categoryList() const
@@ -255,6 +243,7 @@ QStringList CalFilter::categoryList() const
 void CalFilter::setEmailList( const QStringList &emailList )
 {
   d->mEmailList = emailList;
+  d->mEmails = emailList.toSet();
 }
 
 QStringList CalFilter::emailList() const
@@ -136,6 +136,17 @@ class KCALCORE_EXPORT CalFilter
     */
     void apply( Journal::List *journalList ) const;
 
+    /**
+      Applies the filter to a list of Incidences of any type. All incidences
+      not matching the filter criteria are removed from the list.
+
+      Like the other apply() methods, this filters the list in place in a
+      single pass, keeping the order of the remaining incidences.
+
+      @param incidenceList is a list of Incidences to filter.
+    */
+    void apply( Incidence::List *incidenceList ) const;
+
     /**
       Applies the filter criteria to the specified Incidence.
 
@@ -0,0 +1,241 @@
+/*
+  This file is part of the kcalcore library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+/**
+  @file
+  This file is part of the API for handling calendar data and
+  defines the CompactDateTime class.
+*/
+
+#include "compactdatetime_p.h"
+#include "sortablelist.h"
+
+#include <kglobal.h>
+
+#include <QtCore/QMultiHash>
+#include <QtCore/QMutex>
+#include <QtCore/QPair>
+#include <QtCore/QVector>
+
+#include <algorithm>
+
+using namespace KCalCore;
+
+static const qint64 MSecsPerDay = 86400000;
+
+//@cond PRIVATE
+/*
+  The time zones of all CompactDateTime values. A zone is found by its
+  name and then by identity, since calendars may hold different zones of
+  the same name. Entries are only appended, to chunks which are never
+  moved, so an index stays valid for the life of the process.
+*/
+class CompactZoneTable
+{
+  public:
+    CompactZoneTable() : mCount( 0 ) {}
+    ~CompactZoneTable();
+
+    int indexOf( const KTimeZone &zone );
+    KDateTime::Spec spec( int index );
+
+  private:
+    enum { ChunkSize = 64 };
+
+    KTimeZone &entry( int index )
+    {
+      return mChunks[index / ChunkSize][index % ChunkSize];
+    }
+
+    QMutex mLock;
+    QVector<KTimeZone*> mChunks;        // ChunkSize zones each
+    int mCount;
+    QMultiHash<QString, int> mIndexes;  // zone name -> index in the chunks
+};
+
+CompactZoneTable::~CompactZoneTable()
+{
+  for ( int i = 0, end = mChunks.count(); i < end; ++i ) {
+    delete[] mChunks[i];
+  }
+}
+
+int CompactZoneTable::indexOf( const KTimeZone &zone )
+{
+  const QString name = zone.name();
+  QMutexLocker lock( &mLock );
+  QMultiHash<QString, int>::const_iterator it = mIndexes.constFind( name );
+  for ( ; it != mIndexes.constEnd() && it.key() == name; ++it ) {
+    if ( entry( it.value() ) == zone ) {
+      return it.value();
+    }
+  }
+  if ( mCount == mChunks.count() * ChunkSize ) {
+    mChunks.append( new KTimeZone[ChunkSize] );
+  }
+  // KTimeZone copies share their data without atomic counting, so entries
+  // are only assigned and copied under the lock.
+  entry( mCount ) = zone;
+  mIndexes.insert( name, mCount );
+  return mCount++;
+}
+
+KDateTime::Spec CompactZoneTable::spec( int index )
+{
+  QMutexLocker lock( &mLock );
+  return KDateTime::Spec( entry( index ) );
+}
+
+K_GLOBAL_STATIC( CompactZoneTable, sZones )
+
+static qint64 toMSecs( const QDateTime &dt )
+{
+  return qint64( dt.date().toJulianDay() ) * MSecsPerDay + QTime( 0, 0 ).msecsTo( dt.time() );
+}
+
+static QDateTime fromMSecs( qint64 msecs, Qt::TimeSpec spec )
+{
+  const qint64 day = msecs >= 0 ? msecs / MSecsPerDay : ( msecs - MSecsPerDay + 1 ) / MSecsPerDay;
+  return QDateTime( QDate::fromJulianDay( int( day ) ),
+                    QTime( 0, 0 ).addMSecs( int( msecs - day * MSecsPerDay ) ), spec );
+}
+
+typedef QPair<CompactDateTime, int> SortKey;   // value and position in the list
+
+static bool sortKeyLessThan( const SortKey &a, const SortKey &b )
+{
+  return a.first < b.first;
+}
+//@endcond
+
+CompactDateTime::CompactDateTime( const KDateTime &dt )
+  : mValue( 0 ), mSpec( 0 ), mType( KDateTime::Invalid ), mFlags( 0 ), mReserved( 0 )
+{
+  if ( !dt.isValid() ) {
+    return;
+  }
+  const KDateTime::Spec spec = dt.timeSpec();
+  mType = spec.type();
+  if ( mType == KDateTime::OffsetFromUTC ) {
+    mSpec = spec.utcOffset();
+  } else if ( mType == KDateTime::TimeZone ) {
+    mSpec = sZones->indexOf( spec.timeZone() );
+  }
+  if ( dt.isDateOnly() ) {
+    mFlags = DateOnly;
+    mValue = dt.date().toJulianDay();
+  } else if ( mType == KDateTime::ClockTime ) {
+    mValue = toMSecs( dt.dateTime() );
+  } else {
+    mValue = utcMSecs( dt );
+  }
+}
+
+KDateTime CompactDateTime::toKDateTime() const
+{
+  KDateTime::Spec spec;
+  switch ( mType ) {
+  case KDateTime::UTC:
+    spec = KDateTime::Spec::UTC();
+    break;
+  case KDateTime::OffsetFromUTC:
+    spec = KDateTime::Spec::OffsetFromUTC( mSpec );
+    break;
+  case KDateTime::TimeZone:
+    spec = sZones->spec( mSpec );
+    break;
+  case KDateTime::LocalZone:
+    spec = KDateTime::Spec::LocalZone();
+    break;
+  case KDateTime::ClockTime:
+    spec = KDateTime::Spec::ClockTime();
+    break;
+  default:
+    return KDateTime();
+  }
+  if ( isDateOnly() ) {
+    return KDateTime( QDate::fromJulianDay( int( mValue ) ), spec );
+  }
+  if ( mType == KDateTime::ClockTime ) {
+    return KDateTime( fromMSecs( mValue, Qt::LocalTime ), spec );
+  }
+  // A UTC QDateTime is converted to the spec, which also sets the second
+  // occurrence flag of times repeated at the end of daylight saving time.
+  return KDateTime( fromMSecs( mValue, Qt::UTC ), spec );
+}
+
+CompactDateTime CompactDateTime::addSecs( qint64 secs ) const
+{
+  CompactDateTime result( *this );
+  if ( !isValid() ) {
+    return result;
+  }
+  if ( isDateOnly() ) {
+    result.mValue += secs / 86400;
+  } else {
+    result.mValue += secs * 1000;
+  }
+  return result;
+}
+
+qint64 KCalCore::utcMSecs( const KDateTime &dt )
+{
+  if ( dt.isDateOnly() ) {
+    return toMSecs( KDateTime( dt.date(), QTime( 0, 0 ), dt.timeSpec() ).toUtc().dateTime() );
+  }
+  return toMSecs( dt.toUtc().dateTime() );
+}
+
+KDateTime KCalCore::fromUtcSecs( qint64 secs, const KDateTime::Spec &spec )
+{
+  return KDateTime( fromMSecs( secs * 1000, Qt::UTC ), KDateTime::UTC ).toTimeSpec( spec );
+}
+
+void KCalCore::qSortUnique( QList<KDateTime> &list )
+{
+  if ( list.count() <= 1 ) {
+    return;
+  }
+
+  QVector<SortKey> keys;
+  keys.reserve( list.count() );
+  for ( int i = 0, end = list.count(); i < end; ++i ) {
+    keys.append( SortKey( CompactDateTime( list[i] ), i ) );
+    if ( !keys[i].first.comparesDirectly( keys[0].first ) ) {
+      // Mixed date-only and timed values or clock times: every comparison
+      // would go through KDateTime anyway.
+      qSortUnique<KDateTime>( list );
+      return;
+    }
+  }
+
+  // Sort the positions by the compact values and rebuild the list from the
+  // original values, so that nothing has to be converted back.
+  std::stable_sort( keys.begin(), keys.end(), sortKeyLessThan );
+  QList<KDateTime> result;
+  result.reserve( keys.count() );
+  int prev = 0;
+  result.append( list[keys[0].second] );
+  for ( int i = 1, end = keys.count(); i < end; ++i ) {
+    if ( keys[i].first != keys[prev].first ) {
+      result.append( list[keys[i].second] );
+      prev = i;
+    }
+  }
+  list = result;
+}
@@ -0,0 +1,166 @@
+/*
+  This file is part of the kcalcore library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+/**
+  @file
+  This file is part of the API for handling calendar data and
+  defines the CompactDateTime class and the UTC time scale it is based on.
+*/
+#ifndef KCALCORE_COMPACTDATETIME_P_H
+#define KCALCORE_COMPACTDATETIME_P_H
+
+#include <KDateTime>
+
+#include <QtCore/QtGlobal>
+
+namespace KCalCore {
+
+/**
+  @brief
+  A date/time value which can be copied and compared without allocating.
+
+  CompactDateTime holds everything a KDateTime does in 16 bytes of plain
+  data: the time in milliseconds since the start of the Julian day count
+  (in UTC, or in clock time for floating values) or the Julian day of a
+  date-only value, the type of time spec, and either its UTC offset or the
+  index of its time zone in a process-wide table. It is meant for sorted
+  lists and caches which hold many values and only convert a few of them
+  back to KDateTime; other code keeps KDateTime.
+
+  Values whose order is decided by their UTC times, and date-only values
+  with the same time spec, are compared as integers. Other comparisons are
+  done by KDateTime, so the results always agree with it.
+
+  Time zones are registered on first use and kept for the life of the
+  process, in chunks which never move, so that copying a value copies
+  only its bytes. Calendars which share their zones through
+  ICalTimeZoneRegistry or the system database keep the table small.
+
+  @internal
+*/
+class CompactDateTime
+{
+  public:
+    /**
+      Constructs an invalid date/time.
+    */
+    CompactDateTime()
+      : mValue( 0 ), mSpec( 0 ), mType( KDateTime::Invalid ), mFlags( 0 ), mReserved( 0 )
+    {}
+
+    /**
+      Constructs the compact form of @p dt.
+    */
+    explicit CompactDateTime( const KDateTime &dt );
+
+    /**
+      Returns the value as a KDateTime. Converting a KDateTime to
+      CompactDateTime and back gives an equal value in the same time spec.
+    */
+    KDateTime toKDateTime() const;
+
+    bool isValid() const { return mType != KDateTime::Invalid; }
+    bool isDateOnly() const { return mFlags & DateOnly; }
+
+    /**
+      Returns the value @p secs seconds later, following the rules of
+      KDateTime::addSecs().
+    */
+    CompactDateTime addSecs( qint64 secs ) const;
+
+    /**
+      Returns whether this value and @p other are compared without
+      converting them to KDateTime: both are timed values in UTC, a fixed
+      offset or a time zone, or both are date-only in the same time spec.
+    */
+    bool comparesDirectly( const CompactDateTime &other ) const
+    {
+      if ( isDateOnly() ) {
+        return other.isDateOnly() && mType == other.mType && mSpec == other.mSpec;
+      }
+      return isOrderedByUtc() && other.isOrderedByUtc();
+    }
+
+    bool operator==( const CompactDateTime &other ) const
+    {
+      if ( isDateOnly() != other.isDateOnly() ) {
+        return false;
+      }
+      if ( comparesDirectly( other ) ) {
+        return mValue == other.mValue;
+      }
+      return toKDateTime() == other.toKDateTime();
+    }
+    bool operator!=( const CompactDateTime &other ) const { return !operator==( other ); }
+
+    bool operator<( const CompactDateTime &other ) const
+    {
+      if ( comparesDirectly( other ) ) {
+        return mValue < other.mValue;
+      }
+      return toKDateTime() < other.toKDateTime();
+    }
+    bool operator>( const CompactDateTime &other ) const { return other.operator<( *this ); }
+    bool operator<=( const CompactDateTime &other ) const { return !other.operator<( *this ); }
+    bool operator>=( const CompactDateTime &other ) const { return !operator<( other ); }
+
+  private:
+    enum { DateOnly = 0x01 };
+
+    bool isOrderedByUtc() const
+    {
+      return mType != KDateTime::Invalid && mType != KDateTime::ClockTime && !isDateOnly();
+    }
+
+    qint64 mValue;      // milliseconds, or Julian day if date-only
+    qint32 mSpec;       // UTC offset in seconds, or time zone index
+    quint8 mType;       // KDateTime::SpecType
+    quint8 mFlags;
+    quint16 mReserved;
+};
+
+/**
+  Returns the UTC time of @p dt in milliseconds since the start of the
+  Julian day count, the time scale of CompactDateTime. A date-only value
+  is taken at the start of its day in its own time spec. @p dt must be
+  valid.
+  @internal
+*/
+qint64 utcMSecs( const KDateTime &dt );
+
+/**
+  Returns the UTC time of @p dt in seconds on the scale of utcMSecs().
+  @internal
+*/
+inline qint64 utcSecs( const KDateTime &dt )
+{
+  return utcMSecs( dt ) / 1000;
+}
+
+/**
+  Returns the time @p secs, in seconds on the scale of utcMSecs(), in the
+  time spec @p spec.
+  @internal
+*/
+KDateTime fromUtcSecs( qint64 secs, const KDateTime::Spec &spec );
+
+}
+
+Q_DECLARE_TYPEINFO( KCalCore::CompactDateTime, Q_PRIMITIVE_TYPE );
+
+#endif
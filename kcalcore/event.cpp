@@ -30,6 +30,7 @@
 */
 
 #include "event.h"
+#include "incidence_p.h"
 #include "visitor.h"
 
 #include <KDebug>
@@ -287,10 +288,10 @@ KDateTime Event::dateTime( DateTimeRole role ) const
   case RoleDisplayStart:
     return dtStart();
   case RoleAlarm:
-    if ( alarms().isEmpty() ) {
+    if ( IncidenceInternals::alarms( *this ).isEmpty() ) {
       return KDateTime();
     } else {
-      Alarm::Ptr alarm = alarms().first();
+      const Alarm::Ptr alarm = IncidenceInternals::alarms( *this ).first();
       return alarm->hasStartOffset() ? dtStart() : dtEnd();
     }
   break;
@@ -36,24 +36,311 @@
 
 #include <KDebug>
 
+#include <QtCore/QBuffer>
+#include <QtCore/QFile>
+#include <QtCore/QRunnable>
+#include <QtCore/QSet>
+#include <QtCore/QThreadPool>
+
+#include <cstdio>     // for ::rename()
+#include <unistd.h>   // for ::fsync()
+
 using namespace KCalCore;
 
+//@cond PRIVATE
+// Marks the kind of the VCALENDAR record following it in a journal
+static const char journalUpdate[] = "X-KCALCORE-JOURNAL:UPDATE\r\n";
+static const char journalDelete[] = "X-KCALCORE-JOURNAL:DELETE\r\n";
+
+/**
+  Writes a calendar snapshot to a temporary file and moves it over the
+  calendar file, then drops the journal it replaces.
+*/
+class CompactJob : public QRunnable
+{
+  public:
+    CompactJob( const QString &fileName, const QByteArray &text,
+                const QString &journalFileName )
+      : mFileName( fileName ), mText( text ), mJournalFileName( journalFileName )
+    {}
+
+    void run()
+    {
+      const QString tmpFileName = mFileName + QLatin1String( ".new" );
+      QFile file( tmpFileName );
+      if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) ||
+           file.write( mText ) != mText.size() || !file.flush() ||
+           ::fsync( file.handle() ) != 0 ) {
+        kWarning() << "cannot write" << tmpFileName << file.errorString();
+        file.close();
+        QFile::remove( tmpFileName );
+        return;
+      }
+      file.close();
+
+      // rename() atomically replaces the old file, so a crash in between
+      // leaves either the old file plus journal, or the new file
+      if ( ::rename( QFile::encodeName( tmpFileName ).constData(),
+                     QFile::encodeName( mFileName ).constData() ) != 0 ) {
+        kWarning() << "cannot replace" << mFileName;
+        QFile::remove( tmpFileName );
+        return;
+      }
+      QFile::remove( mJournalFileName );
+    }
+
+  private:
+    QString mFileName;
+    QByteArray mText;
+    QString mJournalFileName;
+};
+//@endcond
+
 /*
   Private class that helps to provide binary compatibility between releases.
 */
 //@cond PRIVATE
-class KCalCore::FileStorage::Private
+class KCalCore::FileStorage::Private : public Calendar::CalendarObserver
 {
   public:
     Private( const QString &fileName, CalFormat *format )
       : mFileName( fileName ),
-        mSaveFormat( format )
-    {}
+        mSaveFormat( format ),
+        mJournalEnabled( false ),
+        mJournalThreshold( 1024 * 1024 ),
+        mSynced( false )
+    {
+      mCompactor.setMaxThreadCount( 1 );
+    }
     ~Private() { delete mSaveFormat; }
 
+    void calendarIncidenceAdded( const Incidence::Ptr &incidence )
+    {
+      mDeleted.remove( incidence );
+      mDirty.insert( incidence );
+    }
+    void calendarIncidenceChanged( const Incidence::Ptr &incidence )
+    {
+      calendarIncidenceAdded( incidence );
+    }
+    void calendarIncidenceDeleted( const Incidence::Ptr &incidence )
+    {
+      mDirty.remove( incidence );
+      mDeleted.insert( incidence );
+    }
+    void calendarIncidenceAdditionCanceled( const Incidence::Ptr &incidence )
+    {
+      calendarIncidenceDeleted( incidence );
+    }
+
+    bool canJournal() const;
+    QString journalFileName() const;
+    QString oldJournalFileName() const;
+    void resetJournal();
+    QByteArray journalRecord( const Calendar::Ptr &calendar,
+                              const QSet<Incidence::Ptr> &incidences ) const;
+    bool appendJournal( const Calendar::Ptr &calendar );
+    bool replayJournal( const Calendar::Ptr &calendar, const QString &fileName );
+    bool replayRecord( const Calendar::Ptr &calendar, const QByteArray &record,
+                       bool deleted );
+    void compact( const Calendar::Ptr &calendar );
+
     QString mFileName;
     CalFormat *mSaveFormat;
+    bool mJournalEnabled;
+    qint64 mJournalThreshold;
+    bool mSynced; // the file plus journal matches the calendar but for mDirty and mDeleted
+    QSet<Incidence::Ptr> mDirty;
+    QSet<Incidence::Ptr> mDeleted;
+    QThreadPool mCompactor;
 };
+
+bool FileStorage::Private::canJournal() const
+{
+  return mJournalEnabled && mSynced &&
+         ( !mSaveFormat || dynamic_cast<ICalFormat*>( mSaveFormat ) ) &&
+         QFile::exists( mFileName );
+}
+
+QString FileStorage::Private::journalFileName() const
+{
+  return mFileName + QLatin1String( ".journal" );
+}
+
+// The journal being merged into the file by a CompactJob
+QString FileStorage::Private::oldJournalFileName() const
+{
+  return mFileName + QLatin1String( ".journal.old" );
+}
+
+void FileStorage::Private::resetJournal()
+{
+  mCompactor.waitForDone();
+  QFile::remove( journalFileName() );
+  QFile::remove( oldJournalFileName() );
+  mDirty.clear();
+  mDeleted.clear();
+  mSynced = true;
+}
+
+QByteArray FileStorage::Private::journalRecord( const Calendar::Ptr &calendar,
+                                                const QSet<Incidence::Ptr> &incidences ) const
+{
+  MemoryCalendar::Ptr batch( new MemoryCalendar( calendar->timeSpec() ) );
+  foreach ( const Incidence::Ptr &incidence, incidences ) {
+    batch->addIncidence( Incidence::Ptr( incidence->clone() ) );
+  }
+  ICalFormat format;
+  QByteArray record = format.toString( batch.staticCast<Calendar>() ).toUtf8();
+  batch->close();
+  if ( !record.endsWith( '\n' ) ) {
+    record += "\r\n";
+  }
+  return record;
+}
+
+bool FileStorage::Private::appendJournal( const Calendar::Ptr &calendar )
+{
+  if ( mDirty.isEmpty() && mDeleted.isEmpty() ) {
+    return true;
+  }
+
+  // Deletions go first, so that an incidence deleted and added back with
+  // the same uid is replayed correctly
+  QByteArray data;
+  if ( !mDeleted.isEmpty() ) {
+    data += journalDelete;
+    data += journalRecord( calendar, mDeleted );
+  }
+  if ( !mDirty.isEmpty() ) {
+    data += journalUpdate;
+    data += journalRecord( calendar, mDirty );
+  }
+
+  QFile file( journalFileName() );
+  if ( !file.open( QIODevice::WriteOnly | QIODevice::Append ) ||
+       file.write( data ) != data.size() || !file.flush() ||
+       ::fsync( file.handle() ) != 0 ) {
+    kWarning() << "cannot append to" << file.fileName() << file.errorString();
+    return false;
+  }
+
+  mDirty.clear();
+  mDeleted.clear();
+  if ( file.size() > mJournalThreshold ) {
+    file.close();
+    compact( calendar );
+  }
+  return true;
+}
+
+bool FileStorage::Private::replayJournal( const Calendar::Ptr &calendar,
+                                          const QString &fileName )
+{
+  QFile file( fileName );
+  if ( !file.exists() ) {
+    return true;
+  }
+  if ( !file.open( QIODevice::ReadOnly ) ) {
+    kWarning() << "cannot read" << fileName << file.errorString();
+    return false;
+  }
+
+  bool deleted = false;
+  bool inRecord = false;
+  QByteArray record;
+  while ( !file.atEnd() ) {
+    const QByteArray line = file.readLine();
+    if ( !line.endsWith( '\n' ) ) {
+      // the last append did not complete
+      break;
+    }
+    if ( !inRecord ) {
+      if ( line == journalUpdate || line == journalDelete ) {
+        deleted = ( line == journalDelete );
+      } else if ( line.startsWith( "BEGIN:VCALENDAR" ) ) {
+        inRecord = true;
+        record = line;
+      }
+    } else {
+      record += line;
+      if ( line.startsWith( "END:VCALENDAR" ) ) {
+        inRecord = false;
+        if ( !replayRecord( calendar, record, deleted ) ) {
+          return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool FileStorage::Private::replayRecord( const Calendar::Ptr &calendar,
+                                         const QByteArray &record, bool deleted )
+{
+  MemoryCalendar::Ptr batch( new MemoryCalendar( calendar->timeSpec() ) );
+  ICalFormat format;
+  if ( !format.fromRawString( batch, record ) ) {
+    kWarning() << "cannot parse journal record";
+    return false;
+  }
+
+  const Incidence::List incidences = batch->rawIncidences();
+  foreach ( const Incidence::Ptr &incidence, incidences ) {
+    Incidence::Ptr existing = calendar->incidence( incidence->uid(), incidence->recurrenceId() );
+    if ( deleted ) {
+      if ( existing ) {
+        calendar->deleteIncidence( existing );
+      }
+    } else if ( existing && existing->type() == incidence->type() ) {
+      // Update in place, so pointers held by the application stay valid
+      existing->startUpdates();
+      static_cast<IncidenceBase &>( *existing ) = *incidence;
+      existing->updated();
+      existing->endUpdates();
+    } else {
+      if ( existing ) {
+        calendar->deleteIncidence( existing );
+      }
+      calendar->addIncidence( Incidence::Ptr( incidence->clone() ) );
+    }
+  }
+  batch->close();
+  return true;
+}
+
+void FileStorage::Private::compact( const Calendar::Ptr &calendar )
+{
+  mCompactor.waitForDone();
+
+  const QString journal = journalFileName();
+  const QString oldJournal = oldJournalFileName();
+  if ( QFile::exists( oldJournal ) ) {
+    // An earlier rewrite failed; its journal is still needed until one succeeds
+    QFile from( journal );
+    QFile to( oldJournal );
+    if ( !from.open( QIODevice::ReadOnly ) ||
+         !to.open( QIODevice::WriteOnly | QIODevice::Append ) ||
+         to.write( from.readAll() ) != from.size() || !to.flush() ) {
+      kWarning() << "cannot merge" << journal << "into" << oldJournal;
+      return;
+    }
+    from.remove();
+  } else if ( !QFile::rename( journal, oldJournal ) ) {
+    kWarning() << "cannot rename" << journal;
+    return;
+  }
+
+  // The calendar is not thread safe, so it is serialized here; only the
+  // file writing happens in the background
+  ICalFormat format;
+  QBuffer buffer;
+  buffer.open( QIODevice::WriteOnly );
+  if ( !format.save( calendar, &buffer ) ) {
+    return;
+  }
+  mCompactor.start( new CompactJob( mFileName, buffer.data(), oldJournal ) );
+}
 //@endcond
 
 FileStorage::FileStorage( const Calendar::Ptr &cal, const QString &fileName,
@@ -65,12 +352,18 @@ FileStorage::FileStorage( const Calendar::Ptr &cal, const QString &fileName,
 
 FileStorage::~FileStorage()
 {
+  d->mCompactor.waitForDone();
+  if ( d->mJournalEnabled ) {
+    calendar()->unregisterObserver( d );
+  }
   delete d;
 }
 
 void FileStorage::setFileName( const QString &fileName )
 {
+  d->mCompactor.waitForDone();
   d->mFileName = fileName;
+  d->mSynced = false;
 }
 
 QString FileStorage::fileName() const
@@ -89,6 +382,40 @@ CalFormat *FileStorage::saveFormat() const
   return d->mSaveFormat;
 }
 
+void FileStorage::setJournalEnabled( bool enabled )
+{
+  if ( enabled == d->mJournalEnabled ) {
+    return;
+  }
+  d->mJournalEnabled = enabled;
+  d->mSynced = false;
+  if ( enabled ) {
+    calendar()->registerObserver( d );
+  } else {
+    calendar()->unregisterObserver( d );
+  }
+}
+
+bool FileStorage::isJournalEnabled() const
+{
+  return d->mJournalEnabled;
+}
+
+QString FileStorage::journalFileName() const
+{
+  return d->journalFileName();
+}
+
+void FileStorage::setJournalThreshold( qint64 bytes )
+{
+  d->mJournalThreshold = bytes;
+}
+
+qint64 FileStorage::journalThreshold() const
+{
+  return d->mJournalThreshold;
+}
+
 bool FileStorage::open()
 {
   return true;
@@ -135,6 +462,16 @@ bool FileStorage::load()
     }
   }
 
+  // Changes saved after the file was last rewritten
+  d->mCompactor.waitForDone();
+  if ( !d->replayJournal( calendar(), d->oldJournalFileName() ) ||
+       !d->replayJournal( calendar(), d->journalFileName() ) ) {
+    return false;
+  }
+  d->mDirty.clear();
+  d->mDeleted.clear();
+  d->mSynced = true;
+
   calendar()->setProductId( productId );
   calendar()->setModified( false );
 
@@ -148,11 +485,22 @@ bool FileStorage::save()
     return false;
   }
 
+  if ( d->canJournal() ) {
+    if ( !d->appendJournal( calendar() ) ) {
+      return false;
+    }
+    calendar()->setModified( false );
+    return true;
+  }
+
+  d->mCompactor.waitForDone();
   CalFormat *format = d->mSaveFormat ? d->mSaveFormat : new ICalFormat;
 
   bool success = format->save( calendar(), d->mFileName );
 
   if ( success ) {
+    // The file now holds everything, a journal would only replay stale data
+    d->resetJournal();
     calendar()->setModified( false );
   } else {
     if ( !format->exception() ) {
@@ -171,5 +519,6 @@ bool FileStorage::save()
 
 bool FileStorage::close()
 {
+  d->mCompactor.waitForDone();
   return true;
 }
@@ -40,6 +40,12 @@ class Calendar;
 /**
   @brief
   This class provides a calendar storage as a local file.
+
+  In journal mode (see setJournalEnabled()), save() does not rewrite the
+  whole file. Instead it appends the incidences changed and deleted since
+  the last save to a journal next to the file. Once the journal grows past
+  journalThreshold(), the calendar file is rewritten in a background
+  thread. load() replays any journal left behind.
 */
 class KCALCORE_EXPORT FileStorage : public CalStorage
 {
@@ -101,6 +107,47 @@ class KCALCORE_EXPORT FileStorage : public CalStorage
     */
     CalFormat *saveFormat() const;
 
+    /**
+      Enables or disables journal mode. Journal mode only applies to the
+      iCalendar format; with another save format, save() always rewrites
+      the whole file. Changes are tracked from the time journal mode is
+      enabled, so the first save() after that, or after setFileName(),
+      writes the whole file unless load() is called in between.
+
+      @param enabled true to append changes to the journal on save().
+      @see isJournalEnabled(), journalFileName()
+    */
+    void setJournalEnabled( bool enabled );
+
+    /**
+      Returns true if journal mode is enabled.
+      @see setJournalEnabled()
+    */
+    bool isJournalEnabled() const;
+
+    /**
+      Returns the name of the journal file, which is the calendar file name
+      with ".journal" appended.
+      @see setJournalEnabled()
+    */
+    QString journalFileName() const;
+
+    /**
+      Sets the journal size, in bytes, above which save() merges the
+      journal into the calendar file. The default is 1 MiB.
+
+      @param bytes is the size threshold.
+      @see journalThreshold()
+    */
+    void setJournalThreshold( qint64 bytes );
+
+    /**
+      Returns the journal size above which the journal gets merged into the
+      calendar file.
+      @see setJournalThreshold()
+    */
+    qint64 journalThreshold() const;
+
     /**
       @copydoc CalStorage::open()
     */
@@ -118,6 +165,8 @@ class KCALCORE_EXPORT FileStorage : public CalStorage
 
     /**
       @copydoc CalStorage::close()
+
+      Waits for a background rewrite of the calendar file to finish.
     */
     bool close();
 
@@ -31,6 +31,8 @@
   @author Reinhold Kainhofer \<reinhold@kainhofer.com\>
 */
 #include "freebusy.h"
+#include "compactdatetime_p.h"
+#include "incidence_p.h"
 #include "visitor.h"
 
 #include "icalformat.h"
@@ -38,6 +40,8 @@
 #include <KDebug>
 #include <QTime>
 
+#include <algorithm>
+
 using namespace KCalCore;
 
 //@cond PRIVATE
@@ -63,9 +67,6 @@ class KCalCore::FreeBusy::Private
 
     KDateTime mDtEnd;                  // end datetime
     FreeBusyPeriod::List mBusyPeriods; // list of periods
-
-    // This is used for creating a freebusy object for the current user
-    bool addLocalPeriod( FreeBusy *fb, const KDateTime &start, const KDateTime &end );
 };
 
 void KCalCore::FreeBusy::Private::init( const KCalCore::FreeBusy::Private &other )
@@ -106,82 +107,72 @@ FreeBusy::FreeBusy( const Event::List &events, const KDateTime &start, const KDa
 void FreeBusy::Private::init( const Event::List &eventList,
                               const KDateTime &start, const KDateTime &end )
 {
-  int extraDays, i, x, duration;
-  duration = start.daysTo( end );
-  QDate day;
-  KDateTime tmpStart;
-  KDateTime tmpEnd;
+  const KDateTime rangeStart = start.toUtc();
+  const KDateTime rangeEnd = end.toUtc();
+
+  // Busy intervals in UTC, clipped to the requested range
+  typedef QPair<KDateTime, KDateTime> Interval;
+  QVector<Interval> intervals;
 
-  // Loops through every event in the calendar
   Event::List::ConstIterator it;
   for ( it = eventList.constBegin(); it != eventList.constEnd(); ++it ) {
-    Event::Ptr event = *it;
+    const Event::Ptr event = *it;
 
     // If this event is transparent it shouldn't be in the freebusy list.
     if ( event->transparency() == Event::Transparent ) {
       continue;
     }
 
-    // The code below can not handle all-day events. Fixing this resulted
-    // in a lot of duplicated code. Instead, make a copy of the event and
-    // set the period to the full day(s). This trick works for recurring,
-    // multiday, and single day all-day events.
-    Event::Ptr allDayEvent;
+    // All-day events block their days from midnight to midnight
+    KDateTime eventStart = event->dtStart();
+    KDateTime eventEnd = event->dtEnd();
+    Duration length;
     if ( event->allDay() ) {
-      // addDay event. Do the hack
-      kDebug() << "All-day event";
-      allDayEvent = Event::Ptr( new Event( *event ) );
-
-      // Set the start and end times to be on midnight
-      KDateTime st = allDayEvent->dtStart();
-      st.setTime( QTime( 0, 0 ) );
-      KDateTime nd = allDayEvent->dtEnd();
-      nd.setTime( QTime( 23, 59, 59, 999 ) );
-      allDayEvent->setAllDay( false );
-      allDayEvent->setDtStart( st );
-      allDayEvent->setDtEnd( nd );
-
-      kDebug() << "Use:" << st.toString() << "to" << nd.toString();
-      // Finally, use this event for the setting below
-      event = allDayEvent;
+      eventStart.setDateOnly( false );
+      eventEnd = eventEnd.addDays( 1 );
+      eventEnd.setDateOnly( false );
+      length = Duration( eventStart.daysTo( eventEnd ), Duration::Days );
+    } else {
+      length = Duration( eventStart, eventEnd );
     }
 
-    // This whole for loop is for recurring events, it loops through
-    // each of the days of the freebusy request
-
-    for ( i = 0; i <= duration; ++i ) {
-      day = start.addDays( i ).date();
-      tmpStart.setDate( day );
-      tmpEnd.setDate( day );
-
-      if ( event->recurs() ) {
-        if ( event->isMultiDay() ) {
-  // FIXME: This doesn't work for sub-daily recurrences or recurrences with
-  //        a different time than the original event.
-          extraDays = event->dtStart().daysTo( event->dtEnd() );
-          for ( x = 0; x <= extraDays; ++x ) {
-            if ( event->recursOn( day.addDays( -x ), start.timeSpec() ) ) {
-              tmpStart.setDate( day.addDays( -x ) );
-              tmpStart.setTime( event->dtStart().time() );
-              tmpEnd = event->duration().end( tmpStart );
-
-              addLocalPeriod( q, tmpStart, tmpEnd );
-              break;
-            }
-          }
-        } else {
-          if ( event->recursOn( day, start.timeSpec() ) ) {
-            tmpStart.setTime( event->dtStart().time() );
-            tmpEnd.setTime( event->dtEnd().time() );
+    DateTimeList starts;
+    if ( event->recurs() ) {
+      // Occurrences starting up to one event length (plus a day for time
+      // zone and daylight saving shifts) before the range may overlap it
+      const KDateTime from = rangeStart.addSecs( -length.asSeconds() ).addDays( -1 );
+      starts = IncidenceInternals::recurrence( *event )->timesInInterval( from, rangeEnd );
+    } else {
+      starts.append( eventStart );
+    }
 
-            addLocalPeriod ( q, tmpStart, tmpEnd );
-          }
-        }
+    DateTimeList::ConstIterator st;
+    for ( st = starts.constBegin(); st != starts.constEnd(); ++st ) {
+      KDateTime occurrenceStart = *st;
+      if ( !occurrenceStart.isValid() ) {
+        continue;
+      }
+      occurrenceStart.setDateOnly( false );
+      const KDateTime occurrenceEnd = length.end( occurrenceStart ).toUtc();
+      occurrenceStart = occurrenceStart.toUtc();
+      if ( occurrenceEnd <= rangeStart || occurrenceStart >= rangeEnd ) {
+        continue;
       }
+      intervals.append( Interval( qMax( occurrenceStart, rangeStart ),
+                                  qMin( occurrenceEnd, rangeEnd ) ) );
+    }
+  }
 
+  // Sweep the intervals in order of their start, coalescing overlapping
+  // and adjacent ones into a single busy period
+  qSort( intervals );
+  QVector<Interval>::ConstIterator in = intervals.constBegin();
+  while ( in != intervals.constEnd() ) {
+    Interval busy = *in;
+    for ( ++in; in != intervals.constEnd() && ( *in ).first <= busy.second; ++in ) {
+      busy.second = qMax( busy.second, ( *in ).second );
     }
-    // Non-recurring events
-    addLocalPeriod( q, event->dtStart(), event->dtEnd() );
+    mBusyPeriods.append( FreeBusyPeriod( busy.first, busy.second ) );
   }
 
   q->sortList();
@@ -296,6 +287,223 @@ void FreeBusy::merge( FreeBusy::Ptr freeBusy )
   sortList();
 }
 
+//@cond PRIVATE
+// A busy period of one attendee, in UTC seconds
+struct BusyInterval
+{
+  qint64 start;
+  qint64 end;
+  int weight;
+  int attendee;
+  int index;      // in the attendee's period list
+};
+
+static bool startsEarlier( const BusyInterval &a, const BusyInterval &b )
+{
+  return a.start < b.start;
+}
+
+// Order heaps by ascending start, or by ascending end
+static bool startsLater( const BusyInterval &a, const BusyInterval &b )
+{
+  return a.start > b.start;
+}
+
+static bool endsLater( const BusyInterval &a, const BusyInterval &b )
+{
+  return a.end > b.end;
+}
+
+/**
+  Sweeps over the busy periods of several attendees at once, merging their
+  sorted period lists through a heap of the next period of each attendee,
+  and keeps the total weight of the attendees busy at the current time.
+*/
+class BusySweep
+{
+  public:
+    BusySweep() : mBusyWeight( 0 ) {}
+
+    void addAttendee( const FreeBusyPeriod::List &periods, int weight )
+    {
+      const int attendee = mPeriods.count();
+      mPeriods.append( QVector<BusyInterval>() );
+      QVector<BusyInterval> &intervals = mPeriods.last();
+      intervals.reserve( periods.count() );
+      bool sorted = true;
+      foreach ( const FreeBusyPeriod &period, periods ) {
+        const BusyInterval interval = { utcSecs( period.start() ), utcSecs( period.end() ),
+                                        weight, attendee, 0 };
+        sorted = sorted && ( intervals.isEmpty() || intervals.last().start <= interval.start );
+        intervals.append( interval );
+      }
+      // Periods passed to the constructor are not sorted by FreeBusy
+      if ( !sorted ) {
+        std::sort( intervals.begin(), intervals.end(), startsEarlier );
+      }
+      for ( int i = 0; i < intervals.count(); ++i ) {
+        intervals[i].index = i;
+      }
+      if ( !intervals.isEmpty() ) {
+        mStarts.append( intervals.first() );
+        std::push_heap( mStarts.begin(), mStarts.end(), startsLater );
+      }
+    }
+
+    // Ends the periods finished by pos and starts those begun by then
+    void moveTo( qint64 pos )
+    {
+      while ( !mActive.isEmpty() && mActive.first().end <= pos ) {
+        mBusyWeight -= mActive.first().weight;
+        std::pop_heap( mActive.begin(), mActive.end(), endsLater );
+        mActive.pop_back();
+      }
+      while ( !mStarts.isEmpty() && mStarts.first().start <= pos ) {
+        const BusyInterval interval = mStarts.first();
+        std::pop_heap( mStarts.begin(), mStarts.end(), startsLater );
+        mStarts.pop_back();
+        const QVector<BusyInterval> &intervals = mPeriods[interval.attendee];
+        if ( interval.index + 1 < intervals.count() ) {
+          mStarts.append( intervals[interval.index + 1] );
+          std::push_heap( mStarts.begin(), mStarts.end(), startsLater );
+        }
+        if ( interval.end > pos ) {
+          mBusyWeight += interval.weight;
+          mActive.append( interval );
+          std::push_heap( mActive.begin(), mActive.end(), endsLater );
+        }
+      }
+    }
+
+    // The time of the next start or end of a period, at most limit
+    qint64 nextChange( qint64 limit ) const
+    {
+      qint64 next = limit;
+      if ( !mActive.isEmpty() ) {
+        next = qMin( next, mActive.first().end );
+      }
+      if ( !mStarts.isEmpty() ) {
+        next = qMin( next, mStarts.first().start );
+      }
+      return next;
+    }
+
+    int busyWeight() const
+    {
+      return mBusyWeight;
+    }
+
+  private:
+    QVector< QVector<BusyInterval> > mPeriods;
+    QVector<BusyInterval> mStarts;   // next period of each attendee
+    QVector<BusyInterval> mActive;   // periods in progress
+    int mBusyWeight;
+};
+
+/**
+  Places slots back to back in a free interval, within the working hours.
+*/
+class SlotPlacer
+{
+  public:
+    SlotPlacer( qint64 duration, quint32 workingHours, const KDateTime::Spec &spec,
+                int maxSlots, Period::List *slots )
+      : mDuration( duration ), mWorkingHours( workingHours & 0xffffff ),
+        mSpec( spec ), mMaxSlots( maxSlots ), mSlots( slots )
+    {}
+
+    bool isFull() const
+    {
+      return mSlots->count() >= mMaxSlots;
+    }
+
+    void place( qint64 from, qint64 to )
+    {
+      qint64 start = from;
+      while ( start + mDuration <= to && !isFull() ) {
+        // The run of allowed hours beginning at start
+        qint64 runEnd = start;
+        if ( mWorkingHours == 0xffffff ) {
+          runEnd = to;
+        }
+        while ( runEnd < start + mDuration ) {
+          const QTime time = fromUtcSecs( runEnd, mSpec ).time();
+          if ( !( mWorkingHours & ( 1 << time.hour() ) ) ) {
+            break;
+          }
+          runEnd += 3600 - ( time.minute() * 60 + time.second() );
+        }
+
+        if ( runEnd >= start + mDuration ) {
+          mSlots->append( Period( fromUtcSecs( start, mSpec ),
+                                  fromUtcSecs( start + mDuration, mSpec ) ) );
+          start += mDuration;
+        } else if ( runEnd > start ) {
+          start = runEnd;
+        } else {
+          // skip the rest of an hour which is not allowed
+          const QTime time = fromUtcSecs( start, mSpec ).time();
+          start += 3600 - ( time.minute() * 60 + time.second() );
+        }
+      }
+    }
+
+  private:
+    qint64 mDuration;
+    quint32 mWorkingHours;
+    KDateTime::Spec mSpec;
+    int mMaxSlots;
+    Period::List *mSlots;
+};
+//@endcond
+
+Period::List FreeBusy::freeSlots( const FreeBusy::List &freeBusyList,
+                                  const Period &window,
+                                  const Duration &duration,
+                                  int maxSlots,
+                                  quint32 workingHours,
+                                  const QList<int> &weights,
+                                  int maxBusyWeight )
+{
+  Period::List slots;
+  const qint64 windowStart = utcSecs( window.start() );
+  const qint64 windowEnd = utcSecs( window.end() );
+  const qint64 length = duration.asSeconds();
+  if ( maxSlots <= 0 || length <= 0 || windowStart >= windowEnd ) {
+    return slots;
+  }
+
+  BusySweep sweep;
+  for ( int i = 0; i < freeBusyList.count(); ++i ) {
+    if ( freeBusyList[i] ) {
+      sweep.addAttendee( freeBusyList[i]->d->mBusyPeriods,
+                         i < weights.count() ? weights[i] : 1 );
+    }
+  }
+
+  SlotPlacer placer( length, workingHours, window.start().timeSpec(), maxSlots, &slots );
+  qint64 pos = windowStart;
+  qint64 freeStart = 0;
+  bool inFree = false;
+  sweep.moveTo( pos );
+  while ( pos < windowEnd && !placer.isFull() ) {
+    const bool free = sweep.busyWeight() <= maxBusyWeight;
+    if ( free && !inFree ) {
+      freeStart = pos;
+    } else if ( !free && inFree ) {
+      placer.place( freeStart, pos );
+    }
+    inFree = free;
+    pos = sweep.nextChange( windowEnd );
+    sweep.moveTo( pos );
+  }
+  if ( inFree ) {
+    placer.place( freeStart, windowEnd );
+  }
+
+  return slots;
+}
+
 void FreeBusy::shiftTimes( const KDateTime::Spec &oldSpec,
                            const KDateTime::Spec &newSpec )
 {
@@ -357,43 +565,6 @@ void FreeBusy::virtual_hook( int id, void *data )
   Q_ASSERT( false );
 }
 
-//@cond PRIVATE
-bool FreeBusy::Private::addLocalPeriod( FreeBusy *fb,
-                                        const KDateTime &eventStart,
-                                        const KDateTime &eventEnd )
-{
-  KDateTime tmpStart;
-  KDateTime tmpEnd;
-
-  //Check to see if the start *or* end of the event is
-  //between the start and end of the freebusy dates.
-  KDateTime start = fb->dtStart();
-  if ( !( ( ( start.secsTo( eventStart ) >= 0 ) &&
-            ( eventStart.secsTo( mDtEnd ) >= 0 ) ) ||
-          ( ( start.secsTo( eventEnd ) >= 0 ) &&
-            ( eventEnd.secsTo( mDtEnd ) >= 0 ) ) ) ) {
-    return false;
-  }
-
-  if ( eventStart.secsTo( start ) >= 0 ) {
-    tmpStart = start;
-  } else {
-    tmpStart = eventStart;
-  }
-
-  if ( eventEnd.secsTo( mDtEnd ) <= 0 ) {
-    tmpEnd = mDtEnd;
-  } else {
-    tmpEnd = eventEnd;
-  }
-
-  FreeBusyPeriod p( tmpStart, tmpEnd );
-  mBusyPeriods.append( p );
-
-  return true;
-}
-//@endcond
-
 QLatin1String FreeBusy::mimeType() const
 {
   return FreeBusy::freeBusyMimeType();
@@ -213,6 +213,42 @@ class KCALCORE_EXPORT FreeBusy : public IncidenceBase
     */
     void merge( FreeBusy::Ptr freebusy );
 
+    /**
+      Finds the earliest time slots in which a group of attendees is free.
+
+      The busy periods of all attendees are merged in order of their start
+      time and swept once, stopping as soon as @p maxSlots slots are found.
+      Each attendee has a weight, and a slot is free when the total weight
+      of the attendees busy during it is at most @p maxBusyWeight. With the
+      default weights of 1 and a @p maxBusyWeight of 0 everybody has to be
+      free. To allow optional attendees to be busy, give required attendees
+      a weight larger than @p maxBusyWeight.
+
+      Slots are placed back to back from the start of each free interval,
+      within the hours of the day set in @p workingHours.
+
+      @param freeBusyList is the free/busy information of each attendee.
+      @param window is the period to search in.
+      @param duration is the length of each slot.
+      @param maxSlots is the maximum number of slots to return.
+      @param workingHours is a bit mask of the allowed hours of the day in
+      the time specification of the window start: bit 0 for 00:00 to 01:00
+      up to bit 23 for 23:00 to 24:00. By default all hours are allowed.
+      @param weights is the weight of each attendee, in the order of
+      @p freeBusyList; attendees without an entry have a weight of 1.
+      @param maxBusyWeight is the maximum total weight of busy attendees.
+      @return the slots in ascending order, in the time specification of
+      the window start.
+      @see merge()
+    */
+    static Period::List freeSlots( const FreeBusy::List &freeBusyList,
+                                   const Period &window,
+                                   const Duration &duration,
+                                   int maxSlots = 1,
+                                   quint32 workingHours = 0xffffff,
+                                   const QList<int> &weights = QList<int>(),
+                                   int maxBusyWeight = 0 );
+
     /**
       @copydoc
       IncidenceBase::dateTime()
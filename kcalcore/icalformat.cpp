@@ -37,6 +37,7 @@
 #include <KDebug>
 #include <KSaveFile>
 
+#include <QtCore/QBuffer>
 #include <QtCore/QFile>
 
 extern "C" {
@@ -55,14 +56,329 @@ class KCalCore::ICalFormat::Private
   public:
     Private( ICalFormat *parent )
       : mImpl( new ICalFormatImpl( parent ) ),
-        mTimeSpec( KDateTime::UTC )
+        mParent( parent ),
+        mTimeSpec( KDateTime::UTC ),
+        mStreamingLoad( false ),
+        mPopulated( false )
     {}
     ~Private()  { delete mImpl; }
+    bool loadStream( const Calendar::Ptr &calendar, QIODevice *device );
+    bool loadTimeZones( const Calendar::Ptr &calendar, QIODevice *device,
+                        const QByteArray &firstLine );
+    bool saveStream( const Calendar::Ptr &calendar, QIODevice *device,
+                     const QString &notebook, bool deleted );
+
     ICalFormatImpl *mImpl;
+    ICalFormat *mParent;
     KDateTime::Spec mTimeSpec;
+    bool mStreamingLoad;
+    bool mPopulated;    // loadStream() read at least one valid VCALENDAR header
 };
+
+static bool isContentLine( const QByteArray &line, const char *keyword, int length )
+{
+  // Folded continuation lines start with white space and are never matched.
+  return line.size() > length && qstrnicmp( line.constData(), keyword, length ) == 0;
+}
+
+static QByteArray contentLineValue( const QByteArray &line, int length )
+{
+  return line.mid( length ).trimmed().toUpper();
+}
+
+// Populates the time zones of the VCALENDAR being read, whose first
+// component begins with @p firstLine. The VTIMEZONE components usually
+// follow the incidences which use them, as they do in every file we write,
+// so they are read ahead up to the END:VCALENDAR line, after which the
+// device is put back where it was.
+bool ICalFormat::Private::loadTimeZones( const Calendar::Ptr &calendar, QIODevice *device,
+                                         const QByteArray &firstLine )
+{
+  const qint64 start = device->pos();
+  QByteArray line = firstLine;
+  QByteArray component;     // the VTIMEZONE being read
+  int depth = 1;            // 1 in the VCALENDAR properties, > 1 in a component
+  bool inTimeZone = false;
+  bool success = true;
+
+  for ( ;; ) {
+    const bool isBegin = isContentLine( line, "BEGIN:", 6 );
+    const bool isEnd = !isBegin && isContentLine( line, "END:", 4 );
+    if ( depth == 1 ) {
+      if ( isEnd ) {
+        break;    // END:VCALENDAR
+      }
+      if ( isBegin ) {
+        inTimeZone = contentLineValue( line, 6 ) == "VTIMEZONE";
+        component = inTimeZone ? line : QByteArray();
+        depth = 2;
+      }
+    } else {
+      if ( inTimeZone ) {
+        component += line;
+      }
+      if ( isBegin ) {
+        ++depth;
+      } else if ( isEnd && --depth == 1 && inTimeZone ) {
+        icalcomponent *c = icalcomponent_new_from_string( component.data() );
+        if ( c ) {
+          mImpl->populateComponent( calendar, c );
+          icalcomponent_free( c );
+        } else {
+          kError() << "parse error in time zone";
+          if ( !mParent->exception() ) {
+            mParent->setException( new Exception( Exception::ParseErrorIcal ) );
+          }
+          success = false;
+        }
+        icalmemory_free_ring();
+        component.clear();
+        inTimeZone = false;
+      }
+    }
+    if ( device->atEnd() ) {
+      break;
+    }
+    line = device->readLine();
+  }
+
+  return device->seek( start ) && success;
+}
+
+// Reads the top level components of each VCALENDAR one at a time and hands
+// them to the ICalFormatImpl as soon as they are complete, so that only the
+// VCALENDAR properties and a single component are held in memory at once.
+// The time zones of each VCALENDAR are read first, see loadTimeZones().
+bool ICalFormat::Private::loadStream( const Calendar::Ptr &calendar, QIODevice *device )
+{
+  static const QByteArray endCalendar( "END:VCALENDAR\r\n" );
+
+  if ( device->isSequential() ) {
+    // The time zones are read ahead, which needs a device that can seek
+    QBuffer buffer;
+    buffer.setData( device->readAll() );
+    buffer.open( QIODevice::ReadOnly );
+    return loadStream( calendar, &buffer );
+  }
+
+  QByteArray header;      // properties of the current VCALENDAR
+  QByteArray component;   // the top level component being read
+  int depth = 0;          // 0 outside VCALENDAR, 1 in its properties, > 1 in a component
+  bool headerParsed = false;
+  bool headerValid = false;
+  bool foundCalendar = false;
+  bool firstLine = true;
+  bool hasData = false;
+  bool skipComponent = false;   // a VTIMEZONE, already read by loadTimeZones()
+  bool success = true;
+
+  mPopulated = false;
+
+  while ( !device->atEnd() ) {
+    QByteArray line = device->readLine();
+    if ( firstLine ) {
+      firstLine = false;
+      if ( line.startsWith( "\xEF\xBB\xBF" ) ) {   // UTF-8 byte order mark
+        line.remove( 0, 3 );
+      }
+    }
+
+    const bool isBegin = isContentLine( line, "BEGIN:", 6 );
+    const bool isEnd = !isBegin && isContentLine( line, "END:", 4 );
+
+    if ( depth == 0 ) {
+      if ( isBegin ) {
+        if ( contentLineValue( line, 6 ) != "VCALENDAR" ) {
+          kDebug() << "No VCALENDAR component found";
+          mParent->setException( new Exception( Exception::NoCalendar ) );
+          return false;
+        }
+        foundCalendar = true;
+        header = line;
+        headerParsed = false;
+        headerValid = false;
+        depth = 1;
+      } else if ( !line.trimmed().isEmpty() ) {
+        hasData = true;
+      }
+      continue;
+    }
+
+    if ( depth == 1 && !isBegin && !isEnd ) {
+      header += line;
+      continue;
+    }
+
+    if ( depth == 1 && !headerParsed ) {
+      // The calendar properties are complete: they precede all components.
+      headerParsed = true;
+      header += endCalendar;
+      icalcomponent *vcalendar = icalcomponent_new_from_string( header.data() );
+      header.clear();
+      if ( vcalendar ) {
+        headerValid = mImpl->populateHeader( calendar, vcalendar );
+        icalcomponent_free( vcalendar );
+      }
+      if ( headerValid ) {
+        mPopulated = true;
+        if ( !loadTimeZones( calendar, device, line ) ) {
+          success = false;
+        }
+      } else {
+        kError() << "Could not populate calendar";
+        if ( !mParent->exception() ) {
+          mParent->setException( new Exception( Exception::ParseErrorKcal ) );
+        }
+        success = false;
+      }
+    }
+
+    if ( depth == 1 ) {
+      if ( isEnd ) {
+        depth = 0;
+      } else {
+        component = line;
+        skipComponent = contentLineValue( line, 6 ) == "VTIMEZONE";
+        depth = 2;
+      }
+      continue;
+    }
+
+    component += line;
+    if ( isBegin ) {
+      ++depth;
+    } else if ( isEnd && --depth == 1 ) {
+      if ( headerValid && !skipComponent ) {
+        icalcomponent *c = icalcomponent_new_from_string( component.data() );
+        if ( c ) {
+          mImpl->populateComponent( calendar, c );
+          icalcomponent_free( c );
+        } else {
+          kError() << "parse error in component";
+          if ( !mParent->exception() ) {
+            mParent->setException( new Exception( Exception::ParseErrorIcal ) );
+          }
+          success = false;
+        }
+        icalmemory_free_ring();
+      }
+      component.clear();
+    }
+  }
+
+  if ( depth != 0 ) {
+    kError() << "parse error ; unterminated VCALENDAR";
+    mParent->setException( new Exception( Exception::ParseErrorIcal ) );
+    return false;
+  }
+
+  if ( !foundCalendar && hasData ) {
+    // empty files are valid, anything else must be a calendar
+    kDebug() << "No VCALENDAR component found";
+    mParent->setException( new Exception( Exception::NoCalendar ) );
+    return false;
+  }
+
+  return success;
+}
 //@endcond
 
+// Renders a component, appends it to the device and frees it.
+static bool writeComponent( QIODevice *device, icalcomponent *component )
+{
+  char *const text = icalcomponent_as_ical_string_r( component );
+  const qint64 size = qstrlen( text );
+  const bool success = device->write( text, size ) == size;
+  free( text );
+  icalcomponent_free( component );
+  return success;
+}
+
+// Writes the same text as rendering one VCALENDAR holding every incidence,
+// but renders and frees the incidences one at a time, so that only a single
+// component is held in memory besides the calendar itself.
+bool ICalFormat::Private::saveStream( const Calendar::Ptr &cal, QIODevice *device,
+                                      const QString &notebook, bool deleted )
+{
+  // The VCALENDAR properties, without the END:VCALENDAR line
+  icalcomponent *calendar = mImpl->createCalendarComponent( cal );
+  char *const calendarText = icalcomponent_as_ical_string_r( calendar );
+  const QByteArray header( calendarText );
+  free( calendarText );
+  icalcomponent_free( calendar );
+  const int footer = header.lastIndexOf( "END:VCALENDAR" );
+  if ( footer < 0 || device->write( header.constData(), footer ) != footer ) {
+    return false;
+  }
+
+  ICalTimeZones *tzlist = cal->timeZones();  // time zones possibly used in the calendar
+  ICalTimeZones tzUsedList;                  // time zones actually used in the calendar
+  bool success = true;
+
+  // todos
+  Todo::List todoList = deleted ? cal->deletedTodos() : cal->rawTodos();
+  Todo::List::ConstIterator it;
+  for ( it = todoList.constBegin(); success && it != todoList.constEnd(); ++it ) {
+    if ( !deleted || !cal->todo( ( *it )->uid(), ( *it )->recurrenceId() ) ) {
+      // use existing ones, or really deleted ones
+      if ( notebook.isEmpty() ||
+           ( !cal->notebook( *it ).isEmpty() && notebook.endsWith( cal->notebook( *it ) ) ) ) {
+        success = writeComponent( device, mImpl->writeTodo( *it, tzlist, &tzUsedList ) );
+      }
+    }
+  }
+  // events
+  Event::List events = deleted ? cal->deletedEvents() : cal->rawEvents();
+  Event::List::ConstIterator it2;
+  for ( it2 = events.constBegin(); success && it2 != events.constEnd(); ++it2 ) {
+    if ( !deleted || !cal->event( ( *it2 )->uid(), ( *it2 )->recurrenceId() ) ) {
+      // use existing ones, or really deleted ones
+      if ( notebook.isEmpty() ||
+           ( !cal->notebook( *it2 ).isEmpty() && notebook.endsWith( cal->notebook( *it2 ) ) ) ) {
+        success = writeComponent( device, mImpl->writeEvent( *it2, tzlist, &tzUsedList ) );
+      }
+    }
+  }
+
+  // journals
+  Journal::List journals = deleted ? cal->deletedJournals() : cal->rawJournals();
+  Journal::List::ConstIterator it3;
+  for ( it3 = journals.constBegin(); success && it3 != journals.constEnd(); ++it3 ) {
+    if ( !deleted || !cal->journal( ( *it3 )->uid(), ( *it3 )->recurrenceId() ) ) {
+      // use existing ones, or really deleted ones
+      if ( notebook.isEmpty() ||
+           ( !cal->notebook( *it3 ).isEmpty() && notebook.endsWith( cal->notebook( *it3 ) ) ) ) {
+        success = writeComponent( device, mImpl->writeJournal( *it3, tzlist, &tzUsedList ) );
+      }
+    }
+  }
+
+  // time zones
+  ICalTimeZones::ZoneMap zones = tzUsedList.zones();
+  if ( todoList.isEmpty() && events.isEmpty() && journals.isEmpty() ) {
+    // no incidences means no used timezones, use all timezones
+    // this will export a calendar having only timezone definitions
+    zones = tzlist->zones();
+  }
+  for ( ICalTimeZones::ZoneMap::ConstIterator it = zones.constBegin();
+        success && it != zones.constEnd(); ++it ) {
+    icaltimezone *tz = ( *it ).icalTimezone();
+    if ( !tz ) {
+      kError() << "bad time zone";
+    } else {
+      success = writeComponent( device,
+                                icalcomponent_new_clone( icaltimezone_get_component( tz ) ) );
+      icaltimezone_free( tz, 1 );
+    }
+  }
+
+  icalmemory_free_ring();
+
+  const int footerSize = header.size() - footer;
+  return success &&
+         device->write( header.constData() + footer, footerSize ) == footerSize;
+}
+
 ICalFormat::ICalFormat()
   : d( new Private( this ) )
 {
@@ -86,6 +402,16 @@ bool ICalFormat::load( const Calendar::Ptr &calendar, const QString &fileName )
     setException( new Exception( Exception::LoadError ) );
     return false;
   }
+
+  if ( d->mStreamingLoad ) {
+    const bool success = d->loadStream( calendar, &file );
+    if ( d->mPopulated ) {
+      setLoadedProductId( d->mImpl->loadedProductId() );
+    }
+    file.close();
+    return success;
+  }
+
   QTextStream ts( &file );
   ts.setCodec( "UTF-8" );
   QByteArray text = ts.readAll().trimmed().toUtf8();
@@ -105,11 +431,6 @@ bool ICalFormat::save( const Calendar::Ptr &calendar, const QString &fileName )
 
   clearException();
 
-  QString text = toString( calendar );
-  if ( text.isEmpty() ) {
-    return false;
-  }
-
   // Write backup file
   KSaveFile::backupFile( fileName );
 
@@ -122,11 +443,8 @@ bool ICalFormat::save( const Calendar::Ptr &calendar, const QString &fileName )
     return false;
   }
 
-  // Convert to UTF8 and save
-  QByteArray textUtf8 = text.toUtf8();
-  file.write( textUtf8.data(), textUtf8.size() );
-
-  if ( !file.finalize() ) {
+  // Written one component at a time, already in UTF8
+  if ( !d->saveStream( calendar, &file, QString(), false ) || !file.finalize() ) {
     kDebug() << "file finalize error:" << file.errorString();
     setException( new Exception( Exception::SaveErrorSaveFile,
                                  QStringList( fileName ) ) );
@@ -226,78 +544,10 @@ Incidence::Ptr ICalFormat::fromString( const QString &string )
 QString ICalFormat::toString( const Calendar::Ptr &cal,
                               const QString &notebook, bool deleted )
 {
-  icalcomponent *calendar = d->mImpl->createCalendarComponent( cal );
-  icalcomponent *component;
-
-  ICalTimeZones *tzlist = cal->timeZones();  // time zones possibly used in the calendar
-  ICalTimeZones tzUsedList;                  // time zones actually used in the calendar
-
-  // todos
-  Todo::List todoList = deleted ? cal->deletedTodos() : cal->rawTodos();
-  Todo::List::ConstIterator it;
-  for ( it = todoList.constBegin(); it != todoList.constEnd(); ++it ) {
-    if ( !deleted || !cal->todo( ( *it )->uid(), ( *it )->recurrenceId() ) ) {
-      // use existing ones, or really deleted ones
-      if ( notebook.isEmpty() ||
-           ( !cal->notebook( *it ).isEmpty() && notebook.endsWith( cal->notebook( *it ) ) ) ) {
-        component = d->mImpl->writeTodo( *it, tzlist, &tzUsedList );
-        icalcomponent_add_component( calendar, component );
-      }
-    }
-  }
-  // events
-  Event::List events = deleted ? cal->deletedEvents() : cal->rawEvents();
-  Event::List::ConstIterator it2;
-  for ( it2 = events.constBegin(); it2 != events.constEnd(); ++it2 ) {
-    if ( !deleted || !cal->event( ( *it2 )->uid(), ( *it2 )->recurrenceId() ) ) {
-      // use existing ones, or really deleted ones
-      if ( notebook.isEmpty() ||
-           ( !cal->notebook( *it2 ).isEmpty() && notebook.endsWith( cal->notebook( *it2 ) ) ) ) {
-        component = d->mImpl->writeEvent( *it2, tzlist, &tzUsedList );
-        icalcomponent_add_component( calendar, component );
-      }
-    }
-  }
-
-  // journals
-  Journal::List journals = deleted ? cal->deletedJournals() : cal->rawJournals();
-  Journal::List::ConstIterator it3;
-  for ( it3 = journals.constBegin(); it3 != journals.constEnd(); ++it3 ) {
-    if ( !deleted || !cal->journal( ( *it3 )->uid(), ( *it3 )->recurrenceId() ) ) {
-      // use existing ones, or really deleted ones
-      if ( notebook.isEmpty() ||
-           ( !cal->notebook( *it3 ).isEmpty() && notebook.endsWith( cal->notebook( *it3 ) ) ) ) {
-        component = d->mImpl->writeJournal( *it3, tzlist, &tzUsedList );
-        icalcomponent_add_component( calendar, component );
-      }
-    }
-  }
-
-  // time zones
-  ICalTimeZones::ZoneMap zones = tzUsedList.zones();
-  if ( todoList.isEmpty() && events.isEmpty() && journals.isEmpty() ) {
-    // no incidences means no used timezones, use all timezones
-    // this will export a calendar having only timezone definitions
-    zones = tzlist->zones();
-  }
-  for ( ICalTimeZones::ZoneMap::ConstIterator it = zones.constBegin();
-        it != zones.constEnd(); ++it ) {
-    icaltimezone *tz = ( *it ).icalTimezone();
-    if ( !tz ) {
-      kError() << "bad time zone";
-    } else {
-      component = icalcomponent_new_clone( icaltimezone_get_component( tz ) );
-      icalcomponent_add_component( calendar, component );
-      icaltimezone_free( tz, 1 );
-    }
-  }
-
-  char *const componentString = icalcomponent_as_ical_string_r( calendar );
-  const QString &text = QString::fromUtf8( componentString );
-  free( componentString );
-
-  icalcomponent_free( calendar );
-  icalmemory_free_ring();
+  QBuffer buffer;
+  buffer.open( QIODevice::WriteOnly );
+  d->saveStream( cal, &buffer, notebook, deleted );
+  const QString &text = QString::fromUtf8( buffer.data() );
 
   if ( text.isEmpty() ) {
     setException( new Exception( Exception::LibICalError ) );
@@ -306,6 +556,19 @@ QString ICalFormat::toString( const Calendar::Ptr &cal,
   return text;
 }
 
+bool ICalFormat::save( const Calendar::Ptr &calendar, QIODevice *device,
+                       const QString &notebook, bool deleted )
+{
+  clearException();
+
+  if ( !d->saveStream( calendar, device, notebook, deleted ) ) {
+    kDebug() << "write error:" << device->errorString();
+    setException( new Exception( Exception::SaveErrorSaveFile ) );
+    return false;
+  }
+  return true;
+}
+
 QString ICalFormat::toICalString( const Incidence::Ptr &incidence )
 {
   MemoryCalendar::Ptr cal( new MemoryCalendar( d->mTimeSpec ) );
@@ -640,6 +903,26 @@ KDateTime::Spec ICalFormat::timeSpec() const
   return d->mTimeSpec;
 }
 
+void ICalFormat::setStreamingLoad( bool streaming )
+{
+  d->mStreamingLoad = streaming;
+}
+
+bool ICalFormat::streamingLoad() const
+{
+  return d->mStreamingLoad;
+}
+
+void ICalFormat::setLoadThreadCount( int count )
+{
+  d->mImpl->setThreadCount( count );
+}
+
+int ICalFormat::loadThreadCount() const
+{
+  return d->mImpl->threadCount();
+}
+
 QString ICalFormat::timeZoneId() const
 {
   KTimeZone tz = d->mTimeSpec.timeZone();
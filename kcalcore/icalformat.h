@@ -36,6 +36,8 @@
 
 #include <KDateTime>
 
+class QIODevice;
+
 namespace KCalCore {
 
 class FreeBusy;
@@ -80,6 +82,23 @@ class KCALCORE_EXPORT ICalFormat : public CalFormat
     */
     bool save( const Calendar::Ptr &calendar, const QString &fileName );
 
+    /**
+      Writes a calendar to a device as UTF-8 encoded iCalendar text.
+
+      The text is the same as that of toString(), but each incidence is
+      converted, written and freed in turn, followed by the VTIMEZONE
+      components of the time zones used, so that the calendar is never
+      held in memory as a whole. save() to a file works this way too.
+
+      @param calendar is the calendar to write.
+      @param device is an open, writable device.
+      @param notebook if not empty, only incidences of this notebook are written.
+      @param deleted if true, the deleted incidences are written instead.
+      @return true if successful; false otherwise.
+    */
+    bool save( const Calendar::Ptr &calendar, QIODevice *device,
+               const QString &notebook = QString(), bool deleted = false );
+
     /**
       @copydoc
       CalFormat::fromString()
@@ -206,6 +225,45 @@ class KCALCORE_EXPORT ICalFormat : public CalFormat
     */
     KDateTime::Spec timeSpec() const;
 
+    /**
+      Sets whether load() parses the file one component at a time.
+
+      In streaming mode the file is read line by line and each top level
+      VTIMEZONE, VEVENT, VTODO or VJOURNAL is parsed, converted and freed
+      before the next one is read, so memory use depends on the largest
+      component rather than on the size of the file. VTIMEZONE components
+      must appear before the incidences which refer to them.
+
+      @param streaming true to enable streaming loads.
+      @see streamingLoad().
+    */
+    void setStreamingLoad( bool streaming );
+
+    /**
+      Returns true if load() parses files one component at a time.
+      @see setStreamingLoad().
+    */
+    bool streamingLoad() const;
+
+    /**
+      Sets the number of threads used to convert the components of a
+      calendar when loading or parsing it in one piece. Conversion of large
+      calendars is spread over a pool of worker threads, while insertion
+      into the calendar and the handling of duplicate UIDs stay on the
+      calling thread, in document order. Streaming loads are not affected.
+
+      @param count the number of threads; 1, the default, converts on the
+      calling thread and 0 uses one thread per processor core.
+      @see loadThreadCount().
+    */
+    void setLoadThreadCount( int count );
+
+    /**
+      Returns the number of threads used to convert loaded components.
+      @see setLoadThreadCount().
+    */
+    int loadThreadCount() const;
+
     /**
       Returns the timezone id string used by the iCalendar; an empty string
       if the iCalendar does not have a timezone.
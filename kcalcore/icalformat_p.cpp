@@ -41,6 +41,7 @@
 #include "freebusy.h"
 #include "icalformat.h"
 #include "icaltimezones.h"
+#include "incidence_p.h"
 #include "incidencebase.h"
 #include "journal.h"
 #include "memorycalendar.h"
@@ -49,11 +50,24 @@
 
 #include <KCodecs>
 #include <KDebug>
+#include <kglobal.h>
 
+#include <QtCore/QAtomicInt>
 #include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QPair>
+#include <QtCore/QRunnable>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QVector>
 
 using namespace KCalCore;
 
+// Serializes system and libical time zone lookups, which are not thread safe.
+K_GLOBAL_STATIC_WITH_ARGS( QMutex, sStandardZoneLock, ( QMutex::NonRecursive ) )
+
 static const char APP_NAME_FOR_XPROPERTIES[] = "KCALCORE";
 static const char ENABLED_ALARM_XPROPERTY[] = "ENABLED";
 static const char IMPLEMENTATION_VERSION_XPROPERTY[] = "X-KDE-ICAL-IMPLEMENTATION-VERSION";
@@ -150,8 +164,10 @@ class ICalFormatImpl::Private
 {
   public:
     Private( ICalFormatImpl *impl, ICalFormat *parent )
-      : mImpl( impl ), mParent( parent ), mCompat( new Compat ) {}
+      : mImpl( impl ), mParent( parent ), mCompat( new Compat ), mThreadCount( 1 ) {}
     ~Private()  { delete mCompat; }
+    bool populateParallel( const Calendar::Ptr &calendar, icalcomponent *vcalendar,
+                           bool deleted );
     void writeIncidenceBase( icalcomponent *parent, IncidenceBase::Ptr );
     void readIncidenceBase( icalcomponent *parent, IncidenceBase::Ptr );
     void writeCustomProperties( icalcomponent *parent, CustomProperties * );
@@ -163,7 +179,166 @@ class ICalFormatImpl::Private
     Event::List mEventsRelate;        // events with relations
     Todo::List  mTodosRelate;         // todos with relations
     Compat *mCompat;
+    QMutex mRelateLock;               // guards the relation lists in parallel loads
+    int mThreadCount;                 // number of threads used by populate()
+};
+
+/**
+  The time specs a PopulateJob may use. KDateTime::Spec( zone ) copies
+  KTimeZone::utc() and KDateTime::LocalZone copies KSystemTimeZones::local(),
+  and those zones are shared by every thread while loading their data
+  lazily without any locking. A worker therefore only uses specs built on
+  the calling thread, or under sStandardZoneLock, from its own copies of
+  the zones.
+  Components which need the local zone are left to the calling thread.
+*/
+struct PopulateSpecs
+{
+  PopulateSpecs() : deferred( false ) {}
+
+  QHash<QString, KDateTime::Spec> zones;   // by TZID
+  bool deferred;    // the current component must be converted on the calling thread
 };
+
+// The specs of the PopulateJob running on the current thread, if any
+static QThreadStorage<PopulateSpecs*> sPopulateSpecs;
+
+/**
+  Converts a share of the components of a VCALENDAR on a worker thread.
+  Each job has its own copy of the calendar's time zones, since time zones
+  must not be shared between threads; the components are claimed one at a
+  time through a shared counter so the jobs finish at about the same time.
+*/
+class PopulateJob : public QRunnable
+{
+  public:
+    PopulateJob( ICalFormatImpl *impl, const QVector<icalcomponent*> &components,
+                 QVector<Incidence::Ptr> &incidences, QAtomicInt &next )
+      : mImpl( impl ), mComponents( components ), mIncidences( incidences ), mNext( next )
+    {
+      setAutoDelete( false );
+    }
+
+    void run()
+    {
+      // Owned by the thread storage, and deleted on this thread at the end
+      PopulateSpecs *specs = new PopulateSpecs( mSpecs );
+      sPopulateSpecs.setLocalData( specs );
+      const int count = mComponents.count();
+      for ( int i = mNext.fetchAndAddRelaxed( 1 ); i < count;
+            i = mNext.fetchAndAddRelaxed( 1 ) ) {
+        specs->deferred = false;
+        const Incidence::Ptr incidence = mImpl->readComponent( mComponents[i], &mTimeZones );
+        if ( specs->deferred ) {
+          mDeferred.append( qMakePair( i, incidence ) );
+        } else {
+          mIncidences[i] = incidence;
+        }
+      }
+      sPopulateSpecs.setLocalData( 0 );
+    }
+
+    ICalTimeZones mTimeZones;
+    PopulateSpecs mSpecs;     // built from mTimeZones on the calling thread
+    // Components left to the calling thread, with what was read of them
+    QList<QPair<int, Incidence::Ptr> > mDeferred;
+
+  private:
+    ICalFormatImpl *mImpl;
+    const QVector<icalcomponent*> &mComponents;
+    QVector<Incidence::Ptr> &mIncidences;
+    QAtomicInt &mNext;
+};
+
+bool ICalFormatImpl::Private::populateParallel( const Calendar::Ptr &cal,
+                                                icalcomponent *calendar, bool deleted )
+{
+  static const int MinComponentsPerThread = 32;
+
+  // Collect the components up front: iterating an icalcomponent is not
+  // thread safe, reading the properties of distinct components is.
+  QVector<icalcomponent*> components;
+  const icalcomponent_kind kinds[] = {
+    ICAL_VTODO_COMPONENT, ICAL_VEVENT_COMPONENT, ICAL_VJOURNAL_COMPONENT
+  };
+  for ( int k = 0; k < 3; ++k ) {
+    for ( icalcomponent *c = icalcomponent_get_first_component( calendar, kinds[k] );
+          c; c = icalcomponent_get_next_component( calendar, kinds[k] ) ) {
+      components.append( c );
+    }
+  }
+
+  const int threads = qMin( mThreadCount, components.count() / MinComponentsPerThread );
+  if ( threads < 2 ) {
+    return false;
+  }
+
+  // Make sure libical's and KDE's lazily created UTC zones exist before the
+  // workers look at them.
+  icaltimezone_get_utc_timezone();
+  KTimeZone::utc();
+
+  QVector<Incidence::Ptr> incidences( components.count() );
+  QAtomicInt next( 0 );
+  QList<PopulateJob*> jobs;
+  QThreadPool pool;
+  pool.setMaxThreadCount( threads );
+  for ( int i = 0; i < threads; ++i ) {
+    PopulateJob *job = new PopulateJob( mImpl, components, incidences, next );
+    ICalTimeZoneSource tzs;
+    tzs.parse( calendar, job->mTimeZones );
+    const ICalTimeZones::ZoneMap zones = job->mTimeZones.zones();
+    for ( ICalTimeZones::ZoneMap::ConstIterator it = zones.constBegin();
+          it != zones.constEnd(); ++it ) {
+      job->mSpecs.zones.insert( it.key(), KDateTime::Spec( it.value() ) );
+    }
+    jobs.append( job );
+    pool.start( job );
+  }
+  pool.waitForDone();
+
+  // Convert the components which need the local time zone here, where it
+  // can be used. What the workers read of them is dropped, including their
+  // entries in the relation lists.
+  foreach ( PopulateJob *job, jobs ) {
+    for ( int i = 0; i < job->mDeferred.count(); ++i ) {
+      const Incidence::Ptr &stale = job->mDeferred[i].second;
+      if ( stale ) {
+        const int e = mEventsRelate.indexOf( stale.dynamicCast<Event>() );
+        if ( e >= 0 ) {
+          mEventsRelate.remove( e );
+        }
+        const int t = mTodosRelate.indexOf( stale.dynamicCast<Todo>() );
+        if ( t >= 0 ) {
+          mTodosRelate.remove( t );
+        }
+      }
+      const int index = job->mDeferred[i].first;
+      incidences[index] = mImpl->readComponent( components[index], cal->timeZones() );
+    }
+  }
+
+  // Keep the zones which were looked up in the system database while reading.
+  ICalTimeZones *tzlist = cal->timeZones();
+  foreach ( PopulateJob *job, jobs ) {
+    const ICalTimeZones::ZoneMap zones = job->mTimeZones.zones();
+    for ( ICalTimeZones::ZoneMap::ConstIterator it = zones.constBegin();
+          it != zones.constEnd(); ++it ) {
+      if ( !tzlist->zone( it.key() ).isValid() ) {
+        tzlist->add( it.value() );
+      }
+    }
+  }
+  qDeleteAll( jobs );
+
+  // Insert in document order, exactly as the serial loop would.
+  foreach ( const Incidence::Ptr &incidence, incidences ) {
+    if ( incidence ) {
+      mImpl->mergeIncidence( cal, incidence, deleted );
+    }
+  }
+  return true;
+}
 //@endcond
 
 inline icaltimetype ICalFormatImpl::writeICalUtcDateTime ( const KDateTime &dt )
@@ -560,58 +735,62 @@ void ICalFormatImpl::writeIncidence( icalcomponent *parent,
         ICAL_RECURRENCEID_PROPERTY, incidence->recurrenceId(), tzlist, tzUsedList ) );
   }
 
-  RecurrenceRule::List rrules( incidence->recurrence()->rRules() );
-  RecurrenceRule::List::ConstIterator rit;
-  for ( rit = rrules.constBegin(); rit != rrules.constEnd(); ++rit ) {
-    icalcomponent_add_property(
-      parent, icalproperty_new_rrule( writeRecurrenceRule( ( *rit ) ) ) );
-  }
+  // the recurrence is only read, so copies of the incidence keep sharing it
+  const Recurrence *recurrence = IncidenceInternals::recurrence( *incidence );
+  if ( recurrence ) {
+    RecurrenceRule::List rrules( recurrence->rRules() );
+    RecurrenceRule::List::ConstIterator rit;
+    for ( rit = rrules.constBegin(); rit != rrules.constEnd(); ++rit ) {
+      icalcomponent_add_property(
+        parent, icalproperty_new_rrule( writeRecurrenceRule( ( *rit ) ) ) );
+    }
 
-  RecurrenceRule::List exrules( incidence->recurrence()->exRules() );
-  RecurrenceRule::List::ConstIterator exit;
-  for ( exit = exrules.constBegin(); exit != exrules.constEnd(); ++exit ) {
-    icalcomponent_add_property(
-      parent, icalproperty_new_exrule( writeRecurrenceRule( ( *exit ) ) ) );
-  }
+    RecurrenceRule::List exrules( recurrence->exRules() );
+    RecurrenceRule::List::ConstIterator exit;
+    for ( exit = exrules.constBegin(); exit != exrules.constEnd(); ++exit ) {
+      icalcomponent_add_property(
+        parent, icalproperty_new_exrule( writeRecurrenceRule( ( *exit ) ) ) );
+    }
 
-  DateList dateList = incidence->recurrence()->exDates();
-  DateList::ConstIterator exIt;
-  for ( exIt = dateList.constBegin(); exIt != dateList.constEnd(); ++exIt ) {
-    icalcomponent_add_property(
-      parent, icalproperty_new_exdate( writeICalDate( *exIt ) ) );
-  }
+    DateList dateList = recurrence->exDates();
+    DateList::ConstIterator exIt;
+    for ( exIt = dateList.constBegin(); exIt != dateList.constEnd(); ++exIt ) {
+      icalcomponent_add_property(
+        parent, icalproperty_new_exdate( writeICalDate( *exIt ) ) );
+    }
 
-  DateTimeList dateTimeList = incidence->recurrence()->exDateTimes();
-  DateTimeList::ConstIterator extIt;
-  for ( extIt = dateTimeList.constBegin(); extIt != dateTimeList.constEnd(); ++extIt ) {
-    icalcomponent_add_property(
-      parent, writeICalDateTimeProperty( ICAL_EXDATE_PROPERTY, *extIt, tzlist, tzUsedList ) );
-  }
+    DateTimeList dateTimeList = recurrence->exDateTimes();
+    DateTimeList::ConstIterator extIt;
+    for ( extIt = dateTimeList.constBegin(); extIt != dateTimeList.constEnd(); ++extIt ) {
+      icalcomponent_add_property(
+        parent, writeICalDateTimeProperty( ICAL_EXDATE_PROPERTY, *extIt, tzlist, tzUsedList ) );
+    }
 
-  dateList = incidence->recurrence()->rDates();
-  DateList::ConstIterator rdIt;
-  for ( rdIt = dateList.constBegin(); rdIt != dateList.constEnd(); ++rdIt ) {
-    icalcomponent_add_property(
-      parent, icalproperty_new_rdate( writeICalDatePeriod( *rdIt ) ) );
-  }
-  dateTimeList = incidence->recurrence()->rDateTimes();
-  DateTimeList::ConstIterator rdtIt;
-  for ( rdtIt = dateTimeList.constBegin(); rdtIt != dateTimeList.constEnd(); ++rdtIt ) {
-    icalcomponent_add_property(
-      parent, writeICalDateTimeProperty( ICAL_RDATE_PROPERTY, *rdtIt, tzlist, tzUsedList ) );
+    dateList = recurrence->rDates();
+    DateList::ConstIterator rdIt;
+    for ( rdIt = dateList.constBegin(); rdIt != dateList.constEnd(); ++rdIt ) {
+      icalcomponent_add_property(
+        parent, icalproperty_new_rdate( writeICalDatePeriod( *rdIt ) ) );
+    }
+    dateTimeList = recurrence->rDateTimes();
+    DateTimeList::ConstIterator rdtIt;
+    for ( rdtIt = dateTimeList.constBegin(); rdtIt != dateTimeList.constEnd(); ++rdtIt ) {
+      icalcomponent_add_property(
+        parent, writeICalDateTimeProperty( ICAL_RDATE_PROPERTY, *rdtIt, tzlist, tzUsedList ) );
+    }
   }
 
   // attachments
-  Attachment::List attachments = incidence->attachments();
+  const Attachment::List &attachments = IncidenceInternals::attachments( *incidence );
   Attachment::List::ConstIterator atIt;
   for ( atIt = attachments.constBegin(); atIt != attachments.constEnd(); ++atIt ) {
     icalcomponent_add_property( parent, writeAttachment( *atIt ) );
   }
 
   // alarms
+  const Alarm::List &alarms = IncidenceInternals::alarms( *incidence );
   Alarm::List::ConstIterator alarmIt;
-  for ( alarmIt = incidence->alarms().constBegin();
-        alarmIt != incidence->alarms().constEnd(); ++alarmIt ) {
+  for ( alarmIt = alarms.constBegin(); alarmIt != alarms.constEnd(); ++alarmIt ) {
     icalcomponent_add_component( parent, writeAlarm( *alarmIt ) );
   }
 
@@ -640,9 +819,9 @@ void ICalFormatImpl::Private::writeIncidenceBase( icalcomponent *parent,
 
   // attendees
   if ( incidenceBase->attendeeCount() > 0 ) {
+    const Attendee::List &attendees = IncidenceInternals::attendees( *incidenceBase );
     Attendee::List::ConstIterator it;
-    for ( it = incidenceBase->attendees().constBegin();
-          it != incidenceBase->attendees().constEnd(); ++it ) {
+    for ( it = attendees.constBegin(); it != attendees.constEnd(); ++it ) {
       icalproperty *p = mImpl->writeAttendee( *it );
       if ( p ) {
         icalcomponent_add_property( parent, p );
@@ -1141,7 +1320,10 @@ Todo::Ptr ICalFormatImpl::readTodo( icalcomponent *vtodo, ICalTimeZones *tzlist
 
     case ICAL_RELATEDTO_PROPERTY:  // related todo (parent)
       todo->setRelatedTo( QString::fromUtf8( icalproperty_get_relatedto( p ) ) );
-      d->mTodosRelate.append( todo );
+      {
+        QMutexLocker lock( &d->mRelateLock );
+        d->mTodosRelate.append( todo );
+      }
       break;
 
     case ICAL_DTSTART_PROPERTY:
@@ -1174,6 +1356,9 @@ Todo::Ptr ICalFormatImpl::readTodo( icalcomponent *vtodo, ICalTimeZones *tzlist
     d->mCompat->fixEmptySummary( todo );
   }
 
+  // the recurrence and alarms were only handed out to fill them in
+  IncidenceInternals::forgetHandedOut( *todo );
+
   return todo;
 }
 
@@ -1212,7 +1397,10 @@ Event::Ptr ICalFormatImpl::readEvent( icalcomponent *vevent, ICalTimeZones *tzli
     }
     case ICAL_RELATEDTO_PROPERTY:  // related event (parent)
       event->setRelatedTo( QString::fromUtf8( icalproperty_get_relatedto( p ) ) );
-      d->mEventsRelate.append( event );
+      {
+        QMutexLocker lock( &d->mRelateLock );
+        d->mEventsRelate.append( event );
+      }
       break;
 
     case ICAL_TRANSP_PROPERTY:  // Transparency
@@ -1251,6 +1439,9 @@ Event::Ptr ICalFormatImpl::readEvent( icalcomponent *vevent, ICalTimeZones *tzli
     d->mCompat->fixEmptySummary( event );
   }
 
+  // the recurrence and alarms were only handed out to fill them in
+  IncidenceInternals::forgetHandedOut( *event );
+
   return event;
 }
 
@@ -1322,6 +1513,9 @@ Journal::Ptr ICalFormatImpl::readJournal( icalcomponent *vjournal,
   Journal::Ptr journal( new Journal );
   readIncidence( vjournal, journal, tzlist );
 
+  // the recurrence and alarms were only handed out to fill them in
+  IncidenceInternals::forgetHandedOut( *journal );
+
   return journal;
 }
 
@@ -2344,6 +2538,9 @@ KDateTime ICalFormatImpl::readICalDateTime( icalproperty *p,
 //  kDebug();
 //  _dumpIcaltime( t );
 
+  // Set while a PopulateJob runs on this thread
+  PopulateSpecs *specs = sPopulateSpecs.hasLocalData() ? sPopulateSpecs.localData() : 0;
+
   KDateTime::Spec timeSpec;
   if ( t.is_utc  ||  t.zone == icaltimezone_get_utc_timezone() ) {
     timeSpec = KDateTime::UTC;   // the time zone is UTC
@@ -2357,6 +2554,33 @@ KDateTime ICalFormatImpl::readICalDateTime( icalproperty *p,
     const char *tzid = param ? icalparameter_get_tzid( param ) : 0;
     if ( !tzid ) {
       timeSpec = KDateTime::ClockTime;
+      if ( specs && utc && !t.is_date ) {
+        // Converting a floating time to UTC uses the local time zone
+        specs->deferred = true;
+      }
+    } else if ( specs ) {
+      const QString tzidStr = QString::fromUtf8( tzid );
+      QHash<QString, KDateTime::Spec>::const_iterator it = specs->zones.constFind( tzidStr );
+      if ( it != specs->zones.constEnd() ) {
+        timeSpec = it.value();
+      } else {
+        // Building a spec from a zone copies KTimeZone::utc(), so it is
+        // done under the same lock as the lookup.
+        QMutexLocker lock( sStandardZoneLock );
+        ICalTimeZoneSource tzsource;
+        const ICalTimeZone newtz = tzsource.standardZone( tzidStr );
+        if ( newtz.isValid() ) {
+          if ( tzlist ) {
+            tzlist->add( newtz );
+          }
+          timeSpec = KDateTime::Spec( newtz );
+          specs->zones.insert( tzidStr, timeSpec );
+        } else {
+          // Unknown zones fall back to the local time zone
+          specs->deferred = true;
+          timeSpec = KDateTime::ClockTime;
+        }
+      }
     } else {
       QString tzidStr = QString::fromUtf8( tzid );
       ICalTimeZone tz;
@@ -2366,6 +2590,7 @@ KDateTime ICalFormatImpl::readICalDateTime( icalproperty *p,
       if ( !tz.isValid() ) {
         // The time zone is not in the existing list for the calendar.
         // Try to read it from the system or libical databases.
+        QMutexLocker lock( sStandardZoneLock );
         ICalTimeZoneSource tzsource;
         ICalTimeZone newtz = tzsource.standardZone( tzidStr );
         if ( newtz.isValid() && tzlist ) {
@@ -2586,6 +2811,54 @@ bool ICalFormatImpl::populate( const Calendar::Ptr &cal, icalcomponent *calendar
   // this function will populate the caldict dictionary and other event
   // lists. It turns vevents into Events and then inserts them.
 
+  if ( !populateHeader( cal, calendar ) ) {
+    return false;
+  }
+
+  // Populate the calendar's time zone collection with all VTIMEZONE components
+  ICalTimeZones *tzlist = cal->timeZones();
+  if ( ICalTimeZoneRegistry::isEnabled() ) {
+    ICalTimeZoneRegistry::parse( calendar, *tzlist );
+  } else {
+    ICalTimeZoneSource tzs;
+    tzs.parse( calendar, *tzlist );
+  }
+
+  // TODO: make sure that only actually added events go to the relation lists.
+
+  if ( d->mThreadCount > 1 && d->populateParallel( cal, calendar, deleted ) ) {
+    return true;
+  }
+
+  icalcomponent *c;
+
+  c = icalcomponent_get_first_component( calendar, ICAL_VTODO_COMPONENT );
+  while ( c ) {
+    populateComponent( cal, c, deleted );
+    c = icalcomponent_get_next_component( calendar, ICAL_VTODO_COMPONENT );
+  }
+
+  // Iterate through all events
+  c = icalcomponent_get_first_component( calendar, ICAL_VEVENT_COMPONENT );
+  while ( c ) {
+    populateComponent( cal, c, deleted );
+    c = icalcomponent_get_next_component( calendar, ICAL_VEVENT_COMPONENT );
+  }
+
+  // Iterate through all journals
+  c = icalcomponent_get_first_component( calendar, ICAL_VJOURNAL_COMPONENT );
+  while ( c ) {
+    populateComponent( cal, c, deleted );
+    c = icalcomponent_get_next_component( calendar, ICAL_VJOURNAL_COMPONENT );
+  }
+
+  // TODO: Remove any previous time zones no longer referenced in the calendar
+
+  return true;
+}
+
+bool ICalFormatImpl::populateHeader( const Calendar::Ptr &cal, icalcomponent *calendar )
+{
   if ( !calendar ) {
     kWarning() << "Populate called with empty calendar";
     return false;
@@ -2651,127 +2924,158 @@ bool ICalFormatImpl::populate( const Calendar::Ptr &cal, icalcomponent *calendar
     }
   }
 
-  // Populate the calendar's time zone collection with all VTIMEZONE components
-  ICalTimeZones *tzlist = cal->timeZones();
-  ICalTimeZoneSource tzs;
-  tzs.parse( calendar, *tzlist );
-
   // custom properties
   d->readCustomProperties( calendar, cal.data() );
 
   // Store all events with a relatedTo property in a list for post-processing
   d->mEventsRelate.clear();
   d->mTodosRelate.clear();
-  // TODO: make sure that only actually added events go to this lists.
 
-  icalcomponent *c;
+  return true;
+}
 
-  c = icalcomponent_get_first_component( calendar, ICAL_VTODO_COMPONENT );
-  while ( c ) {
-    Todo::Ptr todo = readTodo( c, tzlist );
-    if ( todo ) {
-      // kDebug() << "todo is not zero and deleted is " << deleted;
-      Todo::Ptr old = cal->todo( todo->uid(), todo->recurrenceId() );
-      if ( old ) {
-        if ( old->uid().isEmpty() ) {
-          kWarning() << "Skipping invalid VTODO";
-          c = icalcomponent_get_next_component( calendar, ICAL_VTODO_COMPONENT );
-          continue;
-        }
-        // kDebug() << "Found an old todo with uid " << old->uid();
-        if ( deleted ) {
-          // kDebug() << "Todo " << todo->uid() << " already deleted";
-          cal->deleteTodo( old ); // move old to deleted
-          removeAllICal( d->mTodosRelate, old );
-        } else if ( todo->revision() > old->revision() ) {
-          // kDebug() << "Replacing old todo " << old.data() << " with this one " << todo.data();
-          cal->deleteTodo( old ); // move old to deleted
-          removeAllICal( d->mTodosRelate, old );
-          cal->addTodo( todo ); // and replace it with this one
-        }
-      } else if ( deleted ) {
+void ICalFormatImpl::populateComponent( const Calendar::Ptr &cal, icalcomponent *c,
+                                        bool deleted )
+{
+  ICalTimeZones *tzlist = cal->timeZones();
+
+  if ( icalcomponent_isa( c ) == ICAL_VTIMEZONE_COMPONENT ) {
+    if ( ICalTimeZoneRegistry::isEnabled() ) {
+      ICalTimeZoneRegistry::add( ICalTimeZoneRegistry::zone( c ), *tzlist );
+      return;
+    }
+    ICalTimeZoneSource tzs;
+    ICalTimeZoneRegistry::add( tzs.parse( c ), *tzlist );
+    return;
+  }
+
+  const Incidence::Ptr incidence = readComponent( c, tzlist );
+  if ( incidence ) {
+    mergeIncidence( cal, incidence, deleted );
+  }
+}
+
+Incidence::Ptr ICalFormatImpl::readComponent( icalcomponent *c, ICalTimeZones *tzlist )
+{
+  switch ( icalcomponent_isa( c ) ) {
+  case ICAL_VTODO_COMPONENT:
+    return readTodo( c, tzlist );
+  case ICAL_VEVENT_COMPONENT:
+    return readEvent( c, tzlist );
+  case ICAL_VJOURNAL_COMPONENT:
+    return readJournal( c, tzlist );
+  default:
+    return Incidence::Ptr();
+  }
+}
+
+void ICalFormatImpl::mergeIncidence( const Calendar::Ptr &cal, const Incidence::Ptr &incidence,
+                                     bool deleted )
+{
+  switch ( incidence->type() ) {
+  case IncidenceBase::TypeTodo:
+  {
+    Todo::Ptr todo = incidence.staticCast<Todo>();
+    // kDebug() << "todo is not zero and deleted is " << deleted;
+    Todo::Ptr old = cal->todo( todo->uid(), todo->recurrenceId() );
+    if ( old ) {
+      if ( old->uid().isEmpty() ) {
+        kWarning() << "Skipping invalid VTODO";
+        break;
+      }
+      // kDebug() << "Found an old todo with uid " << old->uid();
+      if ( deleted ) {
         // kDebug() << "Todo " << todo->uid() << " already deleted";
-        old = cal->deletedTodo( todo->uid(), todo->recurrenceId() );
-        if ( !old ) {
-          cal->addTodo( todo ); // add this one
-          cal->deleteTodo( todo ); // and move it to deleted
-        }
-      } else {
-        // kDebug() << "Adding todo " << todo.data() << todo->uid();
-        cal->addTodo( todo ); // just add this one
+        cal->deleteTodo( old ); // move old to deleted
+        removeAllICal( d->mTodosRelate, old );
+      } else if ( todo->revision() > old->revision() ) {
+        // kDebug() << "Replacing old todo " << old.data() << " with this one " << todo.data();
+        cal->deleteTodo( old ); // move old to deleted
+        removeAllICal( d->mTodosRelate, old );
+        cal->addTodo( todo ); // and replace it with this one
+      }
+    } else if ( deleted ) {
+      // kDebug() << "Todo " << todo->uid() << " already deleted";
+      old = cal->deletedTodo( todo->uid(), todo->recurrenceId() );
+      if ( !old ) {
+        cal->addTodo( todo ); // add this one
+        cal->deleteTodo( todo ); // and move it to deleted
       }
+    } else {
+      // kDebug() << "Adding todo " << todo.data() << todo->uid();
+      cal->addTodo( todo ); // just add this one
     }
-    c = icalcomponent_get_next_component( calendar, ICAL_VTODO_COMPONENT );
+    break;
   }
-
-  // Iterate through all events
-  c = icalcomponent_get_first_component( calendar, ICAL_VEVENT_COMPONENT );
-  while ( c ) {
-    Event::Ptr event = readEvent( c, tzlist );
-    if ( event ) {
-      // kDebug() << "event is not zero and deleted is " << deleted;
-      Event::Ptr old = cal->event( event->uid(), event->recurrenceId() );
-      if ( old ) {
-        if ( old->uid().isEmpty() ) {
-          kWarning() << "Skipping invalid VEVENT";
-          c = icalcomponent_get_next_component( calendar, ICAL_VEVENT_COMPONENT );
-          continue;
-        }
-        // kDebug() << "Found an old event with uid " << old->uid();
-        if ( deleted ) {
-          // kDebug() << "Event " << event->uid() << " already deleted";
-          cal->deleteEvent( old ); // move old to deleted
-          removeAllICal( d->mEventsRelate, old );
-        } else if ( event->revision() > old->revision() ) {
-          // kDebug() << "Replacing old event " << old.data() << " with this one " << event.data();
-          cal->deleteEvent( old ); // move old to deleted
-          removeAllICal( d->mEventsRelate, old );
-          cal->addEvent( event ); // and replace it with this one
-        }
-      } else if ( deleted ) {
+  case IncidenceBase::TypeEvent:
+  {
+    Event::Ptr event = incidence.staticCast<Event>();
+    // kDebug() << "event is not zero and deleted is " << deleted;
+    Event::Ptr old = cal->event( event->uid(), event->recurrenceId() );
+    if ( old ) {
+      if ( old->uid().isEmpty() ) {
+        kWarning() << "Skipping invalid VEVENT";
+        break;
+      }
+      // kDebug() << "Found an old event with uid " << old->uid();
+      if ( deleted ) {
         // kDebug() << "Event " << event->uid() << " already deleted";
-        old = cal->deletedEvent( event->uid(), event->recurrenceId() );
-        if ( !old ) {
-          cal->addEvent( event ); // add this one
-          cal->deleteEvent( event ); // and move it to deleted
-        }
-      } else {
-        // kDebug() << "Adding event " << event.data() << event->uid();
-        cal->addEvent( event ); // just add this one
+        cal->deleteEvent( old ); // move old to deleted
+        removeAllICal( d->mEventsRelate, old );
+      } else if ( event->revision() > old->revision() ) {
+        // kDebug() << "Replacing old event " << old.data() << " with this one " << event.data();
+        cal->deleteEvent( old ); // move old to deleted
+        removeAllICal( d->mEventsRelate, old );
+        cal->addEvent( event ); // and replace it with this one
+      }
+    } else if ( deleted ) {
+      // kDebug() << "Event " << event->uid() << " already deleted";
+      old = cal->deletedEvent( event->uid(), event->recurrenceId() );
+      if ( !old ) {
+        cal->addEvent( event ); // add this one
+        cal->deleteEvent( event ); // and move it to deleted
       }
+    } else {
+      // kDebug() << "Adding event " << event.data() << event->uid();
+      cal->addEvent( event ); // just add this one
     }
-    c = icalcomponent_get_next_component( calendar, ICAL_VEVENT_COMPONENT );
+    break;
   }
-
-  // Iterate through all journals
-  c = icalcomponent_get_first_component( calendar, ICAL_VJOURNAL_COMPONENT );
-  while ( c ) {
-    Journal::Ptr journal = readJournal( c, tzlist );
-    if ( journal ) {
-      Journal::Ptr old = cal->journal( journal->uid(), journal->recurrenceId() );
-      if ( old ) {
-        if ( deleted ) {
-          cal->deleteJournal( old ); // move old to deleted
-        } else if ( journal->revision() > old->revision() ) {
-          cal->deleteJournal( old ); // move old to deleted
-          cal->addJournal( journal ); // and replace it with this one
-        }
-      } else if ( deleted ) {
-        old = cal->deletedJournal( journal->uid(), journal->recurrenceId() );
-        if ( !old ) {
-          cal->addJournal( journal ); // add this one
-          cal->deleteJournal( journal ); // and move it to deleted
-        }
-      } else {
-        cal->addJournal( journal ); // just add this one
+  case IncidenceBase::TypeJournal:
+  {
+    Journal::Ptr journal = incidence.staticCast<Journal>();
+    Journal::Ptr old = cal->journal( journal->uid(), journal->recurrenceId() );
+    if ( old ) {
+      if ( deleted ) {
+        cal->deleteJournal( old ); // move old to deleted
+      } else if ( journal->revision() > old->revision() ) {
+        cal->deleteJournal( old ); // move old to deleted
+        cal->addJournal( journal ); // and replace it with this one
+      }
+    } else if ( deleted ) {
+      old = cal->deletedJournal( journal->uid(), journal->recurrenceId() );
+      if ( !old ) {
+        cal->addJournal( journal ); // add this one
+        cal->deleteJournal( journal ); // and move it to deleted
       }
+    } else {
+      cal->addJournal( journal ); // just add this one
     }
-    c = icalcomponent_get_next_component( calendar, ICAL_VJOURNAL_COMPONENT );
+    break;
+  }
+  default:
+    break;
   }
+}
 
-  // TODO: Remove any previous time zones no longer referenced in the calendar
+void ICalFormatImpl::setThreadCount( int count )
+{
+  d->mThreadCount = count > 0 ? count : QThread::idealThreadCount();
+}
 
-  return true;
+int ICalFormatImpl::threadCount() const
+{
+  return d->mThreadCount;
 }
 
 QString ICalFormatImpl::extractErrorProperty( icalcomponent *c )
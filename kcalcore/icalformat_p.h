@@ -86,7 +86,7 @@ class Todo;
 
   @internal
 */
-class ICalFormatImpl
+class KCALCORE_TEST_EXPORT ICalFormatImpl
 {
   public:
     /**
@@ -108,6 +108,51 @@ class ICalFormatImpl
     bool populate( const Calendar::Ptr &calendar, icalcomponent *fs,
                    bool deleted = false, const QString &notebook = QString() );
 
+    /**
+      Reads the VERSION, PRODID and custom properties of a VCALENDAR
+      component, without looking at its sub-components.
+      @return false if the component is not a usable iCalendar.
+    */
+    bool populateHeader( const Calendar::Ptr &calendar, icalcomponent *vcalendar );
+
+    /**
+      Converts a single VTIMEZONE, VTODO, VEVENT or VJOURNAL component and
+      merges it into @p calendar, as populate() does for each sub-component.
+      Other component types are ignored.
+    */
+    void populateComponent( const Calendar::Ptr &calendar, icalcomponent *component,
+                            bool deleted = false );
+
+    /**
+      Converts a VTODO, VEVENT or VJOURNAL component into an incidence.
+      Only @p component and @p tzlist are touched, so distinct components
+      can be converted concurrently as long as each thread has its own
+      time zone collection.
+      @return the incidence, or a null pointer for other components.
+    */
+    Incidence::Ptr readComponent( icalcomponent *component, ICalTimeZones *tzlist );
+
+    /**
+      Inserts an incidence read by readComponent() into @p calendar, replacing
+      or deleting an existing incidence with the same UID and recurrence id
+      as populate() does.
+    */
+    void mergeIncidence( const Calendar::Ptr &calendar, const Incidence::Ptr &incidence,
+                         bool deleted = false );
+
+    /**
+      Sets the number of threads populate() uses to convert components.
+      A value of 1 converts them on the calling thread, 0 or less uses
+      QThread::idealThreadCount(). Insertion into the calendar always
+      happens on the calling thread, in document order.
+    */
+    void setThreadCount( int count );
+
+    /**
+      Returns the number of threads populate() uses to convert components.
+    */
+    int threadCount() const;
+
     icalcomponent *writeIncidence( const IncidenceBase::Ptr &incidence,
                                    iTIPMethod method = iTIPRequest,
                                    ICalTimeZones *tzList = 0,
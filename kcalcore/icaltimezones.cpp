@@ -28,10 +28,16 @@
 
 #include <KDebug>
 #include <KDateTime>
+#include <kglobal.h>
 #include <ksystemtimezone.h>
 
+#include <QtCore/QCache>
+#include <QtCore/QDataStream>
 #include <QtCore/QDateTime>
 #include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSharedData>
 #include <QtCore/QTextStream>
 
 extern "C" {
@@ -371,13 +377,45 @@ class ICalTimeZoneDataPrivate
       }
     }
 
-    icalcomponent *component() const { return icalComponent; }
+    icalcomponent *component() const
+    {
+      if ( !icalComponent && !pendingVTimezone.isEmpty() ) {
+        icalComponent = icalcomponent_new_from_string( pendingVTimezone.constData() );
+        pendingVTimezone.clear();
+      }
+      return icalComponent;
+    }
     void setComponent( icalcomponent *c )
     {
       if ( icalComponent ) {
         icalcomponent_free( icalComponent );
       }
       icalComponent = c;
+      pendingVTimezone.clear();
+    }
+
+    // Sets the VTIMEZONE text, which is only parsed when the component is needed.
+    void setVTimezone( const QByteArray &vtimezone )
+    {
+      setComponent( 0 );
+      pendingVTimezone = vtimezone;
+    }
+    QByteArray vtimezone() const
+    {
+      if ( !icalComponent ) {
+        return pendingVTimezone;
+      }
+      const QByteArray result( icalcomponent_as_ical_string( icalComponent ) );
+      icalmemory_free_ring();
+      return result;
+    }
+    void copyComponent( const ICalTimeZoneDataPrivate *other )
+    {
+      if ( !other->icalComponent && !other->pendingVTimezone.isEmpty() ) {
+        setVTimezone( other->pendingVTimezone );
+      } else {
+        setComponent( icalcomponent_new_clone( other->component() ) );
+      }
     }
 
     QString       location;       // name of city for this time zone
@@ -385,7 +423,8 @@ class ICalTimeZoneDataPrivate
     QDateTime     lastModified;   // time of last modification of the VTIMEZONE component (optional)
 
   private:
-    icalcomponent *icalComponent; // ical component representing this time zone
+    mutable icalcomponent *icalComponent; // ical component representing this time zone
+    mutable QByteArray pendingVTimezone;  // VTIMEZONE text not yet parsed into icalComponent
 };
 //@endcond
 
@@ -401,7 +440,7 @@ ICalTimeZoneData::ICalTimeZoneData( const ICalTimeZoneData &rhs )
   d->location = rhs.d->location;
   d->url = rhs.d->url;
   d->lastModified = rhs.d->lastModified;
-  d->setComponent( icalcomponent_new_clone( rhs.d->component() ) );
+  d->copyComponent( rhs.d );
 }
 
 #ifdef Q_OS_WINCE
@@ -778,7 +817,7 @@ ICalTimeZoneData &ICalTimeZoneData::operator=( const ICalTimeZoneData &rhs )
   d->location = rhs.d->location;
   d->url = rhs.d->url;
   d->lastModified = rhs.d->lastModified;
-  d->setComponent( icalcomponent_new_clone( rhs.d->component() ) );
+  d->copyComponent( rhs.d );
   return *this;
 }
 
@@ -804,9 +843,7 @@ QDateTime ICalTimeZoneData::lastModified() const
 
 QByteArray ICalTimeZoneData::vtimezone() const
 {
-  const QByteArray result( icalcomponent_as_ical_string( d->component() ) );
-  icalmemory_free_ring();
-  return result;
+  return d->vtimezone();
 }
 
 icaltimezone *ICalTimeZoneData::icalTimezone() const
@@ -835,6 +872,27 @@ void ICalTimeZoneData::virtual_hook( int id, void *data )
   Q_UNUSED( data );
 }
 
+//@cond PRIVATE
+namespace KCalCore {
+
+// Used by SnapshotFormat to restore a zone without parsing its VTIMEZONE.
+void setICalTimeZoneData( ICalTimeZoneData *data,
+                          const QList<KTimeZone::Phase> &phases, int previousUtcOffset,
+                          const QList<KTimeZone::Transition> &transitions,
+                          const QString &city, const QByteArray &url,
+                          const QDateTime &lastModified, const QByteArray &vtimezone )
+{
+  data->setPhases( phases, previousUtcOffset );
+  data->setTransitions( transitions );
+  data->d->location = city;
+  data->d->url = url;
+  data->d->lastModified = lastModified;
+  data->d->setVTimezone( vtimezone );
+}
+
+}
+//@endcond
+
 /******************************************************************************/
 
 //@cond PRIVATE
@@ -891,15 +949,9 @@ bool ICalTimeZoneSource::parse( icalcomponent *calendar, ICalTimeZones &zones )
   for ( icalcomponent *c = icalcomponent_get_first_component( calendar, ICAL_VTIMEZONE_COMPONENT );
         c;  c = icalcomponent_get_next_component( calendar, ICAL_VTIMEZONE_COMPONENT ) ) {
     const ICalTimeZone zone = parse( c );
-    if ( !zone.isValid() ) {
-      return false;
-    }
-    ICalTimeZone oldzone = zones.zone( zone.name() );
-    if ( oldzone.isValid() ) {
-      // The zone already exists in the collection, so update the definition
-      // of the zone rather than using a newly created one.
-      oldzone.update( zone );
-    } else if ( !zones.add( zone ) ) {
+    // A zone which already exists in the collection gets the new definition,
+    // unless the registry shares it with other collections
+    if ( !zone.isValid() || !ICalTimeZoneRegistry::add( zone, zones ) ) {
       return false;
     }
   }
@@ -1120,13 +1172,8 @@ ICalTimeZone ICalTimeZoneSource::parse( const QString &name, const QStringList &
     return oldzone;
   }
 
-  oldzone = zones.zone( name );
-  if ( oldzone.isValid() ) {
-    // The zone already exists, so update
-    oldzone.update( zone );
-    return zone;
-  } else if ( zones.add( zone ) ) {
-    // No similar zone, add and return new one.
+  // Update a zone of the same name unless it is shared, or add the new one
+  if ( ICalTimeZoneRegistry::add( zone, zones ) ) {
     return zone;
   }
   return ICalTimeZone(); // error
@@ -1452,4 +1499,189 @@ void ICalTimeZoneSource::virtual_hook( int id, void *data )
   Q_ASSERT( false );
 }
 
+/******************************************************************************/
+
+//@cond PRIVATE
+// One interned zone. Entries are shared by the registry's indexes and
+// counted atomically, so that lookups from several threads can hold on to
+// one without copying the zone under the lock.
+class ICalTimeZoneRegistryEntry : public QSharedData
+{
+  public:
+    ICalTimeZoneRegistryEntry( const ICalTimeZone &zone, const QByteArray &key )
+      : zone( zone ), key( key ) {}
+
+    const ICalTimeZone zone;
+    const QByteArray key;        // content key, see contentKey()
+};
+
+typedef QExplicitlySharedDataPointer<ICalTimeZoneRegistryEntry> ICalTimeZoneRegistryEntryPtr;
+
+class ICalTimeZoneRegistryPrivate
+{
+  public:
+    ICalTimeZoneRegistryPrivate() : byText( textLimit ), enabled( false ) {}
+
+    static QByteArray contentKey( const ICalTimeZone &zone );
+    ICalTimeZoneRegistryEntryPtr intern( const ICalTimeZone &parsed );
+    bool contains( const ICalTimeZone &zone ) const;
+
+    // Number of VTIMEZONE texts remembered; they are only a shortcut
+    // past parsing, the interned zones are found by their content.
+    static const int textLimit = 256;
+
+    QMutex lock;
+    ICalTimeZoneSource source;                 // source of all interned zones
+    QCache<QByteArray, ICalTimeZoneRegistryEntryPtr> byText;  // VTIMEZONE text -> entry
+    QHash<QByteArray, ICalTimeZoneRegistryEntryPtr> byContent;  // content key -> entry
+    QMultiHash<QString, ICalTimeZoneRegistryEntryPtr> byName;  // TZID -> entries
+    bool enabled;
+};
+
+// Serializes everything which distinguishes one parsed zone from another,
+// apart from LAST-MODIFIED which does not affect conversions.
+QByteArray ICalTimeZoneRegistryPrivate::contentKey( const ICalTimeZone &zone )
+{
+  QByteArray key;
+  QDataStream stream( &key, QIODevice::WriteOnly );
+  stream << zone.name() << zone.city() << zone.url();
+  const KTimeZoneData *data = zone.data();
+  stream << ( data ? data->previousUtcOffset() : 0 );
+  const QList<KTimeZone::Phase> phases = zone.phases();
+  stream << phases.count();
+  foreach ( const KTimeZone::Phase &phase, phases ) {
+    stream << phase.utcOffset() << phase.abbreviations()
+           << phase.isDst() << phase.comment();
+  }
+  const QList<KTimeZone::Transition> transitions = zone.transitions();
+  stream << transitions.count();
+  foreach ( const KTimeZone::Transition &transition, transitions ) {
+    stream << transition.time() << phases.indexOf( transition.phase() );
+  }
+  return key;
+}
+
+// Returns the entry for @p parsed, registering it if no zone with the
+// same content is known yet. Must be called with the lock held.
+ICalTimeZoneRegistryEntryPtr ICalTimeZoneRegistryPrivate::intern( const ICalTimeZone &parsed )
+{
+  const QByteArray key = contentKey( parsed );
+  ICalTimeZoneRegistryEntryPtr entry = byContent.value( key );
+  if ( !entry ) {
+    entry = new ICalTimeZoneRegistryEntry( parsed, key );
+    byContent.insert( key, entry );
+    byName.insert( parsed.name(), entry );
+  }
+  return entry;
+}
+
+// Must be called with the lock held.
+bool ICalTimeZoneRegistryPrivate::contains( const ICalTimeZone &zone ) const
+{
+  QMultiHash<QString, ICalTimeZoneRegistryEntryPtr>::const_iterator it = byName.constFind( zone.name() );
+  for ( ; it != byName.constEnd() && it.key() == zone.name(); ++it ) {
+    if ( it.value()->zone == zone ) {
+      return true;
+    }
+  }
+  return false;
+}
+//@endcond
+
+K_GLOBAL_STATIC( ICalTimeZoneRegistryPrivate, sRegistry )
+
+void ICalTimeZoneRegistry::setEnabled( bool enabled )
+{
+  QMutexLocker lock( &sRegistry->lock );
+  sRegistry->enabled = enabled;
+}
+
+bool ICalTimeZoneRegistry::isEnabled()
+{
+  QMutexLocker lock( &sRegistry->lock );
+  return sRegistry->enabled;
+}
+
+ICalTimeZone ICalTimeZoneRegistry::zone( icalcomponent *vtimezone )
+{
+  char *const ctext = icalcomponent_as_ical_string_r( vtimezone );
+  const QByteArray text( ctext );
+  free( ctext );
+
+  ICalTimeZoneRegistryPrivate *const d = sRegistry;
+  ICalTimeZoneRegistryEntryPtr entry;
+  {
+    QMutexLocker lock( &d->lock );
+    ICalTimeZoneRegistryEntryPtr *const known = d->byText.object( text );
+    if ( known ) {
+      entry = *known;
+    } else {
+      // Not seen in this form lately: parse it, and share an existing zone
+      // if the definition only differs in formatting.
+      const ICalTimeZone parsed = d->source.parse( vtimezone );
+      if ( !parsed.isValid() ) {
+        return parsed;
+      }
+      entry = d->intern( parsed );
+      d->byText.insert( text, new ICalTimeZoneRegistryEntryPtr( entry ) );
+    }
+  }
+  // The entry keeps the zone alive, copy it outside the lock
+  return entry->zone;
+}
+
+bool ICalTimeZoneRegistry::parse( icalcomponent *calendar, ICalTimeZones &zones )
+{
+  for ( icalcomponent *c = icalcomponent_get_first_component( calendar, ICAL_VTIMEZONE_COMPONENT );
+        c;  c = icalcomponent_get_next_component( calendar, ICAL_VTIMEZONE_COMPONENT ) ) {
+    const ICalTimeZone zone = ICalTimeZoneRegistry::zone( c );
+    if ( !zone.isValid() || !add( zone, zones ) ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ICalTimeZoneRegistry::add( const ICalTimeZone &zone, ICalTimeZones &zones )
+{
+  if ( !zone.isValid() ) {
+    return false;
+  }
+  ICalTimeZone oldzone = zones.zone( zone.name() );
+  if ( !oldzone.isValid() ) {
+    return zones.add( zone );
+  }
+  if ( oldzone == zone ) {
+    return true;
+  }
+  if ( contains( oldzone ) ) {
+    // Never modify a shared zone; swap it for the new one instead.
+    zones.remove( oldzone );
+    return zones.add( zone );
+  }
+  return oldzone.update( zone );
+}
+
+bool ICalTimeZoneRegistry::contains( const ICalTimeZone &zone )
+{
+  ICalTimeZoneRegistryPrivate *const d = sRegistry;
+  QMutexLocker lock( &d->lock );
+  return d->contains( zone );
+}
+
+int ICalTimeZoneRegistry::count()
+{
+  QMutexLocker lock( &sRegistry->lock );
+  return sRegistry->byContent.count();
+}
+
+void ICalTimeZoneRegistry::clear()
+{
+  ICalTimeZoneRegistryPrivate *const d = sRegistry;
+  QMutexLocker lock( &d->lock );
+  d->byText.clear();
+  d->byContent.clear();
+  d->byName.clear();
+}
+
 }  // namespace KCalCore
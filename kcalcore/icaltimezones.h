@@ -667,9 +667,112 @@ class KCALCORE_EXPORT ICalTimeZoneData : public KTimeZoneData
   private:
     //@cond PRIVATE
     ICalTimeZoneDataPrivate *const d;
+
+    friend void setICalTimeZoneData( ICalTimeZoneData *data,
+                                     const QList<KTimeZone::Phase> &phases,
+                                     int previousUtcOffset,
+                                     const QList<KTimeZone::Transition> &transitions,
+                                     const QString &city, const QByteArray &url,
+                                     const QDateTime &lastModified,
+                                     const QByteArray &vtimezone );
     //@endcond
 };
 
+/**
+ * Process-wide registry of interned iCalendar time zones.
+ *
+ * Calendars loaded from different files usually carry identical VTIMEZONE
+ * definitions. When the registry is enabled, ICalFormat looks each
+ * VTIMEZONE up here instead of parsing it again, so that every calendar
+ * using the same definition shares one ICalTimeZone and one set of
+ * transition tables.
+ *
+ * Zones are deduplicated by TZID together with the content of their phases
+ * and transitions; VTIMEZONE components which only differ in formatting
+ * therefore resolve to the same zone. The zones handed out are implicitly
+ * shared and must be treated as immutable: do not call
+ * ICalTimeZone::update() on them.
+ *
+ * The registry is thread safe, and so is copying the zones it hands out.
+ * It only remembers the text of the most recently used VTIMEZONE
+ * components; other definitions are parsed again and then resolved to the
+ * zone already registered for their content. The registry is disabled by
+ * default.
+ *
+ * @short Shared registry of iCalendar time zones
+ * @see ICalTimeZoneSource
+ */
+class KCALCORE_EXPORT ICalTimeZoneRegistry //krazy:exclude=dpointer
+{
+  public:
+    /**
+     * Enables or disables the use of the registry when loading calendars.
+     *
+     * @param enabled @c true to share time zones between calendars
+     * @see isEnabled()
+     */
+    static void setEnabled( bool enabled );
+
+    /**
+     * Returns whether calendars share their time zones through the registry.
+     * @see setEnabled()
+     */
+    static bool isEnabled();
+
+    /**
+     * Returns the interned time zone for a VTIMEZONE component, parsing and
+     * registering it if no equal definition is known yet.
+     *
+     * @param vtimezone the VTIMEZONE component
+     * @return the shared ICalTimeZone instance, or invalid on error
+     */
+    static ICalTimeZone zone( icalcomponent *vtimezone );
+
+    /**
+     * Adds the interned time zone for each VTIMEZONE component within a
+     * CALENDAR component to a time zone collection. A zone already in
+     * @p zones is updated in place unless it is itself shared, in which case
+     * it is replaced.
+     *
+     * @param calendar the CALENDAR component from which zones are extracted
+     * @param zones    the time zones collection to which the zones are added
+     * @return @c false if any error occurred, @c true otherwise
+     */
+    static bool parse( icalcomponent *calendar, ICalTimeZones &zones );
+
+    /**
+     * Adds a time zone to a collection. An existing zone of the same name
+     * is updated with the new definition, or replaced if the registry
+     * shares it. Everything which merges zones into a collection uses this,
+     * since the collection may hold registry zones even when the registry
+     * is disabled.
+     *
+     * @param zone  the time zone to add
+     * @param zones the time zones collection
+     * @return @c false if the zone could not be added, @c true otherwise
+     */
+    static bool add( const ICalTimeZone &zone, ICalTimeZones &zones );
+
+    /**
+     * Returns whether @p zone is a shared instance held by the registry.
+     */
+    static bool contains( const ICalTimeZone &zone );
+
+    /**
+     * Returns the number of distinct time zones held by the registry.
+     */
+    static int count();
+
+    /**
+     * Releases the registry's references to all time zones. Calendars which
+     * use them keep their copies.
+     */
+    static void clear();
+
+  private:
+    ICalTimeZoneRegistry();
+};
+
 }
 
 #endif
@@ -33,6 +33,7 @@
 */
 
 #include "incidence.h"
+#include "incidence_p.h"
 #include "calformat.h"
 
 #ifdef MIMETYPE
@@ -41,6 +42,7 @@
 
 #include <ktemporaryfile.h>
 
+#include <QSharedData>
 #include <QTextDocument> // for Qt::escape() and Qt::mightBeRichText()
 #include <QTime>
 
@@ -51,6 +53,64 @@ using namespace KCalCore;
   @internal
 */
 //@cond PRIVATE
+/**
+  The parts of an incidence which are expensive to copy. Copies of an
+  incidence share them until one of the copies changes them or hands out
+  pointers to them, see Incidence::Private::payload(). The incidence which
+  owns them keeps them then, and the other copies get duplicates.
+*/
+class IncidencePayload : public QSharedData
+{
+  public:
+    IncidencePayload()
+      : mRecurrence( 0 ),
+        mOwner( 0 ),
+        mHandedOut( false )
+    {
+    }
+
+    IncidencePayload( const IncidencePayload &other )
+      : QSharedData( other ),
+        mRecurrence( 0 ),
+        mOwner( 0 ),
+        mHandedOut( false )
+    {
+      // Alarms and attachments are shared pointers, so the objects themselves
+      // must be duplicated, otherwise changing them would change the source.
+      // The duplicates belong to no incidence until one adopts them.
+      foreach ( const Alarm::Ptr &alarm, other.mAlarms ) {
+        Alarm::Ptr copy( new Alarm( *alarm ) );
+        copy->setParent( 0 );
+        mAlarms.append( copy );
+      }
+      foreach ( const Attachment::Ptr &attachment, other.mAttachments ) {
+        mAttachments.append( Attachment::Ptr( new Attachment( *attachment ) ) );
+      }
+      if ( other.mRecurrence ) {
+        mRecurrence = new Recurrence( *other.mRecurrence );
+      }
+    }
+
+    ~IncidencePayload()
+    {
+      delete mRecurrence;
+    }
+
+    // Swaps the contents, but not the owner, with @p other
+    void swap( IncidencePayload &other )
+    {
+      qSwap( mRecurrence, other.mRecurrence );
+      qSwap( mAttachments, other.mAttachments );
+      qSwap( mAlarms, other.mAlarms );
+    }
+
+    Recurrence *mRecurrence;            // recurrence
+    Attachment::List mAttachments;      // attachments list
+    Alarm::List mAlarms;                // alarms list
+    Incidence *mOwner;                  // parent of the alarms, observer of the recurrence
+    bool mHandedOut;                    // pointers to the alarms etc. were handed out
+};
+
 class KCalCore::Incidence::Private
 {
   public:
@@ -59,7 +119,7 @@ class KCalCore::Incidence::Private
         mDescriptionIsRich( false ),
         mSummaryIsRich( false ),
         mLocationIsRich( false ),
-        mRecurrence( 0 ),
+        mPayload( new IncidencePayload ),
         mStatus( StatusNone ),
         mSecrecy( SecrecyPublic ),
         mPriority( 0 ),
@@ -80,7 +140,7 @@ class KCalCore::Incidence::Private
         mLocation( p.mLocation ),
         mLocationIsRich( p.mLocationIsRich ),
         mCategories( p.mCategories ),
-        mRecurrence ( 0 ),
+        mPayload( p.mPayload ),
         mResources( p.mResources ),
         mStatus( p.mStatus ),
         mStatusString( p.mStatusString ),
@@ -96,15 +156,120 @@ class KCalCore::Incidence::Private
     {
     }
 
-    void clear()
+    /**
+      Returns the payload for reading. It may be shared with copies of the
+      incidence, so nothing in it must be modified or handed out.
+    */
+    const IncidencePayload *shared() const
     {
-      mAlarms.clear();
-      mAttachments.clear();
-      delete mRecurrence;
-      mRecurrence = 0;
+      return mPayload.constData();
+    }
+
+    /**
+      Returns the payload for handing out pointers to its alarms, attachments
+      or recurrence, which may be used to change them. It is only copied if
+      it is shared, see payload().
+    */
+    const IncidencePayload *handOut( const Incidence *owner )
+    {
+      IncidencePayload *payload = this->payload( const_cast<Incidence *>( owner ) );
+      payload->mHandedOut = true;
+      return payload;
     }
 
-    void init( Incidence *dest, const Incidence &src )
+    /**
+      Returns the payload for writing. If it is shared, the incidence which
+      owns it (or any, if none does) keeps it, so that the pointers it handed
+      out stay valid, and the other copies are left with duplicates. Any
+      other incidence gets the duplicates itself. The alarms and recurrence
+      are then made to belong to @p owner.
+    */
+    IncidencePayload *payload( Incidence *owner )
+    {
+      IncidencePayload *payload = const_cast<IncidencePayload *>( mPayload.constData() );
+      if ( payload->ref != 1 ) {
+        if ( payload->mOwner == owner || !payload->mOwner ) {
+          IncidencePayload *own = new IncidencePayload( *payload );
+          own->swap( *payload );
+          own->mOwner = payload->mOwner;
+          own->mHandedOut = payload->mHandedOut;
+          payload->mOwner = 0;
+          payload->mHandedOut = false;
+          mPayload = own;
+          payload = own;
+        } else {
+          mPayload.detach();
+          payload = mPayload.data();
+        }
+      }
+      adopt( payload, owner );
+      return payload;
+    }
+
+    /**
+      Returns the recurrence for writing, creating it if there is none yet.
+    */
+    Recurrence *recurrence( Incidence *owner )
+    {
+      IncidencePayload *payload = this->payload( owner );
+      if ( !payload->mRecurrence ) {
+        payload->mRecurrence = new Recurrence();
+        initRecurrence( payload->mRecurrence, owner );
+        payload->mRecurrence->addObserver( owner );
+      }
+      return payload->mRecurrence;
+    }
+
+    // Sets up a new recurrence of @p incidence, which doesn't recur yet
+    static void initRecurrence( Recurrence *recurrence, const Incidence *incidence )
+    {
+      recurrence->setStartDateTime( incidence->IncidenceBase::dtStart() );
+      recurrence->setAllDay( incidence->allDay() );
+      recurrence->setRecurReadOnly( incidence->mReadOnly );
+    }
+
+    static void adopt( IncidencePayload *payload, Incidence *owner )
+    {
+      if ( payload->mOwner != owner ) {
+        foreach ( const Alarm::Ptr &alarm, payload->mAlarms ) {
+          alarm->setParent( owner );
+        }
+        if ( payload->mRecurrence ) {
+          if ( payload->mOwner ) {
+            payload->mRecurrence->removeObserver( payload->mOwner );
+          }
+          payload->mRecurrence->addObserver( owner );
+        }
+        payload->mOwner = owner;
+      }
+    }
+
+    /**
+      Detaches @p owner from the payload, which copies may still use.
+    */
+    void release( Incidence *owner )
+    {
+      IncidencePayload *payload = const_cast<IncidencePayload *>( mPayload.constData() );
+      if ( payload->mOwner == owner ) {
+        // Alarm has a raw incidence pointer, so we must set it to 0
+        // so Alarm doesn't use it after Incidence is destroyed
+        foreach ( const Alarm::Ptr &alarm, payload->mAlarms ) {
+          alarm->setParent( 0 );
+        }
+        if ( payload->mRecurrence ) {
+          payload->mRecurrence->removeObserver( owner );
+        }
+        payload->mOwner = 0;
+      }
+    }
+
+    void clear( Incidence *owner )
+    {
+      release( owner );
+      mPayload = new IncidencePayload;
+    }
+
+    void init( const Incidence &src )
     {
       mRevision = src.d->mRevision;
       mCreated = src.d->mCreated;
@@ -124,25 +289,12 @@ class KCalCore::Incidence::Private
       mRecurrenceId = src.d->mRecurrenceId;
       mLocalOnly = src.d->mLocalOnly;
 
-      // Alarms and Attachments are stored in ListBase<...>, which is a QValueList<...*>.
-      // We need to really duplicate the objects stored therein, otherwise deleting
-      // i will also delete all attachments from this object (setAutoDelete...)
-      foreach ( Alarm::Ptr alarm, src.d->mAlarms ) {
-        Alarm::Ptr b ( new Alarm( *alarm.data() ) );
-        b->setParent( dest );
-        mAlarms.append( b );
-      }
-
-      foreach ( Attachment::Ptr attachment, src.d->mAttachments ) {
-        Attachment::Ptr a( new Attachment( *attachment ) );
-        mAttachments.append( a );
-      }
-
-      if ( src.d->mRecurrence ) {
-        mRecurrence = new Recurrence( *( src.d->mRecurrence ) );
-        mRecurrence->addObserver( dest );
-      } else {
-        mRecurrence = 0;
+      // Alarms, attachments and the recurrence are only copied once either
+      // incidence needs them for writing. Pointers handed out by the source
+      // may be used to change them any time, so they are copied right away.
+      mPayload = src.d->mPayload;
+      if ( mPayload.constData()->mHandedOut ) {
+        mPayload.detach();
       }
     }
 
@@ -156,9 +308,7 @@ class KCalCore::Incidence::Private
     QString mLocation;                  // location string
     bool mLocationIsRich;               // location string is richtext.
     QStringList mCategories;            // category list
-    mutable Recurrence *mRecurrence;    // recurrence
-    Attachment::List mAttachments;      // attachments list
-    Alarm::List mAlarms;                // alarms list
+    QSharedDataPointer<IncidencePayload> mPayload; // alarms, attachments, recurrence
     QStringList mResources;             // resources list (not calendar resources)
     Status mStatus;                     // status
     QString mStatusString;              // status string, for custom status
@@ -188,19 +338,13 @@ Incidence::Incidence( const Incidence &i )
     Recurrence::RecurrenceObserver(),
     d( new KCalCore::Incidence::Private( *i.d ) )
 {
-  d->init( this, i );
+  d->init( i );
   resetDirtyFields();
 }
 
 Incidence::~Incidence()
 {
-  // Alarm has a raw incidence pointer, so we must set it to 0
-  // so Alarm doesn't use it after Incidence is destroyed
-  foreach ( Alarm::Ptr alarm, d->mAlarms ) {
-    alarm->setParent( 0 );
-  }
-
-  delete d->mRecurrence;
+  d->release( this );
   delete d;
 }
 
@@ -215,11 +359,11 @@ static bool stringCompare( const QString &s1, const QString &s2 )
 IncidenceBase &Incidence::assign( const IncidenceBase &other )
 {
   if ( &other != this ) {
-    d->clear();
+    d->clear( this );
     //TODO: should relations be cleared out, as in destructor???
     IncidenceBase::assign( other );
     const Incidence *i = static_cast<const Incidence*>( &other );
-    d->init( this, *i );
+    d->init( *i );
   }
 
   return *this;
@@ -234,14 +378,16 @@ bool Incidence::equals( const IncidenceBase &incidence ) const
   // If they weren't the same type IncidenceBase::equals would had returned false already
   const Incidence *i2 = static_cast<const Incidence *>( &incidence );
 
-  if ( alarms().count() != i2->alarms().count() ) {
+  const IncidencePayload *p1 = d->shared();
+  const IncidencePayload *p2 = i2->d->shared();
+  if ( p1->mAlarms.count() != p2->mAlarms.count() ) {
     return false;
   }
 
-  Alarm::List::ConstIterator a1 = alarms().constBegin();
-  Alarm::List::ConstIterator a1end = alarms().constEnd();
-  Alarm::List::ConstIterator a2 = i2->alarms().constBegin();
-  Alarm::List::ConstIterator a2end = i2->alarms().constEnd();
+  Alarm::List::ConstIterator a1 = p1->mAlarms.constBegin();
+  Alarm::List::ConstIterator a1end = p1->mAlarms.constEnd();
+  Alarm::List::ConstIterator a2 = p2->mAlarms.constBegin();
+  Alarm::List::ConstIterator a2end = p2->mAlarms.constEnd();
   for ( ; a1 != a1end && a2 != a2end; ++a1, ++a2 ) {
     if ( **a1 == **a2 ) {
       continue;
@@ -250,14 +396,14 @@ bool Incidence::equals( const IncidenceBase &incidence ) const
     }
   }
 
-  if ( attachments().count() != i2->attachments().count() ) {
+  if ( p1->mAttachments.count() != p2->mAttachments.count() ) {
     return false;
   }
 
-  Attachment::List::ConstIterator att1 = attachments().constBegin();
-  const Attachment::List::ConstIterator att1end = attachments().constEnd();
-  Attachment::List::ConstIterator att2 = i2->attachments().constBegin();
-  const Attachment::List::ConstIterator att2end = i2->attachments().constEnd();
+  Attachment::List::ConstIterator att1 = p1->mAttachments.constBegin();
+  const Attachment::List::ConstIterator att1end = p1->mAttachments.constEnd();
+  Attachment::List::ConstIterator att2 = p2->mAttachments.constBegin();
+  const Attachment::List::ConstIterator att2end = p2->mAttachments.constEnd();
   for ( ; att1 != att1end && att2 != att2end; ++att1, ++att2 ) {
     if ( **att1 == **att2 ) {
       continue;
@@ -266,13 +412,18 @@ bool Incidence::equals( const IncidenceBase &incidence ) const
     }
   }
 
-  bool recurrenceEqual = ( d->mRecurrence == 0 && i2->d->mRecurrence == 0 );
+  const Recurrence *r1 = p1->mRecurrence;
+  const Recurrence *r2 = p2->mRecurrence;
+  bool recurrenceEqual = ( r1 == 0 && r2 == 0 );
   if ( !recurrenceEqual ) {
-    recurrence(); // create if doesn't exist
-    i2->recurrence(); // create if doesn't exist
-    recurrenceEqual = d->mRecurrence != 0 &&
-                      i2->d->mRecurrence != 0 &&
-                      *d->mRecurrence == *i2->d->mRecurrence;
+    if ( r1 && r2 ) {
+      recurrenceEqual = *r1 == *r2;
+    } else {
+      // compare with the recurrence which recurrence() would create
+      Recurrence none;
+      Private::initRecurrence( &none, r1 ? i2 : this );
+      recurrenceEqual = *( r1 ? r1 : r2 ) == none;
+    }
   }
 
   return
@@ -312,8 +463,8 @@ void Incidence::setLastModified( const KDateTime &lm )
 void Incidence::setReadOnly( bool readOnly )
 {
   IncidenceBase::setReadOnly( readOnly );
-  if ( d->mRecurrence ) {
-    d->mRecurrence->setRecurReadOnly( readOnly );
+  if ( d->shared()->mRecurrence ) {
+    d->payload( this )->mRecurrence->setRecurReadOnly( readOnly );
   }
 }
 
@@ -335,8 +486,8 @@ void Incidence::setAllDay( bool allDay )
   if ( mReadOnly ) {
     return;
   }
-  if ( d->mRecurrence ) {
-    d->mRecurrence->setAllDay( allDay );
+  if ( d->shared()->mRecurrence ) {
+    d->payload( this )->mRecurrence->setAllDay( allDay );
   }
   IncidenceBase::setAllDay( allDay );
 }
@@ -379,9 +530,10 @@ int Incidence::revision() const
 
 void Incidence::setDtStart( const KDateTime &dt )
 {
-  if ( d->mRecurrence ) {
-    d->mRecurrence->setStartDateTime( dt );
-    d->mRecurrence->setAllDay( allDay() );
+  if ( d->shared()->mRecurrence ) {
+    Recurrence *recurrence = d->payload( this )->mRecurrence;
+    recurrence->setStartDateTime( dt );
+    recurrence->setAllDay( allDay() );
   }
   IncidenceBase::setDtStart( dt );
 }
@@ -390,11 +542,12 @@ void Incidence::shiftTimes( const KDateTime::Spec &oldSpec,
                             const KDateTime::Spec &newSpec )
 {
   IncidenceBase::shiftTimes( oldSpec, newSpec );
-  if ( d->mRecurrence ) {
-    d->mRecurrence->shiftTimes( oldSpec, newSpec );
+  IncidencePayload *payload = d->payload( this );
+  if ( payload->mRecurrence ) {
+    payload->mRecurrence->shiftTimes( oldSpec, newSpec );
   }
-  for ( int i = 0, end = d->mAlarms.count();  i < end;  ++i ) {
-    d->mAlarms[i]->shiftTimes( oldSpec, newSpec );
+  for ( int i = 0, end = payload->mAlarms.count();  i < end;  ++i ) {
+    payload->mAlarms[i]->shiftTimes( oldSpec, newSpec );
   }
 }
 
@@ -546,27 +699,26 @@ QString Incidence::relatedTo( RelType relType ) const
 
 Recurrence *Incidence::recurrence() const
 {
-  if ( !d->mRecurrence ) {
-    d->mRecurrence = new Recurrence();
-    d->mRecurrence->setStartDateTime( IncidenceBase::dtStart() );
-    d->mRecurrence->setAllDay( allDay() );
-    d->mRecurrence->setRecurReadOnly( mReadOnly );
-    d->mRecurrence->addObserver( const_cast<KCalCore::Incidence*>( this ) );
-  }
-
-  return d->mRecurrence;
+  // the recurrence can be changed through the returned pointer
+  Recurrence *recurrence = d->recurrence( const_cast<KCalCore::Incidence*>( this ) );
+  d->handOut( this );
+  return recurrence;
 }
 
 void Incidence::clearRecurrence()
 {
-  delete d->mRecurrence;
-  d->mRecurrence = 0;
+  if ( d->shared()->mRecurrence ) {
+    IncidencePayload *payload = d->payload( this );
+    delete payload->mRecurrence;
+    payload->mRecurrence = 0;
+  }
 }
 
 ushort Incidence::recurrenceType() const
 {
-  if ( d->mRecurrence ) {
-    return d->mRecurrence->recurrenceType();
+  const Recurrence *recurrence = d->shared()->mRecurrence;
+  if ( recurrence ) {
+    return recurrence->recurrenceType();
   } else {
     return Recurrence::rNone;
   }
@@ -574,8 +726,9 @@ ushort Incidence::recurrenceType() const
 
 bool Incidence::recurs() const
 {
-  if ( d->mRecurrence ) {
-    return d->mRecurrence->recurs();
+  const Recurrence *recurrence = d->shared()->mRecurrence;
+  if ( recurrence ) {
+    return recurrence->recurs();
   } else {
     return false;
   }
@@ -584,12 +737,14 @@ bool Incidence::recurs() const
 bool Incidence::recursOn( const QDate &date,
                           const KDateTime::Spec &timeSpec ) const
 {
-  return d->mRecurrence && d->mRecurrence->recursOn( date, timeSpec );
+  const Recurrence *recurrence = d->shared()->mRecurrence;
+  return recurrence && recurrence->recursOn( date, timeSpec );
 }
 
 bool Incidence::recursAt( const KDateTime &qdt ) const
 {
-  return d->mRecurrence && d->mRecurrence->recursAt( qdt );
+  const Recurrence *recurrence = d->shared()->mRecurrence;
+  return recurrence && recurrence->recursAt( qdt );
 }
 
 QList<KDateTime> Incidence::startDateTimesForDate( const QDate &date,
@@ -619,8 +774,8 @@ QList<KDateTime> Incidence::startDateTimesForDate( const QDate &date,
   QDate tmpday( date.addDays( -days - 1 ) );
   KDateTime tmp;
   while ( tmpday <= date ) {
-    if ( recurrence()->recursOn( tmpday, timeSpec ) ) {
-      QList<QTime> times = recurrence()->recurTimesOn( tmpday, timeSpec );
+    if ( d->shared()->mRecurrence->recursOn( tmpday, timeSpec ) ) {
+      QList<QTime> times = d->shared()->mRecurrence->recurTimesOn( tmpday, timeSpec );
       foreach ( const QTime &time, times ) {
         tmp = KDateTime( tmpday, time, start.timeSpec() );
         if ( endDateForStart( tmp ) >= kdate ) {
@@ -658,9 +813,9 @@ QList<KDateTime> Incidence::startDateTimesForDateTime( const KDateTime &datetime
   QDate tmpday( datetime.date().addDays( -days - 1 ) );
   KDateTime tmp;
   while ( tmpday <= datetime.date() ) {
-    if ( recurrence()->recursOn( tmpday, datetime.timeSpec() ) ) {
+    if ( d->shared()->mRecurrence->recursOn( tmpday, datetime.timeSpec() ) ) {
       // Get the times during the day (in start date's time zone) when recurrences happen
-      QList<QTime> times = recurrence()->recurTimesOn( tmpday, start.timeSpec() );
+      QList<QTime> times = d->shared()->mRecurrence->recurTimesOn( tmpday, start.timeSpec() );
       foreach ( const QTime &time, times ) {
         tmp = KDateTime( tmpday, time, start.timeSpec() );
         if ( !( tmp > datetime || endDateForStart( tmp ) < datetime ) ) {
@@ -693,46 +848,48 @@ void Incidence::addAttachment( const Attachment::Ptr &attachment )
     return;
   }
 
-  Q_ASSERT( !d->mAttachments.contains( attachment ) );
+  Q_ASSERT( !d->shared()->mAttachments.contains( attachment ) );
 
   update();
-  d->mAttachments.append( attachment );
+  d->payload( this )->mAttachments.append( attachment );
   setFieldDirty( FieldAttachment );
   updated();
 }
 
 void Incidence::deleteAttachment( const Attachment::Ptr &attachment )
 {
-  int index = d->mAttachments.indexOf( attachment );
+  int index = d->shared()->mAttachments.indexOf( attachment );
   if ( index > -1 ) {
     setFieldDirty( FieldAttachment );
-    d->mAttachments.remove( index );
+    d->payload( this )->mAttachments.remove( index );
   }
 }
 
 void Incidence::deleteAttachments( const QString &mime )
 {
+  IncidencePayload *payload = d->payload( this );
   Attachment::List result;
-  Attachment::List::Iterator it = d->mAttachments.begin();
-  while ( it != d->mAttachments.end() ) {
+  Attachment::List::Iterator it = payload->mAttachments.begin();
+  while ( it != payload->mAttachments.end() ) {
     if ( ( *it )->mimeType() != mime ) {
       result += *it;
     }
     ++it;
   }
-  d->mAttachments = result;
+  payload->mAttachments = result;
   setFieldDirty( FieldAttachment );
 }
 
 Attachment::List Incidence::attachments() const
 {
-  return d->mAttachments;
+  // the attachments can be changed through the returned pointers
+  return d->handOut( this )->mAttachments;
 }
 
 Attachment::List Incidence::attachments( const QString &mime ) const
 {
   Attachment::List attachments;
-  foreach ( Attachment::Ptr attachment, d->mAttachments ) {
+  foreach ( Attachment::Ptr attachment, d->handOut( this )->mAttachments ) {
     if ( attachment->mimeType() == mime ) {
       attachments.append( attachment );
     }
@@ -743,7 +900,9 @@ Attachment::List Incidence::attachments( const QString &mime ) const
 void Incidence::clearAttachments()
 {
   setFieldDirty( FieldAttachment );
-  d->mAttachments.clear();
+  if ( !d->shared()->mAttachments.isEmpty() ) {
+    d->payload( this )->mAttachments.clear();
+  }
 }
 
 QString Incidence::writeAttachmentToTempFile( const Attachment::Ptr &attachment ) const
@@ -875,30 +1034,33 @@ Incidence::Secrecy Incidence::secrecy() const
 
 Alarm::List Incidence::alarms() const
 {
-  return d->mAlarms;
+  // the alarms can be changed through the returned pointers
+  return d->handOut( this )->mAlarms;
 }
 
 Alarm::Ptr Incidence::newAlarm()
 {
   Alarm::Ptr alarm( new Alarm( this ) );
-  d->mAlarms.append( alarm );
+  IncidencePayload *payload = d->payload( this );
+  payload->mAlarms.append( alarm );
+  payload->mHandedOut = true;
   return alarm;
 }
 
 void Incidence::addAlarm( const Alarm::Ptr &alarm )
 {
   update();
-  d->mAlarms.append( alarm );
+  d->payload( this )->mAlarms.append( alarm );
   setFieldDirty( FieldAlarms );
   updated();
 }
 
 void Incidence::removeAlarm( const Alarm::Ptr &alarm )
 {
-  const int index = d->mAlarms.indexOf( alarm );
+  const int index = d->shared()->mAlarms.indexOf( alarm );
   if ( index > -1 ) {
     update();
-    d->mAlarms.remove( index );
+    d->payload( this )->mAlarms.remove( index );
     setFieldDirty( FieldAlarms );
     updated();
   }
@@ -907,14 +1069,16 @@ void Incidence::removeAlarm( const Alarm::Ptr &alarm )
 void Incidence::clearAlarms()
 {
   update();
-  d->mAlarms.clear();
+  if ( !d->shared()->mAlarms.isEmpty() ) {
+    d->payload( this )->mAlarms.clear();
+  }
   setFieldDirty( FieldAlarms );
   updated();
 }
 
 bool Incidence::hasEnabledAlarms() const
 {
-  foreach ( Alarm::Ptr alarm, d->mAlarms ) {
+  foreach ( const Alarm::Ptr &alarm, d->shared()->mAlarms ) {
     if ( alarm->enabled() ) {
       return true;
     }
@@ -965,11 +1129,14 @@ bool Incidence::locationIsRich() const
 
 void Incidence::setSchedulingID( const QString &sid, const QString &uid )
 {
+  // observers are notified once, after both are set
+  startUpdates();
   d->mSchedulingID = sid;
   if ( !uid.isEmpty() ) {
     setUid( uid );
   }
   setFieldDirty( FieldSchedulingId );
+  endUpdates();
 }
 
 QString Incidence::schedulingID() const
@@ -1060,7 +1227,7 @@ void Incidence::setRecurrenceId( const KDateTime &recurrenceId )
     belongs to. */
 void Incidence::recurrenceUpdated( Recurrence *recurrence )
 {
-  if ( recurrence == d->mRecurrence ) {
+  if ( recurrence == d->shared()->mRecurrence ) {
     update();
     updated();
   }
@@ -1103,3 +1270,42 @@ bool Incidence::supportsGroupwareCommunication() const
 {
   return type() == TypeEvent || type() == TypeTodo;
 }
+
+//@cond PRIVATE
+const Recurrence *IncidenceInternals::recurrence( const Incidence &incidence )
+{
+  return incidence.d->shared()->mRecurrence;
+}
+
+const Alarm::List &IncidenceInternals::alarms( const Incidence &incidence )
+{
+  return incidence.d->shared()->mAlarms;
+}
+
+const Attachment::List &IncidenceInternals::attachments( const Incidence &incidence )
+{
+  return incidence.d->shared()->mAttachments;
+}
+
+Recurrence *IncidenceInternals::changeRecurrence( Incidence &incidence )
+{
+  return incidence.d->recurrence( &incidence );
+}
+
+Alarm::Ptr IncidenceInternals::handOutAlarm( Incidence &incidence, int index )
+{
+  // Handing out may leave this incidence with duplicates of the alarms
+  // which were read, so they are picked by index
+  return incidence.d->handOut( &incidence )->mAlarms.value( index );
+}
+
+void IncidenceInternals::forgetHandedOut( Incidence &incidence )
+{
+  // A payload which was handed out is never shared, see Private::init()
+  const IncidencePayload *payload = incidence.d->shared();
+  if ( payload->mHandedOut && payload->ref == 1 ) {
+    incidence.d->payload( &incidence )->mHandedOut = false;
+  }
+  forgetHandedOutAttendees( incidence );
+}
+//@endcond
@@ -827,6 +827,7 @@ class KCALCORE_EXPORT Incidence
     Incidence &operator=( const Incidence &other );
 
     //@cond PRIVATE
+    friend class IncidenceInternals;
     class Private;
     Private *const d;
     //@endcond
@@ -0,0 +1,97 @@
+/*
+  This file is part of the kcalcore library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+/**
+  @file
+  This file is part of the API for handling calendar data and
+  defines the internal IncidenceInternals class.
+*/
+#ifndef KCALCORE_INCIDENCE_P_H
+#define KCALCORE_INCIDENCE_P_H
+
+#include "kcalcore_export.h"
+#include "incidence.h"
+
+namespace KCalCore {
+
+/**
+  @brief
+  Access to the parts of an incidence which copies share, for code which
+  must not make them stop sharing.
+
+  Incidence::recurrence(), Incidence::alarms(), Incidence::attachments() and
+  IncidenceBase::attendees() hand out pointers which may be used to change
+  an incidence at any time, so its copies stop sharing these parts with it.
+  Calendars and formats which only read them, or change them right away,
+  use these functions instead.
+
+  @internal
+*/
+class KCALCORE_EXPORT IncidenceInternals
+{
+  public:
+    /**
+      Returns the recurrence of @p incidence for reading, or 0 if it has
+      none. It may be shared with copies, so it must not be changed.
+    */
+    static const Recurrence *recurrence( const Incidence &incidence );
+
+    /**
+      Returns the alarms of @p incidence for reading. They may be shared
+      with copies, so they must not be changed or passed on.
+    */
+    static const Alarm::List &alarms( const Incidence &incidence );
+
+    /**
+      Returns the attachments of @p incidence for reading. They may be
+      shared with copies, so they must not be changed or passed on.
+    */
+    static const Attachment::List &attachments( const Incidence &incidence );
+
+    /**
+      Returns the attendees of @p incidence for reading. They may be
+      shared with copies, so they must not be changed or passed on.
+    */
+    static const Attendee::List &attendees( const IncidenceBase &incidence );
+
+    /**
+      Returns the recurrence of @p incidence for changing it right away,
+      creating it if needed. The pointer must not be kept.
+    */
+    static Recurrence *changeRecurrence( Incidence &incidence );
+
+    /**
+      Returns the alarm at @p index in alarms() the way Incidence::alarms()
+      hands it out, for passing it on to callers which may change it.
+    */
+    static Alarm::Ptr handOutAlarm( Incidence &incidence, int index );
+
+    /**
+      Tells @p incidence that none of the pointers it handed out are used
+      any more, so that its copies share its alarms, attachments, attendees
+      and recurrence again. Readers call it on the incidences they build.
+    */
+    static void forgetHandedOut( Incidence &incidence );
+
+  private:
+    static void forgetHandedOutAttendees( IncidenceBase &incidence );
+};
+
+}
+
+#endif
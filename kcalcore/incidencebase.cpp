@@ -35,14 +35,19 @@
 */
 
 #include "incidencebase.h"
+#include "incidence_p.h"
 #include "calformat.h"
 #include "visitor.h"
 
 #include <QDebug>
+#include <QSharedData>
 #include <QTime>
 
 #include <KUrl>
+#include <kglobal.h>
 
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
 #include <QtCore/QStringList>
 
 using namespace KCalCore;
@@ -52,19 +57,55 @@ using namespace KCalCore;
   @internal
 */
 //@cond PRIVATE
+// Serializes the generation of UIDs by concurrent readers of an incidence
+K_GLOBAL_STATIC( QMutex, sUidLock )
+
+/**
+  The attendees of an incidence. Copies of an incidence share them until one
+  of the copies changes them or hands out pointers to them. The incidence
+  which owns them keeps them then, and the other copies get duplicates.
+*/
+class IncidenceAttendees : public QSharedData
+{
+  public:
+    IncidenceAttendees()
+      : mOwner( 0 ),
+        mHandedOut( false )
+    {
+    }
+
+    IncidenceAttendees( const IncidenceAttendees &other )
+      : QSharedData( other ),
+        mOwner( 0 ),
+        mHandedOut( false )
+    {
+      Attendee::List::ConstIterator it;
+      for ( it = other.mList.constBegin(); it != other.mList.constEnd(); ++it ) {
+        mList.append( Attendee::Ptr( new Attendee( *( *it ) ) ) );
+      }
+    }
+
+    Attendee::List mList;
+    const IncidenceBase *mOwner;  // the incidence which last changed them
+    bool mHandedOut;              // pointers to the attendees were handed out
+};
+
 class KCalCore::IncidenceBase::Private
 {
   public:
     Private()
       : mOrganizer( new Person() ),
+        mHasUid( 0 ),
         mUpdateGroupLevel( 0 ),
         mUpdatedPending( false ),
         mAllDay( true ),
-        mHasDuration( false )
+        mHasDuration( false ),
+        mAttendees( new IncidenceAttendees )
     {}
 
     Private( const Private &other )
-      : mUpdateGroupLevel( 0 ),
+      : mHasUid( 0 ),
+        mUpdateGroupLevel( 0 ),
         mUpdatedPending( false ),
         mAllDay( true ),
         mHasDuration( false )
@@ -78,16 +119,81 @@ class KCalCore::IncidenceBase::Private
 
     void init( const Private &other );
 
+    // The attendees for reading, possibly shared with copies
+    const Attendee::List &attendees() const
+    {
+      return mAttendees.constData()->mList;
+    }
+
+    // The attendees for writing. If they are shared, the incidence which
+    // owns them (or any, if none does) keeps them, so that the pointers it
+    // handed out stay valid, and the other copies are left with duplicates.
+    // Any other incidence gets the duplicates itself.
+    Attendee::List &detachedAttendees( const IncidenceBase *owner )
+    {
+      IncidenceAttendees *attendees = const_cast<IncidenceAttendees *>( mAttendees.constData() );
+      if ( attendees->ref != 1 ) {
+        if ( attendees->mOwner == owner || !attendees->mOwner ) {
+          IncidenceAttendees *own = new IncidenceAttendees( *attendees );
+          qSwap( own->mList, attendees->mList );
+          own->mHandedOut = attendees->mHandedOut;
+          attendees->mOwner = 0;
+          attendees->mHandedOut = false;
+          mAttendees = own;
+          attendees = own;
+        } else {
+          mAttendees.detach();
+          attendees = mAttendees.data();
+        }
+      }
+      attendees->mOwner = owner;
+      return attendees->mList;
+    }
+
+    // The attendees for handing out pointers, which may be used to change them
+    const Attendee::List &handedOutAttendees( const IncidenceBase *owner )
+    {
+      Attendee::List &attendees = detachedAttendees( owner );
+      mAttendees.data()->mHandedOut = true;
+      return attendees;
+    }
+
+    // Stops @p owner from owning the attendees, which copies may still use
+    void releaseAttendees( const IncidenceBase *owner )
+    {
+      if ( mAttendees.constData()->mOwner == owner ) {
+        const_cast<IncidenceAttendees *>( mAttendees.constData() )->mOwner = 0;
+      }
+    }
+
+    // Most incidences are created by parsers which set the UID right away,
+    // so a unique id is only generated when it is read before being set.
+    // Readers may do so concurrently: the first one to finish publishes its
+    // id under sUidLock, and mHasUid is only set once mUid is written.
+    const QString &uid() const
+    {
+      if ( !mHasUid.testAndSetAcquire( 1, 1 ) ) {
+        const QString uid = CalFormat::createUniqueId();
+        QMutexLocker lock( sUidLock );
+        if ( !mHasUid.testAndSetAcquire( 1, 1 ) ) {
+          mUid = uid;
+          mHasUid.fetchAndStoreRelease( 1 );
+        }
+      }
+      return mUid;
+    }
+
     KDateTime mLastModified;     // incidence last modified date
     KDateTime mDtStart;          // incidence start time
     Person::Ptr mOrganizer;           // incidence person (owner)
-    QString mUid;                // incidence unique id
+    mutable QString mUid;        // incidence unique id
+    mutable QAtomicInt mHasUid;  // 0 until mUid is set or generated
     Duration mDuration;          // incidence duration
     int mUpdateGroupLevel;       // if non-zero, suppresses update() calls
     bool mUpdatedPending;        // true if an update has occurred since startUpdates()
     bool mAllDay;                // true if the incidence is all-day
     bool mHasDuration;           // true if the incidence has a duration
-    Attendee::List mAttendees;   // list of incidence attendees
+    QSharedDataPointer<IncidenceAttendees> mAttendees; // list of incidence attendees
     QStringList mComments;       // list of incidence comments
     QStringList mContacts;       // list of incidence contacts
     QList<IncidenceObserver*> mObservers; // list of incidence observers
@@ -100,7 +206,8 @@ void IncidenceBase::Private::init( const Private &other )
   mLastModified = other.mLastModified;
   mDtStart = other.mDtStart;
   mOrganizer = other.mOrganizer;
-  mUid = other.mUid;
+  mUid = other.uid();
+  mHasUid.fetchAndStoreRelease( 1 );
   mDuration = other.mDuration;
   mAllDay = other.mAllDay;
   mHasDuration = other.mHasDuration;
@@ -108,10 +215,11 @@ void IncidenceBase::Private::init( const Private &other )
   mComments = other.mComments;
   mContacts = other.mContacts;
 
-  mAttendees.clear();
-  Attendee::List::ConstIterator it;
-  for ( it = other.mAttendees.constBegin(); it != other.mAttendees.constEnd(); ++it ) {
-    mAttendees.append( Attendee::Ptr( new Attendee( *( *it ) ) ) );
+  // the attendees are only copied once either incidence changes them, or
+  // right away if the source handed out pointers which may change them
+  mAttendees = other.mAttendees;
+  if ( mAttendees.constData()->mHandedOut ) {
+    mAttendees.detach();
   }
 }
 //@endcond
@@ -120,7 +228,8 @@ IncidenceBase::IncidenceBase()
  : d( new KCalCore::IncidenceBase::Private )
 {
   mReadOnly = false;
-  setUid( CalFormat::createUniqueId() );
+  // the UID is generated on first use, see Private::uid()
+  d->mDirtyFields.insert( FieldUid );
 }
 
 IncidenceBase::IncidenceBase( const IncidenceBase &i )
@@ -132,6 +241,7 @@ IncidenceBase::IncidenceBase( const IncidenceBase &i )
 
 IncidenceBase::~IncidenceBase()
 {
+  d->releaseAttendees( this );
   delete d;
 }
 
@@ -150,6 +260,7 @@ IncidenceBase &IncidenceBase::operator=( const IncidenceBase &other )
 IncidenceBase &IncidenceBase::assign( const IncidenceBase &other )
 {
   CustomProperties::operator=( other );
+  d->releaseAttendees( this );
   d->init( *other.d );
   mReadOnly = other.mReadOnly;
   d->mDirtyFields.clear();
@@ -174,12 +285,12 @@ bool IncidenceBase::operator!=( const IncidenceBase &i2 ) const
 
 bool IncidenceBase::equals( const IncidenceBase &i2 ) const
 {
-  if ( attendees().count() != i2.attendees().count() ) {
+  const Attendee::List &al1 = d->attendees();
+  const Attendee::List &al2 = i2.d->attendees();
+  if ( al1.count() != al2.count() ) {
     return false;
   }
 
-  Attendee::List al1 = attendees();
-  Attendee::List al2 = i2.attendees();
   Attendee::List::ConstIterator a1 = al1.constBegin();
   Attendee::List::ConstIterator a2 = al2.constBegin();
   //TODO Does the order of attendees in the list really matter?
@@ -218,13 +329,14 @@ void IncidenceBase::setUid( const QString &uid )
 {
   update();
   d->mUid = uid;
+  d->mHasUid.fetchAndStoreRelease( 1 );
   d->mDirtyFields.insert( FieldUid );
   updated();
 }
 
 QString IncidenceBase::uid() const
 {
-  return d->mUid;
+  return d->uid();
 }
 
 void IncidenceBase::setLastModified( const KDateTime &lm )
@@ -411,7 +523,7 @@ void IncidenceBase::addAttendee( const Attendee::Ptr &a, bool doupdate )
     return;
   }
 
-  Q_ASSERT( !d->mAttendees.contains( a ) );
+  Q_ASSERT( !d->attendees().contains( a ) );
 
   if ( doupdate ) {
     update();
@@ -432,7 +544,7 @@ void IncidenceBase::addAttendee( const Attendee::Ptr &a, bool doupdate )
     a->setUid( QString::number( (qlonglong)a.data() ) );
   }
 
-  d->mAttendees.append( a );
+  d->detachedAttendees( this ).append( a );
   if ( doupdate ) {
     d->mDirtyFields.insert( FieldAttendees );
     updated();
@@ -445,13 +557,13 @@ void IncidenceBase::deleteAttendee( const Attendee::Ptr &a, bool doupdate )
     return;
   }
 
-  int index = d->mAttendees.indexOf( a );
+  int index = d->attendees().indexOf( a );
   if ( index >= 0 ) {
     if ( doupdate ) {
       update();
     }
 
-    d->mAttendees.remove( index );
+    d->detachedAttendees( this ).remove( index );
 
     if ( doupdate ) {
       d->mDirtyFields.insert( FieldAttendees );
@@ -462,12 +574,22 @@ void IncidenceBase::deleteAttendee( const Attendee::Ptr &a, bool doupdate )
 
 Attendee::List IncidenceBase::attendees() const
 {
-  return d->mAttendees;
+  // the attendees can be changed through the returned pointers
+  return d->handedOutAttendees( this );
 }
 
 int IncidenceBase::attendeeCount() const
 {
-  return d->mAttendees.count();
+  return d->attendees().count();
+}
+
+QStringList IncidenceBase::attendeeEmails() const
+{
+  QStringList emails;
+  foreach ( const Attendee::Ptr &attendee, d->attendees() ) {
+    emails.append( attendee->email() );
+  }
+  return emails;
 }
 
 void IncidenceBase::clearAttendees()
@@ -476,13 +598,15 @@ void IncidenceBase::clearAttendees()
     return;
   }
   d->mDirtyFields.insert( FieldAttendees );
-  d->mAttendees.clear();
+  d->releaseAttendees( this );
+  d->mAttendees = new IncidenceAttendees;
 }
 
 Attendee::Ptr IncidenceBase::attendeeByMail( const QString &email ) const
 {
+  const Attendee::List &attendees = d->handedOutAttendees( this );
   Attendee::List::ConstIterator it;
-  for ( it = d->mAttendees.constBegin(); it != d->mAttendees.constEnd(); ++it ) {
+  for ( it = attendees.constBegin(); it != attendees.constEnd(); ++it ) {
     if ( ( *it )->email() == email ) {
       return *it;
     }
@@ -499,8 +623,9 @@ Attendee::Ptr IncidenceBase::attendeeByMails( const QStringList &emails,
     mails.append( email );
   }
 
+  const Attendee::List &attendees = d->handedOutAttendees( this );
   Attendee::List::ConstIterator itA;
-  for ( itA = d->mAttendees.constBegin(); itA != d->mAttendees.constEnd(); ++itA ) {
+  for ( itA = attendees.constBegin(); itA != attendees.constEnd(); ++itA ) {
     for ( QStringList::const_iterator it = mails.constBegin(); it != mails.constEnd(); ++it ) {
       if ( ( *itA )->email() == ( *it ) ) {
         return *itA;
@@ -513,8 +638,9 @@ Attendee::Ptr IncidenceBase::attendeeByMails( const QStringList &emails,
 
 Attendee::Ptr IncidenceBase::attendeeByUid( const QString &uid ) const
 {
+  const Attendee::List &attendees = d->handedOutAttendees( this );
   Attendee::List::ConstIterator it;
-  for ( it = d->mAttendees.constBegin(); it != d->mAttendees.constEnd(); ++it ) {
+  for ( it = attendees.constBegin(); it != attendees.constEnd(); ++it ) {
     if ( ( *it )->uid() == uid ) {
       return *it;
     }
@@ -641,3 +767,18 @@ void IncidenceBase::setDirtyFields( const QSet<IncidenceBase::Field> &dirtyField
 IncidenceBase::IncidenceObserver::~IncidenceObserver()
 {
 }
+
+//@cond PRIVATE
+const Attendee::List &IncidenceInternals::attendees( const IncidenceBase &incidence )
+{
+  return incidence.d->attendees();
+}
+
+void IncidenceInternals::forgetHandedOutAttendees( IncidenceBase &incidence )
+{
+  const IncidenceAttendees *attendees = incidence.d->mAttendees.constData();
+  if ( attendees->mHandedOut && attendees->ref == 1 ) {
+    incidence.d->mAttendees.data()->mHandedOut = false;
+  }
+}
+//@endcond
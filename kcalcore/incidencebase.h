@@ -529,6 +529,14 @@ class KCALCORE_EXPORT IncidenceBase : public CustomProperties
     */
     int attendeeCount() const;
 
+    /**
+      Returns the email addresses of the incidence attendees, in the order of
+      the attendees. Unlike attendees(), this does not hand out the attendees,
+      so copies of the incidence can go on sharing them.
+      @since 4.11
+    */
+    QStringList attendeeEmails() const;
+
     /**
       Returns the attendee with the specified email address.
 
@@ -709,6 +717,7 @@ class KCALCORE_EXPORT IncidenceBase : public CustomProperties
 
   private:
     //@cond PRIVATE
+    friend class IncidenceInternals;
     class Private;
     Private *const d;
     //@endcond
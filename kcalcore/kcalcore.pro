@@ -14,6 +14,9 @@ DEFINES += MEEGO \
     UUID \
     KCALCORE_FOR_MEEGO
 
+# qmake CONFIG+=kcalcore_no_debug compiles out all debug output
+kcalcore_no_debug: DEFINES += KCALCORE_NO_DEBUG
+
 equals(QT_MAJOR_VERSION, 5) {
     PKGCONFIG += timed-qt5
     DEFINES += TIMED_SUPPORT
@@ -55,6 +58,7 @@ HEADERS += alarm.h \
            calfilter.h \
            calformat.h \
            calstorage.h \
+           compactdatetime_p.h \
            compat.h \
            customproperties.h \
            duration.h \
@@ -79,6 +83,7 @@ HEADERS += alarm.h \
            recurrence.h \
            recurrencerule.h \
            schedulemessage.h \
+           snapshotformat.h \
            sortablelist.h \
            sorting.h \
            supertrait.h \
@@ -93,6 +98,7 @@ HEADERS += alarm.h \
     kdedate/kcalendarsystemjalali.h \
     klibport/kcodecs.h \
     kdedate/kdatetime.h \
+    klibport/kcalcoredebug_p.h \
     klibport/meego_port.h \
     kdedate/ksystemtimezone.h \
     kdedate/ktimezone.h \
@@ -147,6 +153,7 @@ SOURCES += alarm.cpp \
            calfilter.cpp \
            calformat.cpp \
            calstorage.cpp \
+           compactdatetime_p.cpp \
            compat.cpp \
            customproperties.cpp \
            duration.cpp \
@@ -169,6 +176,7 @@ SOURCES += alarm.cpp \
            recurrence.cpp \
            recurrencerule.cpp \
            schedulemessage.cpp \
+           snapshotformat.cpp \
            sorting.cpp \
            todo.cpp \
            vcalformat.cpp \
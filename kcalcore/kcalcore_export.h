@@ -49,7 +49,7 @@
 # if defined(KDEPIM_STATIC_LIBS)
    /* No export/import for static libraries */
 #  define KCALCORE_TEST_EXPORT
-# elif defined(MAKE_KCALCORE_TEST_LIB)
+# elif defined(MAKE_KCALCORE_LIB)
    /* We are building this library */
 #  define KCALCORE_TEST_EXPORT KDE_EXPORT
 # else
@@ -57,6 +57,10 @@
 #  define KCALCORE_TEST_EXPORT KDE_IMPORT
 # endif
 #endif
+#else
+#ifndef KCALCORE_TEST_EXPORT
+# define KCALCORE_TEST_EXPORT
+#endif
 #endif /* COMPILING_TESTS */
 
 /**
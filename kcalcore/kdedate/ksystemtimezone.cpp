@@ -33,10 +33,13 @@
 #include <climits>
 #include <cstdlib>
 
+#include <QtCore/QAtomicPointer>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QFile>
 #include <QtCore/QFileInfo>
 #include <QtCore/QDir>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
 #include <QtCore/QRegExp>
 #include <QtCore/QStringList>
 #include <QtCore/QTextStream>
@@ -120,6 +123,7 @@ class KSystemTimeZonesPrivate : public KTimeZones
 public:
     static KSystemTimeZonesPrivate *instance();
     static KTzfileTimeZoneSource *tzfileSource();
+    static const KTimeZone *tzfileZone(const QString &name);
     static void setLocalZone();
     static void cleanup();
     static void readConfig(bool init);
@@ -143,6 +147,8 @@ private:
     static KSystemTimeZones *m_parent;
     static KSystemTimeZonesPrivate *m_instance;
     static KTzfileTimeZoneSource *m_tzfileSource;
+    static QHash<QString, KTimeZone*> m_tzfileZones;
+    static QMutex m_tzfileZonesMutex;
 };
 
 KTimeZone                KSystemTimeZonesPrivate::m_localZone;
@@ -153,17 +159,115 @@ KSystemTimeZoneSource   *KSystemTimeZonesPrivate::m_source = 0;
 KTzfileTimeZoneSource   *KSystemTimeZonesPrivate::m_tzfileSource = 0;
 KSystemTimeZones        *KSystemTimeZonesPrivate::m_parent = 0;
 KSystemTimeZonesPrivate *KSystemTimeZonesPrivate::m_instance = 0;
+QHash<QString, KTimeZone*> KSystemTimeZonesPrivate::m_tzfileZones;
+QMutex                   KSystemTimeZonesPrivate::m_tzfileZonesMutex;
+
+/*
+ * Lock-free lookup table of the zones parsed by tzfileZone(). Slots are
+ * only filled, while holding m_tzfileZonesMutex, and each entry is complete
+ * before it is published with an atomic store. Lookups can therefore probe
+ * the table from any thread without locking. Entries are only deleted by
+ * cleanup().
+ */
+struct KTzfileZoneEntry
+{
+    QString name;
+    const KTimeZone *zone;   // null if the zone cannot be read
+};
+
+static const int TzfileTableSize = 2048;   // a power of two well above the number of system zones
+static QAtomicPointer<KTzfileZoneEntry> s_tzfileTable[TzfileTableSize];
+static int s_tzfileTableCount = 0;
+
+static inline KTzfileZoneEntry *loadTzfileEntry(int index)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
+    return s_tzfileTable[index].loadAcquire();
+#else
+    // a plain load of a Qt 4 QAtomicPointer has no acquire barrier
+    return s_tzfileTable[index].fetchAndAddAcquire(0);
+#endif
+}
+
+/*
+ * Return the slot of @p name in the lookup table, or -1 if it is not there.
+ * If @p free is not null, it is set to the first free slot of the probe.
+ */
+static int findTzfileEntry(const QString &name, int *free = 0)
+{
+    const int mask = TzfileTableSize - 1;
+    int i = qHash(name) & mask;
+    for (int probes = 0;  probes < TzfileTableSize;  ++probes, i = (i + 1) & mask)
+    {
+        const KTzfileZoneEntry *entry = loadTzfileEntry(i);
+        if (!entry)
+        {
+            if (free)
+                *free = i;
+            return -1;
+        }
+        if (entry->name == name)
+            return i;
+    }
+    if (free)
+        *free = -1;
+    return -1;
+}
 
 KTzfileTimeZoneSource *KSystemTimeZonesPrivate::tzfileSource()
 {
+    instance();
+    QMutexLocker locker(&m_tzfileZonesMutex);
     if (!m_tzfileSource)
-    {
-        instance();
         m_tzfileSource = new KTzfileTimeZoneSource(m_zoneinfoDir);
-    }
     return m_tzfileSource;
 }
 
+/*
+ * Return the tzfile definition of a system time zone, or null if it cannot
+ * be read. Each zone is parsed only once, while holding the lock, and is never
+ * modified or copied afterwards. Its transitions can therefore be searched by
+ * any number of threads at the same time, without the need to change the TZ
+ * environment variable as the system library functions do. Once a zone has
+ * been parsed, finding it again does not take any lock.
+ */
+const KTimeZone *KSystemTimeZonesPrivate::tzfileZone(const QString &name)
+{
+    int slot = findTzfileEntry(name);
+    if (slot >= 0)
+        return loadTzfileEntry(slot)->zone;
+
+    // instance() may itself look up zones, so it must not be called with
+    // the lock held.
+    KTzfileTimeZoneSource *source = tzfileSource();
+    QMutexLocker locker(&m_tzfileZonesMutex);
+    int free;
+    slot = findTzfileEntry(name, &free);
+    if (slot >= 0)
+        return loadTzfileEntry(slot)->zone;    // parsed by another thread meanwhile
+    QHash<QString, KTimeZone*>::const_iterator it = m_tzfileZones.constFind(name);
+    if (it != m_tzfileZones.constEnd())
+        return it.value();    // the lookup table is full
+
+    KTimeZone *zone = new KTzfileTimeZone(source, name);
+    if (!zone->isValid() || !zone->data(true))
+    {
+        kDebug(161) << "tzfileZone(): cannot read" << name;
+        delete zone;
+        zone = 0;
+    }
+    m_tzfileZones.insert(name, zone);
+    if (free >= 0  &&  s_tzfileTableCount < TzfileTableSize / 2)
+    {
+        KTzfileZoneEntry *entry = new KTzfileZoneEntry;
+        entry->name = name;
+        entry->zone = zone;
+        s_tzfileTable[free].testAndSetRelease(0, entry);
+        ++s_tzfileTableCount;
+    }
+    return zone;
+}
+
 
 KSystemTimeZones::KSystemTimeZones()
   : d(0)
@@ -378,6 +482,14 @@ void KSystemTimeZonesPrivate::cleanup()
 #endif
     delete m_instance;
     delete m_source;
+    for (int i = 0;  i < TzfileTableSize;  ++i)
+    {
+        delete loadTzfileEntry(i);
+        s_tzfileTable[i].fetchAndStoreRelaxed(0);
+    }
+    s_tzfileTableCount = 0;
+    qDeleteAll(m_tzfileZones);
+    m_tzfileZones.clear();
     delete m_tzfileSource;
 }
 
@@ -513,6 +625,11 @@ int KSystemTimeZoneBackend::offsetAtZoneTime(const KTimeZone *caller, const QDat
 {
     if (!caller->isValid()  ||  !zoneDateTime.isValid()  ||  zoneDateTime.timeSpec() != Qt::LocalTime)
         return 0;
+    // Use the parsed zoneinfo file if possible, which is thread-safe
+    const KTimeZone *zone = KSystemTimeZonesPrivate::tzfileZone(caller->name());
+    if (zone)
+        return zone->offsetAtZoneTime(zoneDateTime, secondOffset);
+
     // Make this time zone the current local time zone
     const QByteArray originalZone = qgetenv("TZ");   // save the original local time zone
     QByteArray tz = caller->name().toUtf8();
@@ -580,6 +697,12 @@ int KSystemTimeZoneBackend::offsetAtZoneTime(const KTimeZone *caller, const QDat
 
 int KSystemTimeZoneBackend::offsetAtUtc(const KTimeZone *caller, const QDateTime &utcDateTime) const
 {
+    if (caller->isValid())
+    {
+        const KTimeZone *zone = KSystemTimeZonesPrivate::tzfileZone(caller->name());
+        if (zone)
+            return zone->offsetAtUtc(utcDateTime);
+    }
     return offset(caller, KTimeZone::toTime_t(utcDateTime));
 }
 
@@ -588,6 +711,11 @@ int KSystemTimeZoneBackend::offset(const KTimeZone *caller, time_t t) const
     if (!caller->isValid()  ||  t == KTimeZone::InvalidTime_t)
         return 0;
 
+    // Use the parsed zoneinfo file if possible, which is thread-safe
+    const KTimeZone *zone = KSystemTimeZonesPrivate::tzfileZone(caller->name());
+    if (zone)
+        return zone->offset(t);
+
     // Make this time zone the current local time zone
     const QByteArray originalZone = qgetenv("TZ");   // save the original local time zone
     QByteArray tz = caller->name().toUtf8();
@@ -615,12 +743,23 @@ int KSystemTimeZoneBackend::offset(const KTimeZone *caller, time_t t) const
 
 bool KSystemTimeZoneBackend::isDstAtUtc(const KTimeZone *caller, const QDateTime &utcDateTime) const
 {
+    if (caller->isValid())
+    {
+        const KTimeZone *zone = KSystemTimeZonesPrivate::tzfileZone(caller->name());
+        if (zone)
+            return zone->isDstAtUtc(utcDateTime);
+    }
     return isDst(caller, KTimeZone::toTime_t(utcDateTime));
 }
 
 bool KSystemTimeZoneBackend::isDst(const KTimeZone *caller, time_t t) const
 {
-    Q_UNUSED(caller)
+    if (caller->isValid())
+    {
+        const KTimeZone *zone = KSystemTimeZonesPrivate::tzfileZone(caller->name());
+        if (zone)
+            return zone->isDst(t);
+    }
     if (t != (time_t)-1)
     {
 #ifdef _POSIX_THREAD_SAFE_FUNCTIONS
@@ -802,6 +941,9 @@ QByteArray KSystemTimeZoneData::abbreviation(const QDateTime &utcDateTime) const
     QByteArray abbr;
     if (utcDateTime.timeSpec() != Qt::UTC)
         return abbr;
+    const KTimeZone *zone = KSystemTimeZonesPrivate::tzfileZone(QString::fromUtf8(d->TZ));
+    if (zone)
+        return zone->abbreviation(utcDateTime);
     time_t t = utcDateTime.toTime_t();
     if (t != KTimeZone::InvalidTime_t)
     {
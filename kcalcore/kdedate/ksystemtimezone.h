@@ -179,14 +179,15 @@ private:
  *
  * Typically, instances are created and accessed via the KSystemTimeZones class.
  *
- * @warning The KSystemTimeZone class uses the standard system libraries to
- * access time zone data, and its functionality is limited to what these libraries
- * provide. On many systems, dates earlier than 1970 are not handled, and on
- * non-GNU systems there is no guarantee that the time zone abbreviation returned
- * for a given date will be correct if the abbreviations applicable then were
- * not those currently in use. Consider using KSystemTimeZones::readZone() or the
- * KTzfileTimeZone class instead, which provide accurate information from the time
- * zone definition files (but are likely to incur more overhead).
+ * UTC offsets, daylight savings time and abbreviations are looked up in the
+ * zoneinfo file of the time zone, which is parsed once by KTzfileTimeZoneSource
+ * and shared by all threads. Lookups never change the TZ environment variable.
+ *
+ * @warning If the zoneinfo file cannot be read, the KSystemTimeZone class falls
+ * back to the standard system libraries to access time zone data, and its
+ * functionality is limited to what these libraries provide. On many systems,
+ * dates earlier than 1970 are not handled, and the lookups temporarily change
+ * the TZ environment variable, so they are not thread-safe.
  *
  * @short System time zone
  * @see KSystemTimeZones, KSystemTimeZoneSource, KSystemTimeZoneData, KTzfileTimeZone
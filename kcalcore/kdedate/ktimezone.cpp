@@ -325,7 +325,7 @@ public:
     float   latitude;
     float   longitude;
     mutable KTimeZoneData *data;
-    int refCount;
+    QAtomicInt refCount;  // counted atomically, zones may be shared between threads
 
 private:
     static KTimeZoneSource *mUtcSource;
@@ -418,12 +418,12 @@ KTimeZoneBackend::KTimeZoneBackend(KTimeZoneSource *source, const QString &name,
 KTimeZoneBackend::KTimeZoneBackend(const KTimeZoneBackend &other)
   : d(other.d)
 {
-    ++d->refCount;
+    d->refCount.ref();
 }
   
 KTimeZoneBackend::~KTimeZoneBackend()
 {
-    if (d && --d->refCount == 0)
+    if (d && !d->refCount.deref())
         delete d;
     d = 0;
 }
@@ -432,10 +432,10 @@ KTimeZoneBackend &KTimeZoneBackend::operator=(const KTimeZoneBackend &other)
 {
     if (d != other.d)
     {
-        if (--d->refCount == 0)
+        other.d->refCount.ref();
+        if (!d->refCount.deref())
             delete d;
         d = other.d;
-        ++d->refCount;
     }
     return *this;
 }
@@ -0,0 +1,85 @@
+/*
+  This file is part of the kcal library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#ifndef KCALCOREDEBUG_P_H
+#define KCALCOREDEBUG_P_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+
+#include <cstring>
+
+/*
+  The debug output settings of the MeeGo port, parsed from the values of
+  the KCALDEBUG and KCALDEBUG_CATEGORIES environment variables.
+
+  Any non-empty KCALDEBUG value enables all debug output. KCALDEBUG_CATEGORIES
+  is a comma separated list of categories, which enables only those, e.g.
+  KCALDEBUG_CATEGORIES=icalformat_p,recurrencerule. A category is the base
+  name of a source file without its extension.
+*/
+class KCalcoreDebugConfig
+{
+public:
+  enum Mode {
+    Off,        // no debug output
+    All,        // debug output from all source files
+    Categories  // debug output from the source files in categories only
+  };
+
+  KCalcoreDebugConfig(const QByteArray &debug, const QByteArray &categoryList)
+    : mode(Off)
+  {
+    foreach (const QByteArray &category, categoryList.split(',')) {
+      const QByteArray name = category.trimmed();
+      if (!name.isEmpty()) {
+        categories.append(name);
+      }
+    }
+    if (!categories.isEmpty()) {
+      mode = Categories;
+    } else if (!debug.isEmpty()) {
+      mode = All;
+    }
+  }
+
+  bool isEnabled(const char *filename) const
+  {
+    if (mode != Categories) {
+      return mode == All;
+    }
+
+    // the category is the base name of the file, without extension
+    const char *base = strrchr(filename, '/');
+    base = base ? base + 1 : filename;
+    const char *dot = strchr(base, '.');
+    const int length = dot ? int(dot - base) : int(strlen(base));
+    foreach (const QByteArray &category, categories) {
+      if (category.length() == length && qstrncmp(category.constData(), base, length) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  Mode mode;
+  QList<QByteArray> categories;
+};
+
+#endif
@@ -22,6 +22,7 @@
 
 #include "meego_port.h"
 #include "global.h"
+#include "kcalcoredebug_p.h"
 
 
 KLocale* KGlobal::plocale = 0;
@@ -43,12 +44,22 @@ public:
   qint64 writeData(const char *, qint64 len) { return len; }
 };
 
+// Read once when the library is loaded
+static const KCalcoreDebugConfig sDebugConfig(qgetenv("KCALDEBUG"), qgetenv("KCALDEBUG_CATEGORIES"));
+
+bool kCalcoreDebugOn = sDebugConfig.mode != KCalcoreDebugConfig::Off;
+
+bool kCalcoreDebugFileEnabled(const char *filename)
+{
+  return sDebugConfig.isEnabled(filename);
+}
+
 QDebug kCalcoreDebug(const char *filename, int line)
 {
-  static bool enabled = (getenv("KCALDEBUG") != 0 && !QString(getenv("KCALDEBUG")).isEmpty());
+  // Callers go through kDebug(), which checks kCalcoreDebugEnabled() first
   static KNoDebugStream noDebug;
 
-  if (enabled) {
+  if (kCalcoreDebugEnabled(filename)) {
     return qDebug() << filename << ":" << line << "-";
   }
 
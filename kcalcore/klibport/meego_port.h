@@ -40,12 +40,43 @@
 
 #include <cstdlib>
 
-#define kDebug(x) kCalcoreDebug(__FILE__, __LINE__)
+/*
+  kDebug() only evaluates its arguments if debug output is enabled for the
+  source file it is called from, see kCalcoreDebugEnabled(). Defining
+  KCALCORE_NO_DEBUG (qmake CONFIG+=kcalcore_no_debug) removes debug output
+  at compile time; the arguments are still compiled, but never evaluated.
+*/
+#ifdef KCALCORE_NO_DEBUG
+#define kDebug(x) while (false) kCalcoreDebug(__FILE__, __LINE__)
+#else
+#define kDebug(x) for (bool kcalcoreDebugOn = kCalcoreDebugEnabled(__FILE__); \
+                       kcalcoreDebugOn; kcalcoreDebugOn = false)              \
+                    kCalcoreDebug(__FILE__, __LINE__)
+#endif
 #define kWarning(x) qWarning() << __FILE__":" << __LINE__ << "-"
 #define kError(x) qCritical() << __FILE__":" << __LINE__ << "-"
 
 QDebug kCalcoreDebug(const char * filename, int line);
 
+/*
+  Whether any debug output is enabled, read from the environment once when
+  the library is loaded. Any non-empty KCALDEBUG value enables all debug
+  output; KCALDEBUG_CATEGORIES=icalformat_p,recurrencerule enables only the
+  output of the listed source files (base names without extension).
+*/
+extern bool kCalcoreDebugOn;
+
+bool kCalcoreDebugFileEnabled(const char *filename);
+
+/*
+  Returns whether debug output is enabled for a source file. With debug
+  output off this is a single test of kCalcoreDebugOn.
+*/
+inline bool kCalcoreDebugEnabled(const char *filename)
+{
+  return kCalcoreDebugOn && kCalcoreDebugFileEnabled(filename);
+}
+
 
 class KStringHandler 
 {
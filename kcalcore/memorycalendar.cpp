@@ -33,12 +33,807 @@
  */
 
 #include "memorycalendar.h"
+#include "compactdatetime_p.h"
+#include "incidence_p.h"
 
 #include <KDebug>
 #include <QDate>
+#include <QMap>
+#include <QSet>
+#include <QVector>
+#include <QtAlgorithms>
+
+#include <algorithm>  // for std::inplace_merge() and the heap functions
+#include <limits>
 
 using namespace KCalCore;
 
+//@cond PRIVATE
+/**
+  An index over the time spans of incidences, used to answer range queries
+  without visiting every incidence of the calendar.
+
+  Every incidence with a bounded recurrence is stored as a span ranging from
+  its first occurrence to the end of its last occurrence, in UTC seconds.
+  The spans are kept in a treap ordered by their start: a binary search
+  tree balanced by random node priorities. Each node knows the largest span
+  end found in its subtree, so an overlap query can skip whole subtrees (a
+  classic augmented interval tree). Inserting or removing a span only
+  updates the nodes on its path, in O(log N) expected time.
+
+  Incidences recurring forever, or without a valid start, cannot be put in
+  the tree; they are kept in a separate bucket which is only tested against
+  the start of their span.
+
+  Spans are resolved lazily: inserted and updated incidences are queued and
+  only processed by the next query, so that bulk loading stays cheap.
+
+  The spans are widened by a safety margin, so the result of a query is a
+  superset of the incidences occurring in the range. Callers still have to
+  check each candidate, e.g. with recursOn().
+*/
+class IncidenceSpanIndex
+{
+  public:
+    IncidenceSpanIndex() : mRoot( -1 ), mSeed( 0x9e3779b9 ) {}
+
+    void insert( const Incidence::Ptr &incidence );
+    void remove( const Incidence::Ptr &incidence );
+    void clear();
+
+    /**
+      Returns the incidences whose span may overlap [@p from, @p to].
+      Both bounds are in UTC seconds, see utcSecs().
+    */
+    Incidence::List overlapping( qint64 from, qint64 to );
+
+  private:
+    struct Node {
+      qint64 start;
+      qint64 end;
+      qint64 maxEnd;          // largest end in the subtree of this node
+      Incidence::Ptr incidence;
+      int left;
+      int right;
+      uint priority;
+    };
+
+    // Nodes are ordered by their start, and equal starts by node number
+    bool before( int a, int b ) const
+    {
+      return mNodes[a].start < mNodes[b].start ||
+        ( mNodes[a].start == mNodes[b].start && a < b );
+    }
+
+    void flush();
+    void update( int node );
+    int insertNode( int root, int node );
+    int removeNode( int root, int node );
+    int merge( int left, int right );
+    void collect( int node, qint64 from, qint64 to, Incidence::List &result ) const;
+    static bool span( const Incidence::Ptr &incidence, qint64 &start, qint64 &end );
+
+    QVector<Node> mNodes;                       // nodes of the tree, and free slots
+    QVector<int> mFree;                         // unused slots of mNodes
+    int mRoot;
+    uint mSeed;                                 // state of the priority generator
+    QHash<Incidence::Ptr, int> mNodeOf;         // node of incidences in the tree
+    QHash<Incidence::Ptr, qint64> mOpenEnded;   // span start of unbounded incidences
+    QSet<Incidence::Ptr> mPending;              // incidences waiting to be indexed
+};
+
+// Larger than any UTC offset plus the length of an all-day occurrence, so
+// that spans computed in UTC also cover dates taken in any other time spec.
+static const qint64 SpanMargin = 2 * 86400;
+
+bool IncidenceSpanIndex::span( const Incidence::Ptr &incidence, qint64 &start, qint64 &end )
+{
+  const KDateTime dtStart = incidence->dtStart();
+  if ( !dtStart.isValid() ) {
+    return false;
+  }
+
+  KDateTime last = incidence->dateTime( Incidence::RoleEnd );
+  if ( !last.isValid() || last < dtStart ) {
+    last = dtStart;
+  }
+  start = utcSecs( dtStart );
+
+  if ( incidence->recurs() ) {
+    const Recurrence *recurrence = IncidenceInternals::recurrence( *incidence );
+    const KDateTime lastStart = recurrence->endDateTime();
+    if ( !lastStart.isValid() ) {
+      // recurs forever
+      return false;
+    }
+    last = lastStart.addSecs( dtStart.secsTo( last ) );
+
+    // RDATEs are not required to follow DTSTART
+    const DateList rDates = recurrence->rDates();
+    if ( !rDates.isEmpty() ) {
+      start = qMin( start, utcSecs( KDateTime( rDates.first(), KDateTime::UTC ) ) );
+    }
+    const DateTimeList rDateTimes = recurrence->rDateTimes();
+    if ( !rDateTimes.isEmpty() ) {
+      start = qMin( start, utcSecs( rDateTimes.first() ) );
+    }
+  }
+
+  start -= SpanMargin;
+  end = utcSecs( last ) + SpanMargin;
+  return true;
+}
+
+void IncidenceSpanIndex::insert( const Incidence::Ptr &incidence )
+{
+  remove( incidence );
+  mPending.insert( incidence );
+}
+
+void IncidenceSpanIndex::remove( const Incidence::Ptr &incidence )
+{
+  if ( mPending.remove( incidence ) || mOpenEnded.remove( incidence ) ) {
+    return;
+  }
+
+  QHash<Incidence::Ptr, int>::iterator it = mNodeOf.find( incidence );
+  if ( it == mNodeOf.end() ) {
+    return;
+  }
+  const int node = it.value();
+  mNodeOf.erase( it );
+  mRoot = removeNode( mRoot, node );
+  mNodes[node].incidence.clear();
+  mFree.append( node );
+}
+
+void IncidenceSpanIndex::clear()
+{
+  mNodes.clear();
+  mFree.clear();
+  mRoot = -1;
+  mNodeOf.clear();
+  mOpenEnded.clear();
+  mPending.clear();
+}
+
+void IncidenceSpanIndex::flush()
+{
+  QSet<Incidence::Ptr>::const_iterator it;
+  for ( it = mPending.constBegin(); it != mPending.constEnd(); ++it ) {
+    Node n;
+    if ( span( *it, n.start, n.end ) ) {
+      n.maxEnd = n.end;
+      n.incidence = *it;
+      n.left = n.right = -1;
+      // xorshift; the priorities only need to look random to the tree shape
+      mSeed ^= mSeed << 13;
+      mSeed ^= mSeed >> 17;
+      mSeed ^= mSeed << 5;
+      n.priority = mSeed;
+      int node;
+      if ( mFree.isEmpty() ) {
+        node = mNodes.count();
+        mNodes.append( n );
+      } else {
+        node = mFree.last();
+        mFree.removeLast();
+        mNodes[node] = n;
+      }
+      mRoot = insertNode( mRoot, node );
+      mNodeOf.insert( *it, node );
+    } else {
+      const KDateTime dtStart = ( *it )->dtStart();
+      mOpenEnded.insert( *it, dtStart.isValid() ?
+                         utcSecs( dtStart ) - SpanMargin :
+                         std::numeric_limits<qint64>::min() );
+    }
+  }
+  mPending.clear();
+}
+
+void IncidenceSpanIndex::update( int node )
+{
+  Node &n = mNodes[node];
+  n.maxEnd = n.end;
+  if ( n.left >= 0 ) {
+    n.maxEnd = qMax( n.maxEnd, mNodes[n.left].maxEnd );
+  }
+  if ( n.right >= 0 ) {
+    n.maxEnd = qMax( n.maxEnd, mNodes[n.right].maxEnd );
+  }
+}
+
+int IncidenceSpanIndex::insertNode( int root, int node )
+{
+  if ( root < 0 ) {
+    return node;
+  }
+  if ( before( node, root ) ) {
+    const int left = insertNode( mNodes[root].left, node );
+    mNodes[root].left = left;
+    if ( mNodes[left].priority > mNodes[root].priority ) {
+      // rotate right
+      mNodes[root].left = mNodes[left].right;
+      mNodes[left].right = root;
+      update( root );
+      update( left );
+      return left;
+    }
+  } else {
+    const int right = insertNode( mNodes[root].right, node );
+    mNodes[root].right = right;
+    if ( mNodes[right].priority > mNodes[root].priority ) {
+      // rotate left
+      mNodes[root].right = mNodes[right].left;
+      mNodes[right].left = root;
+      update( root );
+      update( right );
+      return right;
+    }
+  }
+  update( root );
+  return root;
+}
+
+int IncidenceSpanIndex::removeNode( int root, int node )
+{
+  if ( root < 0 ) {
+    return root;
+  }
+  if ( root == node ) {
+    return merge( mNodes[root].left, mNodes[root].right );
+  }
+  if ( before( node, root ) ) {
+    mNodes[root].left = removeNode( mNodes[root].left, node );
+  } else {
+    mNodes[root].right = removeNode( mNodes[root].right, node );
+  }
+  update( root );
+  return root;
+}
+
+int IncidenceSpanIndex::merge( int left, int right )
+{
+  // every node of left comes before every node of right
+  if ( left < 0 ) {
+    return right;
+  }
+  if ( right < 0 ) {
+    return left;
+  }
+  if ( mNodes[left].priority > mNodes[right].priority ) {
+    mNodes[left].right = merge( mNodes[left].right, right );
+    update( left );
+    return left;
+  }
+  mNodes[right].left = merge( left, mNodes[right].left );
+  update( right );
+  return right;
+}
+
+void IncidenceSpanIndex::collect( int node, qint64 from, qint64 to,
+                                  Incidence::List &result ) const
+{
+  if ( node < 0 || mNodes[node].maxEnd < from ) {
+    // nothing in this subtree lasts until the start of the range
+    return;
+  }
+  const Node &n = mNodes[node];
+  collect( n.left, from, to, result );
+  if ( n.start > to ) {
+    // this span and all the following ones start after the range
+    return;
+  }
+  if ( n.end >= from ) {
+    result.append( n.incidence );
+  }
+  collect( n.right, from, to, result );
+}
+
+Incidence::List IncidenceSpanIndex::overlapping( qint64 from, qint64 to )
+{
+  flush();
+
+  Incidence::List result;
+  collect( mRoot, from, to, result );
+
+  QHash<Incidence::Ptr, qint64>::const_iterator it;
+  for ( it = mOpenEnded.constBegin(); it != mOpenEnded.constEnd(); ++it ) {
+    if ( it.value() <= to ) {
+      result.append( it.key() );
+    }
+  }
+  return result;
+}
+
+/**
+  An index of incidences by date, kept as one contiguous array sorted by
+  Julian day so that both single dates and date ranges are found with a
+  binary search followed by an ordered walk.
+
+  New entries are appended to an unsorted tail, which is sorted and merged
+  into the array by the next lookup. Entries are removed by incidence, so the
+  index stays consistent even if the incidence changed before it was removed.
+*/
+class IncidenceDayIndex
+{
+  public:
+    IncidenceDayIndex() : mSorted( 0 ) {}
+
+    void insert( const QDate &date, const Incidence::Ptr &incidence );
+    void remove( const Incidence::Ptr &incidence );
+    void clear();
+
+    /**
+      Returns the incidences indexed from @p from to @p to inclusive, ordered
+      by date. An invalid date leaves the range open on that side.
+    */
+    Incidence::List values( const QDate &from, const QDate &to );
+
+  private:
+    struct Entry {
+      qint64 day;
+      Incidence::Ptr incidence;
+
+      bool operator<( const Entry &other ) const
+      {
+        return day < other.day;
+      }
+    };
+
+    void merge();
+
+    QVector<Entry> mEntries;             // sorted by day up to mSorted
+    int mSorted;
+    QHash<Incidence::Ptr, qint64> mDays; // day each incidence is indexed on
+};
+
+void IncidenceDayIndex::insert( const QDate &date, const Incidence::Ptr &incidence )
+{
+  remove( incidence );
+
+  Entry e;
+  e.day = date.toJulianDay();
+  e.incidence = incidence;
+  mEntries.append( e );
+  mDays.insert( incidence, e.day );
+}
+
+void IncidenceDayIndex::remove( const Incidence::Ptr &incidence )
+{
+  QHash<Incidence::Ptr, qint64>::iterator it = mDays.find( incidence );
+  if ( it == mDays.end() ) {
+    return;
+  }
+
+  Entry key;
+  key.day = it.value();
+  mDays.erase( it );
+
+  QVector<Entry>::iterator sortedEnd = mEntries.begin() + mSorted;
+  QVector<Entry>::iterator pos = qLowerBound( mEntries.begin(), sortedEnd, key );
+  for ( ; pos != sortedEnd && pos->day == key.day; ++pos ) {
+    if ( pos->incidence == incidence ) {
+      mEntries.erase( pos );
+      --mSorted;
+      return;
+    }
+  }
+  for ( pos = sortedEnd; pos != mEntries.end(); ++pos ) {
+    if ( pos->incidence == incidence ) {
+      mEntries.erase( pos );
+      return;
+    }
+  }
+}
+
+void IncidenceDayIndex::clear()
+{
+  mEntries.clear();
+  mDays.clear();
+  mSorted = 0;
+}
+
+void IncidenceDayIndex::merge()
+{
+  if ( mSorted < mEntries.count() ) {
+    QVector<Entry>::iterator sortedEnd = mEntries.begin() + mSorted;
+    qStableSort( sortedEnd, mEntries.end() );
+    std::inplace_merge( mEntries.begin(), sortedEnd, mEntries.end() );
+    mSorted = mEntries.count();
+  }
+}
+
+Incidence::List IncidenceDayIndex::values( const QDate &from, const QDate &to )
+{
+  merge();
+
+  Incidence::List result;
+  QVector<Entry>::const_iterator it = mEntries.constBegin();
+  if ( from.isValid() ) {
+    Entry key;
+    key.day = from.toJulianDay();
+    it = qLowerBound( mEntries.constBegin(), mEntries.constEnd(), key );
+  }
+  const qint64 last = to.isValid() ? qint64( to.toJulianDay() ) :
+                                     std::numeric_limits<qint64>::max();
+  for ( ; it != mEntries.constEnd() && it->day <= last; ++it ) {
+    result.append( it->incidence );
+  }
+  return result;
+}
+
+/**
+  A schedule of the alarms of a calendar, used to find the next alarms to go
+  off without visiting every incidence of the calendar.
+
+  The schedule has a cursor, which is the time up to which alarms were
+  reported by due(). Every enabled alarm is kept in a binary min-heap keyed by
+  the first time it triggers after the cursor. Reporting due alarms pops them
+  off the heap and pushes them back with their following trigger time, so a
+  poll costs O(log N) per alarm which goes off.
+
+  Incidences are scheduled lazily: inserted and updated incidences are queued
+  and only processed by the next query. Entries of removed or updated
+  incidences stay in the heap until they reach the top; they are recognized by
+  their generation, which no longer matches the one of their incidence.
+*/
+class AlarmSchedule
+{
+  public:
+    AlarmSchedule() : mGeneration( 0 ), mLive( 0 ) {}
+
+    void insert( const Incidence::Ptr &incidence );
+    void remove( const Incidence::Ptr &incidence );
+    void clear();
+
+    /**
+      Returns the alarms which trigger after the cursor and at or before
+      @p now, and moves the cursor to @p now.
+    */
+    Alarm::List due( const KDateTime &now );
+
+    /**
+      Returns the next @p limit alarms to trigger after @p after.
+    */
+    MemoryCalendar::AlarmTriggerList next( const KDateTime &after, int limit );
+
+  private:
+    struct Entry {
+      qint64 time;                // trigger time, in UTC seconds
+      CompactDateTime trigger;
+      Alarm::Ptr alarm;
+      int index;                  // of the alarm in the incidence's alarms
+      Incidence::Ptr incidence;
+      uint generation;
+    };
+
+    struct Scheduled {
+      uint generation;
+      int entries;                // entries of this generation in the heap
+    };
+
+    static bool later( const Entry &a, const Entry &b )
+    {
+      return a.time > b.time;
+    }
+
+    static bool setTrigger( Entry &entry, const KDateTime &trigger )
+    {
+      if ( !trigger.isValid() ) {
+        return false;
+      }
+      entry.trigger = CompactDateTime( trigger );
+      entry.time = utcSecs( trigger );
+      return true;
+    }
+
+    static KDateTime nextTrigger( const Alarm::Ptr &alarm, const Incidence::Ptr &incidence,
+                                  const KDateTime &preTime );
+    static Alarm::List activeAlarms( const Incidence::Ptr &incidence );
+    static Alarm::Ptr handOut( const Entry &entry );
+
+    bool isLive( const Entry &entry ) const;
+    void push( const Entry &entry );
+    void reschedule( Entry entry, const KDateTime &preTime );
+    void rewind( const KDateTime &cursor );
+    void flush();
+    void compact();
+
+    QVector<Entry> mHeap;                       // binary min-heap by Entry::time
+    QHash<Incidence::Ptr, Scheduled> mScheduled;
+    QSet<Incidence::Ptr> mPending;              // incidences waiting to be scheduled
+    KDateTime mCursor;                          // invalid until the first query
+    uint mGeneration;
+    int mLive;                                  // entries in the heap which are not stale
+};
+
+KDateTime AlarmSchedule::nextTrigger( const Alarm::Ptr &alarm, const Incidence::Ptr &incidence,
+                                      const KDateTime &preTime )
+{
+  if ( !alarm->enabled() ) {
+    return KDateTime();
+  }
+  if ( alarm->hasTime() || !incidence->recurs() ) {
+    return alarm->nextRepetition( preTime );
+  }
+
+  // Alarm time is defined by an offset from the incidence start or end time,
+  // which applies to every recurrence.
+  const KDateTime dtStart = incidence->dtStart();
+  const KDateTime first =
+    alarm->hasEndOffset() ?
+    alarm->endOffset().end( incidence->dateTime( Incidence::RoleAlarmEndOffset ) ) :
+    alarm->startOffset().end( dtStart );
+  const Duration offset( dtStart, first );
+  const Duration snooze = alarm->snoozeTime();
+  const int interval = snooze.value();
+
+  // Start with the first recurrence whose last repetition is after preTime
+  const Recurrence *recurrence = IncidenceInternals::recurrence( *incidence );
+  KDateTime dt = recurrence->getNextDateTime( ( -alarm->duration() ).end( ( -offset ).end( preTime ) ) );
+  for ( ; dt.isValid(); dt = recurrence->getNextDateTime( dt ) ) {
+    const KDateTime at = offset.end( dt );
+    if ( at > preTime ) {
+      return at;
+    }
+    if ( !alarm->repeatCount() || interval <= 0 ) {
+      continue;
+    }
+    qint64 repetition;
+    if ( snooze.isDaily() ) {
+      int daysTo = at.daysTo( preTime );
+      if ( !preTime.isDateOnly() && preTime.time() <= at.time() ) {
+        --daysTo;
+      }
+      repetition = daysTo / interval + 1;
+    } else {
+      repetition = at.secsTo_long( preTime ) / interval + 1;
+    }
+    if ( repetition <= alarm->repeatCount() ) {
+      return snooze.isDaily() ? at.addDays( int( repetition * interval ) )
+                              : at.addSecs( repetition * interval );
+    }
+  }
+  return KDateTime();
+}
+
+Alarm::List AlarmSchedule::activeAlarms( const Incidence::Ptr &incidence )
+{
+  // like alarms(), completed to-dos don't go off
+  if ( incidence->type() == Incidence::TypeTodo &&
+       incidence.staticCast<Todo>()->isCompleted() ) {
+    return Alarm::List();
+  }
+  // only read them, so that copies of the incidence keep sharing them
+  return IncidenceInternals::alarms( *incidence );
+}
+
+Alarm::Ptr AlarmSchedule::handOut( const Entry &entry )
+{
+  // the caller may change the alarm
+  return IncidenceInternals::handOutAlarm( *entry.incidence, entry.index );
+}
+
+bool AlarmSchedule::isLive( const Entry &entry ) const
+{
+  QHash<Incidence::Ptr, Scheduled>::const_iterator it = mScheduled.constFind( entry.incidence );
+  return it != mScheduled.constEnd() && it.value().generation == entry.generation;
+}
+
+void AlarmSchedule::push( const Entry &entry )
+{
+  mHeap.append( entry );
+  std::push_heap( mHeap.begin(), mHeap.end(), later );
+}
+
+void AlarmSchedule::reschedule( Entry entry, const KDateTime &preTime )
+{
+  if ( setTrigger( entry, nextTrigger( entry.alarm, entry.incidence, preTime ) ) ) {
+    push( entry );
+  } else {
+    // the alarm has gone off for the last time
+    --mScheduled[entry.incidence].entries;
+    --mLive;
+  }
+}
+
+void AlarmSchedule::insert( const Incidence::Ptr &incidence )
+{
+  remove( incidence );
+  mPending.insert( incidence );
+}
+
+void AlarmSchedule::remove( const Incidence::Ptr &incidence )
+{
+  if ( mPending.remove( incidence ) ) {
+    return;
+  }
+  QHash<Incidence::Ptr, Scheduled>::iterator it = mScheduled.find( incidence );
+  if ( it != mScheduled.end() ) {
+    // its entries become stale
+    mLive -= it.value().entries;
+    mScheduled.erase( it );
+  }
+}
+
+void AlarmSchedule::clear()
+{
+  mHeap.clear();
+  mScheduled.clear();
+  mPending.clear();
+  mCursor = KDateTime();
+  mLive = 0;
+}
+
+void AlarmSchedule::rewind( const KDateTime &cursor )
+{
+  QHash<Incidence::Ptr, Scheduled>::const_iterator it;
+  for ( it = mScheduled.constBegin(); it != mScheduled.constEnd(); ++it ) {
+    mPending.insert( it.key() );
+  }
+  mHeap.clear();
+  mScheduled.clear();
+  mLive = 0;
+  mCursor = cursor;
+}
+
+void AlarmSchedule::flush()
+{
+  QSet<Incidence::Ptr>::const_iterator it;
+  for ( it = mPending.constBegin(); it != mPending.constEnd(); ++it ) {
+    const Incidence::Ptr incidence = *it;
+    Scheduled scheduled;
+    scheduled.generation = ++mGeneration;
+    scheduled.entries = 0;
+
+    const Alarm::List alarms = activeAlarms( incidence );
+    for ( int i = 0; i < alarms.count(); ++i ) {
+      Entry entry;
+      if ( setTrigger( entry, nextTrigger( alarms[i], incidence, mCursor ) ) ) {
+        entry.alarm = alarms[i];
+        entry.index = i;
+        entry.incidence = incidence;
+        entry.generation = scheduled.generation;
+        push( entry );
+        ++scheduled.entries;
+      }
+    }
+    mScheduled.insert( incidence, scheduled );
+    mLive += scheduled.entries;
+  }
+  mPending.clear();
+}
+
+void AlarmSchedule::compact()
+{
+  // Drop stale entries once they make up most of the heap
+  if ( mHeap.count() <= 2 * mLive + 64 ) {
+    return;
+  }
+  QVector<Entry> live;
+  live.reserve( mLive );
+  QVector<Entry>::const_iterator it;
+  for ( it = mHeap.constBegin(); it != mHeap.constEnd(); ++it ) {
+    if ( isLive( *it ) ) {
+      live.append( *it );
+    }
+  }
+  std::make_heap( live.begin(), live.end(), later );
+  mHeap = live;
+}
+
+Alarm::List AlarmSchedule::due( const KDateTime &now )
+{
+  if ( !mCursor.isValid() || now < mCursor ) {
+    // start (over) with the alarms triggering right now
+    rewind( now.addSecs( -1 ) );
+  }
+  flush();
+
+  Alarm::List result;
+  const qint64 end = utcSecs( now );
+  while ( !mHeap.isEmpty() && mHeap.first().time <= end ) {
+    std::pop_heap( mHeap.begin(), mHeap.end(), later );
+    const Entry entry = mHeap.last();
+    mHeap.removeLast();
+    if ( isLive( entry ) ) {
+      result.append( handOut( entry ) );
+      reschedule( entry, now );
+    }
+  }
+  mCursor = now;
+  compact();
+  return result;
+}
+
+MemoryCalendar::AlarmTriggerList AlarmSchedule::next( const KDateTime &after, int limit )
+{
+  MemoryCalendar::AlarmTriggerList result;
+  if ( limit <= 0 ) {
+    return result;
+  }
+  if ( !mCursor.isValid() ) {
+    rewind( after );
+  }
+  flush();
+
+  QVector<Entry> found;
+  if ( after < mCursor ) {
+    // The heap only knows about triggers after the cursor, so look at every
+    // alarm. This is slow, but pollers don't look back in time.
+    QHash<Incidence::Ptr, Scheduled>::const_iterator it;
+    for ( it = mScheduled.constBegin(); it != mScheduled.constEnd(); ++it ) {
+      const Alarm::List alarms = activeAlarms( it.key() );
+      for ( int i = 0; i < alarms.count(); ++i ) {
+        Entry entry;
+        if ( setTrigger( entry, nextTrigger( alarms[i], it.key(), after ) ) ) {
+          entry.alarm = alarms[i];
+          entry.index = i;
+          entry.incidence = it.key();
+          found.append( entry );
+        }
+      }
+    }
+    std::make_heap( found.begin(), found.end(), later );
+    while ( !found.isEmpty() && result.count() < limit ) {
+      std::pop_heap( found.begin(), found.end(), later );
+      MemoryCalendar::AlarmTrigger trigger;
+      trigger.time = found.last().trigger.toKDateTime();
+      trigger.alarm = handOut( found.last() );
+      trigger.incidence = found.last().incidence;
+      result.append( trigger );
+      found.removeLast();
+    }
+    return result;
+  }
+
+  // Walk the heap in order without modifying it: the frontier holds the
+  // nodes whose parents were visited, and the entries which trigger between
+  // the cursor and 'after' with their trigger time after 'after' (stored
+  // with negative indexes). Since a node never triggers before its parent,
+  // entries come out in order.
+  const qint64 from = utcSecs( after );
+  QMultiMap<qint64, int> frontier;
+  if ( !mHeap.isEmpty() ) {
+    frontier.insert( mHeap.first().time, 0 );
+  }
+  while ( !frontier.isEmpty() && result.count() < limit ) {
+    QMultiMap<qint64, int>::iterator first = frontier.begin();
+    const int index = first.value();
+    frontier.erase( first );
+
+    Entry entry;
+    if ( index >= 0 ) {
+      for ( int child = 2 * index + 1; child <= 2 * index + 2 && child < mHeap.count(); ++child ) {
+        frontier.insert( mHeap[child].time, child );
+      }
+      entry = mHeap[index];
+      if ( !isLive( entry ) ) {
+        continue;
+      }
+      if ( entry.time <= from ) {
+        if ( setTrigger( entry, nextTrigger( entry.alarm, entry.incidence, after ) ) ) {
+          found.append( entry );
+          frontier.insert( entry.time, -found.count() );
+        }
+        continue;
+      }
+    } else {
+      entry = found[-index - 1];
+    }
+
+    MemoryCalendar::AlarmTrigger trigger;
+    trigger.time = entry.trigger.toKDateTime();
+    trigger.alarm = handOut( entry );
+    trigger.incidence = entry.incidence;
+    result.append( trigger );
+  }
+  return result;
+}
+//@endcond
+
 /**
   Private class that helps to provide binary compatibility between releases.
   @internal
@@ -76,13 +871,31 @@ class KCalCore::MemoryCalendar::Private
      * indexed by start/due date.
      *
      * The QMap key is the incidence->type().
-     * The QMultiHash key is the dtStart/dtDue().toString()
+     * Within a type, incidences are ordered by the date of dtStart/dtDue().
      *
      * Note: We had 3 variables, mJournalsForDate, mTodosForDate and mEventsForDate
      * but i merged them into one (indexed by type) because it simplifies code using
      * it. No need to if else based on type.
      */
-    QMap<IncidenceBase::IncidenceType, QMultiHash<QString, IncidenceBase::Ptr> > mIncidencesForDate;
+    QMap<IncidenceBase::IncidenceType, IncidenceDayIndex> mIncidencesForDate;
+
+    /**
+     * To-dos which cannot be found by their due date in mIncidencesForDate
+     * alone: recurring to-dos and to-dos without a due date.
+     */
+    QSet<Incidence::Ptr> mUndatedTodos;
+
+    /**
+     * Contains all events, indexed by the time span they cover.
+     * Used for range queries, to avoid checking the recurrence of every event.
+     */
+    IncidenceSpanIndex mEventSpans;
+
+    /**
+     * Contains the alarms of all events and to-dos, ordered by the time
+     * they go off next.
+     */
+    AlarmSchedule mAlarms;
 
     void insertIncidence( Incidence::Ptr incidence );
 
@@ -96,6 +909,10 @@ class KCalCore::MemoryCalendar::Private
 
     void deleteAllIncidences( const IncidenceBase::IncidenceType type );
 
+    void indexIncidence( const Incidence::Ptr &incidence );
+
+    void unindexIncidence( const Incidence::Ptr &incidence );
+
 };
 //@endcond
 
@@ -146,10 +963,7 @@ bool MemoryCalendar::deleteIncidence( const Incidence::Ptr &incidence )
     notifyIncidenceDeleted( incidence );
     d->mDeletedIncidences[type].insert( uid, incidence );
 
-    const KDateTime dt = incidence->dateTime( Incidence::RoleCalendarHashing );
-    if ( dt.isValid() ) {
-      d->mIncidencesForDate[type].remove( dt.date().toString(), incidence );
-    }
+    d->unindexIncidence( incidence );
     // Delete child-incidences.
     if ( !incidence->hasRecurrenceId() ) {
       deleteIncidenceInstances( incidence );
@@ -188,12 +1002,18 @@ void MemoryCalendar::Private::deleteAllIncidences( const Incidence::IncidenceTyp
   while ( i.hasNext() ) {
     i.next();
     q->notifyIncidenceDeleted( i.value() );
+    mAlarms.remove( i.value() );
     // suppress update notifications for the relation removal triggered
     // by the following deletions
     i.value()->startUpdates();
   }
   mIncidences[incidenceType].clear();
   mIncidencesForDate[incidenceType].clear();
+  if ( incidenceType == Incidence::TypeEvent ) {
+    mEventSpans.clear();
+  } else if ( incidenceType == Incidence::TypeTodo ) {
+    mUndatedTodos.clear();
+  }
 }
 
 Incidence::Ptr MemoryCalendar::Private::incidence( const QString &uid,
@@ -239,16 +1059,42 @@ MemoryCalendar::Private::deletedIncidence( const QString &uid,
   return Incidence::Ptr();
 }
 
+void MemoryCalendar::Private::indexIncidence( const Incidence::Ptr &incidence )
+{
+  const Incidence::IncidenceType type = incidence->type();
+  const KDateTime dt = incidence->dateTime( Incidence::RoleCalendarHashing );
+  if ( dt.isValid() ) {
+    mIncidencesForDate[type].insert( dt.date(), incidence );
+  }
+  if ( type == Incidence::TypeEvent ) {
+    mEventSpans.insert( incidence );
+  } else if ( type == Incidence::TypeTodo && ( !dt.isValid() || incidence->recurs() ) ) {
+    mUndatedTodos.insert( incidence );
+  }
+  if ( type == Incidence::TypeEvent || type == Incidence::TypeTodo ) {
+    mAlarms.insert( incidence );
+  }
+}
+
+void MemoryCalendar::Private::unindexIncidence( const Incidence::Ptr &incidence )
+{
+  const Incidence::IncidenceType type = incidence->type();
+  mIncidencesForDate[type].remove( incidence );
+  if ( type == Incidence::TypeEvent ) {
+    mEventSpans.remove( incidence );
+  } else if ( type == Incidence::TypeTodo ) {
+    mUndatedTodos.remove( incidence );
+  }
+  mAlarms.remove( incidence );
+}
+
 void MemoryCalendar::Private::insertIncidence( Incidence::Ptr incidence )
 {
   const QString uid = incidence->uid();
   const Incidence::IncidenceType type = incidence->type();
   if ( !mIncidences[type].contains( uid, incidence ) ) {
     mIncidences[type].insert( uid, incidence );
-    const KDateTime dt = incidence->dateTime( Incidence::RoleCalendarHashing );
-    if ( dt.isValid() ) {
-      mIncidencesForDate[type].insert( dt.date().toString(), incidence );
-    }
+    indexIncidence( incidence );
 
   } else {
 #ifndef NDEBUG
@@ -384,21 +1230,21 @@ Todo::List MemoryCalendar::rawTodosForDate( const QDate &date ) const
   Todo::List todoList;
   Todo::Ptr t;
 
+  if ( !date.isValid() ) {
+    return todoList;
+  }
+
   KDateTime::Spec ts = timeSpec();
-  const QString dateStr = date.toString();
-  QMultiHash<QString, IncidenceBase::Ptr >::const_iterator it =
-    d->mIncidencesForDate[Incidence::TypeTodo].constFind( dateStr );
-  while ( it != d->mIncidencesForDate[Incidence::TypeTodo].constEnd() && it.key() == dateStr ) {
-    t = it.value().staticCast<Todo>();
-    todoList.append( t );
-    ++it;
+  const Incidence::List dated = d->mIncidencesForDate[Incidence::TypeTodo].values( date, date );
+  Incidence::List::const_iterator it;
+  for ( it = dated.constBegin(); it != dated.constEnd(); ++it ) {
+    todoList.append( ( *it ).staticCast<Todo>() );
   }
 
-  // Iterate over all todos. Look for recurring todoss that occur on this date
-  QHashIterator<QString, Incidence::Ptr >i( d->mIncidences[Incidence::TypeTodo] );
-  while ( i.hasNext() ) {
-    i.next();
-    t = i.value().staticCast<Todo>();
+  // Look for recurring todos that occur on this date
+  QSet<Incidence::Ptr>::const_iterator i;
+  for ( i = d->mUndatedTodos.constBegin(); i != d->mUndatedTodos.constEnd(); ++i ) {
+    t = ( *i ).staticCast<Todo>();
     if ( t->recurs() ) {
       if ( t->recursOn( date, ts ) ) {
         todoList.append( t );
@@ -421,12 +1267,29 @@ Todo::List MemoryCalendar::rawTodos( const QDate &start,
   KDateTime st( start, ts );
   KDateTime nd( end, ts );
 
-  // Get todos
-  QHashIterator<QString, Incidence::Ptr >i( d->mIncidences[Incidence::TypeTodo] );
+  // Non-recurring todos with a due date are found by walking the date index.
+  // The due dates are indexed in their own time spec, so look a bit beyond
+  // the requested range and check the exact times below.
+  // Recurring todos and todos without a due date are all checked.
+  Incidence::List candidates;
+  const Incidence::List dated =
+    d->mIncidencesForDate[Incidence::TypeTodo].values(
+      start.isValid() ? start.addDays( -2 ) : QDate(),
+      end.isValid() ? end.addDays( 2 ) : QDate() );
+  Incidence::List::const_iterator i;
+  for ( i = dated.constBegin(); i != dated.constEnd(); ++i ) {
+    if ( !( *i )->recurs() ) {
+      candidates.append( *i );
+    }
+  }
+  QSet<Incidence::Ptr>::const_iterator u;
+  for ( u = d->mUndatedTodos.constBegin(); u != d->mUndatedTodos.constEnd(); ++u ) {
+    candidates.append( *u );
+  }
+
   Todo::Ptr todo;
-  while ( i.hasNext() ) {
-    i.next();
-    todo = i.value().staticCast<Todo>();
+  for ( i = candidates.constBegin(); i != candidates.constEnd(); ++i ) {
+    todo = ( *i ).staticCast<Todo>();
     if ( !isVisible( todo ) ) {
       continue;
     }
@@ -445,12 +1308,13 @@ Todo::List MemoryCalendar::rawTodos( const QDate &start,
         continue;
       }
     } else { // recurring events
-      switch ( todo->recurrence()->duration() ) {
+      const Recurrence *recurrence = IncidenceInternals::recurrence( *todo );
+      switch ( recurrence->duration() ) {
       case -1: // infinite
         break;
       case 0: // end date given
       default: // count given
-        KDateTime rEnd( todo->recurrence()->endDate(), ts );
+        KDateTime rEnd( recurrence->endDate(), ts );
         if ( !rEnd.isValid() ) {
           continue;
         }
@@ -494,7 +1358,6 @@ Alarm::List MemoryCalendar::alarms( const KDateTime &from, const KDateTime &to )
     t = it.value().staticCast<Todo>();
 
     if ( !t->isCompleted() ) {
-      appendAlarms( alarmList, t, from, to );
       if ( t->recurs() ) {
         appendRecurringAlarms( alarmList, t, from, to );
       } else {
@@ -506,17 +1369,23 @@ Alarm::List MemoryCalendar::alarms( const KDateTime &from, const KDateTime &to )
   return alarmList;
 }
 
+MemoryCalendar::AlarmTriggerList MemoryCalendar::nextAlarms( const KDateTime &after,
+                                                             int limit ) const
+{
+  return d->mAlarms.next( after, limit );
+}
+
+Alarm::List MemoryCalendar::alarmsDue( const KDateTime &now )
+{
+  return d->mAlarms.due( now );
+}
+
 void MemoryCalendar::incidenceUpdate( const QString &uid, const KDateTime &recurrenceId )
 {
   Incidence::Ptr inc = incidence( uid, recurrenceId );
 
   if ( inc ) {
-    const Incidence::IncidenceType type = inc->type();
-    const KDateTime dt = inc->dateTime( Incidence::RoleCalendarHashing );
-
-    if ( dt.isValid() ) {
-      d->mIncidencesForDate[type].remove( dt.date().toString(), inc );
-    }
+    d->unindexIncidence( inc );
   }
 }
 
@@ -531,12 +1400,7 @@ void MemoryCalendar::incidenceUpdated( const QString &uid, const KDateTime &recu
     // or internally in the Event itself when certain things change.
     // need to verify with ical documentation.
 
-    const Incidence::IncidenceType type = inc->type();
-    const KDateTime dt = inc->dateTime( Incidence::RoleCalendarHashing );
-
-    if ( dt.isValid() ) {
-      d->mIncidencesForDate[type].insert( dt.date().toString(), inc );
-    }
+    d->indexIncidence( inc );
 
     notifyIncidenceChanged( inc );
 
@@ -558,15 +1422,13 @@ Event::List MemoryCalendar::rawEventsForDate( const QDate &date,
 
   Event::Ptr ev;
 
-  // Find the hash for the specified date
-  const QString dateStr = date.toString();
-  QMultiHash<QString, IncidenceBase::Ptr >::const_iterator it =
-    d->mIncidencesForDate[Incidence::TypeEvent].constFind( dateStr );
   // Iterate over all non-recurring, single-day events that start on this date
+  const Incidence::List dated = d->mIncidencesForDate[Incidence::TypeEvent].values( date, date );
   KDateTime::Spec ts = timespec.isValid() ? timespec : timeSpec();
   KDateTime kdt( date, ts );
-  while ( it != d->mIncidencesForDate[Incidence::TypeEvent].constEnd() && it.key() == dateStr ) {
-    ev = it.value().staticCast<Event>();
+  Incidence::List::const_iterator it;
+  for ( it = dated.constBegin(); it != dated.constEnd(); ++it ) {
+    ev = ( *it ).staticCast<Event>();
     KDateTime end( ev->dtEnd().toTimeSpec( ev->dtStart() ) );
     if ( ev->allDay() ) {
       end.setDateOnly( true );
@@ -576,14 +1438,16 @@ Event::List MemoryCalendar::rawEventsForDate( const QDate &date,
     if ( end >= kdt ) {
       eventList.append( ev );
     }
-    ++it;
   }
 
-  // Iterate over all events. Look for recurring events that occur on this date
-  QHashIterator<QString, Incidence::Ptr>i( d->mIncidences[Incidence::TypeEvent] );
-  while ( i.hasNext() ) {
-    i.next();
-    ev = i.value().staticCast<Event>();
+  // Look for recurring and multi-day events that occur on this date,
+  // only checking those whose span covers it
+  const Incidence::List candidates =
+    d->mEventSpans.overlapping( utcSecs( KDateTime( date, KDateTime::UTC ) ),
+                                utcSecs( KDateTime( date.addDays( 1 ), KDateTime::UTC ) ) );
+  Incidence::List::const_iterator c;
+  for ( c = candidates.constBegin(); c != candidates.constEnd(); ++c ) {
+    ev = ( *c ).staticCast<Event>();
     if ( ev->recurs() ) {
       if ( ev->isMultiDay() ) {
         int extraDays = ev->dtStart().date().daysTo( ev->dtEnd().date() );
@@ -619,14 +1483,18 @@ Event::List MemoryCalendar::rawEvents( const QDate &start,
   KDateTime::Spec ts = timespec.isValid() ? timespec : timeSpec();
   KDateTime st( start, ts );
   KDateTime nd( end, ts );
-  KDateTime yesterStart = st.addDays( -1 );
 
-  // Get non-recurring events
-  QHashIterator<QString, Incidence::Ptr>i( d->mIncidences[Incidence::TypeEvent] );
+  // Only check the events whose span overlaps the requested range
+  const Incidence::List candidates =
+    d->mEventSpans.overlapping(
+      start.isValid() ? utcSecs( KDateTime( start, KDateTime::UTC ) ) :
+                        std::numeric_limits<qint64>::min(),
+      end.isValid() ? utcSecs( KDateTime( end.addDays( 1 ), KDateTime::UTC ) ) :
+                      std::numeric_limits<qint64>::max() );
+  Incidence::List::const_iterator i;
   Event::Ptr event;
-  while ( i.hasNext() ) {
-    i.next();
-    event = i.value().staticCast<Event>();
+  for ( i = candidates.constBegin(); i != candidates.constEnd(); ++i ) {
+    event = ( *i ).staticCast<Event>();
     KDateTime rStart = event->dtStart();
     if ( nd < rStart ) {
       continue;
@@ -644,7 +1512,8 @@ Event::List MemoryCalendar::rawEvents( const QDate &start,
         continue;
       }
     } else { // recurring events
-      switch ( event->recurrence()->duration() ) {
+      const Recurrence *recurrence = IncidenceInternals::recurrence( *event );
+      switch ( recurrence->duration() ) {
       case -1: // infinite
         if ( inclusive ) {
           continue;
@@ -652,7 +1521,7 @@ Event::List MemoryCalendar::rawEvents( const QDate &start,
         break;
       case 0: // end date given
       default: // count given
-        KDateTime rEnd( event->recurrence()->endDate(), ts );
+        KDateTime rEnd( recurrence->endDate(), ts );
         if ( !rEnd.isValid() ) {
           continue;
         }
@@ -794,16 +1663,15 @@ Journal::List MemoryCalendar::journalInstances( const Incidence::Ptr &journal,
 Journal::List MemoryCalendar::rawJournalsForDate( const QDate &date ) const
 {
   Journal::List journalList;
-  Journal::Ptr j;
 
-  QString dateStr = date.toString();
-  QMultiHash<QString, IncidenceBase::Ptr >::const_iterator it =
-    d->mIncidencesForDate[Incidence::TypeJournal].constFind( dateStr );
+  if ( !date.isValid() ) {
+    return journalList;
+  }
 
-  while ( it != d->mIncidencesForDate[Incidence::TypeJournal].constEnd() && it.key() == dateStr ) {
-    j = it.value().staticCast<Journal>();
-    journalList.append( j );
-    ++it;
+  const Incidence::List dated = d->mIncidencesForDate[Incidence::TypeJournal].values( date, date );
+  Incidence::List::const_iterator it;
+  for ( it = dated.constBegin(); it != dated.constEnd(); ++it ) {
+    journalList.append( ( *it ).staticCast<Journal>() );
   }
   return journalList;
 }
@@ -315,6 +315,55 @@ class KCALCORE_EXPORT MemoryCalendar : public Calendar
     */
     Alarm::List alarmsTo( const KDateTime &to ) const;
 
+    /**
+      @brief
+      An alarm going off at a given time, as returned by nextAlarms().
+    */
+    struct AlarmTrigger
+    {
+      KDateTime time;            /**< the time the alarm goes off */
+      Alarm::Ptr alarm;          /**< the alarm */
+      Incidence::Ptr incidence;  /**< the incidence the alarm belongs to */
+    };
+
+    /**
+      List of alarm triggers.
+    */
+    typedef QList<AlarmTrigger> AlarmTriggerList;
+
+    /**
+      Returns the next alarms to go off after a given time, in the order
+      they go off. Each alarm is returned once, with the time of its next
+      trigger, counting repetitions and recurrences of its incidence.
+
+      The alarms are looked up in a schedule which is kept up to date as
+      incidences change, so this doesn't visit every incidence of the
+      calendar as long as @p after is not earlier than the time passed to
+      the last call of alarmsDue().
+
+      @param after is the time after which to look for alarms.
+      @param limit is the largest number of alarms to return.
+      @return the list of the next alarm triggers, ordered by time.
+      @see alarmsDue()
+    */
+    AlarmTriggerList nextAlarms( const KDateTime &after, int limit ) const;
+
+    /**
+      Returns the alarms which went off after the previous call, up to and
+      including @p now, for pollers which run at regular intervals. Each
+      alarm is returned once, even if it went off several times.
+
+      Without a previous call, alarms are returned from the time passed to
+      the first nextAlarms() call on, or only if they go off at @p now. The
+      same holds for a time earlier than the previous one. Use alarms() to
+      find the alarms of an arbitrary period.
+
+      @param now is the current time.
+      @return the list of Alarms which went off.
+      @see nextAlarms()
+    */
+    Alarm::List alarmsDue( const KDateTime &now );
+
     /**
       @copydoc Calendar::incidenceUpdate(const QString &,const KDateTime &)
     */
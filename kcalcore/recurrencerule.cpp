@@ -20,17 +20,29 @@
   Boston, MA 02110-1301, USA.
 */
 #include "recurrencerule.h"
+#include "compactdatetime_p.h"
 
 #include <KDebug>
+#include <kglobal.h>
 
+#include <QtCore/QLinkedList>
+#include <QtCore/QMutex>
 #include <QtCore/QStringList>
 #include <QtCore/QTime>
+#include <QtCore/QVector>
+
+#include <algorithm>
 
 using namespace KCalCore;
 
 // Maximum number of intervals to process
 const int LOOP_LIMIT = 10000;
 
+// Default maximum number of occurrences in the occurrence cache of a rule,
+// and of all rules together
+const int OCCURRENCE_CACHE_LIMIT = 1000;
+const int TOTAL_OCCURRENCE_CACHE_LIMIT = 50000;
+
 static QString dumpTime( const KDateTime &dt );   // for debugging
 
 /*=========================================================================
@@ -700,6 +712,340 @@ bool Constraint::readDateTime( const KDateTime &dt, RecurrenceRule::PeriodType t
 }
 //@endcond
 
+/**************************************************************************
+ *                            Occurrence cache                            *
+ **************************************************************************/
+
+//@cond PRIVATE
+/*
+  A sorted list of occurrences. Cached occurrences are kept in compact
+  form, and only those which are returned are converted to KDateTime.
+*/
+typedef QVector<CompactDateTime> CompactDateTimeList;
+
+static CompactDateTimeList toCompact( const DateTimeList &list )
+{
+  CompactDateTimeList result;
+  result.reserve( list.count() );
+  for ( int i = 0, end = list.count();  i < end;  ++i ) {
+    result.append( CompactDateTime( list[i] ) );
+  }
+  return result;
+}
+
+// The index of the first item >= value, or -1 if none
+static int findGE( const CompactDateTimeList &list, const CompactDateTime &value, int start = 0 )
+{
+  const int i = std::lower_bound( list.begin() + start, list.end(), value ) - list.begin();
+  return i < list.count() ? i : -1;
+}
+
+// The index of the first item > value, or -1 if none
+static int findGT( const CompactDateTimeList &list, const CompactDateTime &value, int start = 0 )
+{
+  const int i = std::upper_bound( list.begin() + start, list.end(), value ) - list.begin();
+  return i < list.count() ? i : -1;
+}
+
+// The index of the last item < value, or -1 if none
+static int findLT( const CompactDateTimeList &list, const CompactDateTime &value )
+{
+  return ( std::lower_bound( list.begin(), list.end(), value ) - list.begin() ) - 1;
+}
+
+/*
+  A range of time, inclusive at both ends, for which all the occurrences
+  of a rule are known.
+*/
+struct OccurrenceWindow
+{
+  CompactDateTime start;
+  CompactDateTime end;
+  CompactDateTimeList dates;
+  quint64 lastUse;
+};
+
+/*
+  The occurrence windows of one rule. The windows are sorted by their
+  start and never overlap.
+
+  Each rule guards its windows with its own lock, so that queries of
+  different rules never wait for each other. The OccurrenceCache only
+  steps in when occurrences are added or dropped, to keep the total
+  within its limit.
+*/
+class OccurrenceWindows
+{
+  public:
+    OccurrenceWindows()
+      : mCount( 0 ), mLimit( OCCURRENCE_CACHE_LIMIT ), mTick( 0 ),
+        mUsed( false ), mInLru( false )
+    {}
+
+    /*
+      Returns the window which covers the range from @p start to @p end,
+      or null if there is none. mLock must be held.
+    */
+    const OccurrenceWindow *find( const CompactDateTime &start, const CompactDateTime &end );
+
+    /*
+      Adds a window of occurrences, merging it with the ones it overlaps.
+      mLock must be held. Returns the change in the number of occurrences.
+    */
+    int insert( const CompactDateTime &start, const CompactDateTime &end,
+                const CompactDateTimeList &dates );
+
+    /*
+      Drops all windows. mLock must be held. Returns the change in the
+      number of occurrences.
+    */
+    int clear();
+
+    mutable QMutex mLock;
+    QList<OccurrenceWindow> mWindows;
+    int mCount;    // total number of occurrences in mWindows
+    int mLimit;
+    quint64 mTick; // clock for the lastUse of the windows
+    bool mUsed;    // hit since the OccurrenceCache last looked at the rule
+
+    // The position in the OccurrenceCache, only changed with both
+    // the OccurrenceCache lock and mLock held.
+    bool mInLru;
+    QLinkedList<OccurrenceWindows*>::iterator mLruPos;
+
+  private:
+    void removeWindow( int index );
+};
+
+const OccurrenceWindow *OccurrenceWindows::find( const CompactDateTime &start,
+                                                 const CompactDateTime &end )
+{
+  for ( int i = 0, iend = mWindows.count();  i < iend;  ++i ) {
+    OccurrenceWindow &window = mWindows[i];
+    if ( window.start > start ) {
+      break;
+    }
+    if ( window.end >= end ) {
+      window.lastUse = ++mTick;
+      mUsed = true;
+      return &window;
+    }
+  }
+  return 0;
+}
+
+int OccurrenceWindows::insert( const CompactDateTime &start, const CompactDateTime &end,
+                               const CompactDateTimeList &dates )
+{
+  if ( dates.count() > mLimit ) {
+    return 0;
+  }
+
+  const int oldCount = mCount;
+
+  // Merge with the windows which overlap the new one. Since all windows
+  // are complete, they agree with the new one where they overlap.
+  OccurrenceWindow window;
+  window.start = start;
+  window.end = end;
+  window.dates = dates;
+  window.lastUse = ++mTick;
+  QList<OccurrenceWindow>::Iterator it = mWindows.begin();
+  while ( it != mWindows.end() ) {
+    if ( ( *it ).start > end || ( *it ).end < start ) {
+      ++it;
+      continue;
+    }
+    if ( ( *it ).start < window.start ) {
+      const int i = findGE( ( *it ).dates, window.start );
+      window.dates = ( *it ).dates.mid( 0, i < 0 ? ( *it ).dates.count() : i ) + window.dates;
+      window.start = ( *it ).start;
+    }
+    if ( ( *it ).end > window.end ) {
+      const int i = findGT( ( *it ).dates, window.end );
+      if ( i >= 0 ) {
+        window.dates += ( *it ).dates.mid( i );
+      }
+      window.end = ( *it ).end;
+    }
+    mCount -= ( *it ).dates.count();
+    it = mWindows.erase( it );
+  }
+  if ( window.dates.count() > mLimit ) {
+    // The merged window is too large, keep just the new range
+    window.start = start;
+    window.end = end;
+    window.dates = dates;
+  }
+
+  // Drop the least recently used windows of the rule to make room
+  while ( mCount + window.dates.count() > mLimit ) {
+    int lru = 0;
+    for ( int i = 1, iend = mWindows.count();  i < iend;  ++i ) {
+      if ( mWindows[i].lastUse < mWindows[lru].lastUse ) {
+        lru = i;
+      }
+    }
+    removeWindow( lru );
+  }
+
+  it = mWindows.begin();
+  while ( it != mWindows.end() && ( *it ).start < window.start ) {
+    ++it;
+  }
+  mWindows.insert( it, window );
+  mCount += window.dates.count();
+  mUsed = true;
+  return mCount - oldCount;
+}
+
+int OccurrenceWindows::clear()
+{
+  const int count = mCount;
+  mCount = 0;
+  mWindows.clear();
+  return -count;
+}
+
+void OccurrenceWindows::removeWindow( int index )
+{
+  mCount -= mWindows[index].dates.count();
+  mWindows.removeAt( index );
+}
+
+/*
+  The bookkeeping for the occurrence windows of all rules. The rules are
+  kept in the order in which they were last given room, and when all of
+  them together hold too many occurrences, the rules at the front are
+  dropped, unless they were used since (second chance).
+
+  Lock order: mLock before any OccurrenceWindows::mLock.
+*/
+class OccurrenceCache
+{
+  public:
+    explicit OccurrenceCache( int limit )
+      : mTotal( 0 ), mLimit( limit )
+    {}
+
+    /*
+      Accounts for @p delta occurrences added to @p windows, evicting
+      other rules if needed. The lock of @p windows must not be held.
+    */
+    void added( OccurrenceWindows *windows, int delta );
+
+    /*
+      Drops all windows of @p windows. Its lock must not be held.
+    */
+    void clear( OccurrenceWindows *windows );
+
+    void setLimit( int limit );
+    int limit();
+
+  private:
+    void evict();
+
+    QMutex mLock;
+    QLinkedList<OccurrenceWindows*> mLru;   // least recently given room first
+    int mTotal;
+    int mLimit;
+};
+
+K_GLOBAL_STATIC_WITH_ARGS( OccurrenceCache, sOccurrenceCache, ( TOTAL_OCCURRENCE_CACHE_LIMIT ) )
+
+void OccurrenceCache::added( OccurrenceWindows *windows, int delta )
+{
+  QMutexLocker lock( &mLock );
+  mTotal += delta;
+  {
+    QMutexLocker windowsLock( &windows->mLock );
+    if ( windows->mInLru ) {
+      mLru.erase( windows->mLruPos );
+      windows->mInLru = false;
+    }
+    if ( windows->mCount > 0 ) {
+      windows->mLruPos = mLru.insert( mLru.end(), windows );
+      windows->mInLru = true;
+      windows->mUsed = false;
+    }
+  }
+  evict();
+}
+
+void OccurrenceCache::clear( OccurrenceWindows *windows )
+{
+  {
+    // Nothing to account for: no need to take the shared lock.
+    QMutexLocker windowsLock( &windows->mLock );
+    if ( !windows->mInLru && windows->mCount == 0 ) {
+      return;
+    }
+  }
+
+  QMutexLocker lock( &mLock );
+  QMutexLocker windowsLock( &windows->mLock );
+  mTotal += windows->clear();
+  if ( windows->mInLru ) {
+    mLru.erase( windows->mLruPos );
+    windows->mInLru = false;
+  }
+}
+
+void OccurrenceCache::setLimit( int limit )
+{
+  QMutexLocker lock( &mLock );
+  mLimit = qMax( 0, limit );
+  evict();
+}
+
+int OccurrenceCache::limit()
+{
+  QMutexLocker lock( &mLock );
+  return mLimit;
+}
+
+void OccurrenceCache::evict()
+{
+  while ( mTotal > mLimit && !mLru.isEmpty() ) {
+    OccurrenceWindows *windows = mLru.takeFirst();
+    QMutexLocker windowsLock( &windows->mLock );
+    if ( windows->mUsed ) {
+      windows->mUsed = false;
+      windows->mLruPos = mLru.insert( mLru.end(), windows );
+    } else {
+      windows->mInLru = false;
+      mTotal += windows->clear();
+    }
+  }
+}
+
+/*
+  The range of whole months around a date/time, which is what the
+  occurrence cache expands for daily and longer rules, since calendar
+  views tend to query days and weeks of the same months again and again.
+*/
+static KDateTime startOfMonth( const KDateTime &dt )
+{
+  KDateTime result( dt );
+  result.setDate( QDate( dt.date().year(), dt.date().month(), 1 ) );
+  if ( !dt.isDateOnly() ) {
+    result.setTime( QTime( 0, 0, 0 ) );
+  }
+  return result;
+}
+
+static KDateTime endOfMonth( const KDateTime &dt )
+{
+  KDateTime result( dt );
+  const QDate date = dt.date();
+  result.setDate( QDate( date.year(), date.month(), date.daysInMonth() ) );
+  if ( !dt.isDateOnly() ) {
+    result.setTime( QTime( 23, 59, 59, 999 ) );
+  }
+  return result;
+}
+//@endcond
+
 /**************************************************************************
  *                        RecurrenceRule::Private                         *
  **************************************************************************/
@@ -721,13 +1067,27 @@ class KCalCore::RecurrenceRule::Private
     }
 
     Private( RecurrenceRule *parent, const Private &p );
+    ~Private();
 
     Private &operator=( const Private &other );
     bool operator==( const Private &other ) const;
     void clear();
     void setDirty();
+    void clearCache();
     void buildConstraints();
     bool buildCache() const;
+    DateTimeList expand( const KDateTime &start, const KDateTime &end, bool *complete ) const;
+
+    // Closed form evaluation of the most common rule shapes
+    void buildSimpleShape();
+    int weekOffset( const QDate &date ) const;
+    QDate simpleNextDate( const QDate &date ) const;
+    QDate simplePreviousDate( const QDate &date ) const;
+    QDate simpleNthDate( int n ) const;
+    int simpleCount( const QDate &date ) const;
+    KDateTime simpleOccurrence( const QDate &date ) const;
+    KDateTime simpleNext( const KDateTime &dt, bool inclusive ) const;
+    KDateTime simplePrevious( const KDateTime &dt, bool inclusive ) const;
     Constraint getNextValidDateInterval( const KDateTime &preDate, PeriodType type ) const;
     Constraint getPreviousValidDateInterval( const KDateTime &afterDate, PeriodType type ) const;
     DateTimeList datesForInterval( const Constraint &interval, PeriodType type ) const;
@@ -761,15 +1121,30 @@ class KCalCore::RecurrenceRule::Private
     QList<RuleObserver*> mObservers;
 
     // Cache for duration
-    mutable DateTimeList mCachedDates;
+    mutable CompactDateTimeList mCachedDates;
     mutable KDateTime mCachedDateEnd;
     mutable KDateTime mCachedLastDate;   // when mCachedDateEnd invalid, last date checked
     mutable bool mCached;
 
+    // Occurrence cache for rules without a fixed count, only to be
+    // accessed with mWindows.mLock held
+    mutable OccurrenceWindows mWindows;
+
     bool mIsReadOnly;
     bool mAllDay;
     bool mNoByRules;        // no BySeconds, ByMinutes, ... rules exist
     uint mTimedRepetition;  // repeats at a regular number of seconds interval, or 0
+
+    enum SimpleShape {
+      NotSimple,
+      SimpleDaily,          // every n days
+      SimpleWeekly,         // every n weeks, on the start weekday or on BYDAY weekdays
+      SimpleMonthly,        // every n months, on a day of the month up to 28
+      SimpleYearly          // every n years, on any date but February 29
+    };
+    SimpleShape mSimple;    // occurrences can be calculated arithmetically
+    QList<int> mSimpleOffsets;  // weekly: sorted days since the start of the week
+    int mSimpleFirstWeek;   // weekly: number of occurrences in the first week
 };
 
 RecurrenceRule::Private::Private( RecurrenceRule *parent, const Private &p )
@@ -796,7 +1171,15 @@ RecurrenceRule::Private::Private( RecurrenceRule *parent, const Private &p )
     mAllDay( p.mAllDay ),
     mNoByRules( p.mNoByRules )
 {
-    setDirty();
+  QMutexLocker lock( &p.mWindows.mLock );
+  mWindows.mLimit = p.mWindows.mLimit;
+  lock.unlock();
+  setDirty();
+}
+
+RecurrenceRule::Private::~Private()
+{
+  clearCache();
 }
 
 RecurrenceRule::Private &RecurrenceRule::Private::operator=( const Private &p )
@@ -827,6 +1210,12 @@ RecurrenceRule::Private &RecurrenceRule::Private::operator=( const Private &p )
   mIsReadOnly = p.mIsReadOnly;
   mAllDay = p.mAllDay;
   mNoByRules = p.mNoByRules;
+  p.mWindows.mLock.lock();
+  const int limit = p.mWindows.mLimit;
+  p.mWindows.mLock.unlock();
+  mWindows.mLock.lock();
+  mWindows.mLimit = limit;
+  mWindows.mLock.unlock();
 
   setDirty();
 
@@ -882,14 +1271,22 @@ void RecurrenceRule::Private::clear()
 void RecurrenceRule::Private::setDirty()
 {
   buildConstraints();
-  mCached = false;
-  mCachedDates.clear();
+  clearCache();
   for ( int i = 0, iend = mObservers.count();  i < iend;  ++i ) {
     if ( mObservers[i] ) {
       mObservers[i]->recurrenceChanged( mParent );
     }
   }
 }
+
+void RecurrenceRule::Private::clearCache()
+{
+  mCached = false;
+  mCachedDates.clear();
+  if ( !sOccurrenceCache.isDestroyed() ) {
+    sOccurrenceCache->clear( &mWindows );
+  }
+}
 //@endcond
 
 /**************************************************************************
@@ -969,6 +1366,13 @@ KDateTime RecurrenceRule::endDt( bool *result ) const
     return d->mDateEnd;
   }
 
+  if ( d->mSimple != Private::NotSimple ) {
+    if ( result ) {
+      *result = true;
+    }
+    return d->simpleOccurrence( d->simpleNthDate( d->mDuration - 1 ) );
+  }
+
   // N occurrences. Check if we have a full cache. If so, return the cached end date.
   if ( !d->mCached ) {
     // If not enough occurrences can be found (i.e. inconsistent constraints)
@@ -1020,6 +1424,34 @@ void RecurrenceRule::setDirty()
   d->setDirty();
 }
 
+void RecurrenceRule::setOccurrenceCacheLimit( int limit )
+{
+  {
+    QMutexLocker lock( &d->mWindows.mLock );
+    d->mWindows.mLimit = qMax( 0, limit );
+    if ( d->mWindows.mCount <= d->mWindows.mLimit ) {
+      return;
+    }
+  }
+  sOccurrenceCache->clear( &d->mWindows );
+}
+
+int RecurrenceRule::occurrenceCacheLimit() const
+{
+  QMutexLocker lock( &d->mWindows.mLock );
+  return d->mWindows.mLimit;
+}
+
+void RecurrenceRule::setTotalOccurrenceCacheLimit( int limit )
+{
+  sOccurrenceCache->setLimit( limit );
+}
+
+int RecurrenceRule::totalOccurrenceCacheLimit()
+{
+  return sOccurrenceCache->limit();
+}
+
 void RecurrenceRule::setStartDt( const KDateTime &start )
 {
   if ( isReadOnly() ) {
@@ -1301,6 +1733,8 @@ void RecurrenceRule::Private::buildConstraints()
   }
   #undef fixConstraint
 
+  buildSimpleShape();
+
   if ( mNoByRules ) {
     switch ( mPeriod ) {
       case rHourly:
@@ -1327,6 +1761,297 @@ void RecurrenceRule::Private::buildConstraints()
   }
 }
 
+// Recognise the rules whose occurrences can be calculated directly from
+// the start date, without going through the constraints. Sub-daily rules
+// of that kind are already handled through mTimedRepetition.
+void RecurrenceRule::Private::buildSimpleShape()
+{
+  mSimple = NotSimple;
+  mSimpleOffsets.clear();
+  mSimpleFirstWeek = 0;
+  if ( mFrequency == 0 || !mDateStart.isValid() || mDateStart.isSecondOccurrence() ||
+       mDateStart.time().msec() != 0 ||
+       !mBySeconds.isEmpty() || !mByMinutes.isEmpty() || !mByHours.isEmpty() ||
+       !mByMonthDays.isEmpty() || !mByYearDays.isEmpty() || !mByWeekNumbers.isEmpty() ||
+       !mByMonths.isEmpty() || !mBySetPos.isEmpty() ) {
+    return;
+  }
+
+  const QDate start = mDateStart.date();
+  switch ( mPeriod ) {
+  case rDaily:
+    if ( mByDays.isEmpty() ) {
+      mSimple = SimpleDaily;
+    }
+    break;
+  case rWeekly:
+    if ( mByDays.isEmpty() ) {
+      mSimpleOffsets.append( weekOffset( start ) );
+    } else {
+      for ( int i = 0, iend = mByDays.count();  i < iend;  ++i ) {
+        const WDayPos &pos = mByDays[i];
+        if ( pos.pos() != 0 || pos.day() < 1 || pos.day() > 7 ) {
+          mSimpleOffsets.clear();
+          return;
+        }
+        const int offset = ( pos.day() - ( mWeekStart > 0 ? mWeekStart : 1 ) + 7 ) % 7;
+        if ( !mSimpleOffsets.contains( offset ) ) {
+          mSimpleOffsets.append( offset );
+        }
+      }
+      qSort( mSimpleOffsets );
+    }
+    for ( int i = 0, iend = mSimpleOffsets.count();  i < iend;  ++i ) {
+      if ( mSimpleOffsets[i] >= weekOffset( start ) ) {
+        ++mSimpleFirstWeek;
+      }
+    }
+    mSimple = SimpleWeekly;
+    break;
+  case rMonthly:
+    if ( mByDays.isEmpty() && start.day() <= 28 ) {
+      mSimple = SimpleMonthly;
+    }
+    break;
+  case rYearly:
+    if ( mByDays.isEmpty() && !( start.month() == 2 && start.day() == 29 ) ) {
+      mSimple = SimpleYearly;
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+// Number of days from the start of the week to 'date'
+int RecurrenceRule::Private::weekOffset( const QDate &date ) const
+{
+  return ( date.dayOfWeek() - ( mWeekStart > 0 ? mWeekStart : 1 ) + 7 ) % 7;
+}
+
+// The simple*Date() functions work on dates on or after the start date.
+
+// First occurrence date on or after 'date'
+QDate RecurrenceRule::Private::simpleNextDate( const QDate &date ) const
+{
+  const QDate start = mDateStart.date();
+  const int freq = mFrequency;
+  switch ( mSimple ) {
+  case SimpleDaily:
+  {
+    const int rest = start.daysTo( date ) % freq;
+    return rest ? date.addDays( freq - rest ) : date;
+  }
+  case SimpleWeekly:
+  {
+    const int offset = weekOffset( date );
+    const int week0 = start.toJulianDay() - weekOffset( start );
+    const int week = ( date.toJulianDay() - offset - week0 ) / 7;
+    if ( week % freq == 0 ) {
+      for ( int i = 0, iend = mSimpleOffsets.count();  i < iend;  ++i ) {
+        if ( mSimpleOffsets[i] >= offset ) {
+          return QDate::fromJulianDay( week0 + 7 * week + mSimpleOffsets[i] );
+        }
+      }
+    }
+    const int next = ( week / freq + 1 ) * freq;
+    return QDate::fromJulianDay( week0 + 7 * next + mSimpleOffsets.first() );
+  }
+  case SimpleMonthly:
+  {
+    const int months = ( date.year() - start.year() ) * 12 + date.month() - start.month();
+    if ( months % freq == 0 && date.day() <= start.day() ) {
+      return QDate( date.year(), date.month(), start.day() );
+    }
+    return start.addMonths( ( months / freq + 1 ) * freq );
+  }
+  case SimpleYearly:
+  {
+    const int years = date.year() - start.year();
+    const QDate anniversary( date.year(), start.month(), start.day() );
+    if ( years % freq == 0 && date <= anniversary ) {
+      return anniversary;
+    }
+    return start.addYears( ( years / freq + 1 ) * freq );
+  }
+  default:
+    return QDate();
+  }
+}
+
+// Last occurrence date on or before 'date', or invalid if none
+QDate RecurrenceRule::Private::simplePreviousDate( const QDate &date ) const
+{
+  const QDate start = mDateStart.date();
+  const int freq = mFrequency;
+  switch ( mSimple ) {
+  case SimpleDaily:
+    return date.addDays( -( start.daysTo( date ) % freq ) );
+  case SimpleWeekly:
+  {
+    const int offset = weekOffset( date );
+    const int startOffset = weekOffset( start );
+    const int week0 = start.toJulianDay() - startOffset;
+    const int week = ( date.toJulianDay() - offset - week0 ) / 7;
+    int previous = week - week % freq;
+    if ( week % freq == 0 ) {
+      for ( int i = mSimpleOffsets.count() - 1;  i >= 0;  --i ) {
+        if ( mSimpleOffsets[i] <= offset && ( week > 0 || mSimpleOffsets[i] >= startOffset ) ) {
+          return QDate::fromJulianDay( week0 + 7 * week + mSimpleOffsets[i] );
+        }
+      }
+      previous = week - freq;
+    }
+    if ( previous < 0 || ( previous == 0 && mSimpleOffsets.last() < startOffset ) ) {
+      return QDate();
+    }
+    return QDate::fromJulianDay( week0 + 7 * previous + mSimpleOffsets.last() );
+  }
+  case SimpleMonthly:
+  {
+    const int months = ( date.year() - start.year() ) * 12 + date.month() - start.month();
+    if ( months % freq == 0 && date.day() >= start.day() ) {
+      return QDate( date.year(), date.month(), start.day() );
+    }
+    const int previous = ( months % freq == 0 ) ? months - freq : months - months % freq;
+    return previous < 0 ? QDate() : start.addMonths( previous );
+  }
+  case SimpleYearly:
+  {
+    const int years = date.year() - start.year();
+    const QDate anniversary( date.year(), start.month(), start.day() );
+    if ( years % freq == 0 && date >= anniversary ) {
+      return anniversary;
+    }
+    const int previous = ( years % freq == 0 ) ? years - freq : years - years % freq;
+    return previous < 0 ? QDate() : start.addYears( previous );
+  }
+  default:
+    return QDate();
+  }
+}
+
+// Date of occurrence number 'n', counting from 0
+QDate RecurrenceRule::Private::simpleNthDate( int n ) const
+{
+  const QDate start = mDateStart.date();
+  const int freq = mFrequency;
+  switch ( mSimple ) {
+  case SimpleDaily:
+    return start.addDays( n * freq );
+  case SimpleWeekly:
+  {
+    const int week0 = start.toJulianDay() - weekOffset( start );
+    const int count = mSimpleOffsets.count();
+    if ( n < mSimpleFirstWeek ) {
+      return QDate::fromJulianDay( week0 + mSimpleOffsets[count - mSimpleFirstWeek + n] );
+    }
+    n -= mSimpleFirstWeek;
+    return QDate::fromJulianDay( week0 + 7 * ( 1 + n / count ) * freq +
+                                 mSimpleOffsets[n % count] );
+  }
+  case SimpleMonthly:
+    return start.addMonths( n * freq );
+  case SimpleYearly:
+    return start.addYears( n * freq );
+  default:
+    return QDate();
+  }
+}
+
+// Number of occurrences on dates up to and including 'date'
+int RecurrenceRule::Private::simpleCount( const QDate &date ) const
+{
+  const QDate start = mDateStart.date();
+  const int freq = mFrequency;
+  switch ( mSimple ) {
+  case SimpleDaily:
+    return start.daysTo( date ) / freq + 1;
+  case SimpleWeekly:
+  {
+    const int offset = weekOffset( date );
+    const int startOffset = weekOffset( start );
+    const int week0 = start.toJulianDay() - startOffset;
+    const int week = ( date.toJulianDay() - offset - week0 ) / 7;
+    // occurrence weeks before this one, including the first week
+    const int weeks = ( week + freq - 1 ) / freq;
+    int count = weeks > 0 ? mSimpleFirstWeek + ( weeks - 1 ) * mSimpleOffsets.count() : 0;
+    if ( week % freq == 0 ) {
+      for ( int i = 0, iend = mSimpleOffsets.count();  i < iend;  ++i ) {
+        if ( mSimpleOffsets[i] <= offset && ( week > 0 || mSimpleOffsets[i] >= startOffset ) ) {
+          ++count;
+        }
+      }
+    }
+    return count;
+  }
+  case SimpleMonthly:
+  {
+    const int months = ( date.year() - start.year() ) * 12 + date.month() - start.month();
+    return months / freq + ( ( months % freq == 0 && date.day() < start.day() ) ? 0 : 1 );
+  }
+  case SimpleYearly:
+  {
+    const int years = date.year() - start.year();
+    const QDate anniversary( date.year(), start.month(), start.day() );
+    return years / freq + ( ( years % freq == 0 && date < anniversary ) ? 0 : 1 );
+  }
+  default:
+    return 0;
+  }
+}
+
+// The occurrence on an occurrence date, built the same way as by
+// Constraint::dateTimes()
+KDateTime RecurrenceRule::Private::simpleOccurrence( const QDate &date ) const
+{
+  const QTime time = mDateStart.time();
+  return KDateTime( date, QTime( time.hour(), time.minute(), time.second() ),
+                    mDateStart.timeSpec() );
+}
+
+// First occurrence after (or at, if 'inclusive') 'dt', ignoring the end of
+// the recurrence
+KDateTime RecurrenceRule::Private::simpleNext( const KDateTime &dt, bool inclusive ) const
+{
+  QDate date = dt.toTimeSpec( mDateStart.timeSpec() ).date();
+  if ( date < mDateStart.date() ) {
+    date = mDateStart.date();
+  }
+  // If the occurrence on the date of 'dt' is too early, the one on the
+  // next occurrence date is always late enough.
+  for ( int i = 0;  i < 2;  ++i ) {
+    date = simpleNextDate( date );
+    const KDateTime next = simpleOccurrence( date );
+    if ( inclusive ? next >= dt : next > dt ) {
+      return next;
+    }
+    date = date.addDays( 1 );
+  }
+  return KDateTime();
+}
+
+// Last occurrence before (or at, if 'inclusive') 'dt'
+KDateTime RecurrenceRule::Private::simplePrevious( const KDateTime &dt, bool inclusive ) const
+{
+  QDate date = dt.toTimeSpec( mDateStart.timeSpec() ).date();
+  for ( int i = 0;  i < 2;  ++i ) {
+    if ( date < mDateStart.date() ) {
+      return KDateTime();
+    }
+    date = simplePreviousDate( date );
+    if ( !date.isValid() ) {
+      return KDateTime();
+    }
+    const KDateTime previous = simpleOccurrence( date );
+    if ( inclusive ? previous <= dt : previous < dt ) {
+      return previous;
+    }
+    date = date.addDays( -1 );
+  }
+  return KDateTime();
+}
+
 // Build and cache a list of all occurrences.
 // Only call buildCache() if mDuration > 0.
 bool RecurrenceRule::Private::buildCache() const
@@ -1360,7 +2085,7 @@ bool RecurrenceRule::Private::buildCache() const
     dts.erase( dts.begin() + mDuration, dts.end() );
   }
   mCached = true;
-  mCachedDates = dts;
+  mCachedDates = toCompact( dts );
 
 // it = dts.begin();
 // while ( it != dts.end() ) {
@@ -1377,6 +2102,41 @@ bool RecurrenceRule::Private::buildCache() const
     return false;
   }
 }
+
+// Return all occurrences from 'start' up to and including 'end'.
+// 'complete' is set to false if the loop limit was reached before 'end'.
+DateTimeList RecurrenceRule::Private::expand( const KDateTime &start, const KDateTime &end,
+                                              bool *complete ) const
+{
+  DateTimeList result;
+  Constraint interval( getNextValidDateInterval( start, mPeriod ) );
+  bool done = false;
+  int loop = 0;
+  do {
+    DateTimeList dts = datesForInterval( interval, mPeriod );
+    int i = 0;
+    int iend = dts.count();
+    if ( loop == 0 ) {
+      i = dts.findGE( start );
+      if ( i < 0 ) {
+        i = iend;
+      }
+    }
+    int j = dts.findGT( end, i );
+    if ( j >= 0 ) {
+      iend = j;
+      done = true;
+    }
+    while ( i < iend ) {
+      result += dts[i++];
+    }
+    // Increase the interval.
+    interval.increase( mPeriod, mFrequency );
+  } while ( !done && ++loop < LOOP_LIMIT &&
+            interval.intervalDateTime( mPeriod ) <= end );
+  *complete = done || loop < LOOP_LIMIT;
+  return result;
+}
 //@endcond
 
 bool RecurrenceRule::dateMatchesRules( const KDateTime &kdt ) const
@@ -1414,6 +2174,10 @@ bool RecurrenceRule::recursOn( const QDate &qd, const KDateTime::Spec &timeSpec
       }
     }
 
+    if ( d->mSimple != Private::NotSimple ) {
+      return d->simpleNextDate( qd ) == qd;
+    }
+
     // The date must be in an appropriate interval (getNextValidDateInterval),
     // Plus it must match at least one of the constraints
     bool match = false;
@@ -1477,6 +2241,22 @@ bool RecurrenceRule::recursOn( const QDate &qd, const KDateTime::Spec &timeSpec
     return start.addSecs( d->mTimedRepetition - n ) < end;
   }
 
+  if ( d->mSimple != Private::NotSimple ) {
+    const KDateTime next = d->simpleNext( start, true );
+    return next.isValid() && next <= end;
+  }
+
+  if ( d->mDuration <= 0 ) {
+    const CompactDateTime cstart( start );
+    const CompactDateTime cend( end );
+    QMutexLocker lock( &d->mWindows.mLock );
+    const OccurrenceWindow *window = d->mWindows.find( cstart, cend );
+    if ( window ) {
+      int i = findGE( window->dates, cstart );
+      return i >= 0 && window->dates[i] <= cend;
+    }
+  }
+
   // Find the start and end dates in the time spec for the rule
   QDate startDay = start.date();
   QDate endDay = end.addSecs( -1 ).date();
@@ -1550,6 +2330,13 @@ bool RecurrenceRule::recursAt( const KDateTime &kdt ) const
     return !( d->mDateStart.secsTo_long( dt ) % d->mTimedRepetition );
   }
 
+  if ( d->mSimple != Private::NotSimple ) {
+    const QTime time = dt.time();
+    return d->simpleNextDate( dt.date() ) == dt.date() &&
+           d->simpleOccurrence( dt.date() ).time() ==
+             QTime( time.hour(), time.minute(), time.second() );
+  }
+
   // The date must be in an appropriate interval (getNextValidDateInterval),
   // Plus it must match at least one of the constraints
   if ( !dateMatchesRules( dt ) ) {
@@ -1600,6 +2387,21 @@ int RecurrenceRule::durationTo( const KDateTime &dt ) const
     return static_cast<int>( d->mDateStart.secsTo_long( toDate ) / d->mTimedRepetition );
   }
 
+  if ( d->mSimple != Private::NotSimple ) {
+    if ( d->mDuration == 0 && d->mDateEnd.isValid() && toDate > d->mDateEnd ) {
+      toDate = d->mDateEnd.toTimeSpec( d->mDateStart.timeSpec() );
+      if ( toDate < d->mDateStart ) {
+        return 0;
+      }
+    }
+    const QDate date = toDate.date();
+    int count = d->simpleCount( date );
+    if ( d->simpleNextDate( date ) == date && d->simpleOccurrence( date ) > toDate ) {
+      --count;
+    }
+    return count;
+  }
+
   return timesInInterval( d->mDateStart, toDate ).count();
 }
 
@@ -1632,14 +2434,34 @@ KDateTime RecurrenceRule::getPreviousDate( const KDateTime &afterDate ) const
     return prev >= d->mDateStart ? prev : KDateTime();
   }
 
+  if ( d->mSimple != Private::NotSimple ) {
+    if ( d->mDuration >= 0 && endDt().isValid() && toDate > endDt() ) {
+      return d->simplePrevious( endDt(), true );
+    }
+    return d->simplePrevious( toDate, false );
+  }
+
+  if ( d->mDuration <= 0 ) {
+    const CompactDateTime ctoDate( toDate );
+    const CompactDateTime cdateStart( d->mDateStart );
+    QMutexLocker lock( &d->mWindows.mLock );
+    const OccurrenceWindow *window = d->mWindows.find( ctoDate, ctoDate );
+    if ( window ) {
+      int i = findLT( window->dates, ctoDate );
+      if ( i >= 0 && window->dates[i] >= cdateStart ) {
+        return window->dates[i].toKDateTime();
+      }
+    }
+  }
+
   // If we have a cache (duration given), use that
   if ( d->mDuration > 0 ) {
     if ( !d->mCached ) {
       d->buildCache();
     }
-    int i = d->mCachedDates.findLT( toDate );
+    int i = findLT( d->mCachedDates, CompactDateTime( toDate ) );
     if ( i >= 0 ) {
-      return d->mCachedDates[i];
+      return d->mCachedDates[i].toKDateTime();
     }
     return KDateTime();
   }
@@ -1695,13 +2517,28 @@ KDateTime RecurrenceRule::getNextDate( const KDateTime &preDate ) const
     return d->mDuration < 0 || !endDt().isValid() || next <= endDt() ? next : KDateTime();
   }
 
+  if ( d->mSimple != Private::NotSimple ) {
+    const KDateTime next = d->simpleNext( fromDate, false );
+    return d->mDuration < 0 || !endDt().isValid() || next <= endDt() ? next : KDateTime();
+  }
+
+  const CompactDateTime cfromDate( fromDate );
   if ( d->mDuration > 0 ) {
     if ( !d->mCached ) {
       d->buildCache();
     }
-    int i = d->mCachedDates.findGT( fromDate );
+    int i = findGT( d->mCachedDates, cfromDate );
     if ( i >= 0 ) {
-      return d->mCachedDates[i];
+      return d->mCachedDates[i].toKDateTime();
+    }
+  } else {
+    QMutexLocker lock( &d->mWindows.mLock );
+    const OccurrenceWindow *window = d->mWindows.find( cfromDate, cfromDate );
+    if ( window ) {
+      int i = findGT( window->dates, cfromDate );
+      if ( i >= 0 ) {
+        return window->dates[i].toKDateTime();
+      }
     }
   }
 
@@ -1783,16 +2620,16 @@ DateTimeList RecurrenceRule::timesInInterval( const KDateTime &dtStart,
     if ( d->mCachedDateEnd.isValid() && start > d->mCachedDateEnd ) {
       return result;    // beyond end of recurrence
     }
-    int i = d->mCachedDates.findGE( start );
+    int i = findGE( d->mCachedDates, CompactDateTime( start ) );
     if ( i >= 0 ) {
-      int iend = d->mCachedDates.findGT( enddt, i );
+      int iend = findGT( d->mCachedDates, CompactDateTime( enddt ), i );
       if ( iend < 0 ) {
         iend = d->mCachedDates.count();
       } else {
         done = true;
       }
       while ( i < iend ) {
-        result += d->mCachedDates[i++];
+        result += d->mCachedDates[i++].toKDateTime();
       }
     }
     if ( d->mCachedDateEnd.isValid() ) {
@@ -1808,30 +2645,69 @@ DateTimeList RecurrenceRule::timesInInterval( const KDateTime &dtStart,
     st = d->mCachedLastDate.addSecs( 1 );
   }
 
-  Constraint interval( d->getNextValidDateInterval( st, recurrenceType() ) );
-  int loop = 0;
-  do {
-    DateTimeList dts = d->datesForInterval( interval, recurrenceType() );
-    int i = 0;
-    int iend = dts.count();
-    if ( loop == 0 ) {
-      i = dts.findGE( st );
-      if ( i < 0 ) {
-        i = iend;
+  bool complete;
+  if ( d->mDuration <= 0 ) {
+    // Use the occurrence cache
+    const CompactDateTime cst( st );
+    const CompactDateTime cenddt( enddt );
+    QMutexLocker lock( &d->mWindows.mLock );
+    if ( d->mWindows.mLimit > 0 ) {
+      const OccurrenceWindow *window = d->mWindows.find( cst, cenddt );
+      if ( window ) {
+        int i = findGE( window->dates, cst );
+        if ( i >= 0 ) {
+          int iend = findGT( window->dates, cenddt, i );
+          if ( iend < 0 ) {
+            iend = window->dates.count();
+          }
+          while ( i < iend ) {
+            result += window->dates[i++].toKDateTime();
+          }
+        }
+        return result;
+      }
+      lock.unlock();
+
+      // Expand whole months of daily and longer rules, so that nearby
+      // queries are answered from the cache as well.
+      KDateTime wst = st;
+      KDateTime wend = enddt;
+      if ( recurrenceType() >= rDaily ) {
+        wst = startOfMonth( st );
+        if ( wst < d->mDateStart && st >= d->mDateStart ) {
+          wst = d->mDateStart;
+        }
+        wend = endOfMonth( enddt );
+        if ( d->mDuration == 0 && endDt().isValid() && wend > endDt() ) {
+          wend = endDt();
+        }
+      }
+      const DateTimeList dts = d->expand( wst, wend, &complete );
+      if ( complete ) {
+        const CompactDateTimeList cdts = toCompact( dts );
+        const CompactDateTime cwst( wst );
+        const CompactDateTime cwend( wend );
+        lock.relock();
+        const int added = d->mWindows.insert( cwst, cwend, cdts );
+        lock.unlock();
+        sOccurrenceCache->added( &d->mWindows, added );
+
+        int i = dts.findGE( st );
+        if ( i >= 0 ) {
+          int iend = dts.findGT( enddt, i );
+          if ( iend < 0 ) {
+            iend = dts.count();
+          }
+          while ( i < iend ) {
+            result += dts[i++];
+          }
+        }
+        return result;
       }
     }
-    int j = dts.findGT( enddt, i );
-    if ( j >= 0 ) {
-      iend = j;
-      loop = LOOP_LIMIT;
-    }
-    while ( i < iend ) {
-      result += dts[i++];
-    }
-    // Increase the interval.
-    interval.increase( recurrenceType(), frequency() );
-  } while ( ++loop < LOOP_LIMIT &&
-            interval.intervalDateTime( recurrenceType() ) < end );
+  }
+
+  result += d->expand( st, enddt, &complete );
   return result;
 }
 
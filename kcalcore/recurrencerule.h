@@ -254,6 +254,35 @@ class KCALCORE_EXPORT RecurrenceRule
      */
     KDateTime getPreviousDate( const KDateTime &afterDateTime ) const;
 
+    /** Sets the maximum number of occurrences which this rule keeps in its
+     * occurrence cache.
+     *
+     * Rules without a fixed count (i.e. with an end date or no end at all)
+     * remember the occurrences expanded by timesInInterval() around the
+     * recently queried ranges, so that repeated queries over the same period
+     * need not expand the rule again. The least recently used ranges are
+     * dropped first when the limit is reached.
+     * @param limit maximum number of cached occurrences, or 0 to disable the cache
+     * @see setTotalOccurrenceCacheLimit()
+     */
+    void setOccurrenceCacheLimit( int limit );
+
+    /** Returns the maximum number of occurrences which this rule keeps in its
+     * occurrence cache.
+     */
+    int occurrenceCacheLimit() const;
+
+    /** Sets the maximum number of occurrences cached by all rules together.
+     * When it is exceeded, the caches of the least recently used rules are
+     * dropped.
+     * @param limit maximum total number of cached occurrences
+     */
+    static void setTotalOccurrenceCacheLimit( int limit );
+
+    /** Returns the maximum number of occurrences cached by all rules together.
+     */
+    static int totalOccurrenceCacheLimit();
+
     void setBySeconds( const QList<int> &bySeconds );
     void setByMinutes( const QList<int> &byMinutes );
     void setByHours( const QList<int> &byHours );
@@ -0,0 +1,1146 @@
+/*
+  This file is part of the kcalcore library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+/**
+  @file
+  This file is part of the API for handling calendar data and
+  defines the SnapshotFormat class.
+*/
+#include "snapshotformat.h"
+#include "calendar.h"
+#include "event.h"
+#include "exceptions.h"
+#include "icaltimezones.h"
+#include "incidence_p.h"
+#include "journal.h"
+#include "todo.h"
+
+#include <KDebug>
+#include <KSaveFile>
+#include <ksystemtimezone.h>
+
+#include <QtCore/QBuffer>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+
+using namespace KCalCore;
+
+//@cond PRIVATE
+static const quint32 SnapshotMagic = 0x4B43534E; // "KCSN"
+static const quint32 SnapshotVersion = 2;
+static const qint64 MSecsPerDay = 86400000;
+
+/*
+  The data stream used for snapshots. Strings which tend to repeat are
+  written once and then referred to by index, and time zone names are
+  resolved against the time zones of the calendar being loaded.
+*/
+class SnapshotStream : public QDataStream
+{
+  public:
+    SnapshotStream( QIODevice *device, ICalTimeZones *zones )
+      : QDataStream( device ), mZoneList( zones )
+    {
+      setVersion( QDataStream::Qt_4_6 );
+    }
+
+    void writeString( const QString &string );
+    QString readString();
+    void writeStringList( const QStringList &list );
+    QStringList readStringList();
+    void writeDateTime( const KDateTime &dt );
+    KDateTime readDateTime();
+    void writeDateTimeList( const DateTimeList &list );
+    DateTimeList readDateTimeList();
+    void writeDuration( const Duration &duration );
+    Duration readDuration();
+
+  private:
+    KTimeZone zone( const QString &name );
+
+    ICalTimeZones *mZoneList;
+    QHash<QString, quint32> mStringIds;
+    QStringList mStrings;
+    QHash<QString, KTimeZone> mZones;
+};
+
+void SnapshotStream::writeString( const QString &string )
+{
+  QHash<QString, quint32>::ConstIterator it = mStringIds.constFind( string );
+  if ( it != mStringIds.constEnd() ) {
+    *this << it.value();
+  } else {
+    const quint32 id = mStringIds.count();
+    mStringIds.insert( string, id );
+    *this << id << string;
+  }
+}
+
+QString SnapshotStream::readString()
+{
+  quint32 id;
+  *this >> id;
+  if ( id < quint32( mStrings.count() ) ) {
+    return mStrings.at( id );
+  }
+  if ( id != quint32( mStrings.count() ) ) {
+    kWarning() << "Invalid string reference" << id;
+    setStatus( ReadCorruptData );
+    return QString();
+  }
+  QString string;
+  *this >> string;
+  mStrings.append( string );
+  return string;
+}
+
+void SnapshotStream::writeStringList( const QStringList &list )
+{
+  *this << quint32( list.count() );
+  foreach ( const QString &string, list ) {
+    writeString( string );
+  }
+}
+
+QStringList SnapshotStream::readStringList()
+{
+  quint32 count;
+  *this >> count;
+  QStringList list;
+  for ( quint32 i = 0; i < count && status() == Ok; ++i ) {
+    list.append( readString() );
+  }
+  return list;
+}
+
+void SnapshotStream::writeDateTime( const KDateTime &dt )
+{
+  // Like the KDateTime operators, encode the specification type so that we
+  // are insulated from changes to the SpecType enum.
+  if ( !dt.isValid() ) {
+    *this << quint8( 'i' );
+    return;
+  }
+
+  quint8 type;
+  const KDateTime::Spec spec = dt.timeSpec();
+  switch ( spec.type() ) {
+  case KDateTime::UTC:
+    type = 'u';
+    break;
+  case KDateTime::OffsetFromUTC:
+    type = 'o';
+    break;
+  case KDateTime::TimeZone:
+    type = 'z';
+    break;
+  default:
+    type = 'c';
+    break;
+  }
+
+  *this << type << dt.isDateOnly()
+        << qint64( dt.date().toJulianDay() ) * MSecsPerDay + QTime( 0, 0 ).msecsTo( dt.time() );
+  if ( type == 'o' ) {
+    *this << qint32( spec.utcOffset() );
+  } else if ( type == 'z' ) {
+    writeString( spec.timeZone().name() );
+  }
+}
+
+KDateTime SnapshotStream::readDateTime()
+{
+  quint8 type;
+  *this >> type;
+  if ( type == 'i' ) {
+    return KDateTime();
+  }
+
+  bool dateOnly;
+  qint64 msecs;
+  *this >> dateOnly >> msecs;
+
+  KDateTime::Spec spec;
+  switch ( type ) {
+  case 'u':
+    spec = KDateTime::UTC;
+    break;
+  case 'o':
+  {
+    qint32 offset;
+    *this >> offset;
+    spec = KDateTime::Spec( KDateTime::OffsetFromUTC, offset );
+    break;
+  }
+  case 'z':
+  {
+    const QString name = readString();
+    const KTimeZone tz = zone( name );
+    if ( tz.isValid() ) {
+      spec = KDateTime::Spec( tz );
+    } else {
+      kWarning() << "Unknown time zone" << name << "read as clock time";
+      spec = KDateTime::ClockTime;
+    }
+    break;
+  }
+  case 'c':
+    spec = KDateTime::ClockTime;
+    break;
+  default:
+    kWarning() << "Invalid date-time specification" << type;
+    setStatus( ReadCorruptData );
+    return KDateTime();
+  }
+
+  const QDate date = QDate::fromJulianDay( int( msecs / MSecsPerDay ) );
+  if ( dateOnly ) {
+    return KDateTime( date, spec );
+  }
+  return KDateTime( date, QTime( 0, 0 ).addMSecs( int( msecs % MSecsPerDay ) ), spec );
+}
+
+void SnapshotStream::writeDateTimeList( const DateTimeList &list )
+{
+  *this << quint32( list.count() );
+  foreach ( const KDateTime &dt, list ) {
+    writeDateTime( dt );
+  }
+}
+
+DateTimeList SnapshotStream::readDateTimeList()
+{
+  quint32 count;
+  *this >> count;
+  DateTimeList list;
+  for ( quint32 i = 0; i < count && status() == Ok; ++i ) {
+    list.append( readDateTime() );
+  }
+  return list;
+}
+
+void SnapshotStream::writeDuration( const Duration &duration )
+{
+  *this << qint32( duration.value() ) << duration.isDaily();
+}
+
+Duration SnapshotStream::readDuration()
+{
+  qint32 value;
+  bool daily;
+  *this >> value >> daily;
+  return Duration( value, daily ? Duration::Days : Duration::Seconds );
+}
+
+KTimeZone SnapshotStream::zone( const QString &name )
+{
+  QHash<QString, KTimeZone>::ConstIterator it = mZones.constFind( name );
+  if ( it != mZones.constEnd() ) {
+    return it.value();
+  }
+
+  KTimeZone tz;
+  if ( mZoneList ) {
+    tz = mZoneList->zone( name );
+  }
+  if ( !tz.isValid() ) {
+    tz = KSystemTimeZones::zone( name );
+  }
+  if ( !tz.isValid() ) {
+    ICalTimeZoneSource source;
+    tz = source.standardZone( name );
+  }
+  mZones.insert( name, tz );
+  return tz;
+}
+
+/*
+  Time zones are stored with their phases and transitions, so that loading
+  a snapshot does not need libical to parse the VTIMEZONE definitions. The
+  VTIMEZONE text is kept as well, and only parsed if the zone is written
+  out as iCalendar again.
+*/
+static void writeZone( SnapshotStream &out, const ICalTimeZone &zone )
+{
+  const KTimeZoneData *data = zone.data( true );
+  const QList<KTimeZone::Phase> phases = zone.phases();
+  const QList<KTimeZone::Transition> transitions = zone.transitions();
+
+  out << zone.name() << zone.city() << zone.url() << zone.lastModified()
+      << qint32( data ? data->previousUtcOffset() : 0 );
+
+  out << quint32( phases.count() );
+  foreach ( const KTimeZone::Phase &phase, phases ) {
+    out << qint32( phase.utcOffset() ) << phase.abbreviations()
+        << phase.isDst() << phase.comment();
+  }
+
+  out << quint32( transitions.count() );
+  foreach ( const KTimeZone::Transition &transition, transitions ) {
+    out << transition.time() << qint32( phases.indexOf( transition.phase() ) );
+  }
+
+  out << zone.vtimezone();
+}
+
+static ICalTimeZone readZone( SnapshotStream &in, ICalTimeZoneSource *source )
+{
+  QString name, city;
+  QByteArray url, vtimezone;
+  QDateTime lastModified;
+  qint32 previousUtcOffset;
+  quint32 count;
+
+  in >> name >> city >> url >> lastModified >> previousUtcOffset;
+
+  QList<KTimeZone::Phase> phases;
+  in >> count;
+  for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i ) {
+    qint32 utcOffset;
+    QList<QByteArray> abbreviations;
+    bool dst;
+    QString comment;
+    in >> utcOffset >> abbreviations >> dst >> comment;
+    phases.append( KTimeZone::Phase( utcOffset, abbreviations, dst, comment ) );
+  }
+
+  QList<KTimeZone::Transition> transitions;
+  in >> count;
+  for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i ) {
+    QDateTime time;
+    qint32 phase;
+    in >> time >> phase;
+    if ( phase < 0 || phase >= phases.count() ) {
+      in.setStatus( QDataStream::ReadCorruptData );
+      break;
+    }
+    transitions.append( KTimeZone::Transition( time, phases.at( phase ) ) );
+  }
+
+  in >> vtimezone;
+  if ( in.status() != QDataStream::Ok || name.isEmpty() ) {
+    return ICalTimeZone();
+  }
+
+  ICalTimeZoneData *data = new ICalTimeZoneData();
+  setICalTimeZoneData( data, phases, previousUtcOffset, transitions,
+                       city, url, lastModified, vtimezone );
+  return ICalTimeZone( source, name, data );
+}
+
+static void writeAlarm( SnapshotStream &out, const Alarm::Ptr &alarm )
+{
+  out << *static_cast<const CustomProperties *>( alarm.data() )
+      << qint32( alarm->type() );
+  switch ( alarm->type() ) {
+  case Alarm::Display:
+    out << alarm->text();
+    break;
+  case Alarm::Procedure:
+    out.writeString( alarm->programFile() );
+    out << alarm->programArguments();
+    break;
+  case Alarm::Email:
+  {
+    const Person::List addresses = alarm->mailAddresses();
+    out << alarm->mailSubject() << alarm->mailText() << alarm->mailAttachments();
+    out << quint32( addresses.count() );
+    foreach ( const Person::Ptr &person, addresses ) {
+      out << person;
+    }
+    break;
+  }
+  case Alarm::Audio:
+    out.writeString( alarm->audioFile() );
+    break;
+  case Alarm::Invalid:
+    break;
+  }
+
+  // the alarm time is either absolute, or relative to the start or end
+  quint8 timing = alarm->hasTime() ? 't' : alarm->hasEndOffset() ? 'e' : 's';
+  out << timing;
+  if ( timing == 't' ) {
+    out.writeDateTime( alarm->time() );
+  } else {
+    out.writeDuration( timing == 'e' ? alarm->endOffset() : alarm->startOffset() );
+  }
+
+  out.writeDuration( alarm->snoozeTime() );
+  out << qint32( alarm->repeatCount() ) << alarm->enabled()
+      << alarm->hasLocationRadius() << qint32( alarm->locationRadius() );
+}
+
+static void readAlarm( SnapshotStream &in, const Incidence::Ptr &incidence )
+{
+  const Alarm::Ptr alarm = incidence->newAlarm();
+  qint32 type;
+
+  in >> *static_cast<CustomProperties *>( alarm.data() ) >> type;
+  switch ( type ) {
+  case Alarm::Display:
+  {
+    QString text;
+    in >> text;
+    alarm->setDisplayAlarm( text );
+    break;
+  }
+  case Alarm::Procedure:
+  {
+    const QString programFile = in.readString();
+    QString arguments;
+    in >> arguments;
+    alarm->setProcedureAlarm( programFile, arguments );
+    break;
+  }
+  case Alarm::Email:
+  {
+    QString subject, text;
+    QStringList attachments;
+    Person::List addresses;
+    quint32 count;
+    in >> subject >> text >> attachments >> count;
+    for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i ) {
+      Person::Ptr person;
+      in >> person;
+      addresses.append( person );
+    }
+    alarm->setEmailAlarm( subject, text, addresses, attachments );
+    break;
+  }
+  case Alarm::Audio:
+    alarm->setAudioAlarm( in.readString() );
+    break;
+  default:
+    break;
+  }
+
+  quint8 timing;
+  in >> timing;
+  if ( timing == 't' ) {
+    alarm->setTime( in.readDateTime() );
+  } else if ( timing == 'e' ) {
+    alarm->setEndOffset( in.readDuration() );
+  } else {
+    alarm->setStartOffset( in.readDuration() );
+  }
+
+  qint32 repeatCount, locationRadius;
+  bool enabled, hasLocationRadius;
+  alarm->setSnoozeTime( in.readDuration() );
+  in >> repeatCount >> enabled >> hasLocationRadius >> locationRadius;
+  alarm->setRepeatCount( repeatCount );
+  alarm->setEnabled( enabled );
+  // the radius goes first, setHasLocationRadius() stores it as a property
+  alarm->setLocationRadius( locationRadius );
+  alarm->setHasLocationRadius( hasLocationRadius );
+}
+
+/*
+  Recurrence rules are stored decoded, so that no RRULE text needs to be
+  parsed on load.
+*/
+static void writeRule( SnapshotStream &out, const RecurrenceRule *rule )
+{
+  out << rule->rrule() << qint32( rule->recurrenceType() );
+  out.writeDateTime( rule->startDt() );
+  out << quint32( rule->frequency() ) << qint32( rule->duration() );
+  if ( rule->duration() == 0 ) {
+    out.writeDateTime( rule->endDt() );
+  }
+  out << rule->bySeconds() << rule->byMinutes() << rule->byHours();
+
+  out << quint32( rule->byDays().count() );
+  foreach ( const RecurrenceRule::WDayPos &pos, rule->byDays() ) {
+    out << qint32( pos.pos() ) << qint16( pos.day() );
+  }
+
+  out << rule->byMonthDays() << rule->byYearDays() << rule->byWeekNumbers()
+      << rule->byMonths() << rule->bySetPos()
+      << qint16( rule->weekStart() ) << rule->isReadOnly();
+}
+
+static RecurrenceRule *readRule( SnapshotStream &in, bool *readOnly )
+{
+  RecurrenceRule *rule = new RecurrenceRule();
+  QString rrule;
+  qint32 period, duration;
+  quint32 frequency, count;
+
+  in >> rrule >> period;
+  rule->setRRule( rrule );
+  rule->setRecurrenceType( static_cast<RecurrenceRule::PeriodType>( period ) );
+  rule->setStartDt( in.readDateTime() );
+  in >> frequency >> duration;
+  rule->setFrequency( frequency );
+  if ( duration == 0 ) {
+    rule->setEndDt( in.readDateTime() );
+  } else {
+    rule->setDuration( duration );
+  }
+
+  QList<int> list;
+  in >> list;
+  rule->setBySeconds( list );
+  in >> list;
+  rule->setByMinutes( list );
+  in >> list;
+  rule->setByHours( list );
+
+  QList<RecurrenceRule::WDayPos> byDays;
+  in >> count;
+  for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i ) {
+    qint32 pos;
+    qint16 day;
+    in >> pos >> day;
+    byDays.append( RecurrenceRule::WDayPos( pos, day ) );
+  }
+  rule->setByDays( byDays );
+
+  in >> list;
+  rule->setByMonthDays( list );
+  in >> list;
+  rule->setByYearDays( list );
+  in >> list;
+  rule->setByWeekNumbers( list );
+  in >> list;
+  rule->setByMonths( list );
+  in >> list;
+  rule->setBySetPos( list );
+
+  qint16 weekStart;
+  in >> weekStart >> *readOnly;
+  rule->setWeekStart( weekStart );
+  return rule;
+}
+
+static void writeRecurrence( SnapshotStream &out, const Recurrence *recurrence )
+{
+  out.writeDateTime( recurrence->startDateTime() );
+  out << recurrence->allDay() << recurrence->recurReadOnly();
+  out.writeDateTimeList( recurrence->rDateTimes() );
+  out << recurrence->rDates();
+  out.writeDateTimeList( recurrence->exDateTimes() );
+  out << recurrence->exDates();
+
+  const RecurrenceRule::List rrules = recurrence->rRules();
+  out << quint32( rrules.count() );
+  foreach ( const RecurrenceRule *rule, rrules ) {
+    writeRule( out, rule );
+  }
+  const RecurrenceRule::List exrules = recurrence->exRules();
+  out << quint32( exrules.count() );
+  foreach ( const RecurrenceRule *rule, exrules ) {
+    writeRule( out, rule );
+  }
+}
+
+static void readRecurrence( SnapshotStream &in, Recurrence *recurrence )
+{
+  bool allDay, readOnly;
+  DateList dates;
+  quint32 count;
+
+  recurrence->setStartDateTime( in.readDateTime() );
+  in >> allDay >> readOnly;
+  recurrence->setAllDay( allDay );
+  recurrence->setRDateTimes( in.readDateTimeList() );
+  in >> dates;
+  recurrence->setRDates( dates );
+  recurrence->setExDateTimes( in.readDateTimeList() );
+  in >> dates;
+  recurrence->setExDates( dates );
+
+  in >> count;
+  for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i ) {
+    bool ruleReadOnly;
+    RecurrenceRule *rule = readRule( in, &ruleReadOnly );
+    recurrence->addRRule( rule );
+    rule->setReadOnly( ruleReadOnly );
+  }
+  in >> count;
+  for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i ) {
+    bool ruleReadOnly;
+    RecurrenceRule *rule = readRule( in, &ruleReadOnly );
+    recurrence->addExRule( rule );
+    rule->setReadOnly( ruleReadOnly );
+  }
+
+  recurrence->setRecurReadOnly( readOnly );
+}
+
+static void writeIncidence( SnapshotStream &out, const Incidence::Ptr &incidence )
+{
+  out << qint32( incidence->type() )
+      << *static_cast<const CustomProperties *>( incidence.data() );
+  out.writeDateTime( incidence->lastModified() );
+  // the stored start, not the one of the current occurrence of a to-do
+  out.writeDateTime( incidence->IncidenceBase::dtStart() );
+  out << incidence->organizer() << incidence->uid();
+  out.writeDuration( incidence->duration() );
+  out << incidence->hasDuration() << incidence->allDay() << incidence->isReadOnly();
+  out.writeStringList( incidence->comments() );
+  out.writeStringList( incidence->contacts() );
+
+  const Attendee::List &attendees = IncidenceInternals::attendees( *incidence );
+  out << quint32( attendees.count() );
+  foreach ( const Attendee::Ptr &attendee, attendees ) {
+    out << attendee;
+  }
+
+  out.writeDateTime( incidence->created() );
+  out << qint32( incidence->revision() )
+      << incidence->description() << incidence->descriptionIsRich()
+      << incidence->summary() << incidence->summaryIsRich();
+  out.writeString( incidence->location() );
+  out << incidence->locationIsRich();
+  out.writeStringList( incidence->categories() );
+  out.writeStringList( incidence->resources() );
+  out << qint32( incidence->status() );
+  out.writeString( incidence->customStatus() );
+  out << qint32( incidence->secrecy() ) << qint32( incidence->priority() )
+      << incidence->schedulingID()
+      << incidence->relatedTo( Incidence::RelTypeParent )
+      << incidence->relatedTo( Incidence::RelTypeChild )
+      << incidence->relatedTo( Incidence::RelTypeSibling );
+  out << incidence->hasGeo() << incidence->geoLatitude() << incidence->geoLongitude();
+  out.writeDateTime( incidence->recurrenceId() );
+  out << incidence->localOnly();
+
+  const Attachment::List &attachments = IncidenceInternals::attachments( *incidence );
+  out << quint32( attachments.count() );
+  foreach ( const Attachment::Ptr &attachment, attachments ) {
+    out << attachment->isUri();
+    if ( attachment->isUri() ) {
+      out << attachment->uri();
+    } else {
+      out << attachment->data();
+    }
+    out.writeString( attachment->mimeType() );
+    out << attachment->showInline() << attachment->label() << attachment->isLocal();
+  }
+
+  const Alarm::List &alarms = IncidenceInternals::alarms( *incidence );
+  out << quint32( alarms.count() );
+  foreach ( const Alarm::Ptr &alarm, alarms ) {
+    writeAlarm( out, alarm );
+  }
+
+  switch ( incidence->type() ) {
+  case IncidenceBase::TypeEvent:
+  {
+    const Event::Ptr event = incidence.staticCast<Event>();
+    out << event->hasEndDate();
+    if ( event->hasEndDate() ) {
+      out.writeDateTime( event->dtEnd() );
+    }
+    out << qint32( event->transparency() );
+    break;
+  }
+  case IncidenceBase::TypeTodo:
+  {
+    const Todo::Ptr todo = incidence.staticCast<Todo>();
+    out.writeDateTime( todo->dtDue( true ) );
+    out << todo->hasDueDate() << todo->hasStartDate();
+    out.writeDateTime( todo->completed() );
+    out << todo->hasCompletedDate() << qint32( todo->percentComplete() );
+    out.writeDateTime( todo->dtRecurrence() );
+    break;
+  }
+  default:
+    break;
+  }
+
+  out << incidence->recurs();
+  if ( incidence->recurs() ) {
+    writeRecurrence( out, IncidenceInternals::recurrence( *incidence ) );
+  }
+}
+
+/*
+  Rebuilds an incidence through its public setters, in the order the
+  iCalendar reader uses: setters which depend on other fields come after
+  them, and the read-only flag, which blocks all setters, comes last.
+*/
+static Incidence::Ptr readIncidence( SnapshotStream &in )
+{
+  qint32 type;
+  in >> type;
+
+  Incidence::Ptr incidence;
+  switch ( type ) {
+  case IncidenceBase::TypeEvent:
+    incidence = Incidence::Ptr( new Event() );
+    break;
+  case IncidenceBase::TypeTodo:
+    incidence = Incidence::Ptr( new Todo() );
+    break;
+  case IncidenceBase::TypeJournal:
+    incidence = Incidence::Ptr( new Journal() );
+    break;
+  default:
+    kWarning() << "Invalid incidence type" << type;
+    in.setStatus( QDataStream::ReadCorruptData );
+    return Incidence::Ptr();
+  }
+
+  QString string;
+  bool flag, readOnly;
+  qint32 number;
+  quint32 count;
+
+  in >> *static_cast<CustomProperties *>( incidence.data() );
+  const KDateTime lastModified = in.readDateTime();
+  incidence->setDtStart( in.readDateTime() );
+
+  Person::Ptr organizer;
+  in >> organizer >> string;
+  incidence->setOrganizer( organizer );
+  incidence->setUid( string );
+
+  const Duration duration = in.readDuration();
+  in >> flag;
+  if ( flag ) {
+    incidence->setDuration( duration );
+  }
+  in >> flag >> readOnly;
+  incidence->setAllDay( flag );
+  foreach ( const QString &comment, in.readStringList() ) {
+    incidence->addComment( comment );
+  }
+  foreach ( const QString &contact, in.readStringList() ) {
+    incidence->addContact( contact );
+  }
+
+  in >> count;
+  for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i ) {
+    Attendee::Ptr attendee;
+    in >> attendee;
+    incidence->addAttendee( attendee, false );
+  }
+
+  const KDateTime created = in.readDateTime();
+  bool isRich;
+  in >> number;
+  const int revision = number;
+  in >> string >> isRich;
+  incidence->setDescription( string, isRich );
+  in >> string >> isRich;
+  incidence->setSummary( string, isRich );
+  string = in.readString();
+  in >> isRich;
+  incidence->setLocation( string, isRich );
+  incidence->setCategories( in.readStringList() );
+  incidence->setResources( in.readStringList() );
+  in >> number;
+  string = in.readString();
+  if ( number == Incidence::StatusX ) {
+    incidence->setCustomStatus( string );
+  } else {
+    incidence->setStatus( static_cast<Incidence::Status>( number ) );
+  }
+  in >> number;
+  incidence->setSecrecy( static_cast<Incidence::Secrecy>( number ) );
+  in >> number;
+  incidence->setPriority( number );
+  in >> string;
+  incidence->setSchedulingID( string );
+  for ( int relType = Incidence::RelTypeParent; relType <= Incidence::RelTypeSibling; ++relType ) {
+    in >> string;
+    if ( !string.isEmpty() ) {
+      incidence->setRelatedTo( string, static_cast<Incidence::RelType>( relType ) );
+    }
+  }
+
+  float latitude, longitude;
+  in >> flag >> latitude >> longitude;
+  incidence->setHasGeo( flag );
+  incidence->setGeoLatitude( latitude );
+  incidence->setGeoLongitude( longitude );
+  incidence->setRecurrenceId( in.readDateTime() );
+
+  // local-only incidences ignore changes to these
+  incidence->setCreated( created );
+  incidence->setRevision( revision );
+  incidence->setLastModified( lastModified );
+  in >> flag;
+  incidence->setLocalOnly( flag );
+
+  in >> count;
+  for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i ) {
+    bool isUri, showInline, local;
+    QString uri, label;
+    QByteArray data;
+    in >> isUri;
+    if ( isUri ) {
+      in >> uri;
+    } else {
+      in >> data;
+    }
+    const QString mimeType = in.readString();
+    in >> showInline >> label >> local;
+
+    Attachment::Ptr attachment( isUri ? new Attachment( uri, mimeType ) :
+                                        new Attachment( data, mimeType ) );
+    attachment->setShowInline( showInline );
+    attachment->setLabel( label );
+    attachment->setLocal( local );
+    incidence->addAttachment( attachment );
+  }
+
+  in >> count;
+  for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i ) {
+    readAlarm( in, incidence );
+  }
+
+  bool hasStartDate = false;
+  switch ( type ) {
+  case IncidenceBase::TypeEvent:
+  {
+    const Event::Ptr event = incidence.staticCast<Event>();
+    in >> flag;
+    if ( flag ) {
+      event->setDtEnd( in.readDateTime() );
+    }
+    in >> number;
+    event->setTransparency( static_cast<Event::Transparency>( number ) );
+    break;
+  }
+  case IncidenceBase::TypeTodo:
+  {
+    // the completion is set before the recurrence, which it would advance
+    const Todo::Ptr todo = incidence.staticCast<Todo>();
+    const KDateTime due = in.readDateTime();
+    if ( due.isValid() ) {
+      todo->setDtDue( due, true );
+    }
+    in >> flag >> hasStartDate;
+    todo->setHasDueDate( flag );
+    const KDateTime completed = in.readDateTime();
+    in >> flag >> number;
+    if ( flag ) {
+      todo->setCompleted( completed );
+    }
+    todo->setPercentComplete( number );
+    todo->setDtRecurrence( in.readDateTime() );
+    break;
+  }
+  default:
+    break;
+  }
+
+  in >> flag;
+  if ( flag ) {
+    readRecurrence( in, incidence->recurrence() );
+  }
+  if ( type == IncidenceBase::TypeTodo ) {
+    incidence.staticCast<Todo>()->setHasStartDate( hasStartDate );
+  }
+
+  incidence->setReadOnly( readOnly );
+  incidence->resetDirtyFields();
+  // the recurrence and alarms were only handed out to fill them in
+  IncidenceInternals::forgetHandedOut( *incidence );
+  return incidence;
+}
+
+class KCalCore::SnapshotFormat::Private
+{
+  public:
+    Private( SnapshotFormat *parent )
+      : mParent( parent )
+    {}
+
+    bool read( const Calendar::Ptr &calendar, QIODevice *device, bool deleted );
+    bool write( const Calendar::Ptr &calendar, QIODevice *device,
+                const QString &notebook, bool deleted );
+    void mergeIncidence( const Calendar::Ptr &calendar, const Incidence::Ptr &incidence,
+                         bool deleted );
+
+    SnapshotFormat *mParent;
+};
+
+/*
+  Selects the incidences the same way ICalFormat::toString() does:
+  either the live ones, or the deleted ones which are not live again,
+  restricted to @p notebook if given.
+*/
+template <typename T>
+static void selectIncidences( const Calendar::Ptr &cal, const QList<QSharedPointer<T> > &list,
+                              const QString &notebook, bool deleted,
+                              Incidence::List &selected )
+{
+  typename QList<QSharedPointer<T> >::ConstIterator it;
+  for ( it = list.constBegin(); it != list.constEnd(); ++it ) {
+    if ( deleted && cal->incidence( ( *it )->uid(), ( *it )->recurrenceId() ) ) {
+      continue;
+    }
+    if ( notebook.isEmpty() ||
+         ( !cal->notebook( *it ).isEmpty() && notebook.endsWith( cal->notebook( *it ) ) ) ) {
+      selected.append( *it );
+    }
+  }
+}
+
+bool SnapshotFormat::Private::write( const Calendar::Ptr &cal, QIODevice *device,
+                                     const QString &notebook, bool deleted )
+{
+  Incidence::List incidences;
+  selectIncidences( cal, deleted ? cal->deletedTodos() : cal->rawTodos(),
+                    notebook, deleted, incidences );
+  selectIncidences( cal, deleted ? cal->deletedEvents() : cal->rawEvents(),
+                    notebook, deleted, incidences );
+  selectIncidences( cal, deleted ? cal->deletedJournals() : cal->rawJournals(),
+                    notebook, deleted, incidences );
+
+  SnapshotStream out( device, cal->timeZones() );
+
+  out << SnapshotMagic << SnapshotVersion;
+  out << CalFormat::productId();
+  out << *static_cast<CustomProperties*>( cal.data() );
+
+  // time zone definitions, so that the incidences can refer to them by name
+  const ICalTimeZones::ZoneMap zones = cal->timeZones()->zones();
+  out << quint32( zones.count() );
+  ICalTimeZones::ZoneMap::ConstIterator zit;
+  for ( zit = zones.constBegin(); zit != zones.constEnd(); ++zit ) {
+    writeZone( out, zit.value() );
+  }
+
+  out << quint32( incidences.count() );
+  Incidence::List::ConstIterator it;
+  for ( it = incidences.constBegin(); it != incidences.constEnd(); ++it ) {
+    writeIncidence( out, *it );
+  }
+
+  return out.status() == QDataStream::Ok;
+}
+
+bool SnapshotFormat::Private::read( const Calendar::Ptr &cal, QIODevice *device, bool deleted )
+{
+  ICalTimeZones *tzlist = cal->timeZones();
+  SnapshotStream in( device, tzlist );
+
+  quint32 magic, version;
+  in >> magic >> version;
+  if ( in.status() != QDataStream::Ok || magic != SnapshotMagic ) {
+    mParent->setException( new Exception( Exception::ParseErrorKcal ) );
+    return false;
+  }
+  if ( version != SnapshotVersion ) {
+    mParent->setException( new Exception( Exception::CalVersionUnknown ) );
+    return false;
+  }
+
+  QString productId;
+  in >> productId;
+  in >> *static_cast<CustomProperties*>( cal.data() );
+
+  quint32 count;
+  in >> count;
+  ICalTimeZoneSource tzs;
+  for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i ) {
+    // the calendar may hold zones shared through the registry
+    ICalTimeZoneRegistry::add( readZone( in, &tzs ), *tzlist );
+  }
+
+  in >> count;
+  for ( quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i ) {
+    const Incidence::Ptr incidence = readIncidence( in );
+    if ( incidence && in.status() == QDataStream::Ok ) {
+      mergeIncidence( cal, incidence, deleted );
+    }
+  }
+
+  if ( in.status() != QDataStream::Ok ) {
+    kError() << "Truncated or corrupt snapshot";
+    mParent->setException( new Exception( Exception::ParseErrorKcal ) );
+    return false;
+  }
+
+  mParent->setLoadedProductId( productId );
+  return true;
+}
+
+void SnapshotFormat::Private::mergeIncidence( const Calendar::Ptr &cal,
+                                              const Incidence::Ptr &incidence, bool deleted )
+{
+  const Incidence::Ptr old = cal->incidence( incidence->uid(), incidence->recurrenceId() );
+  if ( old ) {
+    if ( deleted ) {
+      cal->deleteIncidence( old ); // move old to deleted
+    } else if ( incidence->revision() > old->revision() ) {
+      cal->deleteIncidence( old ); // move old to deleted
+      cal->addIncidence( incidence ); // and replace it with this one
+    }
+  } else if ( deleted ) {
+    Incidence::Ptr dold;
+    switch ( incidence->type() ) {
+    case IncidenceBase::TypeEvent:
+      dold = cal->deletedEvent( incidence->uid(), incidence->recurrenceId() );
+      break;
+    case IncidenceBase::TypeTodo:
+      dold = cal->deletedTodo( incidence->uid(), incidence->recurrenceId() );
+      break;
+    case IncidenceBase::TypeJournal:
+      dold = cal->deletedJournal( incidence->uid(), incidence->recurrenceId() );
+      break;
+    default:
+      break;
+    }
+    if ( !dold ) {
+      cal->addIncidence( incidence ); // add this one
+      cal->deleteIncidence( incidence ); // and move it to deleted
+    }
+  } else {
+    cal->addIncidence( incidence ); // just add this one
+  }
+}
+//@endcond
+
+SnapshotFormat::SnapshotFormat()
+  : d( new Private( this ) )
+{
+}
+
+SnapshotFormat::~SnapshotFormat()
+{
+  delete d;
+}
+
+quint32 SnapshotFormat::formatVersion()
+{
+  return SnapshotVersion;
+}
+
+bool SnapshotFormat::load( const Calendar::Ptr &calendar, const QString &fileName )
+{
+  kDebug() << fileName;
+
+  clearException();
+
+  QFile file( fileName );
+  if ( !file.open( QIODevice::ReadOnly ) ) {
+    kError() << "load error";
+    setException( new Exception( Exception::LoadError ) );
+    return false;
+  }
+
+  if ( file.size() == 0 ) {
+    // empty files are valid
+    return true;
+  }
+
+  // Read straight from the page cache when the file can be mapped.
+  QByteArray data;
+  uchar *mapped = file.map( 0, file.size() );
+  if ( mapped ) {
+    data = QByteArray::fromRawData( reinterpret_cast<const char *>( mapped ), file.size() );
+  } else {
+    data = file.readAll();
+  }
+
+  QBuffer buffer( &data );
+  buffer.open( QIODevice::ReadOnly );
+  const bool success = d->read( calendar, &buffer, false );
+  buffer.close();
+
+  if ( mapped ) {
+    file.unmap( mapped );
+  }
+  file.close();
+
+  return success;
+}
+
+bool SnapshotFormat::save( const Calendar::Ptr &calendar, const QString &fileName )
+{
+  kDebug() << fileName;
+
+  clearException();
+
+  // Write backup file
+  KSaveFile::backupFile( fileName );
+
+  KSaveFile file( fileName );
+  if ( !file.open() ) {
+    kDebug() << "file open error:" << file.errorString();
+    setException( new Exception( Exception::SaveErrorOpenFile,
+                                 QStringList( fileName ) ) );
+
+    return false;
+  }
+
+  if ( !d->write( calendar, &file, QString(), false ) || !file.finalize() ) {
+    kDebug() << "file finalize error:" << file.errorString();
+    setException( new Exception( Exception::SaveErrorSaveFile,
+                                 QStringList( fileName ) ) );
+
+    return false;
+  }
+
+  return true;
+}
+
+bool SnapshotFormat::fromString( const Calendar::Ptr &calendar, const QString &string,
+                                 bool deleted, const QString &notebook )
+{
+  return fromRawString( calendar, QByteArray::fromBase64( string.toLatin1() ),
+                        deleted, notebook );
+}
+
+bool SnapshotFormat::fromRawString( const Calendar::Ptr &calendar, const QByteArray &string,
+                                    bool deleted, const QString &notebook )
+{
+  Q_UNUSED( notebook );
+
+  clearException();
+
+  QByteArray data( string );
+  QBuffer buffer( &data );
+  buffer.open( QIODevice::ReadOnly );
+  return d->read( calendar, &buffer, deleted );
+}
+
+QString SnapshotFormat::toString( const Calendar::Ptr &calendar,
+                                  const QString &notebook, bool deleted )
+{
+  return QString::fromLatin1( toRawString( calendar, notebook, deleted ).toBase64() );
+}
+
+QByteArray SnapshotFormat::toRawString( const Calendar::Ptr &calendar,
+                                        const QString &notebook, bool deleted )
+{
+  clearException();
+
+  QByteArray data;
+  QBuffer buffer( &data );
+  buffer.open( QIODevice::WriteOnly );
+  if ( !d->write( calendar, &buffer, notebook, deleted ) ) {
+    setException( new Exception( Exception::SaveError ) );
+    return QByteArray();
+  }
+  return data;
+}
+
+void SnapshotFormat::virtual_hook( int id, void *data )
+{
+  Q_UNUSED( id );
+  Q_UNUSED( data );
+  Q_ASSERT( false );
+}
@@ -0,0 +1,136 @@
+/*
+  This file is part of the kcalcore library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+/**
+  @file
+  This file is part of the API for handling calendar data and
+  defines the SnapshotFormat class.
+*/
+#ifndef KCALCORE_SNAPSHOTFORMAT_H
+#define KCALCORE_SNAPSHOTFORMAT_H
+
+#include "kcalcore_export.h"
+#include "calformat.h"
+
+namespace KCalCore {
+
+/**
+  @brief
+  Binary calendar snapshot format.
+
+  This class stores a whole calendar in a compact, versioned binary form
+  which is much faster to load and save than iCalendar. It is meant as a
+  cache next to the real calendar file, not as an exchange format:
+  snapshots are only readable by the same major format version.
+
+  Strings which tend to repeat, such as categories, locations and time
+  zone names, are stored once and then referred to by index. Date-times
+  are stored as wall clock time plus a reference to their time zone. The
+  time zones of the calendar are stored once, with their phases and
+  transitions, so that loading does not parse any VTIMEZONE; recurrence
+  rules are likewise stored decoded. Snapshots are read from a memory
+  mapped file.
+
+  fromString() and toString() work on the base64 encoding of a snapshot.
+*/
+class KCALCORE_EXPORT SnapshotFormat : public CalFormat
+{
+  public:
+    /**
+      Constructs a new snapshot format object.
+    */
+    SnapshotFormat();
+
+    /**
+      Destructor.
+    */
+    virtual ~SnapshotFormat();
+
+    /**
+      @copydoc
+      CalFormat::load()
+    */
+    bool load( const Calendar::Ptr &calendar, const QString &fileName );
+
+    /**
+      @copydoc
+      CalFormat::save()
+    */
+    bool save( const Calendar::Ptr &calendar, const QString &fileName );
+
+    /**
+      @copydoc
+      CalFormat::fromString()
+
+      @p string holds a base64 encoded snapshot.
+    */
+    bool fromString( const Calendar::Ptr &calendar, const QString &string,
+                     bool deleted = false, const QString &notebook = QString() );
+
+    /**
+      @copydoc
+      CalFormat::fromRawString()
+
+      @note The notebook is ignored and the default one is used
+    */
+    bool fromRawString( const Calendar::Ptr &calendar, const QByteArray &string,
+                        bool deleted = false, const QString &notebook = QString() );
+
+    /**
+      @copydoc
+      CalFormat::toString()
+
+      @return a base64 encoded snapshot.
+    */
+    QString toString( const Calendar::Ptr &calendar,
+                      const QString &notebook = QString(), bool deleted = false );
+
+    /**
+      Returns a snapshot of @p calendar.
+
+      @param calendar is the calendar to serialize.
+      @param notebook restricts the snapshot to the incidences of a notebook,
+      or includes all incidences if empty.
+      @param deleted if true, the deleted incidences are stored instead.
+    */
+    QByteArray toRawString( const Calendar::Ptr &calendar,
+                            const QString &notebook = QString(), bool deleted = false );
+
+    /**
+      Returns the version of the snapshots written by this class.
+    */
+    static quint32 formatVersion();
+
+  protected:
+    /**
+      @copydoc
+      IncidenceBase::virtual_hook()
+    */
+    virtual void virtual_hook( int id, void *data );
+
+  private:
+    //@cond PRIVATE
+    Q_DISABLE_COPY( SnapshotFormat )
+    class Private;
+    Private *const d;
+    //@endcond
+};
+
+}
+
+#endif
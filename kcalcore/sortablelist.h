@@ -29,9 +29,13 @@
 #ifndef KCALCORE_SORTABLELIST_H
 #define KCALCORE_SORTABLELIST_H
 
+#include "kcalcore_export.h"
+
 #include <QtCore/QList>
 #include <QtCore/QtAlgorithms>
 
+class KDateTime;
+
 namespace KCalCore {
 
 //@cond PRIVATE
@@ -57,6 +61,12 @@ void qSortUnique( QList<T> &list )
     }
   }
 }
+
+/*
+  Sorts date/times through their compact form, which avoids converting
+  them to UTC for every comparison.
+*/
+KCALCORE_EXPORT void qSortUnique( QList<KDateTime> &list );
 //@endcond
 
 /**
@@ -0,0 +1,398 @@
+/*
+  This file is part of the kcalcore library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#include "calendarbenchmark.h"
+#include "testincidencegenerator.h"
+#include "../freebusy.h"
+#include "../icalformat.h"
+#include "../memorycalendar.h"
+#include "../recurrencerule.h"
+#include "../vcalformat.h"
+
+#include <ksystemtimezone.h>
+
+#include <QtCore/QBitArray>
+#include <QtCore/QFile>
+
+#include <qtest_kde.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+QTEST_KDEMAIN( CalendarBenchmark, NoGUI )
+
+using namespace KCalCore;
+
+static const char benchmarkFile[] = "calendarbenchmark.ics";
+static const char vCalBenchmarkFile[] = "calendarbenchmark.vcs";
+
+static const KDateTime benchmarkStart( QDate( 2012, 1, 2 ), QTime( 8, 0 ), KDateTime::UTC );
+
+/**
+  Generates a calendar of @p count incidences spread over the year after
+  benchmarkStart: four fifths are events, of which one in ten recurs and
+  one in five has an alarm, the rest are split between todos and journals.
+*/
+static MemoryCalendar::Ptr generateCalendar( int count )
+{
+  MemoryCalendar::Ptr calendar( new MemoryCalendar( KDateTime::UTC ) );
+  const int minutesPerYear = 365 * 24 * 60;
+
+  for ( int i = 0; i < count; ++i ) {
+    const KDateTime dt = benchmarkStart.addSecs( 60 * ( qint64( i ) * 7919 % minutesPerYear ) );
+    const QString uid = QString::fromLatin1( "benchmark-%1" ).arg( i );
+
+    if ( i % 10 < 8 ) {
+      Event::Ptr event( makeTestEvent() );
+      event->setUid( uid );
+      event->setDtStart( dt );
+      event->setDtEnd( dt.addSecs( 3600 ) );
+      switch ( i % 20 ) {
+      case 0:
+        event->recurrence()->setWeekly( 1 );   // unbounded
+        break;
+      case 10:
+        break;                                 // the generator's daily rule
+      default:
+        event->recurrence()->clear();
+      }
+      if ( i % 5 == 1 ) {
+        Alarm::Ptr alarm = event->newAlarm();
+        alarm->setEnabled( true );
+        alarm->setStartOffset( Duration( -900 ) );
+      }
+      calendar->addEvent( event );
+    } else if ( i % 10 == 8 ) {
+      Todo::Ptr todo( makeTestTodo() );
+      todo->setUid( uid );
+      todo->setDtDue( dt );
+      calendar->addTodo( todo );
+    } else {
+      Journal::Ptr journal( makeTestJournal() );
+      journal->setUid( uid );
+      journal->setDtStart( dt );
+      calendar->addJournal( journal );
+    }
+  }
+  return calendar;
+}
+
+static MemoryCalendar::Ptr cachedCalendar( int count )
+{
+  static int cachedCount = -1;
+  static MemoryCalendar::Ptr calendar;
+  if ( count != cachedCount ) {
+    calendar.clear();
+    calendar = generateCalendar( count );
+    cachedCount = count;
+  }
+  return calendar;
+}
+
+void CalendarBenchmark::sizes()
+{
+  QTest::addColumn<int>( "count" );
+
+  int maxCount = qgetenv( "KCALCORE_BENCHMARK_SIZE" ).toInt();
+  if ( maxCount <= 0 ) {
+    maxCount = 10000;
+  }
+  for ( int count = 1000; count <= qMin( maxCount, 1000000 ); count *= 10 ) {
+    QTest::newRow( QByteArray::number( count ).constData() ) << count;
+  }
+}
+
+void CalendarBenchmark::rules()
+{
+  QTest::addColumn<int>( "type" );
+
+  QTest::newRow( "daily" ) << int( RecurrenceRule::rDaily );
+  QTest::newRow( "weekly byday" ) << int( RecurrenceRule::rWeekly );
+  QTest::newRow( "monthly bysetpos" ) << int( RecurrenceRule::rMonthly );
+  QTest::newRow( "yearly bymonth" ) << int( RecurrenceRule::rYearly );
+}
+
+/**
+  Returns an unbounded recurrence of the given type, starting at
+  benchmarkStart.
+*/
+static Recurrence *makeRecurrence( int type )
+{
+  Recurrence *recurrence = new Recurrence();
+  recurrence->setStartDateTime( benchmarkStart );
+
+  QBitArray days( 7 );
+  switch ( type ) {
+  case RecurrenceRule::rDaily:
+    recurrence->setDaily( 1 );
+    break;
+  case RecurrenceRule::rWeekly:
+    days.setBit( 0 );
+    days.setBit( 2 );
+    days.setBit( 4 );
+    recurrence->setWeekly( 1, days );
+    break;
+  case RecurrenceRule::rMonthly:
+    days.fill( true, 0, 5 );
+    recurrence->setMonthly( 1 );
+    recurrence->addMonthlyPos( -1, days );
+    break;
+  default:
+    recurrence->setYearly( 1 );
+    recurrence->addYearlyMonth( 3 );
+    recurrence->addYearlyDate( 15 );
+    break;
+  }
+  return recurrence;
+}
+
+void CalendarBenchmark::iCalLoad_data()
+{
+  sizes();
+}
+
+void CalendarBenchmark::iCalLoad()
+{
+  QFETCH( int, count );
+  ICalFormat format;
+  QVERIFY( format.save( cachedCalendar( count ), benchmarkFile ) );
+
+  QBENCHMARK {
+    MemoryCalendar::Ptr calendar( new MemoryCalendar( KDateTime::UTC ) );
+    format.load( calendar, benchmarkFile );
+  }
+}
+
+void CalendarBenchmark::iCalSave_data()
+{
+  sizes();
+}
+
+void CalendarBenchmark::iCalSave()
+{
+  QFETCH( int, count );
+  const MemoryCalendar::Ptr calendar = cachedCalendar( count );
+  ICalFormat format;
+
+  QBENCHMARK {
+    format.save( calendar, benchmarkFile );
+  }
+}
+
+void CalendarBenchmark::vCalLoad_data()
+{
+  sizes();
+}
+
+void CalendarBenchmark::vCalLoad()
+{
+  QFETCH( int, count );
+  VCalFormat format;
+  QVERIFY( format.save( cachedCalendar( count ), vCalBenchmarkFile ) );
+
+  QBENCHMARK {
+    MemoryCalendar::Ptr calendar( new MemoryCalendar( KDateTime::UTC ) );
+    format.load( calendar, vCalBenchmarkFile );
+  }
+}
+
+void CalendarBenchmark::vCalSave_data()
+{
+  sizes();
+}
+
+void CalendarBenchmark::vCalSave()
+{
+  QFETCH( int, count );
+  const MemoryCalendar::Ptr calendar = cachedCalendar( count );
+  VCalFormat format;
+
+  QBENCHMARK {
+    format.save( calendar, vCalBenchmarkFile );
+  }
+}
+
+void CalendarBenchmark::parsedIncidences_data()
+{
+  sizes();
+}
+
+/**
+  Creates incidences the way the format readers do, setting the UID read
+  from the file on each new incidence.
+*/
+void CalendarBenchmark::parsedIncidences()
+{
+  QFETCH( int, count );
+  QStringList uids;
+  for ( int i = 0; i < count; ++i ) {
+    uids.append( QString::fromLatin1( "benchmark-%1" ).arg( i ) );
+  }
+
+  QBENCHMARK {
+    Event::List events;
+    events.reserve( count );
+    foreach ( const QString &uid, uids ) {
+      Event::Ptr event( new Event() );
+      event->setUid( uid );
+      events.append( event );
+    }
+  }
+}
+
+void CalendarBenchmark::rawEvents_data()
+{
+  sizes();
+}
+
+void CalendarBenchmark::rawEvents()
+{
+  QFETCH( int, count );
+  const MemoryCalendar::Ptr calendar = cachedCalendar( count );
+  const QDate start = benchmarkStart.date().addMonths( 5 );
+
+  QBENCHMARK {
+    // A month view
+    calendar->rawEvents( start, start.addDays( 41 ) );
+  }
+}
+
+void CalendarBenchmark::rawEventsForDate_data()
+{
+  sizes();
+}
+
+void CalendarBenchmark::rawEventsForDate()
+{
+  QFETCH( int, count );
+  const MemoryCalendar::Ptr calendar = cachedCalendar( count );
+  const QDate start = benchmarkStart.date().addMonths( 5 );
+
+  QBENCHMARK {
+    // A week view
+    for ( int i = 0; i < 7; ++i ) {
+      calendar->rawEventsForDate( start.addDays( i ) );
+    }
+  }
+}
+
+void CalendarBenchmark::alarms_data()
+{
+  sizes();
+}
+
+void CalendarBenchmark::alarms()
+{
+  QFETCH( int, count );
+  const MemoryCalendar::Ptr calendar = cachedCalendar( count );
+  const KDateTime from = benchmarkStart.addDays( 150 );
+
+  QBENCHMARK {
+    calendar->alarms( from, from.addDays( 1 ) );
+  }
+}
+
+void CalendarBenchmark::freeBusy_data()
+{
+  sizes();
+}
+
+void CalendarBenchmark::freeBusy()
+{
+  QFETCH( int, count );
+  const Event::List events = cachedCalendar( count )->rawEvents();
+  const KDateTime start = benchmarkStart.addDays( 150 );
+  const KDateTime end = start.addDays( 30 );
+
+  QBENCHMARK {
+    FreeBusy freebusy( events, start, end );
+  }
+}
+
+void CalendarBenchmark::timesInInterval_data()
+{
+  rules();
+}
+
+void CalendarBenchmark::timesInInterval()
+{
+  QFETCH( int, type );
+  Recurrence *recurrence = makeRecurrence( type );
+  const RecurrenceRule *rule = recurrence->defaultRRuleConst();
+  const KDateTime start = benchmarkStart.addDays( 700 );
+
+  QBENCHMARK {
+    rule->timesInInterval( start, start.addDays( 365 ) );
+  }
+  delete recurrence;
+}
+
+void CalendarBenchmark::getNextDate_data()
+{
+  rules();
+}
+
+void CalendarBenchmark::getNextDate()
+{
+  QFETCH( int, type );
+  Recurrence *recurrence = makeRecurrence( type );
+  const RecurrenceRule *rule = recurrence->defaultRRuleConst();
+
+  QBENCHMARK {
+    KDateTime dt = benchmarkStart.addDays( 700 );
+    for ( int i = 0; i < 100 && dt.isValid(); ++i ) {
+      dt = rule->getNextDate( dt );
+    }
+  }
+  delete recurrence;
+}
+
+void CalendarBenchmark::zoneConversion_data()
+{
+  sizes();
+}
+
+void CalendarBenchmark::zoneConversion()
+{
+  QFETCH( int, count );
+  // A system zone, whose offsets come from the parsed zoneinfo file
+  const KTimeZone system = KSystemTimeZones::zone( "Europe/Helsinki" );
+  QVERIFY( system.isValid() );
+  QCOMPARE( system.type(), QByteArray( "KSystemTimeZone" ) );
+  const KDateTime::Spec zone( system );
+
+  QList<KDateTime> dateTimes;
+  for ( int i = 0; i < count; ++i ) {
+    dateTimes.append( benchmarkStart.addSecs( qint64( i ) * 7919 * 60 ) );
+  }
+
+  QBENCHMARK {
+    foreach ( const KDateTime &dt, dateTimes ) {
+      // UTC to zone time looks up offsetAtUtc(), and zone time back to
+      // UTC offsetAtZoneTime()
+      KDateTime( dt.toTimeSpec( zone ).dateTime(), zone ).toUtc();
+    }
+  }
+}
+
+void CalendarBenchmark::cleanupTestCase()
+{
+  unlink( benchmarkFile );
+  unlink( vCalBenchmarkFile );
+}
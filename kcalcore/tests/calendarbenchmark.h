@@ -0,0 +1,66 @@
+/*
+  This file is part of the kcalcore library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#ifndef CALENDARBENCHMARK_H
+#define CALENDARBENCHMARK_H
+
+#include <QtCore/QObject>
+
+/**
+  Benchmarks for the calendar hot paths.
+
+  The data driven benchmarks run on synthetic calendars of 1000 up to
+  KCALCORE_BENCHMARK_SIZE incidences (10000 by default, at most 1000000).
+*/
+class CalendarBenchmark : public QObject
+{
+  Q_OBJECT
+  private Q_SLOTS:
+    void iCalLoad_data();
+    void iCalLoad();
+    void iCalSave_data();
+    void iCalSave();
+    void vCalLoad_data();
+    void vCalLoad();
+    void vCalSave_data();
+    void vCalSave();
+    void parsedIncidences_data();
+    void parsedIncidences();
+    void rawEvents_data();
+    void rawEvents();
+    void rawEventsForDate_data();
+    void rawEventsForDate();
+    void alarms_data();
+    void alarms();
+    void freeBusy_data();
+    void freeBusy();
+    void timesInInterval_data();
+    void timesInInterval();
+    void getNextDate_data();
+    void getNextDate();
+    void zoneConversion_data();
+    void zoneConversion();
+    void cleanupTestCase();
+
+  private:
+    void sizes();
+    void rules();
+};
+
+#endif
@@ -50,3 +50,57 @@ void CalFilterTest::testCats()
   f2.setCategoryList( cats );
   QVERIFY( f1.categoryList() == f2.categoryList() );
 }
+
+void CalFilterTest::testApply()
+{
+  const KDateTime now = KDateTime::currentUtcDateTime();
+
+  Event::Ptr work( new Event() );
+  work->setCategories( QStringList() << "work" << "x" );
+  Event::Ptr home( new Event() );
+  home->setCategories( QStringList() << "home" );
+  Event::Ptr none( new Event() );
+
+  Todo::Ptr done( new Todo() );
+  done->setCompleted( now.addDays( -10 ) );
+  Todo::Ptr mine( new Todo() );
+  mine->addAttendee( Attendee::Ptr( new Attendee( "Me", "me@example.com" ) ) );
+  Todo::Ptr theirs( new Todo() );
+  theirs->addAttendee( Attendee::Ptr( new Attendee( "Other", "other@example.com" ) ) );
+
+  CalFilter filter;
+  filter.setCategoryList( QStringList() << "work" << "home" );
+  filter.setCriteria( CalFilter::ShowCategories );
+  Event::List events;
+  events << work << home << none;
+  filter.apply( &events );
+  QCOMPARE( events, Event::List() << work << home );
+
+  filter.setCriteria( 0 );
+  events.clear();
+  events << work << home << none;
+  filter.apply( &events );
+  QCOMPARE( events, Event::List() << none );
+
+  filter.setCategoryList( QStringList() );
+  filter.setEmailList( QStringList() << "me@example.com" );
+  filter.setCriteria( CalFilter::HideCompletedTodos | CalFilter::HideNoMatchingAttendeeTodos );
+  filter.setCompletedTimeSpan( 5 );
+  Incidence::List incidences;
+  incidences << done << work << mine << theirs << none;
+  filter.apply( &incidences );
+  QCOMPARE( incidences, Incidence::List() << work << mine << none );
+  QVERIFY( !filter.filterIncidence( theirs ) );
+  QVERIFY( filter.filterIncidence( mine ) );
+
+  // Recently completed to-dos are kept
+  filter.setCompletedTimeSpan( 20 );
+  QVERIFY( filter.filterIncidence( done ) );
+
+  // Disabled filters keep everything
+  filter.setEnabled( false );
+  incidences.clear();
+  incidences << done << theirs;
+  filter.apply( &incidences );
+  QCOMPARE( incidences.count(), 2 );
+}
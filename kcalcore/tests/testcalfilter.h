@@ -29,6 +29,7 @@ class CalFilterTest : public QObject
   private Q_SLOTS:
     void testValidity();
     void testCats();
+    void testApply();
 };
 
 #endif
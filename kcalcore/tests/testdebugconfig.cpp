@@ -0,0 +1,66 @@
+/*
+  This file is part of the kcalcore library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#include "testdebugconfig.h"
+#include "../klibport/kcalcoredebug_p.h"
+
+#include <qtest_kde.h>
+QTEST_KDEMAIN( DebugConfigTest, NoGUI )
+
+void DebugConfigTest::testOff()
+{
+  KCalcoreDebugConfig config( QByteArray(), QByteArray() );
+  QCOMPARE( config.mode, KCalcoreDebugConfig::Off );
+  QVERIFY( !config.isEnabled( "/src/kcalcore/calendar.cpp" ) );
+
+  // separators only do not name any category
+  KCalcoreDebugConfig empty( QByteArray(), " , ," );
+  QCOMPARE( empty.mode, KCalcoreDebugConfig::Off );
+}
+
+void DebugConfigTest::testAll()
+{
+  // any non-empty value enables all output
+  const char *values[] = { "1", "all", "0", "yes", " " };
+  for ( unsigned i = 0; i < sizeof( values ) / sizeof( values[0] );  ++i ) {
+    KCalcoreDebugConfig config( values[i], QByteArray() );
+    QCOMPARE( config.mode, KCalcoreDebugConfig::All );
+    QVERIFY( config.isEnabled( "/src/kcalcore/calendar.cpp" ) );
+    QVERIFY( config.isEnabled( "recurrencerule.cpp" ) );
+  }
+}
+
+void DebugConfigTest::testCategories()
+{
+  KCalcoreDebugConfig config( QByteArray(), " icalformat_p, recurrencerule ,," );
+  QCOMPARE( config.mode, KCalcoreDebugConfig::Categories );
+  QCOMPARE( config.categories.count(), 2 );
+  QVERIFY( config.isEnabled( "/src/kcalcore/icalformat_p.cpp" ) );
+  QVERIFY( config.isEnabled( "recurrencerule.cpp" ) );
+  QVERIFY( config.isEnabled( "recurrencerule" ) );
+  QVERIFY( !config.isEnabled( "/src/kcalcore/icalformat.cpp" ) );
+  QVERIFY( !config.isEnabled( "/src/kcalcore/recurrence.cpp" ) );
+  QVERIFY( !config.isEnabled( "/src/recurrencerule/calendar.cpp" ) );
+
+  // categories restrict the output even if KCALDEBUG is set as well
+  KCalcoreDebugConfig both( "1", "calendar" );
+  QCOMPARE( both.mode, KCalcoreDebugConfig::Categories );
+  QVERIFY( both.isEnabled( "calendar.cpp" ) );
+  QVERIFY( !both.isEnabled( "event.cpp" ) );
+}
@@ -20,6 +20,9 @@
 */
 #include "testevent.h"
 #include "../event.h"
+#include "../icalformat.h"
+#include "../incidence_p.h"
+#include "../memorycalendar.h"
 
 #include <qtest_kde.h>
 QTEST_KDEMAIN( EventTest, NoGUI )
@@ -114,3 +117,175 @@ void EventTest::testAssign()
   Event event2 = event1;
   QVERIFY( event1 == event2 );
 }
+
+void EventTest::testUid()
+{
+  // The UID of a new event is only generated when it is read
+  Event event1;
+  const QString uid = event1.uid();
+  QVERIFY( !uid.isEmpty() );
+  QCOMPARE( event1.uid(), uid );
+
+  Event event2;
+  QVERIFY( event2.uid() != uid );
+
+  // Copies share the UID even if it wasn't read before copying
+  Event event3;
+  Event event4( event3 );
+  QVERIFY( !event3.uid().isEmpty() );
+  QCOMPARE( event4.uid(), event3.uid() );
+  QVERIFY( event3 == event4 );
+
+  // A UID set before reading is kept, even an empty one
+  Event event5;
+  event5.setUid( "uid" );
+  QCOMPARE( event5.uid(), QString( "uid" ) );
+  event5.setUid( QString() );
+  QVERIFY( event5.uid().isEmpty() );
+}
+
+void EventTest::testCopyOnWrite()
+{
+  const KDateTime dt( QDate( 2012, 1, 2 ), QTime( 10, 0 ), KDateTime::UTC );
+  Event *event1 = new Event();
+  event1->setDtStart( dt );
+  event1->setDtEnd( dt.addSecs( 3600 ) );
+  event1->addAttendee( Attendee::Ptr( new Attendee( "Joe", "joe@example.com" ) ) );
+  event1->addAttachment( Attachment::Ptr( new Attachment( QString( "http://example.com" ) ) ) );
+  event1->recurrence()->setDaily( 1 );
+  Alarm::Ptr alarm = event1->newAlarm();
+  alarm->setStartOffset( Duration( -600 ) );
+  alarm->setEnabled( true );
+
+  // The pointers event1 handed out may still change it, so its clones get
+  // their own alarms, attachments, attendees and recurrence, and changing
+  // them must not affect event1
+  Event *event2 = event1->clone();
+  QVERIFY( *event1 == *event2 );
+  QVERIFY( event2->recurs() );
+  QVERIFY( event2->hasEnabledAlarms() );
+
+  event2->attendees().first()->setStatus( Attendee::Accepted );
+  QCOMPARE( event1->attendees().first()->status(), Attendee::None );
+  event2->attachments().first()->setUri( "http://example.org" );
+  QCOMPARE( event1->attachments().first()->uri(), QString( "http://example.com" ) );
+  event2->recurrence()->setDuration( 3 );
+  QCOMPARE( event1->recurrence()->duration(), -1 );
+  QVERIFY( *event1 != *event2 );
+
+  // Alarms of the clone belong to the clone
+  Event *event3 = event1->clone();
+  event3->setDtStart( dt.addDays( 1 ) );
+  event3->setDtEnd( dt.addDays( 1 ).addSecs( 3600 ) );
+  QCOMPARE( event3->alarms().first()->time(), dt.addDays( 1 ).addSecs( -600 ) );
+  QCOMPARE( event1->alarms().first(), alarm );
+  QCOMPARE( alarm->time(), dt.addSecs( -600 ) );
+
+  // Clones outlive their source
+  Event *event4 = event1->clone();
+  delete event1;
+  QVERIFY( event4->recurs() );
+  QCOMPARE( event4->alarms().first()->time(), dt.addSecs( -600 ) );
+  event4->recurrence()->setDuration( 2 );
+  QVERIFY( !event4->recursOn( dt.date().addDays( 2 ), KDateTime::UTC ) );
+
+  delete event2;
+  delete event3;
+  delete event4;
+}
+
+void EventTest::testCopyOnWriteSource()
+{
+  const KDateTime dt( QDate( 2012, 1, 2 ), QTime( 10, 0 ), KDateTime::UTC );
+  Event *event1 = new Event();
+  event1->setDtStart( dt );
+  event1->setDtEnd( dt.addSecs( 3600 ) );
+  event1->addAttendee( Attendee::Ptr( new Attendee( "Joe", "joe@example.com" ) ) );
+  event1->addAttachment( Attachment::Ptr( new Attachment( QString( "http://example.com" ) ) ) );
+  Alarm::Ptr newAlarm( new Alarm( event1 ) );
+  newAlarm->setStartOffset( Duration( -600 ) );
+  event1->addAlarm( newAlarm );
+  newAlarm.clear();
+
+  Event *event2 = event1->clone();
+  QVERIFY( *event1 == *event2 );
+
+  // Changing the source after clone() leaves the clone alone, and the
+  // source keeps its own objects
+  const Alarm::Ptr alarm = event1->alarms().first();
+  const Attendee::Ptr attendee = event1->attendees().first();
+  alarm->setStartOffset( Duration( -1200 ) );
+  attendee->setStatus( Attendee::Accepted );
+  event1->clearAttachments();
+  QCOMPARE( event1->alarms().first(), alarm );
+  QCOMPARE( event1->attendees().first(), attendee );
+  QCOMPARE( alarm->parentUid(), event1->uid() );
+
+  QVERIFY( event2->alarms().first() != alarm );
+  QVERIFY( event2->attendees().first() != attendee );
+  QCOMPARE( event2->alarms().first()->startOffset(), Duration( -600 ) );
+  QCOMPARE( event2->alarms().first()->parentUid(), event2->uid() );
+  QCOMPARE( event2->attendees().first()->status(), Attendee::None );
+  QCOMPARE( event2->attachments().count(), 1 );
+
+  // The clone outlives the source
+  delete event1;
+  QCOMPARE( event2->alarms().first()->startOffset(), Duration( -600 ) );
+  QCOMPARE( event2->alarms().first()->parentUid(), event2->uid() );
+  QCOMPARE( event2->attendees().first()->email(), QString( "joe@example.com" ) );
+  QCOMPARE( event2->attachments().first()->uri(), QString( "http://example.com" ) );
+  delete event2;
+}
+
+void EventTest::testCopyOnWriteShared()
+{
+  const QString ical =
+    "BEGIN:VCALENDAR\n"
+    "VERSION:2.0\n"
+    "BEGIN:VEVENT\n"
+    "UID:shared\n"
+    "DTSTART:20120102T100000Z\n"
+    "DTEND:20120102T110000Z\n"
+    "RRULE:FREQ=DAILY\n"
+    "ATTENDEE;CN=Joe:mailto:joe@example.com\n"
+    "BEGIN:VALARM\n"
+    "ACTION:DISPLAY\n"
+    "TRIGGER:-PT10M\n"
+    "END:VALARM\n"
+    "END:VEVENT\n"
+    "END:VCALENDAR\n";
+  MemoryCalendar::Ptr calendar( new MemoryCalendar( KDateTime::UTC ) );
+  ICalFormat format;
+  QVERIFY( format.fromString( calendar, ical ) );
+  const Event::Ptr event = calendar->event( "shared" );
+  QVERIFY( event );
+
+  // Indexing, querying and writing the calendar only read the event
+  const KDateTime dt( QDate( 2012, 1, 2 ), QTime( 10, 0 ), KDateTime::UTC );
+  QCOMPARE( calendar->rawEventsForDate( dt.date().addDays( 1 ) ).count(), 1 );
+  QVERIFY( !calendar->occurrencesInRange( dt, dt.addDays( 2 ) ).isEmpty() );
+  QVERIFY( calendar->alarmsDue( dt.addDays( -1 ) ).isEmpty() );
+  QVERIFY( !format.toString( calendar ).isEmpty() );
+
+  // so its clones share its payload until they change it
+  Event::Ptr clone( event->clone() );
+  QVERIFY( IncidenceInternals::recurrence( *clone ) );
+  QCOMPARE( IncidenceInternals::recurrence( *clone ), IncidenceInternals::recurrence( *event ) );
+  QCOMPARE( IncidenceInternals::alarms( *clone ).first(), IncidenceInternals::alarms( *event ).first() );
+  QCOMPARE( IncidenceInternals::attendees( *clone ).first(),
+            IncidenceInternals::attendees( *event ).first() );
+
+  clone->recurrence()->setDuration( 3 );
+  clone->attendees().first()->setStatus( Attendee::Accepted );
+  QVERIFY( IncidenceInternals::recurrence( *clone ) != IncidenceInternals::recurrence( *event ) );
+  QVERIFY( IncidenceInternals::alarms( *clone ).first() != IncidenceInternals::alarms( *event ).first() );
+  QCOMPARE( IncidenceInternals::recurrence( *event )->duration(), -1 );
+  QCOMPARE( IncidenceInternals::attendees( *event ).first()->status(), Attendee::None );
+
+  // Alarms the calendar hands out may be changed, so later clones get their own
+  const Alarm::List due = calendar->alarmsDue( dt.addSecs( -300 ) );
+  QCOMPARE( due.count(), 1 );
+  QCOMPARE( due.first(), IncidenceInternals::alarms( *event ).first() );
+  Event::Ptr clone2( event->clone() );
+  QVERIFY( IncidenceInternals::alarms( *clone2 ).first() != due.first() );
+}
@@ -33,6 +33,10 @@ class EventTest : public QObject
     void testClone();
     void testCopy();
     void testAssign();
+    void testUid();
+    void testCopyOnWrite();
+    void testCopyOnWriteSource();
+    void testCopyOnWriteShared();
 };
 
 #endif
@@ -167,3 +167,78 @@ void FileStorageTest::testSpecialChars()
 
   unlink( "bart.ics" );
 }
+
+void FileStorageTest::testJournal()
+{
+  const QString fileName( QLatin1String( "journal.ics" ) );
+  const KDateTime start( QDate( 2012, 3, 1 ), QTime( 10, 0 ), KDateTime::UTC );
+
+  MemoryCalendar::Ptr cal( new MemoryCalendar( QLatin1String( "UTC" ) ) );
+  FileStorage fs( cal, fileName );
+  fs.setJournalEnabled( true );
+  QVERIFY( fs.isJournalEnabled() );
+  QCOMPARE( fs.journalFileName(), fileName + QLatin1String( ".journal" ) );
+
+  Event::Ptr event1 = Event::Ptr( new Event() );
+  event1->setUid( "1" );
+  event1->setDtStart( start );
+  event1->setSummary( "Event1 Summary" );
+  cal->addEvent( event1 );
+
+  Event::Ptr event2 = Event::Ptr( new Event() );
+  event2->setUid( "2" );
+  event2->setDtStart( start );
+  event2->setSummary( "Event2 Summary" );
+  cal->addEvent( event2 );
+
+  // The first save writes the whole file
+  QVERIFY( fs.open() );
+  QVERIFY( fs.save() );
+  QVERIFY( !QFile::exists( fs.journalFileName() ) );
+  QFile file( fileName );
+  const qint64 fileSize = file.size();
+
+  // Later saves only append the changes
+  event1->setSummary( "Changed" );
+  QVERIFY( fs.save() );
+  QVERIFY( cal->deleteEvent( event2 ) );
+  Event::Ptr event3 = Event::Ptr( new Event() );
+  event3->setUid( "3" );
+  event3->setDtStart( start );
+  cal->addEvent( event3 );
+  QVERIFY( fs.save() );
+  QVERIFY( fs.close() );
+  QVERIFY( QFile::exists( fs.journalFileName() ) );
+  QCOMPARE( file.size(), fileSize );
+
+  // Loading replays the journal
+  MemoryCalendar::Ptr otherCal( new MemoryCalendar( QLatin1String( "UTC" ) ) );
+  FileStorage otherFs( otherCal, fileName );
+  otherFs.setJournalEnabled( true );
+  QVERIFY( otherFs.open() );
+  QVERIFY( otherFs.load() );
+  QCOMPARE( otherCal->incidence( "1" )->summary(), QString( "Changed" ) );
+  QVERIFY( !otherCal->incidence( "2" ) );
+  QVERIFY( otherCal->incidence( "3" ) );
+
+  // Passing the threshold merges the journal into the file
+  otherFs.setJournalThreshold( 0 );
+  otherCal->incidence( "3" )->setSummary( "Event3 Summary" );
+  QVERIFY( otherFs.save() );
+  QVERIFY( otherFs.close() );
+  QVERIFY( !QFile::exists( otherFs.journalFileName() ) );
+  QVERIFY( !QFile::exists( otherFs.journalFileName() + QLatin1String( ".old" ) ) );
+
+  MemoryCalendar::Ptr thirdCal( new MemoryCalendar( QLatin1String( "UTC" ) ) );
+  FileStorage thirdFs( thirdCal, fileName );
+  QVERIFY( thirdFs.open() );
+  QVERIFY( thirdFs.load() );
+  QCOMPARE( thirdCal->incidences().count(), 2 );
+  QCOMPARE( thirdCal->incidence( "3" )->summary(), QString( "Event3 Summary" ) );
+  QVERIFY( thirdFs.close() );
+
+  cal->close();
+  otherCal->close();
+  thirdCal->close();
+  unlink( "journal.ics" );
+}
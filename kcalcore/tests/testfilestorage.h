@@ -35,6 +35,11 @@ class FileStorageTest : public QObject
         and compares both incidences. The comparison should yeld true.
     */
     void testSpecialChars();
+
+    /** Saves changes to the journal, reloads them and merges the journal
+        into the calendar file.
+    */
+    void testJournal();
 };
 
 #endif
@@ -128,3 +128,116 @@ void FreeBusyTest::testDataStream()
   QVERIFY( fb1->busyPeriods() == fb2->busyPeriods() );
 //   QVERIFY( *fb1 == *fb2 );
 }
+
+void FreeBusyTest::testEvents()
+{
+  const QDate day( 2012, 3, 1 );
+  const KDateTime start( day, QTime( 0, 0 ), KDateTime::UTC );
+  const KDateTime end( day.addDays( 3 ), QTime( 0, 0 ), KDateTime::UTC );
+  Event::List events;
+
+  Event::Ptr daily( new Event() );
+  daily->setDtStart( KDateTime( day.addDays( -2 ), QTime( 10, 0 ), KDateTime::UTC ) );
+  daily->setDtEnd( KDateTime( day.addDays( -2 ), QTime( 11, 0 ), KDateTime::UTC ) );
+  daily->recurrence()->setDaily( 1 );
+  daily->recurrence()->setDuration( 10 );
+  events << daily;
+
+  Event::Ptr overlapping( new Event() );
+  overlapping->setDtStart( KDateTime( day.addDays( 1 ), QTime( 10, 30 ), KDateTime::UTC ) );
+  overlapping->setDtEnd( KDateTime( day.addDays( 1 ), QTime( 12, 0 ), KDateTime::UTC ) );
+  events << overlapping;
+
+  // Sub-daily recurrences are expanded too
+  Event::Ptr sixHourly( new Event() );
+  sixHourly->setDtStart( KDateTime( day.addDays( 2 ), QTime( 0, 0 ), KDateTime::UTC ) );
+  sixHourly->setDtEnd( KDateTime( day.addDays( 2 ), QTime( 0, 30 ), KDateTime::UTC ) );
+  sixHourly->recurrence()->setHourly( 6 );
+  sixHourly->recurrence()->setDuration( 4 );
+  events << sixHourly;
+
+  Event::Ptr allDay( new Event() );
+  allDay->setDtStart( KDateTime( day, KDateTime::UTC ) );
+  allDay->setDtEnd( KDateTime( day, KDateTime::UTC ) );
+  allDay->setAllDay( true );
+  events << allDay;
+
+  // Clipped to the start of the range
+  Event::Ptr before( new Event() );
+  before->setDtStart( start.addSecs( -3600 ) );
+  before->setDtEnd( start.addSecs( 3600 ) );
+  events << before;
+
+  Event::Ptr transparent( new Event() );
+  transparent->setDtStart( KDateTime( day.addDays( 1 ), QTime( 20, 0 ), KDateTime::UTC ) );
+  transparent->setDtEnd( KDateTime( day.addDays( 1 ), QTime( 21, 0 ), KDateTime::UTC ) );
+  transparent->setTransparency( Event::Transparent );
+  events << transparent;
+
+  FreeBusy fb( events, start, end );
+  const Period::List periods = fb.busyPeriods();
+
+  Period::List expected;
+  expected << Period( start, start.addDays( 1 ) )
+           << Period( KDateTime( day.addDays( 1 ), QTime( 10, 0 ), KDateTime::UTC ),
+                      KDateTime( day.addDays( 1 ), QTime( 12, 0 ), KDateTime::UTC ) );
+  const QTime times[] = { QTime( 0, 0 ), QTime( 6, 0 ), QTime( 10, 0 ),
+                          QTime( 12, 0 ), QTime( 18, 0 ) };
+  for ( int i = 0; i < 5; ++i ) {
+    const KDateTime busy( day.addDays( 2 ), times[i], KDateTime::UTC );
+    expected << Period( busy, busy.addSecs( i == 2 ? 3600 : 1800 ) );
+  }
+
+  QCOMPARE( periods.count(), expected.count() );
+  for ( int i = 0; i < expected.count(); ++i ) {
+    QCOMPARE( periods[i].start(), expected[i].start() );
+    QCOMPARE( periods[i].end(), expected[i].end() );
+  }
+}
+
+void FreeBusyTest::testFreeSlots()
+{
+  const QDate day( 2012, 3, 5 );
+  const Period window( KDateTime( day, QTime( 8, 0 ), KDateTime::UTC ),
+                       KDateTime( day, QTime( 18, 0 ), KDateTime::UTC ) );
+  const Duration hour( 3600 );
+
+  FreeBusy::Ptr a( new FreeBusy( window.start(), window.end() ) );
+  a->addPeriod( KDateTime( day, QTime( 13, 0 ), KDateTime::UTC ), hour );
+  a->addPeriod( KDateTime( day, QTime( 9, 0 ), KDateTime::UTC ), hour );
+  FreeBusy::Ptr b( new FreeBusy( window.start(), window.end() ) );
+  b->addPeriod( KDateTime( day, QTime( 9, 30 ), KDateTime::UTC ),
+                KDateTime( day, QTime( 11, 0 ), KDateTime::UTC ) );
+  FreeBusy::Ptr c( new FreeBusy( window.start(), window.end() ) );
+  c->addPeriod( KDateTime( day, QTime( 11, 0 ), KDateTime::UTC ), hour );
+  const FreeBusy::List attendees = FreeBusy::List() << a << b << c;
+
+  // Everybody required
+  Period::List slots = FreeBusy::freeSlots( attendees, window, hour, 3 );
+  QCOMPARE( slots.count(), 3 );
+  QCOMPARE( slots[0].start(), KDateTime( day, QTime( 8, 0 ), KDateTime::UTC ) );
+  QCOMPARE( slots[1].start(), KDateTime( day, QTime( 12, 0 ), KDateTime::UTC ) );
+  QCOMPARE( slots[2].start(), KDateTime( day, QTime( 14, 0 ), KDateTime::UTC ) );
+  QCOMPARE( slots[2].end(), KDateTime( day, QTime( 15, 0 ), KDateTime::UTC ) );
+
+  // The last attendee is optional
+  slots = FreeBusy::freeSlots( attendees, window, hour, 3, 0xffffff,
+                               QList<int>() << 10 << 10 << 1, 1 );
+  QCOMPARE( slots.count(), 3 );
+  QCOMPARE( slots[1].start(), KDateTime( day, QTime( 11, 0 ), KDateTime::UTC ) );
+  QCOMPARE( slots[2].start(), KDateTime( day, QTime( 12, 0 ), KDateTime::UTC ) );
+
+  // Only from 14:00 to 17:00
+  slots = FreeBusy::freeSlots( attendees, window, hour, 5, 0x7 << 14 );
+  QCOMPARE( slots.count(), 3 );
+  QCOMPARE( slots[0].start(), KDateTime( day, QTime( 14, 0 ), KDateTime::UTC ) );
+  QCOMPARE( slots[2].end(), KDateTime( day, QTime( 17, 0 ), KDateTime::UTC ) );
+
+  // Longer slots only fit into the afternoon
+  slots = FreeBusy::freeSlots( attendees, window, Duration( 5400 ), 5 );
+  QCOMPARE( slots.count(), 2 );
+  QCOMPARE( slots[0].start(), KDateTime( day, QTime( 14, 0 ), KDateTime::UTC ) );
+  QCOMPARE( slots[1].start(), KDateTime( day, QTime( 15, 30 ), KDateTime::UTC ) );
+
+  QVERIFY( FreeBusy::freeSlots( attendees, window, hour, 0 ).isEmpty() );
+}
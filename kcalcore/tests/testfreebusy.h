@@ -32,6 +32,8 @@ class FreeBusyTest : public QObject
     void testAddSort();
     void testAssign();
     void testDataStream();
+    void testEvents();
+    void testFreeSlots();
 };
 
 #endif
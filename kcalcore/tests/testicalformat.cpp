@@ -22,14 +22,22 @@
 
 #include "testicalformat.h"
 #include "../event.h"
+#include "../journal.h"
+#include "../todo.h"
 #include "../icalformat.h"
+#include "../icalformat_p.h"
+#include "../icaltimezones.h"
 #include "../memorycalendar.h"
 
 #include <KDebug>
 #include <kdatetime.h>
+#include <ksystemtimezone.h>
+
+#include <QtCore/QBuffer>
 
 #include <qtest_kde.h>
 
+#include <stdlib.h>
 #include <unistd.h>
 
 QTEST_KDEMAIN( ICalFormatTest, NoGUI )
@@ -103,3 +111,330 @@ void ICalFormatTest::testCharsets()
 
   unlink( "hommer.ics" );
 }
+
+void ICalFormatTest::testStreamingLoad()
+{
+  ICalFormat format;
+  const KDateTime dt( QDate( 2012, 3, 4 ), QTime( 10, 0 ), KDateTime::UTC );
+
+  Event::Ptr event( new Event() );
+  event->setUid( "streaming-event" );
+  event->setSummary( "event" );
+  event->setDtStart( dt );
+  event->setDtEnd( dt.addSecs( 3600 ) );
+  Alarm::Ptr alarm = event->newAlarm();
+  alarm->setEnabled( true );
+  alarm->setStartOffset( Duration( -600 ) );
+
+  Todo::Ptr todo( new Todo() );
+  todo->setUid( "streaming-todo" );
+  todo->setSummary( "todo" );
+  todo->setDtDue( dt.addDays( 1 ) );
+
+  Journal::Ptr journal( new Journal() );
+  journal->setUid( "streaming-journal" );
+  journal->setSummary( "journal" );
+  journal->setDtStart( dt );
+
+  MemoryCalendar::Ptr calendar( new MemoryCalendar( "UTC" ) );
+  calendar->addIncidence( event );
+  calendar->addIncidence( todo );
+  calendar->addIncidence( journal );
+  QVERIFY( format.save( calendar, "streaming.ics" ) );
+
+  QVERIFY( !format.streamingLoad() );
+  format.setStreamingLoad( true );
+  QVERIFY( format.streamingLoad() );
+
+  MemoryCalendar::Ptr calendar2( new MemoryCalendar( "UTC" ) );
+  QVERIFY( format.load( calendar2, "streaming.ics" ) );
+  QCOMPARE( calendar2->incidences().count(), 3 );
+  QVERIFY( *calendar2->event( "streaming-event" ) == *event );
+  QVERIFY( *calendar2->todo( "streaming-todo" ) == *todo );
+  QVERIFY( *calendar2->journal( "streaming-journal" ) == *journal );
+  QCOMPARE( calendar2->event( "streaming-event" )->alarms().count(), 1 );
+  QVERIFY( !format.loadedProductId().isEmpty() );
+
+  // A newer revision replaces the loaded incidence, an older one doesn't.
+  event->setRevision( 2 );
+  event->setSummary( "new event" );
+  todo->setSummary( "old todo" );
+  QVERIFY( format.save( calendar, "streaming.ics" ) );
+  QVERIFY( format.load( calendar2, "streaming.ics" ) );
+  QCOMPARE( calendar2->incidences().count(), 3 );
+  QCOMPARE( calendar2->event( "streaming-event" )->summary(), QString( "new event" ) );
+  QCOMPARE( calendar2->todo( "streaming-todo" )->summary(), QString( "todo" ) );
+
+  // Files without a VCALENDAR are rejected, empty ones are not.
+  QFile file( "streaming.ics" );
+  QVERIFY( file.open( QIODevice::WriteOnly | QIODevice::Truncate ) );
+  file.write( "BEGIN:VEVENT\nUID:orphan\nEND:VEVENT\n" );
+  file.close();
+  MemoryCalendar::Ptr calendar3( new MemoryCalendar( "UTC" ) );
+  QVERIFY( !format.load( calendar3, "streaming.ics" ) );
+  QVERIFY( calendar3->incidences().isEmpty() );
+
+  QVERIFY( file.open( QIODevice::WriteOnly | QIODevice::Truncate ) );
+  file.write( "\n" );
+  file.close();
+  QVERIFY( format.load( calendar3, "streaming.ics" ) );
+
+  unlink( "streaming.ics" );
+}
+
+void ICalFormatTest::testStreamingLoadTimeZones()
+{
+  // A zone which is neither a system zone nor the local one
+  ICalFormat format;
+  MemoryCalendar::Ptr calendar( new MemoryCalendar( "UTC" ) );
+  QVERIFY( format.fromString( calendar,
+                              "BEGIN:VCALENDAR\r\n"
+                              "PRODID:-//K Desktop Environment//NONSGML libkcal 4.3//EN\r\n"
+                              "VERSION:2.0\r\n"
+                              "BEGIN:VTIMEZONE\r\n"
+                              "TZID:Test-Custom-Zone\r\n"
+                              "BEGIN:STANDARD\r\n"
+                              "DTSTART:19700101T000000\r\n"
+                              "TZOFFSETFROM:+0530\r\n"
+                              "TZOFFSETTO:+0530\r\n"
+                              "TZNAME:TST\r\n"
+                              "END:STANDARD\r\n"
+                              "END:VTIMEZONE\r\n"
+                              "END:VCALENDAR\r\n" ) );
+  const ICalTimeZone zone = calendar->timeZones()->zone( "Test-Custom-Zone" );
+  QVERIFY( zone.isValid() );
+
+  const KDateTime dt( QDate( 2012, 3, 4 ), QTime( 10, 0 ), KDateTime::Spec( zone ) );
+  Event::Ptr event( new Event() );
+  event->setUid( "streaming-zoned-event" );
+  event->setDtStart( dt );
+  event->setDtEnd( dt.addSecs( 3600 ) );
+  calendar->addEvent( event );
+  QVERIFY( format.save( calendar, "streaming.ics" ) );
+
+  // The VTIMEZONE is written after the event, and still applies to it
+  format.setStreamingLoad( true );
+  MemoryCalendar::Ptr calendar2( new MemoryCalendar( "UTC" ) );
+  QVERIFY( format.load( calendar2, "streaming.ics" ) );
+  const Event::Ptr loaded = calendar2->event( "streaming-zoned-event" );
+  QVERIFY( loaded );
+  QCOMPARE( loaded->dtStart(), dt );
+  QCOMPARE( loaded->dtStart().dateTime(), dt.dateTime() );
+  QCOMPARE( loaded->dtStart().utcOffset(), 5 * 3600 + 1800 );
+  QCOMPARE( loaded->dtStart().timeZone().name(), QString( "Test-Custom-Zone" ) );
+  QCOMPARE( loaded->dtEnd(), dt.addSecs( 3600 ) );
+  QCOMPARE( calendar2->timeZones()->count(), 1 );
+
+  unlink( "streaming.ics" );
+}
+
+void ICalFormatTest::testParallelLoad()
+{
+  ICalFormat format;
+  const KDateTime dt( QDate( 2012, 3, 4 ), QTime( 10, 0 ), KDateTime::UTC );
+
+  MemoryCalendar::Ptr calendar( new MemoryCalendar( "UTC" ) );
+  for ( int i = 0; i < 300; ++i ) {
+    Event::Ptr event( new Event() );
+    event->setUid( QString( "parallel-event-%1" ).arg( i ) );
+    event->setSummary( QString::number( i ) );
+    event->setDtStart( dt.addSecs( i * 3600 ) );
+    event->setDtEnd( dt.addSecs( i * 3600 + 1800 ) );
+    if ( i % 10 == 0 ) {
+      event->recurrence()->setDaily( 1 );
+      event->recurrence()->setDuration( 5 );
+    }
+    calendar->addEvent( event );
+
+    Todo::Ptr todo( new Todo() );
+    todo->setUid( QString( "parallel-todo-%1" ).arg( i ) );
+    todo->setDtDue( dt.addDays( i ) );
+    calendar->addTodo( todo );
+  }
+
+  // A newer revision of an event further down the file must win.
+  Event::Ptr newer( calendar->event( "parallel-event-7" )->clone() );
+  newer->setSummary( "newer" );
+  newer->setRevision( 1 );
+  const QString text = format.toString( calendar );
+  const int end = text.lastIndexOf( "END:VCALENDAR" );
+  QVERIFY( end > 0 );
+  const QString withNewer = text.left( end ) +
+                            format.toString( newer.staticCast<Incidence>() ) +
+                            "\nEND:VCALENDAR\n";
+
+  QCOMPARE( format.loadThreadCount(), 1 );
+  MemoryCalendar::Ptr serial( new MemoryCalendar( "UTC" ) );
+  QVERIFY( format.fromString( serial, withNewer ) );
+
+  format.setLoadThreadCount( 4 );
+  QCOMPARE( format.loadThreadCount(), 4 );
+  MemoryCalendar::Ptr parallel( new MemoryCalendar( "UTC" ) );
+  QVERIFY( format.fromString( parallel, withNewer ) );
+
+  QCOMPARE( parallel->events().count(), 300 );
+  QCOMPARE( parallel->todos().count(), 300 );
+  QCOMPARE( parallel->event( "parallel-event-7" )->summary(), QString( "newer" ) );
+  foreach ( const Incidence::Ptr &incidence, serial->incidences() ) {
+    const Incidence::Ptr other = parallel->incidence( incidence->uid() );
+    QVERIFY( other );
+    QVERIFY( *other == *incidence );
+  }
+
+  format.setLoadThreadCount( 0 );
+  QVERIFY( format.loadThreadCount() >= 1 );
+}
+
+void ICalFormatTest::testParallelLoadTimeZones()
+{
+  ICalFormat format;
+  const KTimeZone helsinki = KSystemTimeZones::zone( "Europe/Helsinki" );
+  QVERIFY( helsinki.isValid() );
+  const QDate date( 2012, 3, 4 );
+
+  // Zoned, floating and UTC times
+  MemoryCalendar::Ptr calendar( new MemoryCalendar( "UTC" ) );
+  for ( int i = 0; i < 300; ++i ) {
+    KDateTime::Spec spec;
+    switch ( i % 3 ) {
+    case 0:
+      spec = KDateTime::Spec( helsinki );
+      break;
+    case 1:
+      spec = KDateTime::ClockTime;
+      break;
+    default:
+      spec = KDateTime::UTC;
+      break;
+    }
+    Event::Ptr event( new Event() );
+    event->setUid( QString( "zoned-event-%1" ).arg( i ) );
+    event->setDtStart( KDateTime( date.addDays( i ), QTime( 10, 0 ), spec ) );
+    event->setDtEnd( KDateTime( date.addDays( i ), QTime( 11, 0 ), spec ) );
+    calendar->addEvent( event );
+  }
+
+  // A floating CREATED time and a zone known neither to the calendar nor
+  // to the system both need the local time zone.
+  const QString text = format.toString( calendar );
+  const int end = text.lastIndexOf( "END:VCALENDAR" );
+  QVERIFY( end > 0 );
+  const QString withLocal = text.left( end ) +
+    "BEGIN:VEVENT\nUID:floating-created\nCREATED:20120304T100000\n"
+    "DTSTART:20120304T100000\nEND:VEVENT\n"
+    "BEGIN:VEVENT\nUID:unknown-zone\n"
+    "DTSTART;TZID=Nowhere/Land:20120304T100000\nEND:VEVENT\n"
+    "END:VCALENDAR\n";
+
+  MemoryCalendar::Ptr serial( new MemoryCalendar( "UTC" ) );
+  QVERIFY( format.fromString( serial, withLocal ) );
+
+  format.setLoadThreadCount( 4 );
+  MemoryCalendar::Ptr parallel( new MemoryCalendar( "UTC" ) );
+  QVERIFY( format.fromString( parallel, withLocal ) );
+
+  QCOMPARE( parallel->events().count(), 302 );
+  foreach ( const Incidence::Ptr &incidence, serial->incidences() ) {
+    const Incidence::Ptr other = parallel->incidence( incidence->uid() );
+    QVERIFY( other );
+    QVERIFY( *other == *incidence );
+    QCOMPARE( other->dtStart().timeType(), incidence->dtStart().timeType() );
+    QCOMPARE( other->dtStart().timeZone().name(), incidence->dtStart().timeZone().name() );
+    QCOMPARE( other->dtStart().isLocalZone(), incidence->dtStart().isLocalZone() );
+    QCOMPARE( other->created(), incidence->created() );
+  }
+  QVERIFY( parallel->event( "unknown-zone" )->dtStart().isLocalZone() );
+  QCOMPARE( parallel->event( "zoned-event-0" )->dtStart().timeZone().name(),
+            QString( "Europe/Helsinki" ) );
+}
+
+// Renders @p calendar the way toString() did before it streamed: as one
+// VCALENDAR component holding every incidence and then the time zones
+static QByteArray renderTree( const Calendar::Ptr &calendar )
+{
+  ICalFormat format;
+  ICalFormatImpl impl( &format );
+  icalcomponent *component = impl.createCalendarComponent( calendar );
+  ICalTimeZones *tzlist = calendar->timeZones();
+  ICalTimeZones tzUsedList;
+  foreach ( const Todo::Ptr &todo, calendar->rawTodos() ) {
+    icalcomponent_add_component( component, impl.writeTodo( todo, tzlist, &tzUsedList ) );
+  }
+  foreach ( const Event::Ptr &event, calendar->rawEvents() ) {
+    icalcomponent_add_component( component, impl.writeEvent( event, tzlist, &tzUsedList ) );
+  }
+  foreach ( const Journal::Ptr &journal, calendar->rawJournals() ) {
+    icalcomponent_add_component( component, impl.writeJournal( journal, tzlist, &tzUsedList ) );
+  }
+  const ICalTimeZones::ZoneMap zones = tzUsedList.zones();
+  for ( ICalTimeZones::ZoneMap::ConstIterator it = zones.constBegin();
+        it != zones.constEnd(); ++it ) {
+    icaltimezone *tz = ( *it ).icalTimezone();
+    icalcomponent_add_component( component,
+                                 icalcomponent_new_clone( icaltimezone_get_component( tz ) ) );
+    icaltimezone_free( tz, 1 );
+  }
+
+  char *const text = icalcomponent_as_ical_string_r( component );
+  const QByteArray result( text );
+  free( text );
+  icalcomponent_free( component );
+  return result;
+}
+
+void ICalFormatTest::testStreamingSave()
+{
+  ICalFormat format;
+  const KDateTime dt( QDate( 2012, 3, 4 ), QTime( 10, 0 ), KDateTime::UTC );
+
+  MemoryCalendar::Ptr calendar( new MemoryCalendar( "UTC" ) );
+  for ( int i = 0; i < 10; ++i ) {
+    Event::Ptr event( new Event() );
+    event->setUid( QString( "event-%1" ).arg( i ) );
+    event->setSummary( QString::fromUtf8( "event \xC3\xA9 %1" ).arg( i ) );
+    event->setDtStart( dt.addDays( i ) );
+    event->setDtEnd( dt.addDays( i ).addSecs( 3600 ) );
+    calendar->addIncidence( event );
+  }
+  Todo::Ptr todo( new Todo() );
+  todo->setUid( "todo" );
+  todo->setDtDue( dt );
+  calendar->addIncidence( todo );
+  const KTimeZone helsinki = KSystemTimeZones::zone( "Europe/Helsinki" );
+  QVERIFY( helsinki.isValid() );
+  Event::Ptr zoned( new Event() );
+  zoned->setUid( "zoned-event" );
+  zoned->setDtStart( KDateTime( dt.date(), QTime( 12, 0 ), helsinki ) );
+  zoned->setDtEnd( KDateTime( dt.date(), QTime( 13, 0 ), helsinki ) );
+  calendar->addIncidence( zoned );
+  Journal::Ptr journal( new Journal() );
+  journal->setUid( "journal" );
+  journal->setDtStart( dt );
+  calendar->addIncidence( journal );
+
+  QBuffer buffer;
+  QVERIFY( buffer.open( QIODevice::WriteOnly ) );
+  QVERIFY( format.save( calendar, &buffer ) );
+  buffer.close();
+
+  const QByteArray text = buffer.data();
+  QVERIFY( text.startsWith( "BEGIN:VCALENDAR" ) );
+  QVERIFY( text.trimmed().endsWith( "END:VCALENDAR" ) );
+  QCOMPARE( text.count( "BEGIN:VEVENT" ), 11 );
+  QCOMPARE( text.count( "BEGIN:VTIMEZONE" ), 1 );
+  QVERIFY( text.indexOf( "BEGIN:VTIMEZONE" ) > text.lastIndexOf( "END:VJOURNAL" ) );
+  QCOMPARE( text, renderTree( calendar ) );
+  QCOMPARE( format.toString( calendar.staticCast<Calendar>() ).toUtf8(), text );
+
+  MemoryCalendar::Ptr calendar2( new MemoryCalendar( "UTC" ) );
+  QVERIFY( format.fromRawString( calendar2, text ) );
+  QCOMPARE( calendar2->incidences().count(), 13 );
+  QCOMPARE( calendar2->event( "zoned-event" )->dtStart(), zoned->dtStart() );
+  QCOMPARE( calendar2->event( "event-3" )->summary(), calendar->event( "event-3" )->summary() );
+
+  // Write errors are reported
+  QBuffer readOnly;
+  QVERIFY( readOnly.open( QIODevice::ReadOnly ) );
+  QVERIFY( !format.save( calendar, &readOnly ) );
+  QVERIFY( format.exception() );
+}
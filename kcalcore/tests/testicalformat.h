@@ -30,6 +30,11 @@ class ICalFormatTest : public QObject
   Q_OBJECT
   private Q_SLOTS:
     void testCharsets();
+    void testStreamingLoad();
+    void testStreamingLoadTimeZones();
+    void testParallelLoad();
+    void testParallelLoadTimeZones();
+    void testStreamingSave();
 };
 
 #endif
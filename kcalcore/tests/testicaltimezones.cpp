@@ -158,6 +158,86 @@ void ICalTimeZonesTest::parse()
 }
 
 
+void ICalTimeZonesTest::registry()
+{
+    ICalTimeZoneRegistry::clear();
+    QCOMPARE( ICalTimeZoneRegistry::count(), 0 );
+
+    // The same definition parsed twice yields a single shared zone.
+    icalcomponent *vtz1 = loadVTIMEZONE( VTZ_Western );
+    icalcomponent *vtz2 = loadVTIMEZONE( VTZ_Western );
+    QVERIFY( vtz1 && vtz2 );
+    const ICalTimeZone western = ICalTimeZoneRegistry::zone( vtz1 );
+    QVERIFY( western.isValid() );
+    QVERIFY( ICalTimeZoneRegistry::zone( vtz2 ) == western );
+    QVERIFY( ICalTimeZoneRegistry::contains( western ) );
+    QCOMPARE( ICalTimeZoneRegistry::count(), 1 );
+    icalcomponent_free( vtz1 );
+    icalcomponent_free( vtz2 );
+
+    // A different LAST-MODIFIED leaves the transitions alone.
+    QByteArray text = VTZ_Western;
+    text.replace( "LAST-MODIFIED:19870101T000000Z", "LAST-MODIFIED:19880101T000000Z" );
+    icalcomponent *vtz = loadVTIMEZONE( text );
+    QVERIFY( ICalTimeZoneRegistry::zone( vtz ) == western );
+    QCOMPARE( ICalTimeZoneRegistry::count(), 1 );
+    icalcomponent_free( vtz );
+
+    // A different phase makes a different zone, and is never merged
+    // into the shared one.
+    text = VTZ_Western;
+    text.replace( "TZNAME:WST", "TZNAME:XST" );
+    vtz = loadVTIMEZONE( text );
+    const ICalTimeZone changed = ICalTimeZoneRegistry::zone( vtz );
+    icalcomponent_free( vtz );
+    QVERIFY( changed.isValid() );
+    QVERIFY( !( changed == western ) );
+    QCOMPARE( ICalTimeZoneRegistry::count(), 2 );
+
+    // Calendars loaded through the registry share their zones.
+    QByteArray caltext = calendarHeader;
+    caltext += VTZ_Western;
+    caltext += VTZ_other;
+    caltext += calendarFooter;
+    icalcomponent *calendar = loadCALENDAR( caltext );
+    QVERIFY( calendar );
+    ICalTimeZones zones1;
+    ICalTimeZones zones2;
+    QVERIFY( ICalTimeZoneRegistry::parse( calendar, zones1 ) );
+    QVERIFY( ICalTimeZoneRegistry::parse( calendar, zones2 ) );
+    icalcomponent_free( calendar );
+    QCOMPARE( zones1.count(), 2 );
+    QVERIFY( zones1.zone( western.name() ) == western );
+    QVERIFY( zones2.zone( western.name() ) == western );
+    QVERIFY( zones1.zone( "Test-Dummy-Other" ) == zones2.zone( "Test-Dummy-Other" ) );
+    QCOMPARE( ICalTimeZoneRegistry::count(), 3 );
+
+    // Redefining a shared zone replaces it in the collection only.
+    QVERIFY( ICalTimeZoneRegistry::add( changed, zones1 ) );
+    QVERIFY( zones1.zone( western.name() ) == changed );
+    QVERIFY( zones2.zone( western.name() ) == western );
+    QVERIFY( western.abbreviations().contains( "WST" ) );
+
+    // Only recent texts are remembered, older ones still resolve to the
+    // interned zone by their content.
+    for ( int i = 0; i < 300; ++i ) {
+      text = VTZ_Western;
+      text.replace( "LAST-MODIFIED:19870101T000000Z",
+                    "LAST-MODIFIED:" + QByteArray::number( 1600 + i ) + "0101T000000Z" );
+      vtz = loadVTIMEZONE( text );
+      QVERIFY( ICalTimeZoneRegistry::zone( vtz ) == western );
+      icalcomponent_free( vtz );
+    }
+    QCOMPARE( ICalTimeZoneRegistry::count(), 3 );
+    QVERIFY( ICalTimeZoneRegistry::contains( changed ) );
+
+    // Clearing drops the registry's references only.
+    ICalTimeZoneRegistry::clear();
+    QCOMPARE( ICalTimeZoneRegistry::count(), 0 );
+    QVERIFY( !ICalTimeZoneRegistry::contains( western ) );
+    QVERIFY( zones2.zone( western.name() ).isValid() );
+}
+
 /////////////////////
 // ICalTimeZone tests
 /////////////////////
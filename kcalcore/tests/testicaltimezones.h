@@ -29,6 +29,7 @@ class ICalTimeZonesTest : public QObject
   Q_OBJECT
   private Q_SLOTS:
     void parse();
+    void registry();
     void general();
     void offsetAtUtc();
     void offset();
@@ -21,9 +21,12 @@
 
 #include "testmemorycalendar.h"
 #include "../filestorage.h"
+#include "../calfilter.h"
 #include "../memorycalendar.h"
+#include "../sorting.h"
 
 #include <kdebug.h>
+#include <ksystemtimezone.h>
 
 #include <unistd.h>
 
@@ -172,3 +175,687 @@ void MemoryCalendarTest::testRelationsCrash()
 */
   cal->close();
 }
+
+void MemoryCalendarTest::testRawEvents()
+{
+  MemoryCalendar::Ptr cal( new MemoryCalendar( KDateTime::UTC ) );
+  const QDate dt( 2012, 1, 2 );
+
+  Event::Ptr single = Event::Ptr( new Event() );
+  single->setUid( "single" );
+  single->setDtStart( KDateTime( dt, QTime( 10, 0 ), KDateTime::UTC ) );
+  single->setDtEnd( KDateTime( dt, QTime( 11, 0 ), KDateTime::UTC ) );
+
+  Event::Ptr multiDay = Event::Ptr( new Event() );
+  multiDay->setUid( "multiday" );
+  multiDay->setDtStart( KDateTime( dt.addDays( 10 ), QTime( 10, 0 ), KDateTime::UTC ) );
+  multiDay->setDtEnd( KDateTime( dt.addDays( 13 ), QTime( 11, 0 ), KDateTime::UTC ) );
+
+  Event::Ptr weekly = Event::Ptr( new Event() );
+  weekly->setUid( "weekly" );
+  weekly->setDtStart( KDateTime( dt, QTime( 12, 0 ), KDateTime::UTC ) );
+  weekly->setDtEnd( KDateTime( dt, QTime( 13, 0 ), KDateTime::UTC ) );
+  weekly->recurrence()->setWeekly( 1 );
+  weekly->recurrence()->setDuration( 4 );
+
+  Event::Ptr daily = Event::Ptr( new Event() );
+  daily->setUid( "daily" );
+  daily->setDtStart( KDateTime( dt.addDays( 100 ), QTime( 8, 0 ), KDateTime::UTC ) );
+  daily->setDtEnd( KDateTime( dt.addDays( 100 ), QTime( 9, 0 ), KDateTime::UTC ) );
+  daily->recurrence()->setDaily( 1 );
+
+  QVERIFY( cal->addEvent( single ) );
+  QVERIFY( cal->addEvent( multiDay ) );
+  QVERIFY( cal->addEvent( weekly ) );
+  QVERIFY( cal->addEvent( daily ) );
+
+  QCOMPARE( cal->rawEventsForDate( dt ).count(), 2 );
+  QCOMPARE( cal->rawEventsForDate( dt.addDays( 1 ) ).count(), 0 );
+  QCOMPARE( cal->rawEventsForDate( dt.addDays( 12 ) ).count(), 1 );
+  QCOMPARE( cal->rawEventsForDate( dt.addDays( 14 ) ).count(), 1 );
+  QCOMPARE( cal->rawEventsForDate( dt.addDays( 28 ) ).count(), 0 );
+  QCOMPARE( cal->rawEventsForDate( dt.addDays( 99 ) ).count(), 0 );
+  QCOMPARE( cal->rawEventsForDate( dt.addDays( 1000 ) ).count(), 1 );
+
+  QCOMPARE( cal->rawEvents( dt.addDays( 1 ), dt.addDays( 9 ) ).count(), 1 );
+  QCOMPARE( cal->rawEvents( dt.addDays( 30 ), dt.addDays( 90 ) ).count(), 0 );
+  QCOMPARE( cal->rawEvents( dt, dt.addDays( 200 ) ).count(), 4 );
+
+  // Moving an event must move it in the index too
+  single->setDtStart( KDateTime( dt.addDays( 50 ), QTime( 10, 0 ), KDateTime::UTC ) );
+  single->setDtEnd( KDateTime( dt.addDays( 50 ), QTime( 11, 0 ), KDateTime::UTC ) );
+  QCOMPARE( cal->rawEventsForDate( dt ).count(), 1 );
+  QCOMPARE( cal->rawEvents( dt.addDays( 30 ), dt.addDays( 90 ) ).count(), 1 );
+
+  // So must changing a recurrence
+  weekly->recurrence()->setDuration( 10 );
+  QCOMPARE( cal->rawEventsForDate( dt.addDays( 63 ) ).count(), 1 );
+  QCOMPARE( cal->rawEvents( dt.addDays( 30 ), dt.addDays( 90 ) ).count(), 2 );
+
+  QVERIFY( cal->deleteEvent( daily ) );
+  QCOMPARE( cal->rawEventsForDate( dt.addDays( 1000 ) ).count(), 0 );
+
+  // Additions and deletions between queries keep the index consistent
+  QVector<int> perDay( 300 );
+  Event::List added;
+  for ( int i = 0; i < 900; ++i ) {
+    const int day = ( i * 37 ) % 300;
+    Event::Ptr event = Event::Ptr( new Event() );
+    event->setDtStart( KDateTime( dt.addDays( 2000 + day ), QTime( 10, 0 ), KDateTime::UTC ) );
+    event->setDtEnd( KDateTime( dt.addDays( 2000 + day ), QTime( 11, 0 ), KDateTime::UTC ) );
+    QVERIFY( cal->addEvent( event ) );
+    added.append( event );
+    ++perDay[day];
+    if ( i % 3 == 2 ) {
+      const Event::Ptr old = added.takeAt( ( i * 7 ) % added.count() );
+      --perDay[old->dtStart().date().toJulianDay() - dt.addDays( 2000 ).toJulianDay()];
+      QVERIFY( cal->deleteEvent( old ) );
+    }
+    if ( i % 50 == 0 ) {
+      QCOMPARE( cal->rawEventsForDate( dt.addDays( 2000 + day ) ).count(), perDay[day] );
+    }
+  }
+  for ( int day = 0; day < 300; ++day ) {
+    QCOMPARE( cal->rawEventsForDate( dt.addDays( 2000 + day ) ).count(), perDay[day] );
+  }
+  cal->close();
+}
+
+void MemoryCalendarTest::testRawTodosAndJournals()
+{
+  MemoryCalendar::Ptr cal( new MemoryCalendar( KDateTime::UTC ) );
+  // recurring to-dos are handled differently in the past
+  const QDate dt = QDate::currentDate().addDays( 100 );
+
+  Todo::Ptr due = Todo::Ptr( new Todo() );
+  due->setUid( "due" );
+  due->setDtDue( KDateTime( dt, QTime( 10, 0 ), KDateTime::UTC ) );
+
+  Todo::Ptr startOnly = Todo::Ptr( new Todo() );
+  startOnly->setUid( "startonly" );
+  startOnly->setDtStart( KDateTime( dt.addDays( 5 ), QTime( 10, 0 ), KDateTime::UTC ) );
+
+  Todo::Ptr recurring = Todo::Ptr( new Todo() );
+  recurring->setUid( "recurring" );
+  recurring->setDtStart( KDateTime( dt, QTime( 8, 0 ), KDateTime::UTC ) );
+  recurring->setDtDue( KDateTime( dt, QTime( 9, 0 ), KDateTime::UTC ) );
+  recurring->recurrence()->setDaily( 3 );
+  recurring->recurrence()->setDuration( 3 );
+
+  Journal::Ptr journal = Journal::Ptr( new Journal() );
+  journal->setUid( "journal" );
+  journal->setDtStart( KDateTime( dt.addDays( 1 ), QTime( 10, 0 ), KDateTime::UTC ) );
+
+  QVERIFY( cal->addTodo( due ) );
+  QVERIFY( cal->addTodo( startOnly ) );
+  QVERIFY( cal->addTodo( recurring ) );
+  QVERIFY( cal->addJournal( journal ) );
+
+  QCOMPARE( cal->rawTodosForDate( dt.addDays( 3 ) ).count(), 1 );
+  QCOMPARE( cal->rawTodosForDate( dt.addDays( 4 ) ).count(), 0 );
+  QCOMPARE( cal->rawTodos( dt, dt ).count(), 2 );
+  QCOMPARE( cal->rawTodos( dt.addDays( 1 ), dt.addDays( 10 ) ).count(), 2 );
+  QCOMPARE( cal->rawTodos( dt.addDays( 10 ), dt.addDays( 20 ) ).count(), 0 );
+  QCOMPARE( cal->rawJournalsForDate( dt.addDays( 1 ) ).count(), 1 );
+  QCOMPARE( cal->rawJournalsForDate( dt ).count(), 0 );
+
+  due->setDtDue( KDateTime( dt.addDays( 15 ), QTime( 10, 0 ), KDateTime::UTC ) );
+  QCOMPARE( cal->rawTodos( dt, dt ).count(), 1 );
+  QCOMPARE( cal->rawTodos( dt.addDays( 10 ), dt.addDays( 20 ) ).count(), 1 );
+  QCOMPARE( cal->rawTodosForDate( dt.addDays( 15 ) ).count(), 1 );
+
+  journal->setDtStart( KDateTime( dt.addDays( 2 ), QTime( 10, 0 ), KDateTime::UTC ) );
+  QCOMPARE( cal->rawJournalsForDate( dt.addDays( 1 ) ).count(), 0 );
+  QCOMPARE( cal->rawJournalsForDate( dt.addDays( 2 ) ).count(), 1 );
+
+  QVERIFY( cal->deleteTodo( due ) );
+  QCOMPARE( cal->rawTodosForDate( dt.addDays( 15 ) ).count(), 0 );
+  cal->close();
+}
+
+void MemoryCalendarTest::testOccurrencesInRange()
+{
+  MemoryCalendar::Ptr cal( new MemoryCalendar( KDateTime::UTC ) );
+  const QDate dt( 2012, 1, 2 );
+
+  Event::Ptr single = Event::Ptr( new Event() );
+  single->setUid( "single" );
+  single->setDtStart( KDateTime( dt.addDays( 1 ), QTime( 9, 0 ), KDateTime::UTC ) );
+  single->setDtEnd( KDateTime( dt.addDays( 1 ), QTime( 10, 0 ), KDateTime::UTC ) );
+
+  Event::Ptr allDay = Event::Ptr( new Event() );
+  allDay->setUid( "allday" );
+  allDay->setDtStart( KDateTime( dt.addDays( -1 ), KDateTime::UTC ) );
+  allDay->setDtEnd( KDateTime( dt.addDays( 1 ), KDateTime::UTC ) );
+  allDay->setAllDay( true );
+
+  Event::Ptr daily = Event::Ptr( new Event() );
+  daily->setUid( "daily" );
+  daily->setDtStart( KDateTime( dt, QTime( 12, 0 ), KDateTime::UTC ) );
+  daily->setDtEnd( KDateTime( dt, QTime( 13, 0 ), KDateTime::UTC ) );
+  daily->recurrence()->setDaily( 1 );
+
+  // Moves the third occurrence of the daily event to the morning
+  Event::Ptr exception = Event::Ptr( new Event() );
+  exception->setUid( "daily" );
+  exception->setRecurrenceId( KDateTime( dt.addDays( 2 ), QTime( 12, 0 ), KDateTime::UTC ) );
+  exception->setDtStart( KDateTime( dt.addDays( 2 ), QTime( 7, 0 ), KDateTime::UTC ) );
+  exception->setDtEnd( KDateTime( dt.addDays( 2 ), QTime( 8, 0 ), KDateTime::UTC ) );
+
+  QVERIFY( cal->addEvent( single ) );
+  QVERIFY( cal->addEvent( allDay ) );
+  QVERIFY( cal->addEvent( daily ) );
+  QVERIFY( cal->addEvent( exception ) );
+
+  const KDateTime start( dt, QTime( 0, 0 ), KDateTime::UTC );
+  const KDateTime end( dt.addDays( 2 ), QTime( 23, 59, 59 ), KDateTime::UTC );
+  const Calendar::OccurrenceList occurrences = cal->occurrencesInRange( start, end );
+
+  // all-day, daily, single, daily, exception
+  QCOMPARE( occurrences.count(), 5 );
+  QCOMPARE( occurrences[0].incidence->uid(), QString( "allday" ) );
+  QCOMPARE( occurrences[0].start.date(), dt.addDays( -1 ) );
+  QCOMPARE( occurrences[1].incidence, Incidence::Ptr( daily ) );
+  QCOMPARE( occurrences[1].start, daily->dtStart() );
+  QCOMPARE( occurrences[2].incidence, Incidence::Ptr( single ) );
+  QCOMPARE( occurrences[3].incidence, Incidence::Ptr( daily ) );
+  QCOMPARE( occurrences[3].start, daily->dtStart().addDays( 1 ) );
+  QCOMPARE( occurrences[3].end, daily->dtEnd().addDays( 1 ) );
+  QCOMPARE( occurrences[4].incidence, Incidence::Ptr( exception ) );
+  QCOMPARE( occurrences[4].start, exception->dtStart() );
+
+  for ( int i = 1; i < occurrences.count(); ++i ) {
+    QVERIFY( occurrences[i - 1].start <= occurrences[i].start );
+  }
+
+  // An occurrence ending exactly at the start of the range is not in it
+  const KDateTime afternoon( dt, QTime( 13, 0 ), KDateTime::UTC );
+  QCOMPARE( cal->occurrencesInRange( afternoon, afternoon.addSecs( 3600 ) ).count(), 1 );
+
+  // The filter applies to the occurrences too
+  CalFilter *filter = new CalFilter;
+  filter->setCriteria( CalFilter::HideRecurring );
+  cal->setFilter( filter );
+  QCOMPARE( cal->occurrencesInRange( start, end ).count(), 3 );
+  cal->setFilter( 0 );
+  delete filter;
+
+  // Journals are found by their date, or by their recurrence
+  Journal::Ptr note = Journal::Ptr( new Journal() );
+  note->setUid( "note" );
+  note->setDtStart( KDateTime( dt.addDays( 1 ), QTime( 15, 0 ), KDateTime::UTC ) );
+  Journal::Ptr later = Journal::Ptr( new Journal() );
+  later->setUid( "later" );
+  later->setDtStart( KDateTime( dt.addDays( 10 ), QTime( 15, 0 ), KDateTime::UTC ) );
+  Journal::Ptr diary = Journal::Ptr( new Journal() );
+  diary->setUid( "diary" );
+  diary->setDtStart( KDateTime( dt.addDays( -30 ), QTime( 20, 0 ), KDateTime::UTC ) );
+  diary->recurrence()->setDaily( 1 );
+  QVERIFY( cal->addJournal( note ) );
+  QVERIFY( cal->addJournal( later ) );
+  QVERIFY( cal->addJournal( diary ) );
+  Calendar::OccurrenceList withJournals = cal->occurrencesInRange( start, end );
+  QCOMPARE( withJournals.count(), 9 );
+  QCOMPARE( withJournals[5].incidence, Incidence::Ptr( note ) );
+
+  // A journal which starts to recur is found again
+  later->recurrence()->setDaily( 1 );
+  later->setDtStart( KDateTime( dt.addDays( -10 ), QTime( 15, 0 ), KDateTime::UTC ) );
+  withJournals = cal->occurrencesInRange( start, end );
+  QCOMPARE( withJournals.count(), 12 );
+  later->recurrence()->clear();
+  QCOMPARE( cal->occurrencesInRange( start, end ).count(), 9 );
+  cal->close();
+}
+
+void MemoryCalendarTest::testAlarmSchedule()
+{
+  MemoryCalendar::Ptr cal( new MemoryCalendar( KDateTime::UTC ) );
+  const QDate dt( 2012, 3, 1 );
+
+  Event::Ptr single = Event::Ptr( new Event() );
+  single->setUid( "single" );
+  single->setDtStart( KDateTime( dt, QTime( 10, 0 ), KDateTime::UTC ) );
+  single->setDtEnd( KDateTime( dt, QTime( 11, 0 ), KDateTime::UTC ) );
+  Alarm::Ptr singleAlarm = single->newAlarm();
+  singleAlarm->setStartOffset( Duration( -15 * 60 ) );
+  singleAlarm->setEnabled( true );
+
+  Event::Ptr daily = Event::Ptr( new Event() );
+  daily->setUid( "daily" );
+  daily->setDtStart( KDateTime( dt, QTime( 12, 0 ), KDateTime::UTC ) );
+  daily->setDtEnd( KDateTime( dt, QTime( 13, 0 ), KDateTime::UTC ) );
+  daily->recurrence()->setDaily( 1 );
+  daily->recurrence()->setDuration( 3 );
+  Alarm::Ptr dailyAlarm = daily->newAlarm();
+  dailyAlarm->setStartOffset( Duration( -60 * 60 ) );
+  dailyAlarm->setEnabled( true );
+
+  Todo::Ptr todo = Todo::Ptr( new Todo() );
+  todo->setUid( "todo" );
+  todo->setDtDue( KDateTime( dt, QTime( 9, 0 ), KDateTime::UTC ) );
+  Alarm::Ptr todoAlarm = todo->newAlarm();
+  todoAlarm->setTime( KDateTime( dt, QTime( 8, 0 ), KDateTime::UTC ) );
+  todoAlarm->setEnabled( true );
+
+  Todo::Ptr done = Todo::Ptr( new Todo() );
+  done->setUid( "done" );
+  done->setDtDue( KDateTime( dt, QTime( 9, 0 ), KDateTime::UTC ) );
+  Alarm::Ptr doneAlarm = done->newAlarm();
+  doneAlarm->setTime( KDateTime( dt, QTime( 8, 30 ), KDateTime::UTC ) );
+  doneAlarm->setEnabled( true );
+  done->setCompleted( true );
+
+  QVERIFY( cal->addEvent( single ) );
+  QVERIFY( cal->addEvent( daily ) );
+  QVERIFY( cal->addTodo( todo ) );
+  QVERIFY( cal->addTodo( done ) );
+
+  const KDateTime start( dt, QTime( 0, 0 ), KDateTime::UTC );
+  QCOMPARE( cal->alarms( start, KDateTime( dt, QTime( 23, 59 ), KDateTime::UTC ) ).count(), 3 );
+
+  MemoryCalendar::AlarmTriggerList next = cal->nextAlarms( start, 10 );
+  QCOMPARE( next.count(), 3 );
+  QCOMPARE( next[0].alarm, todoAlarm );
+  QCOMPARE( next[0].incidence, Incidence::Ptr( todo ) );
+  QCOMPARE( next[0].time, KDateTime( dt, QTime( 8, 0 ), KDateTime::UTC ) );
+  QCOMPARE( next[1].alarm, singleAlarm );
+  QCOMPARE( next[1].time, KDateTime( dt, QTime( 9, 45 ), KDateTime::UTC ) );
+  QCOMPARE( next[2].alarm, dailyAlarm );
+  QCOMPARE( next[2].time, KDateTime( dt, QTime( 11, 0 ), KDateTime::UTC ) );
+  QCOMPARE( cal->nextAlarms( start, 2 ).count(), 2 );
+
+  // Polling reports each alarm once, when it goes off
+  QVERIFY( cal->alarmsDue( start ).isEmpty() );
+  Alarm::List due = cal->alarmsDue( KDateTime( dt, QTime( 9, 0 ), KDateTime::UTC ) );
+  QCOMPARE( due.count(), 1 );
+  QCOMPARE( due[0], todoAlarm );
+  QVERIFY( cal->alarmsDue( KDateTime( dt, QTime( 9, 30 ), KDateTime::UTC ) ).isEmpty() );
+  due = cal->alarmsDue( KDateTime( dt, QTime( 11, 0 ), KDateTime::UTC ) );
+  QCOMPARE( due.count(), 2 );
+
+  // The next recurrence is scheduled
+  const KDateTime eleven( dt, QTime( 11, 0 ), KDateTime::UTC );
+  next = cal->nextAlarms( eleven, 10 );
+  QCOMPARE( next.count(), 1 );
+  QCOMPARE( next[0].time, eleven.addDays( 1 ) );
+
+  // Changes to incidences and alarms are picked up
+  single->setDtStart( single->dtStart().addDays( 1 ) );
+  single->setDtEnd( single->dtEnd().addDays( 1 ) );
+  next = cal->nextAlarms( eleven, 10 );
+  QCOMPARE( next.count(), 2 );
+  QCOMPARE( next[0].alarm, singleAlarm );
+  QCOMPARE( next[0].time, KDateTime( dt.addDays( 1 ), QTime( 9, 45 ), KDateTime::UTC ) );
+  singleAlarm->setEnabled( false );
+  QCOMPARE( cal->nextAlarms( eleven, 10 ).count(), 1 );
+  QVERIFY( cal->nextAlarms( eleven.addDays( 2 ), 10 ).isEmpty() );
+
+  // Looking back in time still gives the right answer
+  next = cal->nextAlarms( start, 10 );
+  QCOMPARE( next.count(), 2 );
+  QCOMPARE( next[0].alarm, todoAlarm );
+  QCOMPARE( next[1].alarm, dailyAlarm );
+
+  QVERIFY( cal->deleteEvent( daily ) );
+  QCOMPARE( cal->nextAlarms( start, 10 ).count(), 1 );
+  cal->close();
+}
+
+void MemoryCalendarTest::testSecondaryIndexes()
+{
+  MemoryCalendar::Ptr cal( new MemoryCalendar( KDateTime::UTC ) );
+  const KDateTime start( QDate( 2012, 3, 1 ), QTime( 10, 0 ), KDateTime::UTC );
+
+  Event::Ptr parent = Event::Ptr( new Event() );
+  parent->setUid( "parent" );
+  parent->setDtStart( start );
+  parent->setCategories( QStringList() << "Work" << "Meeting" );
+  parent->setOrganizer( Person::Ptr( new Person( "Org", "org@example.com" ) ) );
+  parent->addAttendee( Attendee::Ptr( new Attendee( "Att", "att@example.com" ) ) );
+
+  Todo::Ptr child = Todo::Ptr( new Todo() );
+  child->setUid( "child" );
+  child->setSchedulingID( "sid" );
+  child->setRelatedTo( "parent" );
+  child->setCategories( QStringList() << "Work" );
+
+  QVERIFY( cal->addEvent( parent ) );
+  QVERIFY( cal->addTodo( child ) );
+
+  QCOMPARE( cal->incidenceFromSchedulingID( "parent" ), Incidence::Ptr( parent ) );
+  QCOMPARE( cal->incidenceFromSchedulingID( "sid" ), Incidence::Ptr( child ) );
+  QVERIFY( !cal->incidenceFromSchedulingID( "child" ) );
+  QCOMPARE( cal->incidencesFromSchedulingID( "sid" ).count(), 1 );
+
+  QCOMPARE( cal->categories(), QStringList() << "Meeting" << "Work" );
+  QCOMPARE( cal->incidencesWithCategory( "Work" ).count(), 2 );
+  QCOMPARE( cal->incidencesWithCategory( "Meeting" ).count(), 1 );
+
+  QCOMPARE( cal->incidencesRelatedTo( "parent" ), Incidence::List() << child );
+  QCOMPARE( cal->incidencesWithEmail( "org@example.com" ), Incidence::List() << parent );
+  QCOMPARE( cal->incidencesWithEmail( "att@example.com" ), Incidence::List() << parent );
+
+  // Changes to an incidence in the calendar are picked up
+  parent->startUpdates();
+  parent->setCategories( QStringList() << "Work" );
+  parent->setSchedulingID( "other" );
+  parent->clearAttendees();
+  parent->endUpdates();
+  QCOMPARE( cal->categories(), QStringList() << "Work" );
+  QVERIFY( !cal->incidenceFromSchedulingID( "parent" ) );
+  QCOMPARE( cal->incidenceFromSchedulingID( "other" ), Incidence::Ptr( parent ) );
+  QVERIFY( cal->incidencesWithEmail( "att@example.com" ).isEmpty() );
+
+  parent->setSchedulingID( "another" );
+  QVERIFY( !cal->incidenceFromSchedulingID( "other" ) );
+  QCOMPARE( cal->incidenceFromSchedulingID( "another" ), Incidence::Ptr( parent ) );
+
+  child->setRelatedTo( QString() );
+  QVERIFY( cal->incidencesRelatedTo( "parent" ).isEmpty() );
+
+  // Deleted incidences are dropped
+  QVERIFY( cal->deleteTodo( child ) );
+  QVERIFY( !cal->incidenceFromSchedulingID( "sid" ) );
+  QCOMPARE( cal->incidencesWithCategory( "Work" ), Incidence::List() << parent );
+
+  cal->close();
+  QVERIFY( cal->categories().isEmpty() );
+  QVERIFY( cal->incidencesWithEmail( "org@example.com" ).isEmpty() );
+}
+
+void MemoryCalendarTest::testDuplicates()
+{
+  MemoryCalendar::Ptr cal( new MemoryCalendar( KDateTime::UTC ) );
+  const KDateTime start( QDate( 2012, 3, 1 ), QTime( 10, 0 ), KDateTime::UTC );
+  QVERIFY( cal->addNotebook( "nb", true ) );
+
+  Event::Ptr event = Event::Ptr( new Event() );
+  event->setUid( "event" );
+  event->setDtStart( start );
+  event->setSummary( "Meeting" );
+  QVERIFY( cal->addEvent( event ) );
+
+  // Only incidences in a notebook are considered
+  Event::Ptr copy = Event::Ptr( new Event() );
+  copy->setDtStart( start.toTimeSpec( KDateTime::Spec::OffsetFromUTC( 3600 ) ) );
+  copy->setSummary( "Meeting" );
+  QVERIFY( cal->duplicates( copy ).isEmpty() );
+
+  QVERIFY( cal->setNotebook( event, "nb" ) );
+  QCOMPARE( cal->duplicates( copy ), Incidence::List() << event );
+
+  Event::Ptr other = Event::Ptr( new Event() );
+  other->setDtStart( start.addSecs( 60 ) );
+  other->setSummary( "Meeting" );
+  QVERIFY( cal->duplicates( other ).isEmpty() );
+
+  Todo::Ptr undated = Todo::Ptr( new Todo() );
+  undated->setSummary( "Undated" );
+  Todo::Ptr undatedCopy = Todo::Ptr( new Todo() );
+  undatedCopy->setSummary( "Undated" );
+
+  const Incidence::List imported = Incidence::List() << copy << other << undated << undatedCopy;
+  QCOMPARE( cal->findDuplicates( imported ), Incidence::List() << copy << undatedCopy );
+
+  // Changes move the incidence in the index
+  event->setDtStart( start.addSecs( 60 ) );
+  QVERIFY( cal->duplicates( copy ).isEmpty() );
+  QCOMPARE( cal->duplicates( other ), Incidence::List() << event );
+
+  cal->clearNotebookAssociations();
+  QVERIFY( cal->duplicates( other ).isEmpty() );
+  cal->close();
+}
+
+class RecordingObserver : public Calendar::CalendarObserver
+{
+  public:
+    void calendarIncidenceAdded( const Incidence::Ptr &incidence )
+    {
+      mAdded.append( incidence );
+    }
+    void calendarIncidenceChanged( const Incidence::Ptr &incidence )
+    {
+      mChanged.append( incidence );
+    }
+    void calendarIncidenceDeleted( const Incidence::Ptr &incidence )
+    {
+      mDeleted.append( incidence );
+    }
+    void calendarIncidenceAdditionCanceled( const Incidence::Ptr &incidence )
+    {
+      mCanceled.append( incidence );
+    }
+
+    Incidence::List mAdded, mChanged, mDeleted, mCanceled;
+};
+
+class TransactionRecordingObserver : public RecordingObserver,
+                                     public Calendar::TransactionObserver
+{
+  public:
+    TransactionRecordingObserver() : mTransactions( 0 ) {}
+
+    void calendarIncidencesChanged( const Calendar::ChangeSet &changes, Calendar *calendar )
+    {
+      Q_UNUSED( calendar );
+      ++mTransactions;
+      mChanges = changes;
+    }
+
+    int mTransactions;
+    Calendar::ChangeSet mChanges;
+};
+
+class CancelingCalendar : public MemoryCalendar
+{
+  public:
+    CancelingCalendar() : MemoryCalendar( KDateTime::UTC ) {}
+
+    void cancelAddition( const Incidence::Ptr &incidence )
+    {
+      notifyIncidenceAdditionCanceled( incidence );
+    }
+};
+
+void MemoryCalendarTest::testTransactions()
+{
+  QSharedPointer<CancelingCalendar> cal( new CancelingCalendar );
+  const KDateTime start( QDate( 2012, 3, 1 ), QTime( 10, 0 ), KDateTime::UTC );
+
+  Event::Ptr existing = Event::Ptr( new Event() );
+  existing->setDtStart( start );
+  Event::Ptr edited = Event::Ptr( new Event() );
+  edited->setDtStart( start );
+  QVERIFY( cal->addEvent( existing ) );
+  QVERIFY( cal->addEvent( edited ) );
+
+  TransactionRecordingObserver bulk;
+  RecordingObserver single;
+  cal->registerObserver( &bulk );
+  cal->registerObserver( &single );
+
+  Event::Ptr added = Event::Ptr( new Event() );
+  added->setDtStart( start );
+  Event::Ptr transient = Event::Ptr( new Event() );
+  transient->setDtStart( start );
+  Event::Ptr canceled = Event::Ptr( new Event() );
+  canceled->setDtStart( start );
+
+  cal->startTransaction();
+  QVERIFY( cal->inTransaction() );
+  QVERIFY( cal->addEvent( added ) );
+  added->setSummary( "added" );
+  edited->setSummary( "edited" );
+  edited->setDescription( "edited twice" );
+
+  cal->startTransaction();
+  QVERIFY( cal->addEvent( transient ) );
+  QVERIFY( cal->deleteEvent( transient ) );
+  QVERIFY( cal->deleteEvent( existing ) );
+  QVERIFY( cal->addEvent( canceled ) );
+  cal->cancelAddition( canceled );
+  cal->commitTransaction();
+
+  QVERIFY( cal->inTransaction() );
+  QCOMPARE( bulk.mTransactions, 0 );
+  QVERIFY( single.mAdded.isEmpty() && single.mChanged.isEmpty() && single.mDeleted.isEmpty() );
+
+  cal->commitTransaction();
+  QVERIFY( !cal->inTransaction() );
+  QCOMPARE( bulk.mTransactions, 1 );
+  QCOMPARE( bulk.mChanges.added(), Incidence::List() << added );
+  QCOMPARE( bulk.mChanges.changed(), Incidence::List() << edited );
+  QCOMPARE( bulk.mChanges.deleted(), Incidence::List() << existing );
+  QVERIFY( bulk.mAdded.isEmpty() && bulk.mChanged.isEmpty() && bulk.mDeleted.isEmpty() );
+
+  // Other observers get the single callbacks
+  QCOMPARE( single.mAdded, Incidence::List() << added );
+  QCOMPARE( single.mChanged, Incidence::List() << edited );
+  QCOMPARE( single.mDeleted, Incidence::List() << existing );
+
+  // An addition canceled within the transaction is not reported at all,
+  // one made before it is reported as canceled right away
+  QVERIFY( single.mCanceled.isEmpty() && bulk.mCanceled.isEmpty() );
+  cal->startTransaction();
+  cal->cancelAddition( added );
+  QCOMPARE( single.mCanceled, Incidence::List() << added );
+  QCOMPARE( bulk.mCanceled, Incidence::List() << added );
+  cal->commitTransaction();
+  QCOMPARE( bulk.mTransactions, 1 );
+
+  // Transactions without changes are not announced
+  cal->startTransaction();
+  cal->commitTransaction();
+  QCOMPARE( bulk.mTransactions, 1 );
+
+  cal->unregisterObserver( &bulk );
+  cal->unregisterObserver( &single );
+  cal->close();
+}
+
+void MemoryCalendarTest::testSortKeys()
+{
+  // Times are never at midnight, where KDateTime::compare() finds a timed
+  // value and an all-day value each to be before the other.
+  const KDateTime base( QDate( 2012, 3, 1 ), QTime( 10, 30 ), KDateTime::UTC );
+  const KDateTime::Spec offset = KDateTime::Spec::OffsetFromUTC( 3600 );
+
+  // Timed values in different specs, all-day values overlapping them,
+  // equal dates with different summaries, and to-dos without due dates
+  Event::List events;
+  Todo::List todos;
+  for ( int i = 0; i < 200; ++i ) {
+    KDateTime dt = base.addSecs( ( i * 7919 ) % 50 * 3600 );
+    if ( i % 3 == 1 ) {
+      dt = dt.toTimeSpec( offset );
+    } else if ( i % 5 == 2 ) {
+      dt.setDateOnly( true );
+    }
+    const QString summary = QString::fromLatin1( i % 2 ? "Item %1" : "item %1" ).arg( i % 7 );
+
+    Event::Ptr event( new Event() );
+    event->setDtStart( dt );
+    event->setSummary( summary );
+    events.append( event );
+
+    Todo::Ptr todo( new Todo() );
+    if ( i % 4 ) {
+      todo->setDtDue( dt );
+    }
+    todo->setPriority( i % 10 );
+    todo->setSummary( summary );
+    todos.append( todo );
+  }
+
+  Event::List sorted = Calendar::sortEvents( events, EventSortStartDate, SortDirectionAscending );
+  QCOMPARE( sorted.count(), events.count() );
+  for ( int i = 1; i < sorted.count(); ++i ) {
+    QVERIFY( !Events::startDateLessThan( sorted[i], sorted[i - 1] ) );
+  }
+  sorted = Calendar::sortEvents( events, EventSortStartDate, SortDirectionDescending );
+  for ( int i = 1; i < sorted.count(); ++i ) {
+    QVERIFY( !Events::startDateMoreThan( sorted[i], sorted[i - 1] ) );
+  }
+  sorted = Calendar::sortEvents( events, EventSortSummary, SortDirectionAscending );
+  for ( int i = 1; i < sorted.count(); ++i ) {
+    QVERIFY( !Events::summaryLessThan( sorted[i], sorted[i - 1] ) );
+  }
+
+  Todo::List sortedTodos = Calendar::sortTodos( todos, TodoSortDueDate, SortDirectionAscending );
+  QCOMPARE( sortedTodos.count(), todos.count() );
+  for ( int i = 1; i < sortedTodos.count(); ++i ) {
+    if ( !sortedTodos[i - 1]->hasDueDate() ) {
+      continue;
+    }
+    // To-dos without due dates come first
+    QVERIFY( sortedTodos[i]->hasDueDate() );
+    QVERIFY( !Todos::dueDateLessThan( sortedTodos[i], sortedTodos[i - 1] ) );
+  }
+  sortedTodos = Calendar::sortTodos( todos, TodoSortPriority, SortDirectionDescending );
+  for ( int i = 1; i < sortedTodos.count(); ++i ) {
+    QVERIFY( !Todos::priorityMoreThan( sortedTodos[i], sortedTodos[i - 1] ) );
+  }
+
+  // All-day values in a time zone and at a fixed offset span their own
+  // day in that spec, whatever the time spec of the values around them.
+  // Again no timed value is at the start of one of the days.
+  QList<KDateTime::Spec> daySpecs;
+  daySpecs << KDateTime::Spec::OffsetFromUTC( -5 * 3600 )
+           << KDateTime::Spec::OffsetFromUTC( 10 * 3600 );
+  const KTimeZone helsinki = KSystemTimeZones::zone( "Europe/Helsinki" );
+  if ( helsinki.isValid() ) {
+    daySpecs << KDateTime::Spec( helsinki );
+  }
+  foreach ( const KDateTime::Spec &spec, daySpecs ) {
+    const QDate date( 2012, 3, 5 );
+    const KDateTime dayStart( date, QTime( 0, 0 ), spec );
+    const KDateTime dayEnd( date, QTime( 23, 59, 59, 999 ), spec );
+    Event::List boundary;
+    QList<KDateTime> starts;
+    starts << KDateTime( date, spec )
+           << dayStart.addSecs( -1 ).toUtc() << dayStart.addSecs( 1 ).toUtc()
+           << dayEnd.addSecs( -1 ).toUtc() << dayEnd.toUtc() << dayEnd.addSecs( 1 ).toUtc()
+           << KDateTime( date.addDays( -1 ), KDateTime::UTC )
+           << KDateTime( date, KDateTime::UTC )
+           << KDateTime( date.addDays( 1 ), KDateTime::UTC );
+    for ( int i = 0; i < starts.count(); ++i ) {
+      Event::Ptr event( new Event() );
+      event->setDtStart( starts[i] );
+      event->setSummary( QString::number( i ) );
+      boundary.append( event );
+    }
+    const Event::List sortedBoundary =
+      Calendar::sortEvents( boundary, EventSortStartDate, SortDirectionAscending );
+    QCOMPARE( sortedBoundary.count(), boundary.count() );
+    for ( int i = 0; i < sortedBoundary.count(); ++i ) {
+      for ( int j = i + 1; j < sortedBoundary.count(); ++j ) {
+        QVERIFY( !Events::startDateLessThan( sortedBoundary[j], sortedBoundary[i] ) );
+      }
+    }
+    // The all-day value comes after the second before its day starts and
+    // before the one after its day ends
+    const int day = sortedBoundary.indexOf( boundary[0] );
+    QVERIFY( sortedBoundary.indexOf( boundary[1] ) < day );
+    QVERIFY( day < sortedBoundary.indexOf( boundary[5] ) );
+  }
+
+  // A list large enough to be sorted in parallel gives the same order
+  Event::List many;
+  for ( int i = 0; i < 40000; ++i ) {
+    Event::Ptr event( new Event() );
+    event->setDtStart( base.addSecs( qint64( i ) * 7919 % 40000 * 60 ) );
+    event->setSummary( QString::number( i % 13 ) );
+    many.append( event );
+  }
+  const Event::List single = Calendar::sortEvents( many, EventSortStartDate, SortDirectionAscending );
+  Calendar::setSortThreadCount( 4 );
+  QCOMPARE( Calendar::sortThreadCount(), 4 );
+  const Event::List parallel = Calendar::sortEvents( many, EventSortStartDate, SortDirectionAscending );
+  Calendar::setSortThreadCount( 1 );
+  QCOMPARE( parallel, single );
+  for ( int i = 1; i < parallel.count(); ++i ) {
+    QVERIFY( parallel[i - 1]->dtStart() < parallel[i]->dtStart() );
+  }
+}
@@ -32,6 +32,14 @@ class MemoryCalendarTest : public QObject
     void testEvents();
     void testIncidences();
     void testRelationsCrash();
+    void testRawEvents();
+    void testRawTodosAndJournals();
+    void testOccurrencesInRange();
+    void testAlarmSchedule();
+    void testSecondaryIndexes();
+    void testDuplicates();
+    void testTransactions();
+    void testSortKeys();
 };
 
 #endif
@@ -78,6 +78,39 @@ void PeriodTest::testCompare()
 
 }
 
+void PeriodTest::testTimeSpecs()
+{
+  // Start and end come back in the time spec they were given in
+  QList<KDateTime> times;
+  times << KDateTime( QDate( 2006, 8, 30 ), QTime( 7, 0, 0 ), KDateTime::UTC )
+        << KDateTime( QDate( 2006, 8, 30 ), QTime( 7, 0, 0 ),
+                      KDateTime::Spec::OffsetFromUTC( -5 * 3600 ) )
+        << KDateTime( QDate( 2006, 8, 30 ), QTime( 7, 0, 0, 250 ), KDateTime::ClockTime )
+        << KDateTime( QDate( 2006, 8, 30 ), QTime( 7, 0, 0 ), KDateTime::LocalZone )
+        << KDateTime( QDate( 2006, 8, 30 ), KDateTime::ClockTime );
+  const KTimeZone london = KSystemTimeZones::zone( "Europe/London" );
+  if ( london.isValid() ) {
+    times << KDateTime( QDate( 2006, 8, 30 ), QTime( 7, 0, 0 ), london )
+          << KDateTime( QDate( 2006, 8, 30 ), london );
+  }
+  foreach ( const KDateTime &start, times ) {
+    const KDateTime end = start.addSecs( 3600 );
+    const Period period( start, end );
+    QCOMPARE( period.start(), start );
+    QCOMPARE( period.start().timeSpec(), start.timeSpec() );
+    QCOMPARE( period.start().dateTime(), start.dateTime() );
+    QCOMPARE( period.start().isDateOnly(), start.isDateOnly() );
+    QCOMPARE( period.end(), end );
+    QCOMPARE( period.end().timeSpec(), end.timeSpec() );
+  }
+
+  // Periods are ordered by their start times across time specs
+  const Period utc( times[0], Duration( 60 ) );
+  const Period offset( times[1], Duration( 60 ) );
+  QVERIFY( utc < offset );
+  QVERIFY( !( offset < utc ) );
+}
+
 void PeriodTest::testDataStreamOut()
 {
     const KDateTime p1DateTime( QDate( 2006, 8, 30 ), QTime( 7, 0, 0 ), KDateTime::UTC );
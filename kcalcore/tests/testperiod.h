@@ -30,6 +30,7 @@ class PeriodTest : public QObject
   private Q_SLOTS:
     void testValidity();
     void testCompare();
+    void testTimeSpecs();
     void testDataStreamOut();
     void testDataStreamIn();
 };
@@ -0,0 +1,130 @@
+/*
+  This file is part of the kcalcore library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#include "testrecurrencerule.h"
+#include "../recurrencerule.h"
+
+#include <qtest_kde.h>
+
+QTEST_KDEMAIN( RecurrenceRuleTest, NoGUI )
+
+using namespace KCalCore;
+
+Q_DECLARE_METATYPE( KDateTime )
+Q_DECLARE_METATYPE( QList<int> )
+
+static RecurrenceRule *createRule( RecurrenceRule::PeriodType type, int frequency,
+                                   const KDateTime &start, const QList<int> &days,
+                                   int duration, const KDateTime &end, bool generic )
+{
+  RecurrenceRule *rule = new RecurrenceRule();
+  rule->setStartDt( start );
+  rule->setRecurrenceType( type );
+  rule->setFrequency( frequency );
+  rule->setWeekStart( 1 );
+  if ( !days.isEmpty() ) {
+    QList<RecurrenceRule::WDayPos> byDays;
+    foreach ( int day, days ) {
+      byDays << RecurrenceRule::WDayPos( 0, day );
+    }
+    rule->setByDays( byDays );
+  }
+  if ( duration > 0 ) {
+    rule->setDuration( duration );
+  } else if ( end.isValid() ) {
+    rule->setEndDt( end );
+  }
+  if ( generic ) {
+    // A redundant BYHOUR keeps the occurrences, but makes the rule go
+    // through the generic constraint evaluation
+    rule->setByHours( QList<int>() << start.time().hour() );
+  }
+  return rule;
+}
+
+void RecurrenceRuleTest::testSimpleRules_data()
+{
+  QTest::addColumn<int>( "type" );
+  QTest::addColumn<int>( "frequency" );
+  QTest::addColumn<KDateTime>( "start" );
+  QTest::addColumn<QList<int> >( "days" );
+  QTest::addColumn<int>( "duration" );
+  QTest::addColumn<KDateTime>( "end" );
+
+  const KDateTime start( QDate( 2011, 1, 12 ), QTime( 10, 30 ), KDateTime::UTC );
+  const KDateTime end( QDate( 2013, 8, 20 ), QTime( 10, 30 ), KDateTime::UTC );
+  const KDateTime clock( QDate( 2011, 1, 12 ), QTime( 10, 30 ), KDateTime::ClockTime );
+  const QList<int> none;
+
+  QTest::newRow( "daily" ) << int( RecurrenceRule::rDaily ) << 1 << start << none << -1 << KDateTime();
+  QTest::newRow( "every 3 days until" ) << int( RecurrenceRule::rDaily ) << 3 << start << none
+                                       << 0 << end;
+  QTest::newRow( "every 4 days count" ) << int( RecurrenceRule::rDaily ) << 4 << start << none
+                                       << 50 << KDateTime();
+  QTest::newRow( "weekly" ) << int( RecurrenceRule::rWeekly ) << 1 << start << none << -1 << KDateTime();
+  QTest::newRow( "biweekly mo we" ) << int( RecurrenceRule::rWeekly ) << 2 << start
+                                    << ( QList<int>() << 1 << 3 ) << -1 << KDateTime();
+  QTest::newRow( "weekly tu th sa count" ) << int( RecurrenceRule::rWeekly ) << 1 << clock
+                                           << ( QList<int>() << 2 << 4 << 6 ) << 40 << KDateTime();
+  QTest::newRow( "every 3 weeks mo su until" ) << int( RecurrenceRule::rWeekly ) << 3 << start
+                                               << ( QList<int>() << 1 << 7 ) << 0 << end;
+  QTest::newRow( "monthly" ) << int( RecurrenceRule::rMonthly ) << 1 << start << none << -1 << KDateTime();
+  QTest::newRow( "every 5 months count" ) << int( RecurrenceRule::rMonthly ) << 5 << clock << none
+                                         << 10 << KDateTime();
+  QTest::newRow( "yearly" ) << int( RecurrenceRule::rYearly ) << 1 << start << none << -1 << KDateTime();
+  QTest::newRow( "every 2 years until" ) << int( RecurrenceRule::rYearly ) << 2 << start << none
+                                        << 0 << end;
+}
+
+void RecurrenceRuleTest::testSimpleRules()
+{
+  QFETCH( int, type );
+  QFETCH( int, frequency );
+  QFETCH( KDateTime, start );
+  QFETCH( QList<int>, days );
+  QFETCH( int, duration );
+  QFETCH( KDateTime, end );
+
+  RecurrenceRule *simple =
+    createRule( static_cast<RecurrenceRule::PeriodType>( type ), frequency, start, days,
+                duration, end, false );
+  RecurrenceRule *generic =
+    createRule( static_cast<RecurrenceRule::PeriodType>( type ), frequency, start, days,
+                duration, end, true );
+
+  QCOMPARE( simple->endDt(), generic->endDt() );
+
+  // Probe around the start, across the end, and at times around the
+  // time of day of the occurrences
+  for ( int day = -20; day < 1200; day += 3 ) {
+    foreach ( int secs, QList<int>() << -3600 << -1 << 0 << 1 << 7200 ) {
+      const KDateTime dt = start.addDays( day ).addSecs( secs );
+      QCOMPARE( simple->getNextDate( dt ), generic->getNextDate( dt ) );
+      QCOMPARE( simple->getPreviousDate( dt ), generic->getPreviousDate( dt ) );
+      QCOMPARE( simple->recursAt( dt ), generic->recursAt( dt ) );
+      QCOMPARE( simple->durationTo( dt ), generic->durationTo( dt ) );
+    }
+    const QDate date = start.date().addDays( day );
+    QCOMPARE( simple->recursOn( date, start.timeSpec() ),
+              generic->recursOn( date, start.timeSpec() ) );
+  }
+
+  delete simple;
+  delete generic;
+}
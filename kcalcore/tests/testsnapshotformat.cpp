@@ -0,0 +1,244 @@
+/*
+  This file is part of the kcalcore library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#include "testsnapshotformat.h"
+#include "../event.h"
+#include "../exceptions.h"
+#include "../icalformat.h"
+#include "../icaltimezones.h"
+#include "../journal.h"
+#include "../todo.h"
+#include "../memorycalendar.h"
+#include "../snapshotformat.h"
+
+#include <kdatetime.h>
+#include <ksystemtimezone.h>
+
+#include <qtest_kde.h>
+
+#include <QtCore/QBitArray>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+
+QTEST_KDEMAIN( SnapshotFormatTest, NoGUI )
+
+using namespace KCalCore;
+
+static Event::Ptr createEvent()
+{
+  const KDateTime start( QDate( 2011, 3, 7 ), QTime( 9, 0 ), KDateTime::UTC );
+  Event::Ptr event( new Event() );
+  event->setUid( "snapshot-event" );
+  event->setSummary( "Weekly meeting" );
+  event->setLocation( "Room 1" );
+  event->setCategories( QStringList() << "Work" << "Meetings" );
+  event->setDtStart( start );
+  event->setDtEnd( start.addSecs( 3600 ) );
+  event->addAttendee( Attendee::Ptr( new Attendee( "Jane Doe", "jane@example.org" ) ) );
+  event->setCustomProperty( "KCALCORE", "TEST", "value" );
+
+  QBitArray days( 7 );
+  days.setBit( 0 );
+  days.setBit( 2 );
+  event->recurrence()->setWeekly( 1, days );
+  event->recurrence()->setDuration( 10 );
+  event->recurrence()->addExDateTime( start.addDays( 7 ) );
+
+  Alarm::Ptr alarm = event->newAlarm();
+  alarm->setType( Alarm::Display );
+  alarm->setText( "Reminder" );
+  alarm->setStartOffset( Duration( -900 ) );
+  alarm->setEnabled( true );
+
+  return event;
+}
+
+void SnapshotFormatTest::testIncidence()
+{
+  MemoryCalendar::Ptr calendar( new MemoryCalendar( KDateTime::UTC ) );
+  const Event::Ptr event = createEvent();
+  calendar->addEvent( event );
+
+  SnapshotFormat format;
+  MemoryCalendar::Ptr loaded( new MemoryCalendar( KDateTime::UTC ) );
+  QVERIFY( format.fromRawString( loaded, format.toRawString( calendar ) ) );
+
+  const Event::Ptr copy = loaded->event( event->uid() );
+  QVERIFY( copy );
+  QVERIFY( *copy == *event );
+  QCOMPARE( copy->alarms().count(), 1 );
+  QCOMPARE( copy->alarms().first()->parentUid(), event->uid() );
+  QCOMPARE( copy->alarms().first()->text(), QString( "Reminder" ) );
+  QCOMPARE( copy->alarms().first()->startOffset(), Duration( -900 ) );
+  QVERIFY( copy->recurs() );
+  QCOMPARE( copy->recurrence()->exDateTimes(), event->recurrence()->exDateTimes() );
+  QCOMPARE( copy->customProperty( "KCALCORE", "TEST" ), QString( "value" ) );
+}
+
+void SnapshotFormatTest::testRoundTrip()
+{
+  MemoryCalendar::Ptr calendar( new MemoryCalendar( KDateTime::UTC ) );
+  const Event::Ptr event = createEvent();
+  calendar->addEvent( event );
+
+  Todo::Ptr todo( new Todo() );
+  todo->setUid( "snapshot-todo" );
+  todo->setSummary( "Write report" );
+  todo->setLocation( "Room 1" );
+  todo->setCategories( QStringList() << "Work" );
+  todo->setDtDue( KDateTime( QDate( 2011, 3, 10 ) ) );
+  todo->setPercentComplete( 50 );
+  calendar->addTodo( todo );
+
+  Journal::Ptr journal( new Journal() );
+  journal->setUid( "snapshot-journal" );
+  journal->setDtStart( KDateTime( QDate( 2011, 3, 8 ), QTime( 18, 0 ),
+                                  KDateTime::Spec::OffsetFromUTC( 7200 ) ) );
+  journal->setDescription( "<b>Done</b>", true );
+  calendar->addJournal( journal );
+
+  const QString fileName = QDir::tempPath() + "/testsnapshotformat.snapshot";
+  SnapshotFormat format;
+  QVERIFY( format.save( calendar, fileName ) );
+
+  MemoryCalendar::Ptr loaded( new MemoryCalendar( KDateTime::UTC ) );
+  QVERIFY( format.load( loaded, fileName ) );
+  QFile::remove( fileName );
+
+  QCOMPARE( format.loadedProductId(), CalFormat::productId() );
+  QCOMPARE( loaded->rawEvents().count(), 1 );
+  QCOMPARE( loaded->rawTodos().count(), 1 );
+  QCOMPARE( loaded->rawJournals().count(), 1 );
+
+  QVERIFY( *loaded->event( event->uid() ) == *event );
+  QVERIFY( *loaded->todo( todo->uid() ) == *todo );
+  QVERIFY( *loaded->journal( journal->uid() ) == *journal );
+  QCOMPARE( loaded->journal( journal->uid() )->dtStart().utcOffset(), 7200 );
+
+  // the in-memory variant round trips as well
+  MemoryCalendar::Ptr fromString( new MemoryCalendar( KDateTime::UTC ) );
+  QVERIFY( format.fromString( fromString, format.toString( calendar ) ) );
+  QCOMPARE( fromString->rawIncidences().count(), 3 );
+}
+
+void SnapshotFormatTest::testTimeZones()
+{
+  const KTimeZone helsinki = KSystemTimeZones::zone( "Europe/Helsinki" );
+  QVERIFY( helsinki.isValid() );
+  const ICalTimeZone zone( helsinki );
+
+  MemoryCalendar::Ptr calendar( new MemoryCalendar( KDateTime::UTC ) );
+  calendar->timeZones()->add( zone );
+  Event::Ptr event( new Event() );
+  event->setUid( "snapshot-zone" );
+  event->setDtStart( KDateTime( QDate( 2011, 7, 1 ), QTime( 12, 0 ), KDateTime::Spec( zone ) ) );
+  calendar->addEvent( event );
+
+  SnapshotFormat format;
+  MemoryCalendar::Ptr loaded( new MemoryCalendar( KDateTime::UTC ) );
+  QVERIFY( format.fromRawString( loaded, format.toRawString( calendar ) ) );
+
+  // the zone is rebuilt from its stored phases and transitions
+  const ICalTimeZone read = loaded->timeZones()->zone( zone.name() );
+  QVERIFY( read.isValid() );
+  QCOMPARE( read.phases().count(), zone.phases().count() );
+  QCOMPARE( read.transitions().count(), zone.transitions().count() );
+  QCOMPARE( read.vtimezone(), zone.vtimezone() );
+
+  const Event::Ptr copy = loaded->event( event->uid() );
+  QVERIFY( copy );
+  QVERIFY( copy->dtStart().timeZone() == read );
+  QCOMPARE( copy->dtStart().utcOffset(), 3 * 3600 );
+  QCOMPARE( copy->dtStart().toUtc(), event->dtStart().toUtc() );
+}
+
+// A calendar with one fixed offset time zone, which @p offset names
+static QString zoneCalendar( const QString &offset )
+{
+  return QString( "BEGIN:VCALENDAR\n"
+                  "VERSION:2.0\n"
+                  "BEGIN:VTIMEZONE\n"
+                  "TZID:Test/Snapshot-Zone\n"
+                  "BEGIN:STANDARD\n"
+                  "DTSTART:19700101T000000\n"
+                  "TZOFFSETFROM:%1\n"
+                  "TZOFFSETTO:%1\n"
+                  "END:STANDARD\n"
+                  "END:VTIMEZONE\n"
+                  "END:VCALENDAR\n" ).arg( offset );
+}
+
+void SnapshotFormatTest::testRegistryTimeZones()
+{
+  const QString name( "Test/Snapshot-Zone" );
+  const KDateTime when( QDate( 2011, 7, 1 ), QTime( 12, 0 ), KDateTime::UTC );
+  ICalFormat ical;
+
+  ICalTimeZoneRegistry::setEnabled( false );
+  MemoryCalendar::Ptr source( new MemoryCalendar( KDateTime::UTC ) );
+  QVERIFY( ical.fromString( source, zoneCalendar( "+0300" ) ) );
+  const QByteArray snapshot = SnapshotFormat().toRawString( source );
+
+  // Both calendars hold the zone which the registry shares
+  ICalTimeZoneRegistry::clear();
+  ICalTimeZoneRegistry::setEnabled( true );
+  MemoryCalendar::Ptr calendar( new MemoryCalendar( KDateTime::UTC ) );
+  MemoryCalendar::Ptr other( new MemoryCalendar( KDateTime::UTC ) );
+  QVERIFY( ical.fromString( calendar, zoneCalendar( "+0200" ) ) );
+  QVERIFY( ical.fromString( other, zoneCalendar( "+0200" ) ) );
+  const ICalTimeZone shared = other->timeZones()->zone( name );
+  QVERIFY( ICalTimeZoneRegistry::contains( shared ) );
+  QVERIFY( calendar->timeZones()->zone( name ) == shared );
+
+  // Loading a snapshot replaces the shared zone instead of changing it,
+  // with the registry enabled or not
+  for ( int i = 0; i < 2; ++i ) {
+    ICalTimeZoneRegistry::setEnabled( i == 0 );
+    SnapshotFormat format;
+    QVERIFY( format.fromRawString( calendar, snapshot ) );
+    const ICalTimeZone loaded = calendar->timeZones()->zone( name );
+    QVERIFY( loaded.isValid() );
+    QCOMPARE( loaded.offsetAtUtc( when.dateTime() ), 3 * 3600 );
+    QCOMPARE( shared.offsetAtUtc( when.dateTime() ), 2 * 3600 );
+    QCOMPARE( other->timeZones()->zone( name ).offsetAtUtc( when.dateTime() ), 2 * 3600 );
+
+    calendar->timeZones()->remove( loaded );
+    calendar->timeZones()->add( shared );
+  }
+
+  ICalTimeZoneRegistry::setEnabled( false );
+  ICalTimeZoneRegistry::clear();
+}
+
+void SnapshotFormatTest::testInvalid()
+{
+  MemoryCalendar::Ptr calendar( new MemoryCalendar( KDateTime::UTC ) );
+  SnapshotFormat format;
+
+  QVERIFY( !format.fromRawString( calendar, QByteArray( "BEGIN:VCALENDAR" ) ) );
+  QVERIFY( format.exception() );
+  QCOMPARE( format.exception()->code(), Exception::ParseErrorKcal );
+
+  // a truncated snapshot must not be accepted
+  calendar->addEvent( createEvent() );
+  QByteArray data = format.toRawString( calendar );
+  data.chop( data.size() / 2 );
+  MemoryCalendar::Ptr loaded( new MemoryCalendar( KDateTime::UTC ) );
+  QVERIFY( !format.fromRawString( loaded, data ) );
+}
@@ -22,6 +22,8 @@
 #include "testsortablelist.h"
 #include "../sortablelist.h"
 
+#include <KDateTime>
+
 #include <stdlib.h>
 
 #include <qtest_kde.h>
@@ -142,3 +144,45 @@ void SortableListTest::general()
   QCOMPARE( list.count(), 7 );
   QCOMPARE( list[0], 1 );
 }
+
+void SortableListTest::dateTimes()
+{
+  // Timed values are ordered by their UTC times whatever their time specs,
+  // and equal instants are merged.
+  const KDateTime utc( QDate( 2011, 3, 1 ), QTime( 12, 0, 0 ), KDateTime::UTC );
+  const KDateTime offset( QDate( 2011, 3, 1 ), QTime( 14, 0, 0 ),
+                          KDateTime::Spec::OffsetFromUTC( 2 * 3600 ) );
+  const KDateTime later( QDate( 2011, 3, 1 ), QTime( 13, 30, 0 ),
+                         KDateTime::Spec::OffsetFromUTC( 3600 ) );
+  const KDateTime earlier = utc.addSecs( -1 );
+  SortableList<KDateTime> list;
+  list << later << utc << earlier << offset << later;
+  list.sortUnique();
+  QCOMPARE( list.count(), 3 );
+  QCOMPARE( list[0], earlier );
+  QCOMPARE( list[1], utc );
+  QCOMPARE( list[1].timeSpec(), utc.timeSpec() );   // the first of equal values is kept
+  QCOMPARE( list[2], later );
+  QCOMPARE( list[2].timeSpec(), later.timeSpec() );
+
+  // Date-only values
+  SortableList<KDateTime> dates;
+  dates << KDateTime( QDate( 2011, 3, 3 ) ) << KDateTime( QDate( 2011, 3, 1 ) )
+        << KDateTime( QDate( 2011, 3, 3 ) ) << KDateTime( QDate( 2011, 2, 28 ) );
+  dates.sortUnique();
+  QCOMPARE( dates.count(), 3 );
+  QCOMPARE( dates[0], KDateTime( QDate( 2011, 2, 28 ) ) );
+  QCOMPARE( dates[1], KDateTime( QDate( 2011, 3, 1 ) ) );
+  QCOMPARE( dates[2], KDateTime( QDate( 2011, 3, 3 ) ) );
+  QVERIFY( dates[0].isDateOnly() );
+
+  // Mixed date-only and timed values keep KDateTime's ordering
+  SortableList<KDateTime> mixed;
+  mixed << utc << KDateTime( QDate( 2011, 3, 2 ), KDateTime::UTC )
+        << KDateTime( QDate( 2011, 2, 28 ), KDateTime::UTC ) << utc;
+  mixed.sortUnique();
+  QCOMPARE( mixed.count(), 3 );
+  QCOMPARE( mixed[0], KDateTime( QDate( 2011, 2, 28 ), KDateTime::UTC ) );
+  QCOMPARE( mixed[1], utc );
+  QCOMPARE( mixed[2], KDateTime( QDate( 2011, 3, 2 ), KDateTime::UTC ) );
+}
@@ -29,6 +29,7 @@ class SortableListTest : public QObject
   Q_OBJECT
   private Q_SLOTS:
     void general();
+    void dateTimes();
 };
 
 #endif
@@ -0,0 +1,86 @@
+/*
+  This file is part of the kcalcore library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#include "testsystemtimezone.h"
+
+#include <ksystemtimezone.h>
+#include <ktzfiletimezone.h>
+
+#include <qtest_kde.h>
+QTEST_KDEMAIN( SystemTimeZoneTest, NoGUI )
+
+void SystemTimeZoneTest::testTransitions()
+{
+  // A system zone gives the same results as its own zoneinfo file
+  const KTimeZone system = KSystemTimeZones::zone( "Europe/Helsinki" );
+  QVERIFY( system.isValid() );
+  KTzfileTimeZoneSource source( KSystemTimeZones::zoneinfoDir() );
+  const KTzfileTimeZone tzfile( &source, "Europe/Helsinki" );
+  QVERIFY( tzfile.isValid() );
+
+  const QList<KTimeZone::Transition> transitions =
+    tzfile.transitions( QDateTime( QDate( 2010, 1, 1 ), QTime( 0, 0 ), Qt::UTC ),
+                        QDateTime( QDate( 2014, 1, 1 ), QTime( 0, 0 ), Qt::UTC ) );
+  QCOMPARE( transitions.count(), 8 );
+
+  const int steps[] = { -7200, -3601, -3600, -1, 0, 1, 3599, 3600, 7200 };
+  foreach ( const KTimeZone::Transition &transition, transitions ) {
+    for ( unsigned i = 0; i < sizeof( steps ) / sizeof( steps[0] );  ++i ) {
+      const QDateTime utc = transition.time().addSecs( steps[i] );
+      QCOMPARE( system.offsetAtUtc( utc ), tzfile.offsetAtUtc( utc ) );
+      QCOMPARE( system.isDstAtUtc( utc ), tzfile.isDstAtUtc( utc ) );
+      QCOMPARE( system.abbreviation( utc ), tzfile.abbreviation( utc ) );
+
+      // The clock times around the change, which are skipped or repeated
+      // right at it
+      QDateTime local = utc.addSecs( tzfile.offsetAtUtc( utc ) );
+      local.setTimeSpec( Qt::LocalTime );
+      int systemSecond = 0;
+      int tzfileSecond = 0;
+      QCOMPARE( system.offsetAtZoneTime( local, &systemSecond ),
+                tzfile.offsetAtZoneTime( local, &tzfileSecond ) );
+      QCOMPARE( systemSecond, tzfileSecond );
+    }
+  }
+}
+
+void SystemTimeZoneTest::testMissingZoneFile()
+{
+  // A zone without a zoneinfo file goes through the system library, which
+  // treats it as UTC, and leaves the local zone of the process alone
+  const QByteArray tz = qgetenv( "TZ" );
+  KSystemTimeZoneSource source;
+  const KSystemTimeZone missing( &source, "Nowhere/Missing" );
+  QVERIFY( missing.isValid() );
+  const QDateTime utc( QDate( 2012, 7, 1 ), QTime( 12, 0 ), Qt::UTC );
+  QDateTime local = utc;
+  local.setTimeSpec( Qt::LocalTime );
+  for ( int i = 0; i < 2; ++i ) {
+    QCOMPARE( missing.offsetAtUtc( utc ), 0 );
+    int second = -1;
+    QCOMPARE( missing.offsetAtZoneTime( local, &second ), 0 );
+    QCOMPARE( second, 0 );
+    QCOMPARE( qgetenv( "TZ" ), tz );
+  }
+
+  // Zones which can be read are still found afterwards
+  const KTimeZone helsinki = KSystemTimeZones::zone( "Europe/Helsinki" );
+  QVERIFY( helsinki.isValid() );
+  QCOMPARE( helsinki.offsetAtUtc( utc ), 3 * 3600 );
+}
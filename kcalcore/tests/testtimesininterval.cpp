@@ -21,6 +21,7 @@
 */
 #include "testtimesininterval.h"
 #include "../event.h"
+#include "../recurrencerule.h"
 
 #include <qtest_kde.h>
 QTEST_KDEMAIN( TimesInIntervalTest, NoGUI )
@@ -83,3 +84,67 @@ void TimesInIntervalTest::test()
   //------------------------------------------------------------------------------------------------
 }
 
+
+static RecurrenceRule *createWeeklyRule( const KDateTime &start, const KDateTime &until )
+{
+  RecurrenceRule *rule = new RecurrenceRule();
+  rule->setStartDt( start );
+  rule->setRecurrenceType( RecurrenceRule::rWeekly );
+  rule->setFrequency( 1 );
+  QList<RecurrenceRule::WDayPos> days;
+  days << RecurrenceRule::WDayPos( 0, 1 ) << RecurrenceRule::WDayPos( 0, 3 )
+       << RecurrenceRule::WDayPos( 0, 5 );
+  rule->setByDays( days );
+  if ( until.isValid() ) {
+    rule->setEndDt( until );
+  }
+  return rule;
+}
+
+void TimesInIntervalTest::testOccurrenceCache()
+{
+  const KDateTime start( QDate( 2011, 1, 5 ), QTime( 10, 0 ), KDateTime::UTC );
+  const KDateTime until( QDate( 2011, 6, 15 ), QTime( 10, 0 ), KDateTime::UTC );
+
+  foreach ( const KDateTime &end, QList<KDateTime>() << until << KDateTime() ) {
+    RecurrenceRule *cached = createWeeklyRule( start, end );
+    RecurrenceRule *uncached = createWeeklyRule( start, end );
+    uncached->setOccurrenceCacheLimit( 0 );
+    QCOMPARE( uncached->occurrenceCacheLimit(), 0 );
+
+    // Query overlapping weeks twice over, so that the second round
+    // is answered from the cache
+    for ( int round = 0; round < 2; ++round ) {
+      for ( int day = -10; day < 200; day += 5 ) {
+        const KDateTime from = start.addDays( day );
+        const KDateTime to = from.addDays( 7 );
+        QCOMPARE( cached->timesInInterval( from, to ), uncached->timesInInterval( from, to ) );
+        QCOMPARE( cached->getNextDate( from ), uncached->getNextDate( from ) );
+        QCOMPARE( cached->getPreviousDate( from ), uncached->getPreviousDate( from ) );
+        QCOMPARE( cached->recursOn( from.date(), KDateTime::UTC ),
+                  uncached->recursOn( from.date(), KDateTime::UTC ) );
+      }
+    }
+
+    // Changing the rule must drop the cache
+    cached->setFrequency( 2 );
+    uncached->setFrequency( 2 );
+    const KDateTime from = start.addDays( 30 );
+    QCOMPARE( cached->timesInInterval( from, from.addDays( 30 ) ),
+              uncached->timesInInterval( from, from.addDays( 30 ) ) );
+
+    delete cached;
+    delete uncached;
+  }
+
+  // A total limit smaller than a single window disables caching without
+  // changing the results
+  const int total = RecurrenceRule::totalOccurrenceCacheLimit();
+  RecurrenceRule::setTotalOccurrenceCacheLimit( 2 );
+  RecurrenceRule *rule = createWeeklyRule( start, KDateTime() );
+  const DateTimeList dates = rule->timesInInterval( start, start.addDays( 13 ) );
+  QCOMPARE( dates.count(), 6 );
+  QCOMPARE( rule->timesInInterval( start, start.addDays( 13 ) ), dates );
+  RecurrenceRule::setTotalOccurrenceCacheLimit( total );
+  delete rule;
+}
@@ -30,6 +30,7 @@ class TimesInIntervalTest : public QObject
   Q_OBJECT
   private Q_SLOTS:
     void test();
+    void testOccurrenceCache();
 };
 
 #endif
@@ -32,6 +32,7 @@
 */
 
 #include "todo.h"
+#include "incidence_p.h"
 #include "visitor.h"
 
 #include <KDebug>
@@ -165,11 +166,12 @@ void Todo::setDtDue( const KDateTime &dtDue, bool first )
   } else {
     d->mDtDue = dtDue;
     // TODO: This doesn't seem right...
-    recurrence()->setStartDateTime( dtDue );
-    recurrence()->setAllDay( allDay() );
+    Recurrence *recurrence = IncidenceInternals::changeRecurrence( *this );
+    recurrence->setStartDateTime( dtDue );
+    recurrence->setAllDay( allDay() );
   }
 
-  if ( recurs() && dtDue < recurrence()->startDateTime() ) {
+  if ( recurs() && dtDue < IncidenceInternals::recurrence( *this )->startDateTime() ) {
     setDtStart( dtDue );
   }
 
@@ -259,8 +261,9 @@ void Todo::setDtStart( const KDateTime &dtStart )
   d->mHasStartDate = dtStart.isValid();
 
   if ( recurs() ) {
-    recurrence()->setStartDateTime( d->mDtDue );
-    recurrence()->setAllDay( allDay() );
+    Recurrence *recurrence = IncidenceInternals::changeRecurrence( *this );
+    recurrence->setStartDateTime( d->mDtDue );
+    recurrence->setAllDay( allDay() );
   }
   IncidenceBase::setDtStart( dtStart );
 }
@@ -423,7 +426,7 @@ bool Todo::recursOn( const QDate &date, const KDateTime::Spec &timeSpec ) const
   return
     Incidence::recursOn( date, timeSpec ) &&
     !( date < today && d->mDtRecurrence.date() < today &&
-       d->mDtRecurrence > recurrence()->startDateTime() );
+       d->mDtRecurrence > IncidenceInternals::recurrence( *this )->startDateTime() );
 }
 
 bool Todo::isOverdue() const
@@ -452,7 +455,7 @@ void Todo::setAllDay( bool allday )
 bool Todo::Private::recurTodo( Todo *todo )
 {
   if ( todo && todo->recurs() ) {
-    Recurrence *r = todo->recurrence();
+    const Recurrence *r = IncidenceInternals::recurrence( *todo );
     const KDateTime recurrenceEndDateTime = r->endDateTime();
     KDateTime nextOccurrenceDateTime = r->getNextDateTime( todo->dtDue() );
 
@@ -521,10 +524,10 @@ KDateTime Todo::dateTime( DateTimeRole role ) const
   case RoleDisplayEnd:
     return dtDue();
   case RoleAlarm:
-    if ( alarms().isEmpty() ) {
+    if ( IncidenceInternals::alarms( *this ).isEmpty() ) {
       return KDateTime();
     } else {
-      Alarm::Ptr alarm = alarms().first();
+      const Alarm::Ptr alarm = IncidenceInternals::alarms( *this ).first();
       if ( alarm->hasStartOffset() && hasStartDate() ) {
         return dtStart();
       } else if ( alarm->hasEndOffset() && hasDueDate() ) {
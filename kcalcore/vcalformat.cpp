@@ -39,6 +39,7 @@
 #include "event.h"
 #include "exceptions.h"
 #include "icaltimezones.h"
+#include "incidence_p.h"
 #include "todo.h"
 #include "versit/vcc.h"
 #include "versit/vobject.h"
@@ -357,8 +358,8 @@ VObject *VCalFormat::eventToVTodo( const Todo::Ptr &anEvent )
   if ( anEvent->attendeeCount() > 0 ) {
     Attendee::List::ConstIterator it;
     Attendee::Ptr curAttendee;
-    for ( it = anEvent->attendees().constBegin(); it != anEvent->attendees().constEnd();
-          ++it ) {
+    const Attendee::List &attendees = IncidenceInternals::attendees( *anEvent );
+    for ( it = attendees.constBegin(); it != attendees.constEnd(); ++it ) {
       curAttendee = *it;
       if ( !curAttendee->email().isEmpty() && !curAttendee->name().isEmpty() ) {
         tmpStr = "MAILTO:" + curAttendee->name() + " <" + curAttendee->email() + '>';
@@ -377,8 +378,8 @@ VObject *VCalFormat::eventToVTodo( const Todo::Ptr &anEvent )
   }
 
   // recurrence rule stuff
-  const Recurrence *recur = anEvent->recurrence();
-  if ( recur->recurs() ) {
+  const Recurrence *recur = IncidenceInternals::recurrence( *anEvent );
+  if ( recur && recur->recurs() ) {
     bool validRecur = true;
     QString tmpStr2;
     switch ( recur->recurrenceType() ) {
@@ -602,8 +603,9 @@ VObject *VCalFormat::eventToVTodo( const Todo::Ptr &anEvent )
   }
 
   // alarm stuff
+  const Alarm::List &alarms = IncidenceInternals::alarms( *anEvent );
   Alarm::List::ConstIterator it;
-  for ( it = anEvent->alarms().constBegin(); it != anEvent->alarms().constEnd(); ++it ) {
+  for ( it = alarms.constBegin(); it != alarms.constEnd(); ++it ) {
     Alarm::Ptr alarm = *it;
     if ( alarm->enabled() ) {
       VObject *a;
@@ -703,8 +705,8 @@ VObject *VCalFormat::eventToVEvent( const Event::Ptr &anEvent )
   // TODO: Put this functionality into Attendee class
   if ( anEvent->attendeeCount() > 0 ) {
     Attendee::List::ConstIterator it;
-    for ( it = anEvent->attendees().constBegin(); it != anEvent->attendees().constEnd();
-          ++it ) {
+    const Attendee::List &attendees = IncidenceInternals::attendees( *anEvent );
+    for ( it = attendees.constBegin(); it != attendees.constEnd(); ++it ) {
       Attendee::Ptr curAttendee = *it;
       if ( !curAttendee->email().isEmpty() && !curAttendee->name().isEmpty() ) {
         tmpStr = "MAILTO:" + curAttendee->name() + " <" + curAttendee->email() + '>';
@@ -723,8 +725,8 @@ VObject *VCalFormat::eventToVEvent( const Event::Ptr &anEvent )
   }
 
   // recurrence rule stuff
-  const Recurrence *recur = anEvent->recurrence();
-  if ( recur->recurs() ) {
+  const Recurrence *recur = IncidenceInternals::recurrence( *anEvent );
+  if ( recur && recur->recurs() ) {
     bool validRecur = true;
     QString tmpStr2;
     switch ( recur->recurrenceType() ) {
@@ -938,7 +940,7 @@ VObject *VCalFormat::eventToVEvent( const Event::Ptr &anEvent )
 
   // attachments
   // TODO: handle binary attachments!
-  Attachment::List attachments = anEvent->attachments();
+  const Attachment::List &attachments = IncidenceInternals::attachments( *anEvent );
   Attachment::List::ConstIterator atIt;
   for ( atIt = attachments.constBegin(); atIt != attachments.constEnd(); ++atIt ) {
     addPropValue( vevent, VCAttachProp, ( *atIt )->uri().toUtf8() );
@@ -952,8 +954,9 @@ VObject *VCalFormat::eventToVEvent( const Event::Ptr &anEvent )
   }
 
   // alarm stuff
+  const Alarm::List &alarms = IncidenceInternals::alarms( *anEvent );
   Alarm::List::ConstIterator it2;
-  for ( it2 = anEvent->alarms().constBegin(); it2 != anEvent->alarms().constEnd(); ++it2 ) {
+  for ( it2 = alarms.constBegin(); it2 != alarms.constEnd(); ++it2 ) {
     Alarm::Ptr alarm = *it2;
     if ( alarm->enabled() ) {
       VObject *a;
@@ -1514,6 +1517,9 @@ Todo::Ptr VCalFormat::VTodoToEvent( VObject *vtodo )
     }
   }
 
+  // the recurrence and alarms were only handed out to fill them in
+  IncidenceInternals::forgetHandedOut( *anEvent );
+
   return anEvent;
 }
 
@@ -2090,6 +2096,9 @@ Event::Ptr VCalFormat::VEventToEvent( VObject *vevent )
   /* Rest of the custom properties */
   readCustomProperties( vevent, anEvent );
 
+  // the recurrence and alarms were only handed out to fill them in
+  IncidenceInternals::forgetHandedOut( *anEvent );
+
   return anEvent;
 }
 